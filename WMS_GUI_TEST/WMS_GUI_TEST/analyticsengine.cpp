@@ -0,0 +1,530 @@
+#include "analyticsengine.h"
+#include "databasemanager.h"
+#include "orderarchive.h"
+#include "repositories.h"
+#include "sqlitestatement.h"
+#include "schema.h"
+#include "metrics.h"
+#include "tracing.h"
+
+#include <QElapsedTimer>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QThread>
+#include <QThreadPool>
+#include <QDebug>
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+constexpr std::string_view kLinesSql =
+    "SELECT l.item_id, l.quantity, o.date, o.type, o.status "
+    "FROM order_lines l JOIN orders o ON o.id = l.order_id";
+
+// Same, including orders moved to the attached archive database
+constexpr std::string_view kLinesWithArchiveSql =
+    "SELECT l.item_id, l.quantity, o.date, o.type, o.status "
+    "FROM main.order_lines l JOIN main.orders o ON o.id = l.order_id "
+    "UNION ALL "
+    "SELECT l.item_id, l.quantity, o.date, o.type, o.status "
+    "FROM archive.order_lines l JOIN archive.orders o ON o.id = l.order_id";
+
+constexpr std::string_view kMovementsSql =
+    "SELECT item_id, moved_at, delta FROM stock_movements WHERE moved_at >= ?";
+
+// Start of the day in the ledger's time base
+qint64 dayStartSeconds(const QDate& date)
+{
+    return date.isValid() ? QDateTime(date, QTime(0, 0)).toSecsSinceEpoch() : 0;
+}
+
+bool hasArchiveSchema(const QSqlDatabase& db)
+{
+    QSqlQuery query(db);
+    return query.exec("SELECT 1 FROM pragma_database_list WHERE name = 'archive'") && query.next();
+}
+
+// Position of an item id in the snapshot's id-ordered arrays, or -1
+qint32 itemIndex(const std::vector<int>& itemIds, int itemId)
+{
+    auto it = std::lower_bound(itemIds.begin(), itemIds.end(), itemId);
+    return it != itemIds.end() && *it == itemId ? qint32(it - itemIds.begin()) : -1;
+}
+
+void appendLine(AnalyticsSnapshot& s, int itemId, qint64 quantity, qint64 date, int type, int status)
+{
+    qint32 item = itemIndex(s.itemIds, itemId);
+    if (item < 0) {
+        return;
+    }
+    s.lineItem.push_back(item);
+    s.lineQuantity.push_back(quantity);
+    s.lineDate.push_back(date);
+    s.lineSign.push_back(type == OrderTypeFrom ? -1 : 1);
+    s.linePosted.push_back(status == OrderStatusPosted);
+}
+
+void appendMovement(AnalyticsSnapshot& s, int itemId, qint64 time, qint64 delta)
+{
+    qint32 item = itemIndex(s.itemIds, itemId);
+    if (item < 0) {
+        return;
+    }
+    s.movementItem.push_back(item);
+    s.movementTime.push_back(time);
+    s.movementDelta.push_back(delta);
+}
+
+bool loadNative(sqlite3* handle, std::string_view linesSql, qint64 movementsFrom, AnalyticsSnapshot& s,
+                QString* errorMessage)
+{
+    SqliteStatement items(handle, selectSql<ItemsTable, "ORDER BY id">());
+    while (items.step()) {
+        s.itemIds.push_back(items.columnInt(ItemsTable::Id));
+        s.itemCodes.push_back(items.columnString(ItemsTable::Code));
+        s.itemDescriptions.push_back(items.columnString(ItemsTable::Description));
+        s.quantities.push_back(items.columnInt64(ItemsTable::Quantity));
+        s.prices.push_back(items.columnInt64(ItemsTable::Price));
+    }
+
+    SqliteStatement lines(handle, linesSql);
+    while (lines.step()) {
+        appendLine(s, lines.columnInt(0), lines.columnInt64(1), lines.columnInt64(2),
+                   lines.columnInt(3), lines.columnInt(4));
+    }
+
+    SqliteStatement movements(handle, kMovementsSql);
+    movements.bind(0, movementsFrom);
+    while (movements.step()) {
+        appendMovement(s, movements.columnInt(0), movements.columnInt64(1), movements.columnInt64(2));
+    }
+
+    QString error = items.hasError() ? items.lastError()
+                    : lines.hasError() ? lines.lastError()
+                                       : movements.lastError();
+    if (!error.isEmpty() && errorMessage) {
+        *errorMessage = error;
+    }
+    return error.isEmpty();
+}
+
+bool loadQuery(const QSqlDatabase& db, std::string_view linesSql, qint64 movementsFrom, AnalyticsSnapshot& s,
+               QString* errorMessage)
+{
+    QSqlQuery items(db);
+    items.setForwardOnly(true);
+    if (items.exec(sqlString(selectSql<ItemsTable, "ORDER BY id">()))) {
+        while (items.next()) {
+            s.itemIds.push_back(items.value(ItemsTable::Id).toInt());
+            s.itemCodes.push_back(items.value(ItemsTable::Code).toString());
+            s.itemDescriptions.push_back(items.value(ItemsTable::Description).toString());
+            s.quantities.push_back(items.value(ItemsTable::Quantity).toLongLong());
+            s.prices.push_back(items.value(ItemsTable::Price).toLongLong());
+        }
+    }
+
+    QSqlQuery lines(db);
+    lines.setForwardOnly(true);
+    if (lines.exec(sqlString(linesSql))) {
+        while (lines.next()) {
+            appendLine(s, lines.value(0).toInt(), lines.value(1).toLongLong(), lines.value(2).toLongLong(),
+                       lines.value(3).toInt(), lines.value(4).toInt());
+        }
+    }
+
+    QSqlQuery movements(db);
+    movements.setForwardOnly(true);
+    if (movements.prepare(sqlString(kMovementsSql))) {
+        movements.addBindValue(movementsFrom);
+        if (movements.exec()) {
+            while (movements.next()) {
+                appendMovement(s, movements.value(0).toInt(), movements.value(1).toLongLong(),
+                               movements.value(2).toLongLong());
+            }
+        }
+    }
+
+    QSqlError error = items.lastError().isValid() ? items.lastError()
+                      : lines.lastError().isValid() ? lines.lastError()
+                                                    : movements.lastError();
+    if (error.isValid() && errorMessage) {
+        *errorMessage = error.text();
+    }
+    return !error.isValid();
+}
+
+bool loadArchive(const QSqlDatabase& db, bool attachedArchive, AnalyticsSnapshot& s,
+                 const OrderArchiveReader& archive, const QDate& from, QString* errorMessage)
+{
+    WMS_TRACE_SCOPE_CAT("AnalyticsSnapshot::loadArchive", "analytics");
+
+    // Orders still in the database are already covered by the live lines
+    std::vector<qint64> liveOrders;
+    QSqlQuery orders(db);
+    orders.setForwardOnly(true);
+    QString ordersSql = attachedArchive
+        ? "SELECT id FROM main.orders UNION ALL SELECT id FROM archive.orders ORDER BY 1"
+        : "SELECT id FROM orders ORDER BY id";
+    if (!orders.exec(ordersSql)) {
+        if (errorMessage) {
+            *errorMessage = orders.lastError().text();
+        }
+        return false;
+    }
+    while (orders.next()) {
+        liveOrders.push_back(orders.value(0).toLongLong());
+    }
+
+    // Lines dated before the range do not affect any report
+    ArchiveScan scan;
+    scan.columns = archiveColumnBit(ArchiveOrderId) | archiveColumnBit(ArchiveDate) | archiveColumnBit(ArchiveType)
+                   | archiveColumnBit(ArchiveStatus) | archiveColumnBit(ArchiveItemId) | archiveColumnBit(ArchiveQuantity);
+    scan.filterColumn = ArchiveDate;
+    if (from.isValid()) {
+        scan.min = DatabaseManager::encodeOrderDate(from);
+    }
+
+    bool ok = archive.scan(scan, [&s, &liveOrders](const ArchiveBatch& batch) {
+        const std::vector<qint64>& orderId = batch.column(ArchiveOrderId);
+        const std::vector<qint64>& date = batch.column(ArchiveDate);
+        const std::vector<qint64>& type = batch.column(ArchiveType);
+        const std::vector<qint64>& status = batch.column(ArchiveStatus);
+        const std::vector<qint64>& itemId = batch.column(ArchiveItemId);
+        const std::vector<qint64>& quantity = batch.column(ArchiveQuantity);
+        for (qint64 i = 0; i < batch.rowCount; ++i) {
+            if (!std::binary_search(liveOrders.begin(), liveOrders.end(), orderId[i])) {
+                appendLine(s, int(itemId[i]), quantity[i], date[i], int(type[i]), int(status[i]));
+            }
+        }
+    }, errorMessage);
+
+    qDebug() << "Analytics archive scan:" << scan.groupsRead << "row groups read," << scan.groupsSkipped << "skipped";
+    return ok;
+}
+
+// Per-worker accumulators over the item arrays
+struct Partial
+{
+    std::vector<qint64> inbound;
+    std::vector<qint64> outbound;
+    // Ledger deltas since the start and since the end of the range
+    std::vector<qint64> sinceFrom;
+    std::vector<qint64> sinceTo;
+};
+
+void aggregateLines(const AnalyticsSnapshot& s, size_t begin, size_t end, qint64 from, qint64 to, Partial& p)
+{
+    WMS_TRACE_SCOPE_CAT("AnalyticsEngine::aggregateLines", "analytics");
+
+    const qint32* item = s.lineItem.data();
+    const qint64* quantity = s.lineQuantity.data();
+    const qint64* date = s.lineDate.data();
+    const qint8* sign = s.lineSign.data();
+    const quint8* posted = s.linePosted.data();
+
+    // Branch-free accumulation: each line adds zero to the arrays it does not belong to
+    for (size_t i = begin; i < end; ++i) {
+        qint64 units = quantity[i] * posted[i];
+        qint64 inRange = (date[i] >= from) & (date[i] <= to);
+        qint64 inbound = sign[i] > 0;
+        p.inbound[item[i]] += units * inRange * inbound;
+        p.outbound[item[i]] += units * inRange * (1 - inbound);
+    }
+}
+
+// fromTime and toTime are the first second of the range and the first
+// second after it
+void aggregateMovements(const AnalyticsSnapshot& s, size_t begin, size_t end, qint64 fromTime, qint64 toTime,
+                        Partial& p)
+{
+    WMS_TRACE_SCOPE_CAT("AnalyticsEngine::aggregateMovements", "analytics");
+
+    const qint32* item = s.movementItem.data();
+    const qint64* time = s.movementTime.data();
+    const qint64* delta = s.movementDelta.data();
+
+    for (size_t i = begin; i < end; ++i) {
+        p.sinceFrom[item[i]] += delta[i] * (time[i] >= fromTime);
+        p.sinceTo[item[i]] += delta[i] * (time[i] >= toTime);
+    }
+}
+
+} // namespace
+
+bool AnalyticsSnapshot::load(const QSqlDatabase& db, AnalyticsSnapshot& snapshot, QString* errorMessage,
+                             const OrderArchiveReader* archive, const QDate& from)
+{
+    WMS_TRACE_SCOPE_CAT("AnalyticsSnapshot::load", "analytics");
+
+    QSqlDatabase connection = db;
+    bool inTransaction = connection.transaction();
+
+    bool attachedArchive = hasArchiveSchema(db);
+    std::string_view linesSql = attachedArchive ? kLinesWithArchiveSql : kLinesSql;
+
+    bool ok;
+    if (sqlite3* handle = nativeBackendHandle(db)) {
+        ok = loadNative(handle, linesSql, dayStartSeconds(from), snapshot, errorMessage);
+    } else {
+        ok = loadQuery(db, linesSql, dayStartSeconds(from), snapshot, errorMessage);
+    }
+    if (ok && archive) {
+        ok = loadArchive(db, attachedArchive, snapshot, *archive, from, errorMessage);
+    }
+
+    if (inTransaction) {
+        connection.commit();
+    }
+    return ok;
+}
+
+AnalyticsEngine::AnalyticsEngine(QObject* parent)
+    : QObject(parent),
+      m_threads(QThread::idealThreadCount()),
+      m_worker(nullptr),
+      m_hasPending(false)
+{
+}
+
+AnalyticsEngine::~AnalyticsEngine()
+{
+    if (m_worker) {
+        m_worker->wait();
+        delete m_worker;
+    }
+}
+
+std::shared_ptr<AnalyticsReport> AnalyticsEngine::compute(std::shared_ptr<const AnalyticsSnapshot> snapshot,
+                                                          const QDate& from, const QDate& to, int threads)
+{
+    WMS_TRACE_SCOPE_CAT("AnalyticsEngine::compute", "analytics");
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const AnalyticsSnapshot& s = *snapshot;
+    const size_t items = s.itemCount();
+    const size_t lines = s.lineCount();
+    const size_t movements = s.movementCount();
+    const qint64 fromDay = DatabaseManager::encodeOrderDate(from);
+    const qint64 toDay = DatabaseManager::encodeOrderDate(to);
+    const qint64 fromTime = dayStartSeconds(from);
+    const qint64 toTime = dayStartSeconds(to.addDays(1));
+
+    auto report = std::make_shared<AnalyticsReport>();
+    report->snapshot = snapshot;
+    report->from = from;
+    report->to = to;
+
+    // Lines and movements are split into one contiguous range each per worker
+    size_t workers = std::clamp<size_t>(size_t(qMax(1, threads)), 1, qMax<size_t>(1, qMax(lines, movements)));
+    std::vector<Partial> partials(workers);
+    for (Partial& p : partials) {
+        p.inbound.assign(items, 0);
+        p.outbound.assign(items, 0);
+        p.sinceFrom.assign(items, 0);
+        p.sinceTo.assign(items, 0);
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(int(workers));
+    for (size_t w = 0; w < workers; ++w) {
+        pool.start([&s, &partials, w, workers, lines, movements, fromDay, toDay, fromTime, toTime]() {
+            aggregateLines(s, lines * w / workers, lines * (w + 1) / workers, fromDay, toDay, partials[w]);
+            aggregateMovements(s, movements * w / workers, movements * (w + 1) / workers, fromTime, toTime,
+                               partials[w]);
+        });
+    }
+    pool.waitForDone();
+
+    // Sum the partials and derive the per-item figures, one item range per worker
+    report->values.resize(items);
+    report->inboundUnits.resize(items);
+    report->outboundUnits.resize(items);
+    report->openingQuantity.resize(items);
+    report->closingQuantity.resize(items);
+    report->turnover.resize(items);
+
+    AnalyticsReport& r = *report;
+    for (size_t w = 0; w < workers; ++w) {
+        size_t begin = items * w / workers;
+        size_t end = items * (w + 1) / workers;
+        pool.start([&s, &r, &partials, begin, end]() {
+            for (size_t i = begin; i < end; ++i) {
+                qint64 inbound = 0;
+                qint64 outbound = 0;
+                qint64 sinceFrom = 0;
+                qint64 sinceTo = 0;
+                for (const Partial& p : partials) {
+                    inbound += p.inbound[i];
+                    outbound += p.outbound[i];
+                    sinceFrom += p.sinceFrom[i];
+                    sinceTo += p.sinceTo[i];
+                }
+                qint64 closing = s.quantities[i] - sinceTo;
+                qint64 opening = s.quantities[i] - sinceFrom;
+                double average = double(opening + closing) / 2.0;
+
+                r.values[i] = s.quantities[i] * s.prices[i];
+                r.inboundUnits[i] = inbound;
+                r.outboundUnits[i] = outbound;
+                r.closingQuantity[i] = closing;
+                r.openingQuantity[i] = opening;
+                r.turnover[i] = average > 0 ? double(outbound) / average : 0.0;
+            }
+        });
+    }
+    pool.waitForDone();
+
+    r.totalValue = Money::sumProducts(s.prices.data(), s.quantities.data(), items);
+
+    r.valueOrder.resize(items);
+    std::iota(r.valueOrder.begin(), r.valueOrder.end(), 0);
+    std::stable_sort(r.valueOrder.begin(), r.valueOrder.end(),
+                     [&r](qint32 a, qint32 b) { return r.values[size_t(a)] > r.values[size_t(b)]; });
+
+    // ABC: rank by moved units and cut at the cumulative share thresholds
+    std::vector<qint64> moved(items);
+    for (size_t i = 0; i < items; ++i) {
+        moved[i] = r.inboundUnits[i] + r.outboundUnits[i];
+    }
+    r.totalMovedUnits = std::accumulate(moved.begin(), moved.end(), qint64(0));
+
+    r.abcOrder.resize(items);
+    std::iota(r.abcOrder.begin(), r.abcOrder.end(), 0);
+    std::stable_sort(r.abcOrder.begin(), r.abcOrder.end(),
+                     [&moved](qint32 a, qint32 b) { return moved[size_t(a)] > moved[size_t(b)]; });
+
+    r.abcClass.resize(items);
+    r.abcCumulativeShare.resize(items);
+    qint64 cumulative = 0;
+    for (size_t rank = 0; rank < items; ++rank) {
+        size_t i = size_t(r.abcOrder[rank]);
+        double before = r.totalMovedUnits > 0 ? double(cumulative) / double(r.totalMovedUnits) : 1.0;
+        cumulative += moved[i];
+        r.abcCumulativeShare[rank] = r.totalMovedUnits > 0 ? double(cumulative) / double(r.totalMovedUnits) : 0.0;
+        if (moved[i] == 0 || before >= AnalyticsReport::kClassBLimit) {
+            r.abcClass[i] = AnalyticsReport::ClassC;
+        } else if (before >= AnalyticsReport::kClassALimit) {
+            r.abcClass[i] = AnalyticsReport::ClassB;
+        } else {
+            r.abcClass[i] = AnalyticsReport::ClassA;
+        }
+    }
+
+    r.computeMs = timer.elapsed();
+    return report;
+}
+
+void AnalyticsEngine::refresh(const QDate& from, const QDate& to)
+{
+    if (m_worker) {
+        m_hasPending = true;
+        m_pendingFrom = from;
+        m_pendingTo = to;
+        return;
+    }
+    start(from, to);
+}
+
+void AnalyticsEngine::start(const QDate& from, const QDate& to)
+{
+    // Reports read the replica, so they never hold locks on the live database
+    DatabaseManager& dbManager = DatabaseManager::instance();
+    QString path = dbManager.replicaDatabase().databaseName();
+    bool remote = dbManager.isRemote();
+    QDateTime dataAsOf = dbManager.hasReplica() ? dbManager.replicaRefreshedAt() : QDateTime::currentDateTime();
+    QString archivePath = m_archivePath;
+    QString archiveDatabasePath = dbManager.archiveDatabasePath();
+    quint64 generation = dbManager.databaseGeneration();
+    int threads = m_threads;
+
+    m_worker = QThread::create([this, path, remote, dataAsOf, archivePath, archiveDatabasePath, generation, from, to,
+                                threads]() {
+        static MetricHistogram* const refreshTime = MetricsRegistry::instance().histogram(
+            "wms_analytics_refresh_duration_seconds", "Time to load the analytics snapshot and compute the reports");
+        ScopedMetricsTimer metricsTimer(refreshTime);
+
+        QElapsedTimer timer;
+        timer.start();
+
+        QString connectionName = QString("analytics-%1").arg(quintptr(QThread::currentThreadId()));
+        auto snapshot = std::make_shared<AnalyticsSnapshot>();
+        QString error;
+        bool loaded = false;
+
+        OrderArchiveReader archive;
+        if (!archivePath.isEmpty() && !archive.open(archivePath, &error)) {
+            qDebug() << "Analytics archive" << archivePath << "not used:" << error;
+            error.clear();
+        }
+
+        {
+            // Over wmsd the snapshot is read through a connection of this thread's own
+            QSqlDatabase db;
+            if (remote) {
+                db = DatabaseManager::instance().addServerConnection(connectionName);
+            } else {
+                db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+                db.setDatabaseName(path);
+                db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+            }
+            if (db.open()) {
+                if (!archiveDatabasePath.isEmpty()) {
+                    QSqlQuery attach(db);
+                    attach.prepare("ATTACH DATABASE ? AS archive");
+                    attach.addBindValue(archiveDatabasePath);
+                    if (!attach.exec()) {
+                        qDebug() << "Analytics: archive database not attached:" << attach.lastError().text();
+                    }
+                }
+                loaded = AnalyticsSnapshot::load(db, *snapshot, &error, archive.isOpen() ? &archive : nullptr, from);
+            } else {
+                error = db.lastError().text();
+            }
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(connectionName);
+
+        if (!loaded) {
+            qDebug() << "Analytics refresh failed:" << error;
+            QMetaObject::invokeMethod(this, [this, error]() { emit refreshFailed(error); }, Qt::QueuedConnection);
+            return;
+        }
+
+        qint64 loadMs = timer.elapsed();
+        std::shared_ptr<AnalyticsReport> report = compute(snapshot, from, to, threads);
+        report->loadMs = loadMs;
+        report->dataAsOf = dataAsOf;
+
+        AnalyticsReportPtr result = report;
+        QMetaObject::invokeMethod(this, [this, result, generation, from, to]() {
+            // A restore during the load leaves a report on the old file; run
+            // again on the new one (finish() picks up the pending range)
+            if (DatabaseManager::instance().databaseGeneration() != generation) {
+                if (!m_hasPending) {
+                    m_hasPending = true;
+                    m_pendingFrom = from;
+                    m_pendingTo = to;
+                }
+                return;
+            }
+            emit reportReady(result);
+        }, Qt::QueuedConnection);
+    });
+
+    connect(m_worker, &QThread::finished, this, &AnalyticsEngine::finish);
+    m_worker->start();
+}
+
+void AnalyticsEngine::finish()
+{
+    delete m_worker;
+    m_worker = nullptr;
+
+    if (m_hasPending) {
+        m_hasPending = false;
+        start(m_pendingFrom, m_pendingTo);
+    }
+}
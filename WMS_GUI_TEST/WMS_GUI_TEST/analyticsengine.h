@@ -0,0 +1,150 @@
+#pragma once
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QDate>
+#include <QDateTime>
+#include <QString>
+#include <memory>
+#include <vector>
+#include "money.h"
+
+class QThread;
+class OrderArchiveReader;
+
+// Column-wise copy of the tables the reports read. Items are stored one
+// array per column in id order; order lines are joined with their order and
+// reference items by position in the item arrays, so aggregation loops run
+// over contiguous integers only.
+struct AnalyticsSnapshot
+{
+    // items
+    std::vector<int> itemIds;
+    std::vector<QString> itemCodes;
+    std::vector<QString> itemDescriptions;
+    std::vector<qint64> quantities;
+    std::vector<qint64> prices;
+
+    // order_lines joined with orders
+    std::vector<qint32> lineItem;
+    std::vector<qint64> lineQuantity;
+    std::vector<qint64> lineDate;   // Julian day
+    std::vector<qint8> lineSign;    // +1 for "to" orders, -1 for "from" orders
+    std::vector<quint8> linePosted;
+
+    // stock_movements from the start of the loaded range on
+    std::vector<qint32> movementItem;
+    std::vector<qint64> movementTime;   // seconds since the epoch
+    std::vector<qint64> movementDelta;
+
+    size_t itemCount() const { return itemIds.size(); }
+    size_t lineCount() const { return lineItem.size(); }
+    size_t movementCount() const { return movementItem.size(); }
+
+    // Reads all tables inside one read transaction, so items, lines and
+    // movements come from the same database state. Lines of orders in an
+    // attached archive database (schema "archive") are included. Ledger
+    // movements are read from the start of from on; with an archive file,
+    // its lines dated on or after from are added too, except those of
+    // orders that are still in the database.
+    static bool load(const QSqlDatabase& db, AnalyticsSnapshot& snapshot, QString* errorMessage = nullptr,
+                     const OrderArchiveReader* archive = nullptr, const QDate& from = QDate());
+};
+
+// Results of one refresh, indexed like the snapshot's item arrays
+struct AnalyticsReport
+{
+    enum AbcClass : quint8 { ClassA, ClassB, ClassC };
+
+    // ABC thresholds on the cumulative share of moved units
+    static constexpr double kClassALimit = 0.80;
+    static constexpr double kClassBLimit = 0.95;
+
+    std::shared_ptr<const AnalyticsSnapshot> snapshot;
+    // When the data read was current: the read replica's refresh time, or
+    // the load time when the live database was read
+    QDateTime dataAsOf;
+    QDate from;
+    QDate to;
+
+    // Valuation at current quantities; valueOrder lists item positions by value, descending
+    std::vector<qint64> values;
+    std::vector<qint32> valueOrder;
+    Money totalValue;
+
+    // Posted movement within [from, to]
+    std::vector<qint64> inboundUnits;
+    std::vector<qint64> outboundUnits;
+    qint64 totalMovedUnits = 0;
+
+    // Item positions by moved units, descending, with their class
+    std::vector<qint32> abcOrder;
+    std::vector<quint8> abcClass;
+    std::vector<double> abcCumulativeShare;
+
+    // Stock on hand at the start and end of the range, rebuilt from the
+    // current quantity and the stock ledger, so manual corrections count
+    std::vector<qint64> openingQuantity;
+    std::vector<qint64> closingQuantity;
+    std::vector<double> turnover;
+
+    qint64 loadMs = 0;
+    qint64 computeMs = 0;
+
+    size_t itemCount() const { return values.size(); }
+};
+
+using AnalyticsReportPtr = std::shared_ptr<const AnalyticsReport>;
+
+// Background computation of the management reports: stock valuation, ABC
+// classification by movement volume and stock turnover over a date range.
+//
+// refresh() returns immediately. A worker thread opens its own read-only
+// connection to the read replica (DatabaseManager::replicaDatabase()) or,
+// before the first replica refresh, to wms.db (attaching the order archive
+// database if the main connection has one), loads an AnalyticsSnapshot and
+// splits the order lines and ledger movements across a thread pool; every
+// worker accumulates into its own per-item arrays, which are then summed
+// item range by item range. The finished report is handed back to the GUI
+// thread through reportReady(). A refresh requested while one is running is
+// queued; only the latest pending range is kept.
+//
+// Only posted orders count as inbound and outbound movement; open orders
+// have not changed stock.
+class AnalyticsEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AnalyticsEngine(QObject* parent = nullptr);
+    ~AnalyticsEngine();
+
+    // Number of aggregation threads; defaults to QThread::idealThreadCount()
+    void setThreadCount(int threads) { m_threads = threads; }
+
+    // Order archive (orderarchive.h) scanned along with the live tables;
+    // empty for none
+    void setArchivePath(const QString& filePath) { m_archivePath = filePath; }
+
+    void refresh(const QDate& from, const QDate& to);
+    bool isRunning() const { return m_worker != nullptr; }
+
+    // Synchronous computation over an already loaded snapshot
+    static std::shared_ptr<AnalyticsReport> compute(std::shared_ptr<const AnalyticsSnapshot> snapshot,
+                                                    const QDate& from, const QDate& to, int threads);
+
+signals:
+    void reportReady(AnalyticsReportPtr report);
+    void refreshFailed(const QString& message);
+
+private:
+    void start(const QDate& from, const QDate& to);
+    void finish();
+
+    QString m_archivePath;
+    int m_threads;
+    QThread* m_worker;
+    bool m_hasPending;
+    QDate m_pendingFrom;
+    QDate m_pendingTo;
+};
@@ -0,0 +1,753 @@
+#include "apiserver.h"
+#include "databasemanager.h"
+#include "metrics.h"
+#include "repositories.h"
+#include "tracing.h"
+
+#include <QDebug>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QTcpSocket>
+#include <QThread>
+#include <QUrl>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+// Limits on what a client may send before the connection is dropped
+static const int kMaxHeaderBytes = 16 * 1024;
+static const int kMaxBodyBytes = 4 * 1024 * 1024;
+
+struct ApiRequest
+{
+    QByteArray method;
+    QByteArray path;
+    QByteArray authorization;
+    QByteArray body;
+    bool keepAlive = true;
+};
+
+struct ApiServer::Connection
+{
+    struct Response
+    {
+        const char* endpoint = "";
+        QElapsedTimer timer;
+        bool done = false;
+        int status = 0;
+        QByteArray body;
+    };
+
+    QTcpSocket* socket = nullptr;
+    QByteArray buffer;
+    // Responses by request sequence number, sent strictly in order
+    std::map<quint64, Response> responses;
+    quint64 nextSequence = 0;
+    quint64 nextToSend = 0;
+    // Write requests still being decoded, in arrival order, and those
+    // decoded ahead of an earlier one, held back until it is done
+    std::deque<quint64> writeOrder;
+    std::map<quint64, PendingWrite> decodedWrites;
+    // Set once a request asked to close; later input is ignored
+    bool closing = false;
+    quint64 closeAfter = 0;
+    QElapsedTimer lastActivity;
+};
+
+// Pool thread with its own read-only connection, opened on first use and
+// reopened when the current site changes or a restore replaced the file
+class ApiWorker : public QObject
+{
+public:
+    explicit ApiWorker(const QString& connectionName) : m_connectionName(connectionName) {}
+
+    ~ApiWorker()
+    {
+        if (m_db.isValid()) {
+            m_db.close();
+            m_db = QSqlDatabase();
+            QSqlDatabase::removeDatabase(m_connectionName);
+        }
+    }
+
+    QSqlDatabase database(const QString& path, quint64 generation, QString* errorMessage)
+    {
+        if (!m_db.isValid()) {
+            m_db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+            m_db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+        }
+        if (m_db.databaseName() != path || m_generation != generation || !m_db.isOpen()) {
+            m_db.close();
+            m_generation = generation;
+            m_db.setDatabaseName(path);
+            if (!m_db.open() && errorMessage) {
+                *errorMessage = m_db.lastError().text();
+            }
+        }
+        return m_db;
+    }
+
+private:
+    QString m_connectionName;
+    QSqlDatabase m_db;
+    quint64 m_generation = 0;
+};
+
+static QByteArray reasonPhrase(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 422: return "Unprocessable Entity";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default: return "Error";
+    }
+}
+
+static QByteArray toJson(const QJsonObject& object)
+{
+    return QJsonDocument(object).toJson(QJsonDocument::Compact);
+}
+
+static QByteArray errorJson(const QString& message)
+{
+    return toJson(QJsonObject{{"error", message}});
+}
+
+static QJsonObject itemJson(const Item& item)
+{
+    return QJsonObject{{"id", item.id},
+                       {"code", item.code},
+                       {"description", item.description},
+                       {"quantity", item.quantity},
+                       {"price", item.price.toString()}};
+}
+
+// JSON numbers are doubles; quantities must be whole and exactly representable
+static bool toInteger(const QJsonValue& value, qint64* integer)
+{
+    double number = value.toDouble();
+    if (!value.isDouble() || std::floor(number) != number || std::abs(number) > 9007199254740992.0) {
+        return false;
+    }
+    *integer = qint64(number);
+    return true;
+}
+
+// Decodes a write request body into scans; entries that cannot be decoded
+// get an error instead of failing the whole batch
+static bool parseScans(const QByteArray& body, Scan::Kind kind, bool batch, int maxBatch,
+                       std::vector<Scan>& scans, QStringList& errors, QString* errorMessage)
+{
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(body, &parseError);
+    if (!document.isObject()) {
+        *errorMessage = parseError.error != QJsonParseError::NoError ? "Invalid JSON: " + parseError.errorString()
+                                                                     : QString("Expected a JSON object");
+        return false;
+    }
+
+    const char* quantityKey = kind == Scan::AddOrderLine ? "quantity" : "delta";
+    QJsonArray entries;
+    if (batch) {
+        const char* listKey = kind == Scan::AddOrderLine ? "scans" : "adjustments";
+        QJsonValue list = document.object().value(listKey);
+        if (!list.isArray()) {
+            *errorMessage = QString("Expected \"%1\" to be an array").arg(listKey);
+            return false;
+        }
+        entries = list.toArray();
+        if (entries.size() > maxBatch) {
+            *errorMessage = QString("At most %1 entries per request").arg(maxBatch);
+            return false;
+        }
+    } else {
+        entries.append(document.object());
+    }
+
+    scans.reserve(size_t(entries.size()));
+    for (const QJsonValue& entry : entries) {
+        QJsonObject object = entry.toObject();
+        Scan scan;
+        scan.kind = kind;
+        scan.itemCode = object.value("item").toString();
+        scan.orderNumber = object.value("order").toString();
+        QString error;
+        if (!entry.isObject()) {
+            error = "Expected a JSON object";
+        } else if (scan.itemCode.isEmpty()) {
+            error = "Missing \"item\"";
+        } else if (kind == Scan::AddOrderLine && scan.orderNumber.isEmpty()) {
+            error = "Missing \"order\"";
+        } else if (!toInteger(object.value(quantityKey), &scan.quantity)) {
+            error = QString("Missing or non-integer \"%1\"").arg(quantityKey);
+        }
+        scans.push_back(scan);
+        errors << error;
+    }
+    return true;
+}
+
+static QJsonObject scanResultJson(const ScanResult& result, Scan::Kind kind)
+{
+    if (!result.ok) {
+        return QJsonObject{{"ok", false}, {"error", result.error}};
+    }
+    if (kind == Scan::AddOrderLine) {
+        return QJsonObject{{"ok", true}, {"id", result.id}};
+    }
+    return QJsonObject{{"ok", true}, {"quantity", result.quantity}};
+}
+
+enum class ParseResult { Complete, Incomplete, Failed };
+
+// Takes one request off the front of buffer; on Failed, status says why
+static ParseResult parseRequest(QByteArray& buffer, ApiRequest& request, int* status)
+{
+    qsizetype headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        if (buffer.size() > kMaxHeaderBytes) {
+            *status = 431;
+            return ParseResult::Failed;
+        }
+        return ParseResult::Incomplete;
+    }
+
+    QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+    QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+    if (requestLine.size() != 3) {
+        *status = 400;
+        return ParseResult::Failed;
+    }
+    QByteArray version = requestLine[2];
+    if (version != "HTTP/1.1" && version != "HTTP/1.0") {
+        *status = 505;
+        return ParseResult::Failed;
+    }
+    request.method = requestLine[0];
+    request.path = requestLine[1];
+
+    qint64 contentLength = 0;
+    QByteArray connection;
+    for (const QByteArray& line : lines) {
+        qsizetype colon = line.indexOf(':');
+        if (colon <= 0) {
+            continue;
+        }
+        QByteArray name = line.left(colon).trimmed().toLower();
+        QByteArray value = line.mid(colon + 1).trimmed();
+        if (name == "content-length") {
+            bool ok = false;
+            contentLength = value.toLongLong(&ok);
+            if (!ok || contentLength < 0) {
+                *status = 400;
+                return ParseResult::Failed;
+            }
+        } else if (name == "transfer-encoding") {
+            *status = 501;
+            return ParseResult::Failed;
+        } else if (name == "connection") {
+            connection = value.toLower();
+        } else if (name == "authorization") {
+            request.authorization = value;
+        }
+    }
+    if (contentLength > kMaxBodyBytes) {
+        *status = 413;
+        return ParseResult::Failed;
+    }
+
+    qsizetype bodyStart = headerEnd + 4;
+    if (buffer.size() - bodyStart < contentLength) {
+        return ParseResult::Incomplete;
+    }
+    request.body = buffer.mid(bodyStart, qsizetype(contentLength));
+    buffer.remove(0, bodyStart + qsizetype(contentLength));
+
+    request.keepAlive = version == "HTTP/1.1" ? !connection.contains("close") : connection.contains("keep-alive");
+    return ParseResult::Complete;
+}
+
+ApiServer::ApiServer(QObject* parent)
+    : QObject(parent),
+      m_nextConnectionId(0),
+      m_nextWorker(0),
+      m_maxConnections(512),
+      m_maxPipelined(32),
+      m_maxBatch(1000),
+      m_idleTimeoutMs(60000)
+{
+    connect(&m_server, &QTcpServer::newConnection, this, &ApiServer::acceptConnections);
+    m_writeTimer.setSingleShot(true);
+    connect(&m_writeTimer, &QTimer::timeout, this, &ApiServer::applyWrites);
+    connect(&m_idleTimer, &QTimer::timeout, this, &ApiServer::closeIdleConnections);
+}
+
+ApiServer::~ApiServer()
+{
+    stop();
+}
+
+bool ApiServer::start(QString* errorMessage)
+{
+    stop();
+
+    QSettings settings;
+    m_token = settings.value("api/token").toString().toUtf8();
+    m_maxConnections = settings.value("api/maxConnections", 512).toInt();
+    m_maxPipelined = qMax(1, settings.value("api/maxPipelined", 32).toInt());
+    m_maxBatch = qMax(1, settings.value("api/maxBatch", 1000).toInt());
+    m_idleTimeoutMs = settings.value("api/idleTimeoutMs", 60000).toInt();
+    int workers = qMax(1, settings.value("api/workers", QThread::idealThreadCount()).toInt());
+
+    QHostAddress address(settings.value("api/address").toString());
+    if (address.isNull()) {
+        address = QHostAddress::LocalHost;
+    }
+    quint16 port = quint16(settings.value("api/port", 8080).toUInt());
+    if (!m_server.listen(address, port)) {
+        QString error = QString("Cannot listen on %1:%2: %3").arg(address.toString()).arg(port).arg(m_server.errorString());
+        qDebug() << error;
+        if (errorMessage) {
+            *errorMessage = error;
+        }
+        return false;
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        QThread* thread = new QThread(this);
+        ApiWorker* worker = new ApiWorker(QString("api-%1").arg(i));
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        thread->start();
+        m_threads.push_back(thread);
+        m_workers.push_back(worker);
+    }
+
+    m_idleTimer.start(qBound(1000, m_idleTimeoutMs / 4, 10000));
+    qDebug() << "API server listening on" << address.toString() << m_server.serverPort() << "with" << workers << "workers";
+    return true;
+}
+
+void ApiServer::stop()
+{
+    m_server.close();
+    m_idleTimer.stop();
+    m_writeTimer.stop();
+    m_writes.clear();
+
+    for (Connection* connection : std::as_const(m_connections)) {
+        connection->socket->disconnect(this);
+        connection->socket->abort();
+        connection->socket->deleteLater();
+        delete connection;
+    }
+    m_connections.clear();
+
+    // Workers are deleted in their threads once these finish
+    for (QThread* thread : m_threads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    m_threads.clear();
+    m_workers.clear();
+}
+
+void ApiServer::runOnWorker(const std::function<void(ApiWorker*)>& task)
+{
+    ApiWorker* worker = m_workers[m_nextWorker++ % m_workers.size()];
+    QMetaObject::invokeMethod(worker, [worker, task]() { task(worker); }, Qt::QueuedConnection);
+}
+
+void ApiServer::acceptConnections()
+{
+    while (QTcpSocket* socket = m_server.nextPendingConnection()) {
+        if (m_connections.size() >= m_maxConnections) {
+            qDebug() << "API connection from" << socket->peerAddress().toString() << "refused: too many connections";
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+
+        quint64 id = m_nextConnectionId++;
+        Connection* connection = new Connection;
+        connection->socket = socket;
+        connection->lastActivity.start();
+        m_connections.insert(id, connection);
+
+        // Scans are small; send them without waiting for more data
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(socket, &QTcpSocket::readyRead, this, [this, id]() { readRequests(id); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, id]() {
+            Connection* connection = m_connections.take(id);
+            if (connection) {
+                connection->socket->deleteLater();
+                delete connection;
+            }
+        });
+    }
+}
+
+void ApiServer::readRequests(quint64 connectionId)
+{
+    Connection* connection = m_connections.value(connectionId);
+    if (!connection) {
+        return;
+    }
+    connection->lastActivity.start();
+
+    while (!connection->closing && int(connection->responses.size()) < m_maxPipelined) {
+        // Input stays in the socket while the pipeline is full
+        if (connection->buffer.size() <= kMaxHeaderBytes + kMaxBodyBytes) {
+            connection->buffer += connection->socket->readAll();
+        }
+
+        ApiRequest request;
+        int status = 0;
+        ParseResult result = parseRequest(connection->buffer, request, &status);
+        if (result == ParseResult::Incomplete) {
+            return;
+        }
+
+        quint64 sequence = connection->nextSequence++;
+        Connection::Response& response = connection->responses[sequence];
+        response.timer.start();
+        if (result == ParseResult::Failed || !request.keepAlive) {
+            connection->closing = true;
+            connection->closeAfter = sequence;
+        }
+
+        if (result == ParseResult::Failed) {
+            // The framing is lost; answer and close
+            respond(connectionId, sequence, status, errorJson(QString::fromLatin1(reasonPhrase(status))));
+            return;
+        }
+        dispatch(connectionId, sequence, request);
+        // respond() may have closed the connection
+        connection = m_connections.value(connectionId);
+        if (!connection) {
+            return;
+        }
+    }
+}
+
+void ApiServer::dispatch(quint64 connectionId, quint64 sequence, const ApiRequest& request)
+{
+    WMS_TRACE_SCOPE_CAT("ApiServer::dispatch", "api");
+
+    Connection::Response& response = m_connections.value(connectionId)->responses[sequence];
+
+    if (!m_token.isEmpty() && request.authorization != "Bearer " + m_token) {
+        response.endpoint = "unauthorized";
+        respond(connectionId, sequence, 401, errorJson("Missing or wrong API token"));
+        return;
+    }
+
+    QByteArray path = request.path;
+    qsizetype query = path.indexOf('?');
+    if (query >= 0) {
+        path.truncate(query);
+    }
+    bool isGet = request.method == "GET";
+    bool isPost = request.method == "POST";
+    QString databasePath = DatabaseManager::instance().databasePath();
+    quint64 generation = DatabaseManager::instance().databaseGeneration();
+    int maxBatch = m_maxBatch;
+
+    // Delivers a worker's answer back on this thread
+    auto reply = [this, connectionId, sequence](int status, const QByteArray& body) {
+        QMetaObject::invokeMethod(this, [this, connectionId, sequence, status, body]() {
+            respond(connectionId, sequence, status, body);
+        }, Qt::QueuedConnection);
+    };
+
+    if (path == "/api/health" && isGet) {
+        response.endpoint = "health";
+        respond(connectionId, sequence, 200, toJson(QJsonObject{{"status", "ok"},
+                                                                {"site", DatabaseManager::instance().currentSite()}}));
+        return;
+    }
+
+    if (path.startsWith("/api/items/") && path != "/api/items/lookup" && isGet) {
+        response.endpoint = "item";
+        QString code = QUrl::fromPercentEncoding(path.mid(int(qstrlen("/api/items/"))));
+        runOnWorker([reply, databasePath, generation, code](ApiWorker* worker) {
+            QString error;
+            QSqlDatabase db = worker->database(databasePath, generation, &error);
+            if (!db.isOpen()) {
+                reply(503, errorJson(error));
+                return;
+            }
+            ItemRepository repo(db);
+            std::optional<Item> item = repo.byCode(code);
+            if (item) {
+                reply(200, toJson(itemJson(*item)));
+            } else if (!repo.lastError().isEmpty()) {
+                reply(503, errorJson(repo.lastError()));
+            } else {
+                reply(404, errorJson(QString("Unknown item %1").arg(code)));
+            }
+        });
+        return;
+    }
+
+    if (path == "/api/items/lookup" && isPost) {
+        response.endpoint = "items_lookup";
+        QByteArray body = request.body;
+        runOnWorker([reply, databasePath, generation, body, maxBatch](ApiWorker* worker) {
+            QJsonValue list = QJsonDocument::fromJson(body).object().value("codes");
+            if (!list.isArray()) {
+                reply(400, errorJson("Expected \"codes\" to be an array"));
+                return;
+            }
+            QJsonArray array = list.toArray();
+            if (array.size() > maxBatch) {
+                reply(400, errorJson(QString("At most %1 entries per request").arg(maxBatch)));
+                return;
+            }
+            QStringList codes;
+            for (const QJsonValue& value : array) {
+                codes << value.toString();
+            }
+
+            QString error;
+            QSqlDatabase db = worker->database(databasePath, generation, &error);
+            if (!db.isOpen()) {
+                reply(503, errorJson(error));
+                return;
+            }
+            ItemRepository repo(db);
+            std::vector<Item> found = repo.byCodes(codes);
+            if (!repo.lastError().isEmpty()) {
+                reply(503, errorJson(repo.lastError()));
+                return;
+            }
+
+            QHash<QString, const Item*> byCode;
+            for (const Item& item : found) {
+                byCode.insert(item.code, &item);
+            }
+            QJsonArray items;
+            QJsonArray missing;
+            for (const QString& code : std::as_const(codes)) {
+                const Item* item = byCode.value(code);
+                if (item) {
+                    items.append(itemJson(*item));
+                } else {
+                    missing.append(code);
+                }
+            }
+            reply(200, toJson(QJsonObject{{"items", items}, {"missing", missing}}));
+        });
+        return;
+    }
+
+    struct WriteRoute { const char* path; const char* endpoint; Scan::Kind kind; bool batch; };
+    static const WriteRoute writeRoutes[] = {
+        {"/api/order-lines", "order_line", Scan::AddOrderLine, false},
+        {"/api/order-lines/batch", "order_lines_batch", Scan::AddOrderLine, true},
+        {"/api/stock/adjust", "stock_adjust", Scan::AdjustStock, false},
+        {"/api/stock/adjust/batch", "stock_adjust_batch", Scan::AdjustStock, true},
+    };
+    for (const WriteRoute& route : writeRoutes) {
+        if (path != route.path) {
+            continue;
+        }
+        response.endpoint = route.endpoint;
+        if (!isPost) {
+            respond(connectionId, sequence, 405, errorJson("Use POST"));
+            return;
+        }
+        m_connections.value(connectionId)->writeOrder.push_back(sequence);
+        QByteArray body = request.body;
+        WriteRoute selected = route;
+        runOnWorker([this, connectionId, sequence, body, selected, maxBatch](ApiWorker*) {
+            PendingWrite write{connectionId, sequence, selected.batch, {}, {}, {}};
+            parseScans(body, selected.kind, selected.batch, maxBatch, write.scans, write.errors, &write.requestError);
+            QMetaObject::invokeMethod(this, [this, write]() { queueWrite(write); }, Qt::QueuedConnection);
+        });
+        return;
+    }
+
+    response.endpoint = "unknown";
+    respond(connectionId, sequence, 404, errorJson("No such endpoint"));
+}
+
+void ApiServer::queueWrite(PendingWrite write)
+{
+    Connection* connection = m_connections.value(write.connection);
+    if (!connection) {
+        return;
+    }
+
+    // Workers finish in any order; a write waits for the connection's
+    // earlier ones, so they reach the database in the order they were sent
+    connection->decodedWrites[write.sequence] = std::move(write);
+    std::vector<PendingWrite> rejected;
+    while (!connection->writeOrder.empty()) {
+        auto it = connection->decodedWrites.find(connection->writeOrder.front());
+        if (it == connection->decodedWrites.end()) {
+            break;
+        }
+        if (it->second.requestError.isEmpty()) {
+            m_writes.push_back(std::move(it->second));
+        } else {
+            rejected.push_back(std::move(it->second));
+        }
+        connection->decodedWrites.erase(it);
+        connection->writeOrder.pop_front();
+    }
+    // respond() may close the connection, so only once it is no longer used
+    for (const PendingWrite& invalid : rejected) {
+        respond(invalid.connection, invalid.sequence, 400, errorJson(invalid.requestError));
+    }
+
+    if (m_writes.empty()) {
+        return;
+    }
+    // Everything decoded until the event loop comes round goes into one transaction
+    if (!m_writeTimer.isActive()) {
+        m_writeTimer.start(0);
+    }
+}
+
+void ApiServer::applyWrites()
+{
+    WMS_TRACE_SCOPE_CAT("ApiServer::applyWrites", "api");
+
+    static MetricCounter* const transactions = MetricsRegistry::instance().counter(
+        "wms_api_write_transactions_total", "Transactions that applied API write requests");
+
+    std::vector<PendingWrite> writes;
+    writes.swap(m_writes);
+
+    std::vector<Scan> scans;
+    for (const PendingWrite& write : writes) {
+        for (size_t i = 0; i < write.scans.size(); ++i) {
+            if (write.errors.at(qsizetype(i)).isEmpty()) {
+                scans.push_back(write.scans[i]);
+            }
+        }
+    }
+
+    std::vector<ScanResult> results;
+    QString error;
+    bool ok = true;
+    if (!scans.empty()) {
+        ok = DatabaseManager::instance().applyScans(scans, results, &error);
+        transactions->inc();
+    }
+
+    size_t next = 0;
+    for (const PendingWrite& write : writes) {
+        if (!ok) {
+            respond(write.connection, write.sequence, 503, errorJson(error));
+            continue;
+        }
+
+        QJsonArray entries;
+        ScanResult single;
+        for (size_t i = 0; i < write.scans.size(); ++i) {
+            ScanResult result;
+            const QString& decodeError = write.errors.at(qsizetype(i));
+            if (decodeError.isEmpty()) {
+                result = results[next++];
+            } else {
+                result.error = decodeError;
+            }
+            entries.append(scanResultJson(result, write.scans[i].kind));
+            single = result;
+        }
+
+        if (write.batch) {
+            respond(write.connection, write.sequence, 200, toJson(QJsonObject{{"results", entries}}));
+        } else if (single.ok) {
+            respond(write.connection, write.sequence, write.scans.front().kind == Scan::AddOrderLine ? 201 : 200,
+                    toJson(entries.first().toObject()));
+        } else {
+            respond(write.connection, write.sequence, 422, errorJson(single.error));
+        }
+    }
+}
+
+void ApiServer::respond(quint64 connectionId, quint64 sequence, int status, const QByteArray& body)
+{
+    Connection* connection = m_connections.value(connectionId);
+    if (!connection) {
+        // The client went away before its answer was ready
+        return;
+    }
+    auto it = connection->responses.find(sequence);
+    if (it == connection->responses.end()) {
+        return;
+    }
+    it->second.done = true;
+    it->second.status = status;
+    it->second.body = body;
+
+    // Send every answer that no earlier one is waiting for
+    while (!connection->responses.empty()) {
+        auto first = connection->responses.begin();
+        if (first->first != connection->nextToSend || !first->second.done) {
+            break;
+        }
+        Connection::Response& ready = first->second;
+        bool close = connection->closing && first->first == connection->closeAfter;
+        QByteArray message = "HTTP/1.1 " + QByteArray::number(ready.status) + ' ' + reasonPhrase(ready.status) + "\r\n"
+                             "Content-Type: application/json\r\n"
+                             "Content-Length: " + QByteArray::number(ready.body.size()) + "\r\n"
+                             + (close ? "Connection: close\r\n" : "Connection: keep-alive\r\n")
+                             + "\r\n" + ready.body;
+        connection->socket->write(message);
+
+        MetricsRegistry::instance()
+            .histogram("wms_api_request_duration_seconds", "API request latency, from parsing to response",
+                       QString("endpoint=\"%1\"").arg(ready.endpoint))
+            ->record(quint64(ready.timer.nsecsElapsed() / 1000));
+        MetricsRegistry::instance()
+            .counter("wms_api_responses_total", "API responses by status", QString("status=\"%1\"").arg(ready.status))
+            ->inc();
+
+        connection->responses.erase(first);
+        ++connection->nextToSend;
+        if (close) {
+            // Pending output is still sent; disconnected() then removes the connection
+            connection->socket->disconnectFromHost();
+            return;
+        }
+    }
+    connection->lastActivity.start();
+
+    // Room in the pipeline again: go on with input that was held back
+    if (!connection->closing && connection->socket->bytesAvailable() + connection->buffer.size() > 0) {
+        QMetaObject::invokeMethod(this, [this, connectionId]() { readRequests(connectionId); }, Qt::QueuedConnection);
+    }
+}
+
+void ApiServer::closeIdleConnections()
+{
+    // Disconnecting may remove the connection right away, so not while iterating
+    QList<QTcpSocket*> idle;
+    for (Connection* connection : std::as_const(m_connections)) {
+        if (connection->responses.empty() && connection->lastActivity.hasExpired(m_idleTimeoutMs)) {
+            idle << connection->socket;
+        }
+    }
+    for (QTcpSocket* socket : std::as_const(idle)) {
+        socket->disconnectFromHost();
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTimer>
+#include <functional>
+#include <map>
+#include <vector>
+#include "entities.h"
+
+class QThread;
+class ApiWorker;
+struct ApiRequest;
+
+// HTTP/JSON API for RF handhelds and other clients that cannot use the
+// desktop GUI; run headless with --server (see main.cpp). Endpoints:
+//
+//   GET  /api/health
+//   GET  /api/items/<code>          one item
+//   POST /api/items/lookup          {"codes": [...]} -> {"items": [...], "missing": [...]}
+//   POST /api/order-lines           {"order": "...", "item": "...", "quantity": n} -> {"id": n}
+//   POST /api/order-lines/batch     {"scans": [{"order", "item", "quantity"}, ...]}
+//   POST /api/stock/adjust          {"item": "...", "delta": n} -> {"quantity": n}
+//   POST /api/stock/adjust/batch    {"adjustments": [{"item", "delta"}, ...]}
+//
+// Batch requests take up to "api/maxBatch" (default 1000) entries and answer
+// {"results": [...]} with one {"ok": true, ...} or {"ok": false, "error": ...}
+// per entry, in order; a failing entry does not affect the others.
+//
+// Connections use HTTP/1.1 keep-alive. Pipelined requests are answered in
+// the order they arrived; with "api/maxPipelined" (default 32) requests of
+// a connection in flight, no more of its input is read until answers have
+// gone out. Idle connections are closed after "api/idleTimeoutMs".
+//
+// Sockets and HTTP framing stay on the thread of the server. JSON decoding,
+// item lookups and response encoding run on "api/workers" threads (default
+// QThread::idealThreadCount()), each with its own read-only connection to the
+// current site's database. Writes go through DatabaseManager: all write
+// requests decoded since the previous write are applied together with one
+// DatabaseManager::applyScans() call, so many scanners share one
+// transaction and one sync of the database file. The writes of a connection
+// are applied in the order its requests arrived, however long each took to
+// decode.
+//
+// With "api/token" set, requests must carry "Authorization: Bearer <token>".
+class ApiServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ApiServer(QObject* parent = nullptr);
+    ~ApiServer();
+
+    // Reads the "api/*" settings, starts the workers and listens on
+    // "api/address" (default localhost; set it to the address handhelds
+    // reach, or 0.0.0.0, to serve the network) and "api/port" (default 8080)
+    bool start(QString* errorMessage = nullptr);
+    void stop();
+    bool isListening() const { return m_server.isListening(); }
+    quint16 port() const { return m_server.serverPort(); }
+
+private:
+    struct Connection;
+    struct PendingWrite
+    {
+        quint64 connection;
+        quint64 sequence;
+        bool batch;
+        std::vector<Scan> scans;
+        QStringList errors;   // per scan; empty if it could be decoded
+        QString requestError; // the body could not be decoded at all
+    };
+
+    void acceptConnections();
+    void readRequests(quint64 connectionId);
+    void dispatch(quint64 connectionId, quint64 sequence, const ApiRequest& request);
+    void respond(quint64 connectionId, quint64 sequence, int status, const QByteArray& body);
+    void queueWrite(PendingWrite write);
+    void applyWrites();
+    void closeIdleConnections();
+    void runOnWorker(const std::function<void(ApiWorker*)>& task);
+
+    QTcpServer m_server;
+    QHash<quint64, Connection*> m_connections;
+    quint64 m_nextConnectionId;
+    std::vector<QThread*> m_threads;
+    std::vector<ApiWorker*> m_workers;
+    size_t m_nextWorker;
+    std::vector<PendingWrite> m_writes;
+    QTimer m_writeTimer;
+    QTimer m_idleTimer;
+    QByteArray m_token;
+    int m_maxConnections;
+    int m_maxPipelined;
+    int m_maxBatch;
+    int m_idleTimeoutMs;
+};
@@ -0,0 +1,421 @@
+#include "backupmanager.h"
+#include "databasemanager.h"
+#include "metrics.h"
+#include "schema.h"
+#include "sqlitebackup.h"
+#include "sqlitestatement.h"
+#include "tracing.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QSettings>
+#include <QThread>
+#include <memory>
+#include <sqlite3.h>
+
+// Pages copied per step when staging a restore; the copy runs on a worker
+// thread, so the steps only serve progress reporting
+static const int kRestorePagesPerStep = 4096;
+
+// Waits between steps while the source is locked: doubling from 10 ms up to
+// 1 s, giving up after kRestoreBusyRetries steps in a row that got no pages
+static const int kRestoreBusyRetries = 60;
+static const int kRestoreMaxBusySleepMs = 1000;
+
+// Backups are named after the database file ("wms-", "wms_site_<code>-"),
+// so the sites can share one backup directory
+static QString backupPrefix()
+{
+    return QFileInfo(DatabaseManager::instance().databasePath()).completeBaseName() + "-";
+}
+
+static void countBackup(const char* kind, bool ok)
+{
+    MetricsRegistry::instance()
+        .counter("wms_backups_total", "Database backups and restores",
+                 QString("kind=\"%1\",result=\"%2\"").arg(kind, ok ? "ok" : "failed"))
+        ->inc();
+}
+
+static MetricHistogram* backupDuration(const char* kind)
+{
+    return MetricsRegistry::instance().histogram("wms_backup_duration_seconds",
+                                                 "Time to back up or restore the database",
+                                                 QString("kind=\"%1\"").arg(kind));
+}
+
+// Copies a database file with the backup API into a new file
+static bool copyDatabase(const QString& sourcePath, const QString& destinationPath,
+                         const std::function<void(int)>& progress, QString* errorMessage)
+{
+    WMS_TRACE_SCOPE_CAT("copyDatabase", "sql");
+
+    QFile::remove(destinationPath);
+    sqlite3* source = SqliteBackupJob::openFile(sourcePath, true, errorMessage);
+    if (!source) {
+        return false;
+    }
+    sqlite3* destination = SqliteBackupJob::openFile(destinationPath, false, errorMessage);
+    if (!destination) {
+        sqlite3_close_v2(source);
+        return false;
+    }
+
+    int rc = SQLITE_OK;
+    int busySteps = 0;
+    int busySleepMs = 10;
+    sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+    if (backup) {
+        for (;;) {
+            rc = sqlite3_backup_step(backup, kRestorePagesPerStep);
+            if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+                if (++busySteps > kRestoreBusyRetries) {
+                    break;
+                }
+                sqlite3_sleep(busySleepMs);
+                busySleepMs = qMin(busySleepMs * 2, kRestoreMaxBusySleepMs);
+                continue;
+            }
+            if (rc != SQLITE_OK) {
+                break;
+            }
+            busySteps = 0;
+            busySleepMs = 10;
+            int total = sqlite3_backup_pagecount(backup);
+            if (total > 0) {
+                progress(int(qint64(total - sqlite3_backup_remaining(backup)) * 100 / total));
+            }
+        }
+        sqlite3_backup_finish(backup);
+    }
+
+    bool ok = backup && rc == SQLITE_DONE;
+    if (!ok && errorMessage) {
+        *errorMessage = backup ? QString::fromUtf8(sqlite3_errstr(rc)) : QString::fromUtf8(sqlite3_errmsg(destination));
+    }
+    sqlite3_close_v2(destination);
+    sqlite3_close_v2(source);
+    if (!ok) {
+        QFile::remove(destinationPath);
+    }
+    return ok;
+}
+
+BackupManager::BackupManager(QObject* parent)
+    : QObject(parent), m_job(nullptr), m_worker(nullptr)
+{
+    // Backups read from the main connection, so the database manager has to
+    // outlive this singleton
+    DatabaseManager& db = DatabaseManager::instance();
+
+    connect(&m_scheduleTimer, &QTimer::timeout, this, [this]() { backupNow(); });
+    connect(&db, &DatabaseManager::databaseClosing, this, &BackupManager::cancelBackup);
+    connect(&db, &DatabaseManager::siteChanged, this, [this]() {
+        if (m_scheduleTimer.isActive()) {
+            startSchedule();
+        }
+    });
+}
+
+BackupManager::~BackupManager()
+{
+    m_scheduleTimer.stop();
+    delete m_job;
+    m_job = nullptr;
+
+    if (m_worker) {
+        m_worker->wait();
+        delete m_worker;
+        m_worker = nullptr;
+    }
+}
+
+BackupManager& BackupManager::instance()
+{
+    static BackupManager instance;
+    return instance;
+}
+
+void BackupManager::startSchedule()
+{
+    QSettings settings;
+    int interval = settings.value("backup/intervalMs", 86400000).toInt();
+    if (!settings.value("backup/enabled", true).toBool() || interval <= 0) {
+        m_scheduleTimer.stop();
+        return;
+    }
+    m_scheduleTimer.start(interval);
+
+    // Catch up shortly after startup if the last backup is overdue
+    QStringList existing = backups();
+    if (existing.isEmpty() || QFileInfo(existing.first()).lastModified().msecsTo(QDateTime::currentDateTime()) > interval) {
+        QTimer::singleShot(60000, this, [this]() {
+            if (!isBusy()) {
+                backupNow();
+            }
+        });
+    }
+}
+
+QString BackupManager::backupDirectory() const
+{
+    QString defaultDirectory = QFileInfo(DatabaseManager::instance().databasePath()).absolutePath() + "/backups";
+    return QSettings().value("backup/directory", defaultDirectory).toString();
+}
+
+QStringList BackupManager::backups() const
+{
+    QDir dir(backupDirectory());
+    QStringList files;
+    QString pattern = backupPrefix() + "*.db";
+    for (const QFileInfo& info : dir.entryInfoList({pattern}, QDir::Files, QDir::Name | QDir::Reversed)) {
+        files.append(info.absoluteFilePath());
+    }
+    return files;
+}
+
+bool BackupManager::backupNow(QString* errorMessage)
+{
+    WMS_TRACE_SCOPE_CAT("BackupManager::backupNow", "sql");
+
+    auto fail = [errorMessage](const QString& message) {
+        qDebug() << "Failed to start backup:" << message;
+        countBackup("backup", false);
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    if (isBusy()) {
+        return fail("A backup or restore is already running");
+    }
+    sqlite3* source = DatabaseManager::instance().nativeHandle();
+    if (!source) {
+        return fail("Online backups require the QSQLITE driver");
+    }
+
+    QDir dir(backupDirectory());
+    if (!dir.exists() && !dir.mkpath(".")) {
+        return fail(QString("Could not create %1").arg(dir.absolutePath()));
+    }
+
+    QString fileName = backupPrefix() + QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss") + ".db.part";
+    m_partPath = dir.absoluteFilePath(fileName);
+    QFile::remove(m_partPath);
+
+    QSettings settings;
+    m_job = new SqliteBackupJob(source, m_partPath, this);
+    m_job->setPagesPerStep(settings.value("backup/pagesPerStep", SqliteBackupJob::kDefaultPagesPerStep).toInt());
+    m_job->setStepInterval(settings.value("backup/stepIntervalMs", SqliteBackupJob::kDefaultStepIntervalMs).toInt());
+    connect(m_job, &SqliteBackupJob::progress, this, [this](int remaining, int total) {
+        if (total > 0) {
+            emit backupProgress(int(qint64(total - remaining) * 100 / total));
+        }
+    });
+    connect(m_job, &SqliteBackupJob::finished, this, &BackupManager::copyFinished);
+
+    QString error;
+    if (!m_job->start(&error)) {
+        delete m_job;
+        m_job = nullptr;
+        QFile::remove(m_partPath);
+        return fail(error);
+    }
+
+    m_elapsed.start();
+    return true;
+}
+
+void BackupManager::cancelBackup()
+{
+    // The job holds the handle of the connection about to be closed;
+    // cancel() reports through copyFinished(), which removes the partial file
+    if (m_job) {
+        qDebug() << "Cancelling the backup: the database is being closed";
+        m_job->cancel();
+    }
+}
+
+void BackupManager::copyFinished(bool ok, const QString& errorMessage)
+{
+    m_job->deleteLater();
+    m_job = nullptr;
+
+    if (!ok) {
+        backupValidated(false, errorMessage);
+        return;
+    }
+
+    // The integrity check reads the whole file, so it runs off the GUI thread
+    QString partPath = m_partPath;
+    runOnWorker([partPath](QString* error) { return validateBackup(partPath, error); },
+                &BackupManager::backupValidated);
+}
+
+void BackupManager::backupValidated(bool ok, const QString& errorMessage)
+{
+    QString error = errorMessage;
+    QString finalPath = m_partPath.chopped(int(qstrlen(".part")));
+    if (ok && !QFile::rename(m_partPath, finalPath)) {
+        ok = false;
+        error = QString("Could not rename %1").arg(m_partPath);
+    }
+
+    if (!ok) {
+        qDebug() << "Backup failed:" << error;
+        QFile::remove(m_partPath);
+        countBackup("backup", false);
+        emit backupFinished(false, error);
+        return;
+    }
+
+    static MetricHistogram* const duration = backupDuration("backup");
+    duration->record(quint64(m_elapsed.nsecsElapsed() / 1000));
+    countBackup("backup", true);
+
+    pruneBackups();
+    emit backupFinished(true, finalPath);
+}
+
+void BackupManager::pruneBackups()
+{
+    int keep = QSettings().value("backup/keep", 7).toInt();
+    if (keep <= 0) {
+        return;
+    }
+
+    QStringList files = backups();
+    for (int i = keep; i < files.size(); ++i) {
+        if (!QFile::remove(files[i])) {
+            qDebug() << "Failed to remove old backup" << files[i];
+        }
+    }
+}
+
+bool BackupManager::restore(const QString& backupPath, QString* errorMessage)
+{
+    WMS_TRACE_SCOPE_CAT("BackupManager::restore", "sql");
+
+    if (isBusy()) {
+        qDebug() << "Failed to start restore: a backup or restore is already running";
+        if (errorMessage) {
+            *errorMessage = "A backup or restore is already running";
+        }
+        return false;
+    }
+
+    // Staged next to wms.db, so the final rename stays on one file system
+    m_stagedPath = DatabaseManager::instance().databasePath() + ".restore";
+    m_elapsed.start();
+
+    QString stagedPath = m_stagedPath;
+    runOnWorker([this, backupPath, stagedPath](QString* error) {
+        auto progress = [this](int percent) {
+            QMetaObject::invokeMethod(this, [this, percent]() { emit restoreProgress(percent); }, Qt::QueuedConnection);
+        };
+        return copyDatabase(backupPath, stagedPath, progress, error) && validateBackup(stagedPath, error);
+    }, &BackupManager::restoreStaged);
+    return true;
+}
+
+void BackupManager::restoreStaged(bool ok, const QString& errorMessage)
+{
+    QString error = errorMessage;
+    if (ok && m_stagedPath != DatabaseManager::instance().databasePath() + ".restore") {
+        ok = false;
+        error = "The site was switched while the backup was being staged";
+    }
+    if (ok) {
+        ok = DatabaseManager::instance().replaceDatabaseFile(m_stagedPath, &error);
+    }
+
+    if (!ok) {
+        qDebug() << "Restore failed:" << error;
+        QFile::remove(m_stagedPath);
+        countBackup("restore", false);
+        emit restoreFinished(false, error);
+        return;
+    }
+
+    static MetricHistogram* const duration = backupDuration("restore");
+    duration->record(quint64(m_elapsed.nsecsElapsed() / 1000));
+    countBackup("restore", true);
+    emit restoreFinished(true, QString());
+}
+
+void BackupManager::runOnWorker(const std::function<bool(QString*)>& work,
+                                void (BackupManager::*done)(bool, const QString&))
+{
+    auto result = std::make_shared<std::pair<bool, QString>>(false, QString());
+    m_worker = QThread::create([work, result]() { result->first = work(&result->second); });
+
+    // The thread is gone before done() runs, so done() may start the next step
+    connect(m_worker, &QThread::finished, this, [this, done, result]() {
+        delete m_worker;
+        m_worker = nullptr;
+        (this->*done)(result->first, result->second);
+    });
+    m_worker->start();
+}
+
+bool BackupManager::validateBackup(const QString& filePath, QString* errorMessage)
+{
+    WMS_TRACE_SCOPE_CAT("BackupManager::validateBackup", "sql");
+
+    auto fail = [errorMessage](const QString& message) {
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    sqlite3* db = SqliteBackupJob::openFile(filePath, true, errorMessage);
+    if (!db) {
+        return false;
+    }
+    // Closes the handle on every return path, after the statements below
+    std::unique_ptr<sqlite3, int (*)(sqlite3*)> closer(db, sqlite3_close_v2);
+
+    SqliteStatement check(db, "PRAGMA quick_check");
+    QStringList problems;
+    while (check.step()) {
+        QString result = check.columnString(0);
+        if (result != "ok") {
+            problems.append(result);
+        }
+    }
+    if (check.hasError()) {
+        return fail(check.lastError());
+    }
+    if (!problems.isEmpty()) {
+        return fail(QString("Integrity check failed: %1").arg(problems.mid(0, 5).join("; ")));
+    }
+
+    SqliteStatement version(db, "PRAGMA user_version");
+    if (!version.step()) {
+        return fail(version.hasError() ? version.lastError() : QString("No schema version"));
+    }
+    if (version.columnInt(0) > DatabaseManager::schemaVersion()) {
+        return fail(QString("Schema version %1 is newer than the supported version %2")
+                        .arg(version.columnInt(0))
+                        .arg(DatabaseManager::schemaVersion()));
+    }
+
+    SqliteStatement tables(db, "SELECT name FROM sqlite_master WHERE type = 'table'");
+    QSet<QString> names;
+    while (tables.step()) {
+        names.insert(tables.columnString(0));
+    }
+    for (std::string_view table : {UsersTable::name, ItemsTable::name, OrdersTable::name, OrderLinesTable::name}) {
+        QString name = QString::fromUtf8(table.data(), int(table.size()));
+        if (!names.contains(name)) {
+            return fail(QString("Not a WMS database: table %1 is missing").arg(name));
+        }
+    }
+    return true;
+}
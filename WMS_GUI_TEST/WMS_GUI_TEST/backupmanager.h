@@ -0,0 +1,81 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <functional>
+
+class QThread;
+class SqliteBackupJob;
+
+// Online backups of wms.db and restore from them.
+//
+// A backup copies the live database with SqliteBackupJob into
+// "<directory>/wms-<timestamp>.db.part" (named after the current site's
+// file), a few pages per timer tick, so the application keeps working while
+// it runs. The finished copy is checked with PRAGMA quick_check on a worker
+// thread and only then renamed to ".db"; older backups beyond the retention
+// count are removed.
+//
+// A restore copies the chosen backup next to wms.db and validates the copy
+// on a worker thread; only then does DatabaseManager::replaceDatabaseFile()
+// swap it in with a rename while the connection is closed. Callers must
+// close every window that holds models on the connection before restoring.
+//
+// Switching sites cancels a running backup, since it reads through the
+// connection being closed, and fails a restore staged for the previous
+// site; the schedule is restarted for the new site's file.
+//
+// Settings: "backup/enabled" (default true), "backup/intervalMs" (default one
+// day), "backup/directory" (default "backups" next to wms.db), "backup/keep"
+// (default 7), "backup/pagesPerStep" and "backup/stepIntervalMs" (throttling).
+class BackupManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    static BackupManager& instance();
+
+    // Starts the backup timer if enabled in the settings
+    void startSchedule();
+
+    bool backupNow(QString* errorMessage = nullptr);
+    bool restore(const QString& backupPath, QString* errorMessage = nullptr);
+    bool isBusy() const { return m_job != nullptr || m_worker != nullptr; }
+
+    QString backupDirectory() const;
+    // Completed backups, newest first
+    QStringList backups() const;
+
+    // Opens the file read-only and checks that it is an intact WMS database
+    // of a schema version this build can open
+    static bool validateBackup(const QString& filePath, QString* errorMessage = nullptr);
+
+signals:
+    void backupProgress(int percent);
+    void backupFinished(bool ok, const QString& filePathOrError);
+    void restoreProgress(int percent);
+    void restoreFinished(bool ok, const QString& errorMessage);
+
+private:
+    BackupManager(QObject* parent = nullptr);
+    ~BackupManager();
+    BackupManager(const BackupManager&) = delete;
+    BackupManager& operator=(const BackupManager&) = delete;
+
+    void cancelBackup();
+    void copyFinished(bool ok, const QString& errorMessage);
+    void backupValidated(bool ok, const QString& errorMessage);
+    void restoreStaged(bool ok, const QString& errorMessage);
+    void pruneBackups();
+    void runOnWorker(const std::function<bool(QString*)>& work, void (BackupManager::*done)(bool, const QString&));
+
+    QTimer m_scheduleTimer;
+    SqliteBackupJob* m_job;
+    QThread* m_worker;
+    QString m_partPath;
+    QString m_stagedPath;
+    QElapsedTimer m_elapsed;
+};
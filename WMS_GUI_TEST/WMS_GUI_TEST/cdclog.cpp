@@ -0,0 +1,398 @@
+#include "cdclog.h"
+#include "crc32.h"
+#include "valuecodec.h"
+#include "varint.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char kMagic[] = "WMSCDC01";
+static const int kMagicSize = 8;
+static const int kFrameHeaderSize = 8;
+// Rows are a handful of columns; anything larger is a damaged size field
+static const quint32 kMaxRecordBytes = 16 * 1024 * 1024;
+
+static bool setError(QString* errorMessage, const QString& message)
+{
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+    return false;
+}
+
+static QString segmentFileName(quint64 firstLsn)
+{
+    return QString("cdc-%1.log").arg(firstLsn, 20, 10, QChar('0'));
+}
+
+static bool syncFile(QFile& file)
+{
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+QByteArray CdcRecord::encode() const
+{
+    QByteArray body;
+    appendVarint(body, lsn);
+    appendSignedVarint(body, changedAt.toMSecsSinceEpoch());
+    appendBytes(body, table.toUtf8());
+    body.append(char(operation));
+    if (operation != CdcOperation::Insert) {
+        appendRow(body, before);
+    }
+    if (operation != CdcOperation::Delete) {
+        appendRow(body, after);
+    }
+    return body;
+}
+
+bool CdcRecord::decode(const char* data, qsizetype size)
+{
+    qsizetype pos = 0;
+    qint64 changedMs;
+    QByteArray tableName;
+    if (!readVarint(data, size, pos, lsn) || !readSignedVarint(data, size, pos, changedMs)
+        || !readBytes(data, size, pos, tableName) || pos >= size) {
+        return false;
+    }
+    quint8 op = quint8(data[pos++]);
+    if (op < quint8(CdcOperation::Insert) || op > quint8(CdcOperation::Delete)) {
+        return false;
+    }
+    operation = CdcOperation(op);
+    changedAt = QDateTime::fromMSecsSinceEpoch(changedMs);
+    table = QString::fromUtf8(tableName);
+    before.clear();
+    after.clear();
+    if (operation != CdcOperation::Insert && !readRow(data, size, pos, before)) {
+        return false;
+    }
+    if (operation != CdcOperation::Delete && !readRow(data, size, pos, after)) {
+        return false;
+    }
+    return pos == size;
+}
+
+std::vector<CdcSegment> cdcSegments(const QString& directory)
+{
+    std::vector<CdcSegment> segments;
+    const QStringList names = QDir(directory).entryList({"cdc-*.log"}, QDir::Files, QDir::Name);
+    for (const QString& name : names) {
+        bool ok = false;
+        quint64 firstLsn = name.mid(4, name.size() - 8).toULongLong(&ok);
+        if (ok) {
+            segments.push_back({firstLsn, QDir(directory).filePath(name)});
+        }
+    }
+    // Zero-padded names sort by LSN already
+    return segments;
+}
+
+// CdcLogWriter
+
+bool CdcLogWriter::open(const QString& directory, qint64 segmentBytes, QString* errorMessage)
+{
+    close();
+    if (!QDir().mkpath(directory)) {
+        return setError(errorMessage, QString("Could not create %1").arg(directory));
+    }
+    m_directory = directory;
+    m_segmentBytes = qMax<qint64>(segmentBytes, 4096);
+    m_lastLsn = 0;
+    return recover(errorMessage);
+}
+
+bool CdcLogWriter::recover(QString* errorMessage)
+{
+    std::vector<CdcSegment> segments = cdcSegments(m_directory);
+    while (!segments.empty()) {
+        const CdcSegment& segment = segments.back();
+        QFile file(segment.filePath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return setError(errorMessage, QString("Could not open %1: %2").arg(segment.filePath, file.errorString()));
+        }
+        QByteArray data = file.readAll();
+        file.close();
+
+        // Scan up to the first incomplete record
+        const char* p = data.constData();
+        qsizetype valid = 0;
+        quint64 lastLsn = 0;
+        if (data.startsWith(QByteArray(kMagic, kMagicSize))) {
+            valid = kMagicSize;
+            while (data.size() - valid >= kFrameHeaderSize) {
+                quint32 size = qFromLittleEndian<quint32>(p + valid);
+                quint32 crc = qFromLittleEndian<quint32>(p + valid + 4);
+                const char* body = p + valid + kFrameHeaderSize;
+                qsizetype pos = 0;
+                quint64 lsn;
+                if (size > kMaxRecordBytes || data.size() - valid - kFrameHeaderSize < qsizetype(size)
+                    || crc32(body, size) != crc || !readVarint(body, size, pos, lsn)) {
+                    break;
+                }
+                lastLsn = lsn;
+                valid += kFrameHeaderSize + size;
+            }
+        }
+
+        if (lastLsn == 0) {
+            // Created just before a crash, before its first record was written
+            QFile::remove(segment.filePath);
+            segments.pop_back();
+            continue;
+        }
+
+        if (!openSegment(segment.filePath, false, errorMessage)) {
+            return false;
+        }
+        if (valid < data.size()) {
+            qDebug() << "Cutting off" << data.size() - valid << "bytes of a torn record in" << segment.filePath;
+            if (!m_file.resize(valid) || !m_file.seek(valid)) {
+                return setError(errorMessage, QString("Could not truncate %1: %2").arg(segment.filePath, m_file.errorString()));
+            }
+            m_fileSize = valid;
+        }
+        m_lastLsn = lastLsn;
+        return true;
+    }
+    // Empty log; the first segment is created by the first append()
+    return true;
+}
+
+bool CdcLogWriter::openSegment(const QString& filePath, bool create, QString* errorMessage)
+{
+    m_file.close();
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        return setError(errorMessage, QString("Could not open %1: %2").arg(filePath, m_file.errorString()));
+    }
+    if (create) {
+        if (m_file.write(kMagic, kMagicSize) != kMagicSize) {
+            return setError(errorMessage, QString("Could not write %1: %2").arg(filePath, m_file.errorString()));
+        }
+        m_fileSize = kMagicSize;
+    } else {
+        m_fileSize = m_file.size();
+        m_file.seek(m_fileSize);
+    }
+    return true;
+}
+
+void CdcLogWriter::close()
+{
+    if (m_file.isOpen()) {
+        flush(false);
+        m_file.close();
+    }
+    m_buffer.clear();
+}
+
+bool CdcLogWriter::append(const CdcRecord& record, QString* errorMessage)
+{
+    if (m_directory.isEmpty()) {
+        return setError(errorMessage, "The change log is not open");
+    }
+    if (record.lsn <= m_lastLsn) {
+        return true;
+    }
+
+    QByteArray body = record.encode();
+    qint64 frameSize = kFrameHeaderSize + body.size();
+    qint64 segmentSize = m_fileSize + m_buffer.size();
+    if (!m_file.isOpen() || (segmentSize > kMagicSize && segmentSize + frameSize > m_segmentBytes)) {
+        // A full segment is synced before the next one starts
+        if (m_file.isOpen() && !flush(true, errorMessage)) {
+            return false;
+        }
+        if (!openSegment(QDir(m_directory).filePath(segmentFileName(record.lsn)), true, errorMessage)) {
+            return false;
+        }
+    }
+
+    quint32 header[2] = {qToLittleEndian(quint32(body.size())),
+                         qToLittleEndian(crc32(body.constData(), body.size()))};
+    m_buffer.append(reinterpret_cast<const char*>(header), sizeof(header));
+    m_buffer.append(body);
+    m_lastLsn = record.lsn;
+    return true;
+}
+
+bool CdcLogWriter::flush(bool sync, QString* errorMessage)
+{
+    if (!m_file.isOpen()) {
+        return true;
+    }
+    if (!m_buffer.isEmpty()) {
+        if (m_file.write(m_buffer) != m_buffer.size() || !m_file.flush()) {
+            // Drop the partial write; the buffer is written again next time
+            QString error = m_file.errorString();
+            m_file.resize(m_fileSize);
+            m_file.seek(m_fileSize);
+            return setError(errorMessage, QString("Could not write %1: %2").arg(m_file.fileName(), error));
+        }
+        m_fileSize += m_buffer.size();
+        m_buffer.clear();
+    }
+    if (sync && !syncFile(m_file)) {
+        return setError(errorMessage, QString("Could not sync %1").arg(m_file.fileName()));
+    }
+    return true;
+}
+
+int CdcLogWriter::removeSegmentsBefore(const QDateTime& cutoff)
+{
+    std::vector<CdcSegment> segments = cdcSegments(m_directory);
+    int removed = 0;
+    for (size_t i = 0; i + 1 < segments.size(); ++i) {
+        // A segment is no longer written to once the next one exists
+        if (QFileInfo(segments[i].filePath).lastModified() < cutoff && QFile::remove(segments[i].filePath)) {
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+// CdcLogReader
+
+bool CdcLogReader::open(const QString& directory, quint64 fromLsn, QString* errorMessage)
+{
+    close();
+    m_directory = directory;
+    m_nextLsn = fromLsn;
+    m_segments = cdcSegments(directory);
+
+    // Start in the last segment beginning at or before fromLsn
+    size_t index = 0;
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        if (m_segments[i].firstLsn <= fromLsn) {
+            index = i;
+        }
+    }
+    if (!m_segments.empty() && !openSegment(index)) {
+        return setError(errorMessage, m_error);
+    }
+    return true;
+}
+
+void CdcLogReader::close()
+{
+    m_file.close();
+    m_segments.clear();
+    m_segmentIndex = 0;
+    m_offset = 0;
+    m_error.clear();
+}
+
+bool CdcLogReader::openSegment(size_t index)
+{
+    m_file.close();
+    m_file.setFileName(m_segments[index].filePath);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_error = QString("Could not open %1: %2").arg(m_file.fileName(), m_file.errorString());
+        return false;
+    }
+    m_segmentIndex = index;
+    m_offset = 0;
+    return true;
+}
+
+bool CdcLogReader::hasNewerSegment()
+{
+    if (m_segmentIndex + 1 < m_segments.size()) {
+        return true;
+    }
+    // Segments may have been added, or old ones removed, since the last look
+    QString current = m_file.fileName();
+    m_segments = cdcSegments(m_directory);
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        if (m_segments[i].filePath == current) {
+            m_segmentIndex = i;
+            return i + 1 < m_segments.size();
+        }
+    }
+    return false;
+}
+
+bool CdcLogReader::next(CdcRecord& record)
+{
+    if (hasError() || m_directory.isEmpty()) {
+        return false;
+    }
+    auto corrupt = [this]() {
+        m_error = QString("%1: damaged record at offset %2").arg(m_file.fileName()).arg(m_offset);
+        return false;
+    };
+
+    for (;;) {
+        if (!m_file.isOpen()) {
+            // The log had no segments when the reader was opened
+            m_segments = cdcSegments(m_directory);
+            if (m_segments.empty() || !openSegment(0)) {
+                return false;
+            }
+        }
+
+        m_file.seek(m_offset);
+        if (m_offset == 0) {
+            QByteArray magic = m_file.read(kMagicSize);
+            if (magic.size() < kMagicSize) {
+                return false;
+            }
+            if (magic != QByteArray(kMagic, kMagicSize)) {
+                m_error = QString("%1 is not a change log segment").arg(m_file.fileName());
+                return false;
+            }
+            m_offset = kMagicSize;
+        }
+
+        QByteArray header = m_file.read(kFrameHeaderSize);
+        if (header.isEmpty()) {
+            // End of this segment; the writer only moves on after a complete record
+            if (hasNewerSegment()) {
+                if (!openSegment(m_segmentIndex + 1)) {
+                    return false;
+                }
+                continue;
+            }
+            return false;
+        }
+
+        bool complete = header.size() == kFrameHeaderSize;
+        QByteArray body;
+        if (complete) {
+            quint32 size = qFromLittleEndian<quint32>(header.constData());
+            quint32 crc = qFromLittleEndian<quint32>(header.constData() + 4);
+            complete = size <= kMaxRecordBytes;
+            if (complete) {
+                body = m_file.read(size);
+                complete = body.size() == qsizetype(size) && crc32(body.constData(), body.size()) == crc;
+            }
+        }
+        if (!complete) {
+            // Still being written, or torn by a crash and about to be cut off
+            // by the writer; either way only the newest segment can end so
+            return hasNewerSegment() ? corrupt() : false;
+        }
+
+        if (!record.decode(body.constData(), body.size())) {
+            return corrupt();
+        }
+        m_offset += kFrameHeaderSize + body.size();
+        if (record.lsn >= m_nextLsn) {
+            m_nextLsn = record.lsn + 1;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+#include <QVariantList>
+#include <vector>
+
+// Change-data-capture log: an append-only sequence of row changes in
+// segment files named cdc-<first LSN, 20 digits>.log. Every segment starts
+// with the 8-byte magic "WMSCDC01", followed by records:
+//
+//   4-byte little-endian body size
+//   4-byte little-endian CRC-32 of the body
+//   body: varint LSN, zigzag varint change time (ms since the epoch),
+//         varint-length-prefixed UTF-8 table name, operation byte,
+//         the row before the change (updates and deletes) and
+//         the row after it (inserts and updates)
+//
+// Rows are encoded as described in valuecodec.h, with the values in the
+// table's column order (schema.h).
+//
+// LSNs increase strictly across the whole log, with gaps allowed. A record
+// is only complete once its checksum matches; a torn record at the end of
+// the newest segment is cut off when the writer opens the log again.
+
+enum class CdcOperation : quint8 { Insert = 1, Update = 2, Delete = 3 };
+
+struct CdcRecord
+{
+    quint64 lsn = 0;
+    QDateTime changedAt;
+    QString table;
+    CdcOperation operation = CdcOperation::Insert;
+    QVariantList before;
+    QVariantList after;
+
+    QByteArray encode() const;
+    bool decode(const char* data, qsizetype size);
+};
+
+struct CdcSegment
+{
+    quint64 firstLsn;
+    QString filePath;
+};
+
+// Segments of the log in directory, oldest first
+std::vector<CdcSegment> cdcSegments(const QString& directory);
+
+class CdcLogWriter
+{
+public:
+    static constexpr qint64 kDefaultSegmentBytes = 64 * 1024 * 1024;
+
+    CdcLogWriter() = default;
+    ~CdcLogWriter() { close(); }
+    CdcLogWriter(const CdcLogWriter&) = delete;
+    CdcLogWriter& operator=(const CdcLogWriter&) = delete;
+
+    // Opens the log for appending, creating directory if needed, and
+    // recovers lastLsn() from the newest segment
+    bool open(const QString& directory, qint64 segmentBytes = kDefaultSegmentBytes, QString* errorMessage = nullptr);
+    // Flushes buffered records without syncing
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+    QString directory() const { return m_directory; }
+    quint64 lastLsn() const { return m_lastLsn; }
+
+    // Buffers a record; records at or below lastLsn() are skipped, so
+    // appending the same changes again after a crash does no harm
+    bool append(const CdcRecord& record, QString* errorMessage = nullptr);
+    // Writes the buffered records and, with sync, waits until they are on disk
+    bool flush(bool sync, QString* errorMessage = nullptr);
+
+    // Deletes segments whose records are all older than cutoff, never the
+    // newest one; returns the number of segments deleted
+    int removeSegmentsBefore(const QDateTime& cutoff);
+
+private:
+    bool openSegment(const QString& filePath, bool create, QString* errorMessage);
+    bool recover(QString* errorMessage);
+
+    QString m_directory;
+    QFile m_file;
+    QByteArray m_buffer;
+    qint64 m_segmentBytes = kDefaultSegmentBytes;
+    qint64 m_fileSize = 0;
+    quint64 m_lastLsn = 0;
+};
+
+// Reads the log from a given LSN on and keeps following it as it grows:
+// next() returns false once it has caught up and can be called again later
+// to pick up new records, including those in segments created meanwhile.
+// Readers never lock anything, so any number of them can follow the log of
+// a running application.
+class CdcLogReader
+{
+public:
+    // Positions the reader at the first record with an LSN of at least
+    // fromLsn; a consumer passes nextLsn() of its previous run to resume
+    bool open(const QString& directory, quint64 fromLsn = 0, QString* errorMessage = nullptr);
+    void close();
+
+    // False when no complete record follows yet, or on a corrupt record
+    // (hasError() is then true and the reader stays where it is)
+    bool next(CdcRecord& record);
+    bool hasError() const { return !m_error.isEmpty(); }
+    QString lastError() const { return m_error; }
+
+    quint64 nextLsn() const { return m_nextLsn; }
+    // Current position within the log
+    QString segmentPath() const { return m_file.fileName(); }
+    qint64 offset() const { return m_offset; }
+
+private:
+    bool openSegment(size_t index);
+    bool hasNewerSegment();
+
+    QString m_directory;
+    std::vector<CdcSegment> m_segments;
+    size_t m_segmentIndex = 0;
+    QFile m_file;
+    qint64 m_offset = 0;
+    quint64 m_nextLsn = 0;
+    QString m_error;
+};
@@ -0,0 +1,361 @@
+#include "changecapture.h"
+#include "metrics.h"
+#include "repositories.h"
+#include "schema.h"
+#include "sqlitestatement.h"
+#include "tracing.h"
+
+#include <QDebug>
+#include <QSettings>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <sqlite3.h>
+
+// Value columns of cdc_outbox: b0.. hold the row before the change, a0..
+// the row after it, in the table's column order
+static const int kOutboxColumns = 5;
+// Outbox rows moved to the log per query
+static const int kDrainBatch = 1000;
+
+static bool setError(QString* errorMessage, const QString& message)
+{
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+    return false;
+}
+
+static QString outboxColumns(char prefix)
+{
+    QStringList columns;
+    for (int i = 0; i < kOutboxColumns; ++i) {
+        columns << QString("%1%2").arg(prefix).arg(i);
+    }
+    return columns.join(", ");
+}
+
+template <typename Table>
+static QStringList columnsOf()
+{
+    QStringList columns;
+    for (const SqlColumn& column : Table::columns) {
+        columns << sqlString(column.name);
+    }
+    return columns;
+}
+
+// Columns whose values stay out of the log: they are written as NULL and
+// changes to them alone are not captured
+static bool isWithheld(const QString& table, const QString& column)
+{
+    return table == sqlString(UsersTable::name)
+           && column == sqlString(UsersTable::columns[UsersTable::Password].name);
+}
+
+template <typename Table>
+static QStringList captureTriggerSql()
+{
+    static_assert(Table::columns.size() <= kOutboxColumns, "cdc_outbox has too few value columns");
+
+    QString table = sqlString(Table::name);
+    QStringList columns = columnsOf<Table>();
+    auto row = [&](const QString& alias) {
+        QStringList values;
+        for (const QString& column : columns) {
+            values << (isWithheld(table, column) ? QString("NULL") : alias + "." + column);
+        }
+        while (values.size() < kOutboxColumns) {
+            values << "NULL";
+        }
+        return values.join(", ");
+    };
+    QStringList nulls;
+    while (nulls.size() < kOutboxColumns) {
+        nulls << "NULL";
+    }
+    QString none = nulls.join(", ");
+    // Statements inside a trigger may not name a schema; cdc_outbox is in
+    // the trigger's own one
+    auto insert = [&](CdcOperation operation, const QString& before, const QString& after) {
+        return QString("INSERT INTO cdc_outbox (changed_at, table_name, operation, %1, %2) "
+                       "VALUES (CAST((julianday('now') - 2440587.5) * 86400000.0 AS INTEGER), '%3', %4, %5, %6);")
+            .arg(outboxColumns('b'), outboxColumns('a'), table)
+            .arg(int(operation))
+            .arg(before, after);
+    };
+
+    // Updates that leave the row as it was are not changes
+    QStringList changed;
+    for (const QString& column : columns) {
+        if (!isWithheld(table, column)) {
+            changed << QString("OLD.%1 IS NOT NEW.%1").arg(column);
+        }
+    }
+
+    return {
+        QString("CREATE TRIGGER IF NOT EXISTS cdc_%1_insert AFTER INSERT ON %1 BEGIN %2 END")
+            .arg(table, insert(CdcOperation::Insert, none, row("NEW"))),
+        QString("CREATE TRIGGER IF NOT EXISTS cdc_%1_update AFTER UPDATE ON %1 WHEN %2 BEGIN %3 END")
+            .arg(table, changed.join(" OR "), insert(CdcOperation::Update, row("OLD"), row("NEW"))),
+        QString("CREATE TRIGGER IF NOT EXISTS cdc_%1_delete AFTER DELETE ON %1 BEGIN %2 END")
+            .arg(table, insert(CdcOperation::Delete, row("OLD"), none)),
+    };
+}
+
+ChangeCapture::ChangeCapture(const QSqlDatabase& db, QObject* parent)
+    : QObject(parent),
+      m_db(db),
+      m_running(false),
+      m_sync(true),
+      m_retentionDays(0)
+{
+    connect(&m_timer, &QTimer::timeout, this, [this]() {
+        QString error;
+        if (drain(&error) < 0) {
+            qDebug() << "Failed to drain the change outbox:" << error;
+        }
+    });
+}
+
+ChangeCapture::~ChangeCapture()
+{
+    stop();
+}
+
+QStringList ChangeCapture::capturedTables()
+{
+    return {sqlString(ItemsTable::name), sqlString(OrdersTable::name), sqlString(OrderLinesTable::name),
+            sqlString(UsersTable::name)};
+}
+
+QStringList ChangeCapture::columnNames(const QString& table)
+{
+    if (table == sqlString(ItemsTable::name)) {
+        return columnsOf<ItemsTable>();
+    }
+    if (table == sqlString(OrdersTable::name)) {
+        return columnsOf<OrdersTable>();
+    }
+    if (table == sqlString(OrderLinesTable::name)) {
+        return columnsOf<OrderLinesTable>();
+    }
+    if (table == sqlString(UsersTable::name)) {
+        return columnsOf<UsersTable>();
+    }
+    return QStringList();
+}
+
+bool ChangeCapture::install(QString* errorMessage)
+{
+    QStringList statements{
+        QString("CREATE TABLE IF NOT EXISTS cdc_outbox (lsn INTEGER PRIMARY KEY AUTOINCREMENT, "
+                "changed_at INTEGER NOT NULL, table_name TEXT NOT NULL, operation INTEGER NOT NULL, %1, %2)")
+            .arg(outboxColumns('b'), outboxColumns('a'))};
+    // Triggers are recreated every time, so databases captured by an older
+    // build pick up the current definitions
+    for (const QString& table : capturedTables()) {
+        for (const char* event : {"insert", "update", "delete"}) {
+            statements << QString("DROP TRIGGER IF EXISTS cdc_%1_%2").arg(table, event);
+        }
+    }
+    // Rows queued by triggers that still copied password hashes
+    statements << QString("UPDATE cdc_outbox SET b%1 = NULL, a%1 = NULL WHERE table_name = '%2'")
+                      .arg(int(UsersTable::Password))
+                      .arg(sqlString(UsersTable::name));
+    statements << captureTriggerSql<ItemsTable>() << captureTriggerSql<OrdersTable>()
+               << captureTriggerSql<OrderLinesTable>() << captureTriggerSql<UsersTable>();
+
+    if (!m_db.transaction()) {
+        return setError(errorMessage, m_db.lastError().text());
+    }
+    QSqlQuery query(m_db);
+    for (const QString& statement : statements) {
+        if (!query.exec(statement)) {
+            QString error = query.lastError().text();
+            m_db.rollback();
+            return setError(errorMessage, error);
+        }
+    }
+
+    // LSNs continue after the log even if the database file was replaced
+    // by an older copy (restore, site switch)
+    if (m_writer.lastLsn() > 0) {
+        qint64 lsn = qint64(m_writer.lastLsn());
+        query.prepare("UPDATE sqlite_sequence SET seq = ? WHERE name = 'cdc_outbox' AND seq < ?");
+        query.addBindValue(lsn);
+        query.addBindValue(lsn);
+        bool ok = query.exec();
+        if (ok) {
+            query.prepare("INSERT INTO sqlite_sequence (name, seq) SELECT 'cdc_outbox', ? "
+                          "WHERE NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = 'cdc_outbox')");
+            query.addBindValue(lsn);
+            ok = query.exec();
+        }
+        if (!ok) {
+            QString error = query.lastError().text();
+            m_db.rollback();
+            return setError(errorMessage, error);
+        }
+    }
+
+    if (!m_db.commit()) {
+        return setError(errorMessage, m_db.lastError().text());
+    }
+    return true;
+}
+
+bool ChangeCapture::uninstall(const QSqlDatabase& db, QString* errorMessage)
+{
+    QSqlQuery query(db);
+    if (!query.exec("SELECT 1 FROM sqlite_master WHERE name = 'cdc_outbox'")) {
+        return setError(errorMessage, query.lastError().text());
+    }
+    if (!query.next()) {
+        return true;
+    }
+    query.finish();
+
+    QStringList statements;
+    for (const QString& table : capturedTables()) {
+        for (const char* event : {"insert", "update", "delete"}) {
+            statements << QString("DROP TRIGGER IF EXISTS cdc_%1_%2").arg(table, event);
+        }
+    }
+    statements << "DROP TABLE IF EXISTS cdc_outbox";
+    for (const QString& statement : statements) {
+        if (!query.exec(statement)) {
+            return setError(errorMessage, query.lastError().text());
+        }
+    }
+    qDebug() << "Change capture switched off; removed its triggers and outbox";
+    return true;
+}
+
+bool ChangeCapture::start(const QString& directory, QString* errorMessage)
+{
+    stop();
+
+    QSettings settings;
+    m_sync = settings.value("cdc/sync", true).toBool();
+    m_retentionDays = settings.value("cdc/retentionDays", 0).toInt();
+    qint64 segmentBytes = settings.value("cdc/segmentBytes", CdcLogWriter::kDefaultSegmentBytes).toLongLong();
+
+    if (!m_writer.open(directory, segmentBytes, errorMessage)) {
+        return false;
+    }
+    if (!install(errorMessage)) {
+        m_writer.close();
+        return false;
+    }
+
+    m_running = true;
+    m_sinceRetention.invalidate();
+    // Changes left from before the last stop, or made while the application was not running
+    drain();
+    m_timer.start(qMax(10, settings.value("cdc/flushIntervalMs", 1000).toInt()));
+    return true;
+}
+
+void ChangeCapture::stop()
+{
+    if (!m_running) {
+        return;
+    }
+    m_timer.stop();
+    QString error;
+    if (drain(&error) < 0) {
+        qDebug() << "Failed to drain the change outbox:" << error;
+    }
+    m_writer.flush(m_sync);
+    m_writer.close();
+    m_running = false;
+}
+
+int ChangeCapture::drain(QString* errorMessage)
+{
+    WMS_TRACE_SCOPE_CAT("ChangeCapture::drain", "sql");
+
+    if (!m_running || !m_db.isOpen()) {
+        return 0;
+    }
+    // Outbox rows of an open transaction are visible to this connection
+    // but not committed yet
+    sqlite3* handle = sqliteHandle(m_db);
+    if (handle && !sqlite3_get_autocommit(handle)) {
+        return 0;
+    }
+
+    static MetricCounter* const written = MetricsRegistry::instance().counter(
+        "wms_cdc_records_written_total", "Row changes appended to the change log");
+
+    int total = 0;
+    for (;;) {
+        QSqlQuery query(m_db);
+        query.setForwardOnly(true);
+        query.prepare(QString("SELECT lsn, changed_at, table_name, operation, %1, %2 FROM cdc_outbox "
+                              "ORDER BY lsn LIMIT %3")
+                          .arg(outboxColumns('b'), outboxColumns('a'))
+                          .arg(kDrainBatch));
+        if (!query.exec()) {
+            setError(errorMessage, query.lastError().text());
+            return -1;
+        }
+
+        int rows = 0;
+        qint64 lastLsn = 0;
+        QString error;
+        while (query.next()) {
+            CdcRecord record;
+            record.lsn = quint64(query.value(0).toLongLong());
+            record.changedAt = QDateTime::fromMSecsSinceEpoch(query.value(1).toLongLong());
+            record.table = query.value(2).toString();
+            record.operation = CdcOperation(query.value(3).toInt());
+            int columns = columnNames(record.table).size();
+            for (int i = 0; i < columns; ++i) {
+                if (record.operation != CdcOperation::Insert) {
+                    record.before << query.value(4 + i);
+                }
+                if (record.operation != CdcOperation::Delete) {
+                    record.after << query.value(4 + kOutboxColumns + i);
+                }
+            }
+            if (!m_writer.append(record, &error)) {
+                setError(errorMessage, error);
+                return -1;
+            }
+            lastLsn = qint64(record.lsn);
+            ++rows;
+        }
+        query.finish();
+        if (rows == 0) {
+            break;
+        }
+
+        // The rows may only go once the log holds them
+        if (!m_writer.flush(m_sync, &error)) {
+            setError(errorMessage, error);
+            return -1;
+        }
+        query.prepare("DELETE FROM cdc_outbox WHERE lsn <= ?");
+        query.addBindValue(lastLsn);
+        if (!query.exec()) {
+            setError(errorMessage, query.lastError().text());
+            return -1;
+        }
+
+        written->inc(rows);
+        total += rows;
+        if (rows < kDrainBatch) {
+            break;
+        }
+    }
+
+    if (m_retentionDays > 0 && (!m_sinceRetention.isValid() || m_sinceRetention.hasExpired(3600000))) {
+        m_sinceRetention.start();
+        int removed = m_writer.removeSegmentsBefore(QDateTime::currentDateTime().addDays(-m_retentionDays));
+        if (removed > 0) {
+            qDebug() << "Removed" << removed << "change log segments older than" << m_retentionDays << "days";
+        }
+    }
+    return total;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include "cdclog.h"
+
+// Change data capture for downstream systems: every committed insert,
+// update and delete on items, orders, order_lines and users ends up in the
+// change log (cdclog.h), which consumers follow with CdcLogReader instead
+// of scanning wms.db. Password hashes of users are not captured: the
+// password column is always NULL in the log, and changing only a password
+// is not a change.
+//
+// Triggers on the captured tables copy each changed row into the cdc_outbox
+// table, inside the transaction that makes the change, so a rolled back
+// change never shows up and a committed one survives a crash. The outbox
+// row id is the LSN (AUTOINCREMENT, so it never goes back). Every
+// "cdc/flushIntervalMs" (default one second) the outbox is drained: its rows
+// are appended to the log, the log is synced ("cdc/sync", default true) and
+// only then are the rows deleted. Rows already in the log when a crash
+// interrupts the drain are skipped by LSN the next time. Changes made by
+// other connections and processes are captured too, since the triggers are
+// part of the database.
+//
+// Segments roll over at "cdc/segmentBytes" (default 64 MiB); segments last
+// written more than "cdc/retentionDays" ago are deleted (default 0: kept).
+class ChangeCapture : public QObject
+{
+    Q_OBJECT
+
+public:
+    ChangeCapture(const QSqlDatabase& db, QObject* parent = nullptr);
+    ~ChangeCapture();
+
+    // Captured tables and the columns of their rows in the log
+    static QStringList capturedTables();
+    static QStringList columnNames(const QString& table);
+
+    // Creates the outbox and triggers if needed, opens the log in directory
+    // and starts draining
+    bool start(const QString& directory, QString* errorMessage = nullptr);
+    // Drains what is committed and closes the log; the triggers stay, so
+    // changes made meanwhile are picked up by the next start()
+    void stop();
+    bool isRunning() const { return m_running; }
+    QString directory() const { return m_writer.directory(); }
+    quint64 lastLsn() const { return m_writer.lastLsn(); }
+
+    // Moves committed outbox rows to the log; returns the number of records
+    // written, or -1 on error. Nothing is drained while the connection is
+    // inside a transaction.
+    int drain(QString* errorMessage = nullptr);
+
+    // Drops the triggers and the outbox when capture is switched off, so
+    // the outbox does not grow without a drain; rows not drained yet are lost
+    static bool uninstall(const QSqlDatabase& db, QString* errorMessage = nullptr);
+
+private:
+    bool install(QString* errorMessage);
+
+    QSqlDatabase m_db;
+    CdcLogWriter m_writer;
+    QTimer m_timer;
+    QElapsedTimer m_sinceRetention;
+    bool m_running;
+    bool m_sync;
+    int m_retentionDays;
+};
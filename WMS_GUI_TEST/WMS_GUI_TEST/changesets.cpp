@@ -0,0 +1,565 @@
+#include "changesets.h"
+#include "crc32.h"
+#include "schema.h"
+#include "sqlitestatement.h"
+#include "varint.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QtEndian>
+#include <sqlite3.h>
+#include <vector>
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+#define WMS_HAVE_SESSIONS 1
+#endif
+
+static const char kMagic[] = "WMSCHG01";
+static const int kMagicSize = 8;
+
+static bool setError(QString* errorMessage, const QString& message)
+{
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+    return false;
+}
+
+QStringList replicatedTables()
+{
+    auto name = [](std::string_view table) { return QString::fromUtf8(table.data(), int(table.size())); };
+    return {name(ItemsTable::name), name(OrdersTable::name), name(OrderLinesTable::name)};
+}
+
+QStringList changesetStateStatements()
+{
+    return {"CREATE TABLE IF NOT EXISTS changeset_applied (node_id TEXT PRIMARY KEY, sequence INTEGER NOT NULL)",
+            "CREATE TABLE IF NOT EXISTS changeset_applying (active INTEGER)",
+            "CREATE TABLE IF NOT EXISTS changeset_sent (sequence INTEGER NOT NULL)",
+            "INSERT INTO changeset_sent (sequence) SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM changeset_sent)"};
+}
+
+bool ChangesetFile::write(const QString& filePath, QString* errorMessage) const
+{
+    QByteArray payload = qCompress(changeset);
+
+    QByteArray data(kMagic, kMagicSize);
+    QByteArray node = nodeId.toUtf8();
+    appendVarint(data, quint64(node.size()));
+    data.append(node);
+    appendVarint(data, sequence);
+    appendSignedVarint(data, createdAt.toMSecsSinceEpoch());
+    appendVarint(data, quint64(changeset.size()));
+    quint32 crc = qToLittleEndian(crc32(payload.constData(), payload.size()));
+    data.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    appendVarint(data, quint64(payload.size()));
+    data.append(payload);
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        return setError(errorMessage, QString("Could not write %1: %2").arg(filePath, file.errorString()));
+    }
+    return true;
+}
+
+bool ChangesetFile::read(const QString& filePath, QString* errorMessage)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return setError(errorMessage, QString("Could not open %1: %2").arg(filePath, file.errorString()));
+    }
+    QByteArray data = file.readAll();
+    auto corrupt = [&]() { return setError(errorMessage, QString("%1 is not a valid changeset file").arg(filePath)); };
+
+    if (data.size() < kMagicSize || !data.startsWith(QByteArray(kMagic, kMagicSize))) {
+        return corrupt();
+    }
+
+    const char* p = data.constData();
+    qsizetype pos = kMagicSize;
+    quint64 nodeSize, rawSize, payloadSize;
+    qint64 createdMs;
+    if (!readVarint(p, data.size(), pos, nodeSize) || nodeSize > quint64(data.size() - pos)) {
+        return corrupt();
+    }
+    nodeId = QString::fromUtf8(p + pos, qsizetype(nodeSize));
+    pos += qsizetype(nodeSize);
+    if (!readVarint(p, data.size(), pos, sequence) || !readSignedVarint(p, data.size(), pos, createdMs)
+        || !readVarint(p, data.size(), pos, rawSize) || data.size() - pos < 4) {
+        return corrupt();
+    }
+    quint32 crc = qFromLittleEndian<quint32>(p + pos);
+    pos += 4;
+    if (!readVarint(p, data.size(), pos, payloadSize) || payloadSize != quint64(data.size() - pos)) {
+        return corrupt();
+    }
+    if (crc32(p + pos, qsizetype(payloadSize)) != crc) {
+        return setError(errorMessage, QString("%1: checksum mismatch").arg(filePath));
+    }
+
+    changeset = qUncompress(reinterpret_cast<const uchar*>(p + pos), qsizetype(payloadSize));
+    if (quint64(changeset.size()) != rawSize) {
+        return corrupt();
+    }
+    createdAt = QDateTime::fromMSecsSinceEpoch(createdMs);
+    return true;
+}
+
+#ifdef WMS_HAVE_SESSIONS
+
+QString ChangesetFile::describe(const QByteArray& changeset)
+{
+    struct Counts { int inserts = 0; int updates = 0; int deletes = 0; };
+    QHash<QString, Counts> counts;
+    QStringList order;
+
+    sqlite3_changeset_iter* it = nullptr;
+    if (sqlite3changeset_start(&it, int(changeset.size()), const_cast<char*>(changeset.constData())) != SQLITE_OK) {
+        return "invalid changeset";
+    }
+    while (sqlite3changeset_next(it) == SQLITE_ROW) {
+        const char* table;
+        int columns, op, indirect;
+        sqlite3changeset_op(it, &table, &columns, &op, &indirect);
+        QString name = QString::fromUtf8(table);
+        if (!counts.contains(name)) {
+            order.append(name);
+        }
+        Counts& c = counts[name];
+        (op == SQLITE_INSERT ? c.inserts : op == SQLITE_UPDATE ? c.updates : c.deletes)++;
+    }
+    sqlite3changeset_finalize(it);
+
+    QStringList lines;
+    for (const QString& name : order) {
+        const Counts& c = counts[name];
+        lines.append(QString("%1: %2 inserted, %3 updated, %4 deleted").arg(name).arg(c.inserts).arg(c.updates).arg(c.deletes));
+    }
+    return lines.isEmpty() ? QString("no changes") : lines.join("\n");
+}
+
+ChangesetRecorder::~ChangesetRecorder()
+{
+    stop();
+}
+
+bool ChangesetRecorder::createSession(QString* errorMessage)
+{
+    if (sqlite3session_create(m_db, "main", &m_session) != SQLITE_OK) {
+        m_session = nullptr;
+        return setError(errorMessage, QString::fromUtf8(sqlite3_errmsg(m_db)));
+    }
+    for (const QString& table : replicatedTables()) {
+        if (sqlite3session_attach(m_session, table.toUtf8().constData()) != SQLITE_OK) {
+            sqlite3session_delete(m_session);
+            m_session = nullptr;
+            return setError(errorMessage, QString("Could not record changes to %1").arg(table));
+        }
+    }
+    return true;
+}
+
+bool ChangesetRecorder::start(sqlite3* db, QString* errorMessage)
+{
+    stop();
+    if (!db) {
+        return setError(errorMessage, "No database connection");
+    }
+    m_db = db;
+    return createSession(errorMessage);
+}
+
+void ChangesetRecorder::stop()
+{
+    if (m_session) {
+        sqlite3session_delete(m_session);
+        m_session = nullptr;
+    }
+    m_db = nullptr;
+}
+
+void ChangesetRecorder::setEnabled(bool enabled)
+{
+    if (m_session) {
+        sqlite3session_enable(m_session, enabled ? 1 : 0);
+    }
+}
+
+bool ChangesetRecorder::take(QByteArray& changeset, QString* errorMessage)
+{
+    changeset.clear();
+    if (!m_session) {
+        return setError(errorMessage, "Not recording");
+    }
+    if (sqlite3session_isempty(m_session)) {
+        return true;
+    }
+
+    int size = 0;
+    void* data = nullptr;
+    int rc = sqlite3session_changeset(m_session, &size, &data);
+    if (rc != SQLITE_OK) {
+        return setError(errorMessage, QString::fromUtf8(sqlite3_errstr(rc)));
+    }
+    changeset = QByteArray(static_cast<const char*>(data), size);
+    sqlite3_free(data);
+
+    // A session cannot be reset, so the next interval gets a new one
+    sqlite3session_delete(m_session);
+    m_session = nullptr;
+    return createSession(errorMessage);
+}
+
+bool ChangesetRecorder::diff(sqlite3* db, const QString& fromSchema, QByteArray& changeset, QString* errorMessage)
+{
+    sqlite3_session* session = nullptr;
+    if (sqlite3session_create(db, "main", &session) != SQLITE_OK) {
+        return setError(errorMessage, QString::fromUtf8(sqlite3_errmsg(db)));
+    }
+
+    QString error;
+    for (const QString& table : replicatedTables()) {
+        QByteArray name = table.toUtf8();
+        char* message = nullptr;
+        if (sqlite3session_attach(session, name.constData()) != SQLITE_OK
+            || sqlite3session_diff(session, fromSchema.toUtf8().constData(), name.constData(), &message) != SQLITE_OK) {
+            error = message ? QString::fromUtf8(message) : QString("Could not compare table %1").arg(table);
+            sqlite3_free(message);
+            break;
+        }
+    }
+
+    if (error.isEmpty()) {
+        int size = 0;
+        void* data = nullptr;
+        int rc = sqlite3session_changeset(session, &size, &data);
+        if (rc == SQLITE_OK) {
+            changeset = QByteArray(static_cast<const char*>(data), size);
+        } else {
+            error = QString::fromUtf8(sqlite3_errstr(rc));
+        }
+        sqlite3_free(data);
+    }
+    sqlite3session_delete(session);
+    return error.isEmpty() || setError(errorMessage, error);
+}
+
+// Incoming item update that collided with a local change
+struct ItemMerge
+{
+    qint64 id = 0;
+    qint64 quantityDelta = 0;
+    QByteArray code;            // empty if unchanged
+    bool descriptionChanged = false;
+    bool descriptionNull = false;
+    QByteArray description;
+    bool priceChanged = false;
+    qint64 price = 0;
+};
+
+struct ApplyContext
+{
+    ChangesetApplyReport* report;
+    std::vector<ItemMerge> merges;
+};
+
+static QByteArray valueText(sqlite3_value* value)
+{
+    return QByteArray(reinterpret_cast<const char*>(sqlite3_value_text(value)), sqlite3_value_bytes(value));
+}
+
+static qint64 primaryKey(sqlite3_changeset_iter* it, int op)
+{
+    sqlite3_value* value = nullptr;
+    if (op == SQLITE_INSERT) {
+        sqlite3changeset_new(it, 0, &value);
+    } else {
+        sqlite3changeset_old(it, 0, &value);
+    }
+    return value ? sqlite3_value_int64(value) : 0;
+}
+
+// Columns that tell rows apart besides their id. Ids are handed out by
+// each node on its own, so an insert that finds its id taken is the same
+// row only if these agree as well.
+static std::vector<int> naturalKey(const QString& table)
+{
+    auto is = [&table](std::string_view name) { return table == QString::fromUtf8(name.data(), int(name.size())); };
+    if (is(ItemsTable::name)) {
+        return {ItemsTable::Code};
+    }
+    if (is(OrdersTable::name)) {
+        return {OrdersTable::Number};
+    }
+    if (is(OrderLinesTable::name)) {
+        return {OrderLinesTable::OrderNumber, OrderLinesTable::ItemId};
+    }
+    return {};
+}
+
+static int filterTable(void*, const char* table)
+{
+    return replicatedTables().contains(QString::fromUtf8(table)) ? 1 : 0;
+}
+
+static int resolveConflict(void* context, int conflict, sqlite3_changeset_iter* it)
+{
+    ApplyContext* ctx = static_cast<ApplyContext*>(context);
+    ChangesetApplyReport& report = *ctx->report;
+
+    // Reported once at the end, with no current change
+    if (conflict == SQLITE_CHANGESET_FOREIGN_KEY) {
+        int violations = 0;
+        sqlite3changeset_fk_conflicts(it, &violations);
+        report.messages.append(QString("Changeset would leave %1 foreign key violation(s)").arg(violations));
+        return SQLITE_CHANGESET_ABORT;
+    }
+
+    const char* table;
+    int columns, op, indirect;
+    sqlite3changeset_op(it, &table, &columns, &op, &indirect);
+    bool isItems = QString::fromUtf8(table) == QString::fromUtf8(ItemsTable::name.data(), int(ItemsTable::name.size()));
+    bool isOrderLines = QString::fromUtf8(table)
+                        == QString::fromUtf8(OrderLinesTable::name.data(), int(OrderLinesTable::name.size()));
+    qint64 id = primaryKey(it, op);
+
+    switch (conflict) {
+    case SQLITE_CHANGESET_DATA:
+        if (isItems && op == SQLITE_UPDATE) {
+            ItemMerge merge;
+            merge.id = id;
+            sqlite3_value* oldValue = nullptr;
+            sqlite3_value* newValue = nullptr;
+            sqlite3changeset_new(it, ItemsTable::Quantity, &newValue);
+            if (newValue) {
+                sqlite3changeset_old(it, ItemsTable::Quantity, &oldValue);
+                merge.quantityDelta = sqlite3_value_int64(newValue) - (oldValue ? sqlite3_value_int64(oldValue) : 0);
+            }
+            newValue = nullptr;
+            sqlite3changeset_new(it, ItemsTable::Code, &newValue);
+            if (newValue) {
+                merge.code = valueText(newValue);
+            }
+            newValue = nullptr;
+            sqlite3changeset_new(it, ItemsTable::Description, &newValue);
+            if (newValue) {
+                merge.descriptionChanged = true;
+                merge.descriptionNull = sqlite3_value_type(newValue) == SQLITE_NULL;
+                merge.description = valueText(newValue);
+            }
+            newValue = nullptr;
+            sqlite3changeset_new(it, ItemsTable::Price, &newValue);
+            if (newValue) {
+                merge.priceChanged = true;
+                merge.price = sqlite3_value_int64(newValue);
+            }
+            ctx->merges.push_back(merge);
+            ++report.merged;
+            return SQLITE_CHANGESET_OMIT;
+        }
+        ++report.replaced;
+        return SQLITE_CHANGESET_REPLACE;
+
+    case SQLITE_CHANGESET_NOTFOUND:
+        ++report.omitted;
+        report.messages.append(QString("%1 %2: deleted locally, change skipped").arg(table).arg(id));
+        return SQLITE_CHANGESET_OMIT;
+
+    case SQLITE_CHANGESET_CONFLICT: {
+        // Skipping a different row under the same id would lose it, and
+        // later changes to it would land on the local row
+        QStringList localKey;
+        QStringList incomingKey;
+        for (int column : naturalKey(QString::fromUtf8(table))) {
+            sqlite3_value* local = nullptr;
+            sqlite3_value* incoming = nullptr;
+            sqlite3changeset_conflict(it, column, &local);
+            sqlite3changeset_new(it, column, &incoming);
+            localKey.append(local ? QString::fromUtf8(valueText(local)) : QString());
+            incomingKey.append(incoming ? QString::fromUtf8(valueText(incoming)) : QString());
+        }
+        if (localKey != incomingKey) {
+            report.messages.append(QString("%1 %2: is %3 here but %4 on the sending node")
+                                       .arg(table)
+                                       .arg(id)
+                                       .arg(localKey.join('/'), incomingKey.join('/')));
+            return SQLITE_CHANGESET_ABORT;
+        }
+        ++report.omitted;
+        return SQLITE_CHANGESET_OMIT;
+    }
+
+    case SQLITE_CHANGESET_CONSTRAINT:
+        if (isOrderLines) {
+            report.messages.append(QString("%1 %2: violates a constraint").arg(table).arg(id));
+            return SQLITE_CHANGESET_ABORT;
+        }
+        ++report.omitted;
+        report.messages.append(QString("%1 %2: violates a constraint, change skipped").arg(table).arg(id));
+        return SQLITE_CHANGESET_OMIT;
+
+    default:
+        return SQLITE_CHANGESET_ABORT;
+    }
+}
+
+static bool applyMerges(sqlite3* db, const std::vector<ItemMerge>& merges, QString* errorMessage)
+{
+    SqliteStatement update(db, "UPDATE items SET quantity = quantity + ?, item_code = COALESCE(?, item_code), "
+                               "item_description = CASE WHEN ? THEN ? ELSE item_description END, "
+                               "price = CASE WHEN ? THEN ? ELSE price END WHERE id = ?");
+    for (const ItemMerge& merge : merges) {
+        update.bind(0, merge.quantityDelta);
+        if (merge.code.isEmpty()) {
+            update.bindNull(1);
+        } else {
+            update.bind(1, std::string_view(merge.code.constData(), size_t(merge.code.size())));
+        }
+        update.bind(2, merge.descriptionChanged ? 1 : 0);
+        if (merge.descriptionNull) {
+            update.bindNull(3);
+        } else {
+            update.bind(3, std::string_view(merge.description.constData(), size_t(merge.description.size())));
+        }
+        update.bind(4, merge.priceChanged ? 1 : 0);
+        update.bind(5, merge.price);
+        update.bind(6, merge.id);
+        if (!update.exec()) {
+            return setError(errorMessage, update.lastError());
+        }
+        update.reset();
+    }
+    return true;
+}
+
+// Last sequence of the node recorded in changeset_applied, 0 if none
+static bool appliedSequence(sqlite3* db, const QString& nodeId, quint64& sequence, QString* errorMessage)
+{
+    SqliteStatement query(db, "SELECT sequence FROM changeset_applied WHERE node_id = ?");
+    query.bind(0, nodeId);
+    sequence = query.step() ? quint64(query.columnInt64(0)) : 0;
+    return !query.hasError() || setError(errorMessage, query.lastError());
+}
+
+static bool setAppliedSequence(sqlite3* db, const QString& nodeId, quint64 sequence, QString* errorMessage)
+{
+    SqliteStatement update(db, "INSERT INTO changeset_applied (node_id, sequence) VALUES (?, ?) "
+                               "ON CONFLICT(node_id) DO UPDATE SET sequence = excluded.sequence");
+    update.bind(0, nodeId);
+    update.bind(1, qint64(sequence));
+    return update.exec() || setError(errorMessage, update.lastError());
+}
+
+bool applyChangeset(sqlite3* db, const ChangesetFile& file, ChangesetApplyReport& report, QString* errorMessage)
+{
+    if (!db) {
+        return setError(errorMessage, "No database connection");
+    }
+    if (sqlite3_exec(db, "SAVEPOINT changeset_apply", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return setError(errorMessage, QString::fromUtf8(sqlite3_errmsg(db)));
+    }
+
+    QString error;
+    int rc = SQLITE_OK;
+    if (file.sequence > 0) {
+        quint64 applied = 0;
+        if (!appliedSequence(db, file.nodeId, applied, &error)) {
+            rc = SQLITE_ERROR;
+        } else if (file.sequence <= applied) {
+            report.alreadyApplied = true;
+            sqlite3_exec(db, "RELEASE changeset_apply", nullptr, nullptr, nullptr);
+            return true;
+        } else if (file.sequence != applied + 1) {
+            error = QString("Changeset %1 of %2 is missing").arg(applied + 1).arg(file.nodeId);
+            rc = SQLITE_ERROR;
+        }
+    }
+
+    // Lets the incoming rows past the triggers that freeze posted orders
+    if (rc == SQLITE_OK
+        && sqlite3_exec(db, "INSERT INTO changeset_applying VALUES (1)", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        error = QString::fromUtf8(sqlite3_errmsg(db));
+        rc = SQLITE_ERROR;
+    }
+
+    ApplyContext context{&report, {}};
+    if (rc == SQLITE_OK) {
+        rc = sqlite3changeset_apply(db, int(file.changeset.size()), const_cast<char*>(file.changeset.constData()),
+                                    filterTable, resolveConflict, &context);
+        if (rc == SQLITE_ABORT && !report.messages.isEmpty()) {
+            // resolveConflict() said why it gave up
+            error = report.messages.last();
+        } else if (rc != SQLITE_OK) {
+            error = QString::fromUtf8(sqlite3_errmsg(db));
+        } else if (!applyMerges(db, context.merges, &error)) {
+            rc = SQLITE_ERROR;
+        }
+    }
+    if (rc == SQLITE_OK
+        && sqlite3_exec(db, "DELETE FROM changeset_applying", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        error = QString::fromUtf8(sqlite3_errmsg(db));
+        rc = SQLITE_ERROR;
+    }
+    if (rc == SQLITE_OK && file.sequence > 0 && !setAppliedSequence(db, file.nodeId, file.sequence, &error)) {
+        rc = SQLITE_ERROR;
+    }
+
+    if (rc != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK TO changeset_apply", nullptr, nullptr, nullptr);
+        sqlite3_exec(db, "RELEASE changeset_apply", nullptr, nullptr, nullptr);
+        return setError(errorMessage, error);
+    }
+    if (sqlite3_exec(db, "RELEASE changeset_apply", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return setError(errorMessage, QString::fromUtf8(sqlite3_errmsg(db)));
+    }
+    return true;
+}
+
+#else
+
+static const char kNoSessions[] = "Changesets need SQLite with the session extension (WMS_CHANGESETS)";
+
+QString ChangesetFile::describe(const QByteArray&)
+{
+    return kNoSessions;
+}
+
+ChangesetRecorder::~ChangesetRecorder() = default;
+
+bool ChangesetRecorder::start(sqlite3*, QString* errorMessage)
+{
+    return setError(errorMessage, kNoSessions);
+}
+
+void ChangesetRecorder::stop()
+{
+}
+
+void ChangesetRecorder::setEnabled(bool)
+{
+}
+
+bool ChangesetRecorder::take(QByteArray& changeset, QString* errorMessage)
+{
+    changeset.clear();
+    return setError(errorMessage, kNoSessions);
+}
+
+bool ChangesetRecorder::createSession(QString* errorMessage)
+{
+    return setError(errorMessage, kNoSessions);
+}
+
+bool ChangesetRecorder::diff(sqlite3*, const QString&, QByteArray&, QString* errorMessage)
+{
+    return setError(errorMessage, kNoSessions);
+}
+
+bool applyChangeset(sqlite3*, const ChangesetFile&, ChangesetApplyReport&, QString* errorMessage)
+{
+    return setError(errorMessage, kNoSessions);
+}
+
+#endif
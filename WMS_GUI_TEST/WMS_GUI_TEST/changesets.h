@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+#include <QStringList>
+
+struct sqlite3;
+struct sqlite3_session;
+
+// Incremental replication between WMS nodes with the SQLite session
+// extension. A node records its changes to the replicated tables, writes
+// them as changeset files and other nodes apply those files; only changed
+// rows travel.
+//
+// Requires SQLite with SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK
+// (CMake option WMS_CHANGESETS); without them every call fails with an
+// error message.
+
+// Tables carried in changesets, parents first. Trigger-maintained tables
+// (stock_movements, order_summary) are not replicated; the triggers rebuild
+// them on the receiving node.
+QStringList replicatedTables();
+
+// Schema of the tables applyChangeset() keeps its state in, created for
+// new databases and by the version 8 migration: changeset_applied holds the last sequence applied
+// per node, changeset_applying has a row only while a changeset is being
+// applied, so triggers that guard local edits can let it through, and the
+// single row of changeset_sent holds the sequence this node wrote last.
+QStringList changesetStateStatements();
+
+// Changeset file: the 8-byte magic "WMSCHG01", then varint-length-prefixed
+// UTF-8 node id, varint sequence number, zigzag varint creation time (ms
+// since the epoch), varint size of the raw changeset, 4-byte little-endian
+// CRC-32 of the compressed payload, varint payload size and the payload
+// (the changeset compressed with qCompress). Sequence 0 marks a standalone
+// changeset (wms_sync diff) that is not part of a node's series.
+struct ChangesetFile
+{
+    QString nodeId;
+    quint64 sequence = 0;
+    QDateTime createdAt;
+    QByteArray changeset;
+
+    bool write(const QString& filePath, QString* errorMessage = nullptr) const;
+    bool read(const QString& filePath, QString* errorMessage = nullptr);
+
+    // One line per table with its insert, update and delete counts
+    static QString describe(const QByteArray& changeset);
+};
+
+// Records the changes made through one connection to the replicated tables
+class ChangesetRecorder
+{
+public:
+    ChangesetRecorder() = default;
+    ~ChangesetRecorder();
+    ChangesetRecorder(const ChangesetRecorder&) = delete;
+    ChangesetRecorder& operator=(const ChangesetRecorder&) = delete;
+
+    bool start(sqlite3* db, QString* errorMessage = nullptr);
+    // Must be called before the connection is closed
+    void stop();
+    bool isRecording() const { return m_session != nullptr; }
+
+    // While disabled (e.g. during applyChangeset()) changes are not recorded
+    void setEnabled(bool enabled);
+
+    // Changes since start() or the previous take(); recording goes on with
+    // an empty session. An empty changeset means nothing changed.
+    bool take(QByteArray& changeset, QString* errorMessage = nullptr);
+
+    // Changeset that turns the replicated tables of the attached schema
+    // fromSchema into those of "main"
+    static bool diff(sqlite3* db, const QString& fromSchema, QByteArray& changeset, QString* errorMessage = nullptr);
+
+private:
+    bool createSession(QString* errorMessage);
+
+    sqlite3* m_db = nullptr;
+    sqlite3_session* m_session = nullptr;
+};
+
+// Outcome of applyChangeset()
+struct ChangesetApplyReport
+{
+    int replaced = 0;     // rows changed on both nodes; the incoming version won
+    int merged = 0;       // item rows changed on both nodes, merged (see below)
+    int omitted = 0;      // changes skipped: row gone, already present, constraint
+    bool alreadyApplied = false;  // the file's sequence had been applied before
+    QStringList messages;
+};
+
+// Applies a changeset inside one transaction. Conflicts are resolved per table:
+//   items        stock is merged: an incoming quantity change is added as a
+//                delta to the local quantity; code, description and price
+//                take the incoming values (item master, last writer wins)
+//   orders,      the incoming row replaces a locally changed one
+//   order_lines
+// Inserts of rows that already exist, changes to rows deleted locally and
+// constraint violations on items and orders are skipped and reported; a
+// constraint violation on order_lines or a foreign key violation aborts the
+// whole changeset, since a skipped line would leave the order different on
+// the two nodes. An insert whose id is taken by a different row (another
+// item code or order number, or a line of another order or item) also
+// aborts: ids are assigned by each node, and the two rows cannot both be
+// kept under one id.
+//
+// The changesets of a node build on each other: one with a sequence number
+// is only applied right after its predecessor, and its sequence is stored
+// in changeset_applied in the same transaction as its changes, so a crash
+// can neither lose nor repeat it. Applying it again does nothing and sets
+// report.alreadyApplied.
+bool applyChangeset(sqlite3* db, const ChangesetFile& file, ChangesetApplyReport& report,
+                    QString* errorMessage = nullptr);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QtGlobal>
+#include <array>
+
+// CRC-32 (IEEE 802.3, as used by zlib and PNG) for checksummed file records.
+// Pass the previous result as crc to checksum data in several pieces.
+inline quint32 crc32(const char* data, qsizetype size, quint32 crc = 0)
+{
+    static constexpr std::array<quint32, 256> table = [] {
+        std::array<quint32, 256> t{};
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (qsizetype i = 0; i < size; ++i) {
+        crc = table[(crc ^ quint8(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
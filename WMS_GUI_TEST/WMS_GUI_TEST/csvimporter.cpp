@@ -0,0 +1,640 @@
+#include "csvimporter.h"
+#include "repositories.h"
+#include "ordervalidator.h"
+#include "metrics.h"
+#include "tracing.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QDebug>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <iterator>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WMS_CSV_SSE2 1
+#endif
+
+namespace {
+
+// Chunks smaller than this are not worth a thread of their own
+constexpr qint64 kMinChunkBytes = 1 << 20;
+
+// Enough for every supported layout; longer records are rejected
+constexpr int kMaxFields = 8;
+
+struct ParsedItem
+{
+    qint64 line;
+    Item item;
+};
+
+// One worker's share of the file. Line numbers are chunk-relative until
+// the chunks are merged.
+struct Chunk
+{
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    bool first = false;
+    qint64 lineCount = 0;
+    qint64 errorCount = 0;
+    std::vector<CsvImportError> errors;
+    std::vector<ParsedItem> items;
+    std::vector<InboundOrderLine> orderLines;
+
+    void reject(qint64 line, const QString& message)
+    {
+        ++errorCount;
+        if (errors.size() < size_t(CsvImporter::kMaxReportedErrors)) {
+            errors.push_back({line, message});
+        }
+    }
+};
+
+// First ',' or '"' in [p, end), or end
+const char* findDelimiter(const char* p, const char* end)
+{
+#ifdef WMS_CSV_SSE2
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, comma), _mm_cmpeq_epi8(block, quote));
+        unsigned mask = unsigned(_mm_movemask_epi8(hits));
+        if (mask != 0) {
+            return p + std::countr_zero(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ',' && *p != '"') {
+        ++p;
+    }
+    return p;
+}
+
+const char* findNewline(const char* p, const char* end)
+{
+    const void* hit = std::memchr(p, '\n', size_t(end - p));
+    return hit ? static_cast<const char*>(hit) : end;
+}
+
+std::string_view trimmed(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+QString toQString(std::string_view text)
+{
+    return QString::fromUtf8(text.data(), qsizetype(text.size()));
+}
+
+// Splits one record (without its line terminator) into fields. Unquoted
+// fields are views into the input; quoted fields are unescaped into scratch.
+// Returns false for malformed quoting or too many fields.
+bool splitFields(const char* p, const char* end, std::vector<std::string_view>& fields,
+                 std::array<std::string, kMaxFields>& scratch)
+{
+    fields.clear();
+    for (;;) {
+        if (fields.size() == size_t(kMaxFields)) {
+            return false;
+        }
+
+        if (p < end && *p == '"') {
+            std::string& out = scratch[fields.size()];
+            out.clear();
+            ++p;
+            for (;;) {
+                const void* hit = std::memchr(p, '"', size_t(end - p));
+                if (!hit) {
+                    return false;
+                }
+                const char* q = static_cast<const char*>(hit);
+                out.append(p, q);
+                p = q + 1;
+                if (p < end && *p == '"') {
+                    out.push_back('"');
+                    ++p;
+                    continue;
+                }
+                break;
+            }
+            fields.push_back(out);
+            if (p == end) {
+                return true;
+            }
+            if (*p != ',') {
+                return false;
+            }
+            ++p;
+            continue;
+        }
+
+        const char* d = findDelimiter(p, end);
+        if (d < end && *d == '"') {
+            return false;
+        }
+        fields.push_back(std::string_view(p, size_t(d - p)));
+        if (d == end) {
+            return true;
+        }
+        p = d + 1;
+    }
+}
+
+bool parseInt(std::string_view text, qint64& value)
+{
+    text = trimmed(text);
+    // from_chars takes a '-' of its own, which would let "+-5" through
+    if (!text.empty() && text.front() == '+') {
+        text.remove_prefix(1);
+        if (!text.empty() && text.front() == '-') {
+            return false;
+        }
+    }
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+// yyyy-MM-dd
+bool parseDate(std::string_view text, QDate& date)
+{
+    text = trimmed(text);
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-') {
+        return false;
+    }
+
+    int year = 0, month = 0, day = 0;
+    auto parsePart = [&](size_t pos, size_t len, int& out) {
+        auto result = std::from_chars(text.data() + pos, text.data() + pos + len, out);
+        return result.ec == std::errc() && result.ptr == text.data() + pos + len;
+    };
+    if (!parsePart(0, 4, year) || !parsePart(5, 2, month) || !parsePart(8, 2, day)) {
+        return false;
+    }
+
+    date = QDate(year, month, day);
+    return date.isValid();
+}
+
+bool isHeader(std::string_view firstField, std::string_view columnName)
+{
+    firstField = trimmed(firstField);
+    return firstField.size() == columnName.size()
+           && std::equal(firstField.begin(), firstField.end(), columnName.begin(),
+                         [](char a, char b) { return (a >= 'A' && a <= 'Z' ? char(a - 'A' + 'a') : a) == b; });
+}
+
+void parseItem(Chunk& chunk, qint64 line, const std::vector<std::string_view>& fields, const KeySnapshot& keys)
+{
+    if (fields.size() != 4) {
+        chunk.reject(line, QString("Expected 4 fields (code,description,quantity,price), found %1").arg(fields.size()));
+        return;
+    }
+
+    std::string_view code = trimmed(fields[0]);
+    if (code.empty()) {
+        chunk.reject(line, "Item code is empty");
+        return;
+    }
+    if (keys.itemIds.find(code) != keys.itemIds.end()) {
+        chunk.reject(line, QString("Item code %1 already exists").arg(toQString(code)));
+        return;
+    }
+
+    qint64 quantity = 0;
+    if (!parseInt(fields[2], quantity) || quantity < 0 || quantity > std::numeric_limits<int>::max()) {
+        chunk.reject(line, QString("Invalid quantity: %1").arg(toQString(fields[2])));
+        return;
+    }
+
+    Money price;
+    if (!Money::parse(fields[3], price) || price < Money()) {
+        chunk.reject(line, QString("Invalid price: %1").arg(toQString(fields[3])));
+        return;
+    }
+
+    ParsedItem parsed;
+    parsed.line = line;
+    parsed.item.code = toQString(code);
+    parsed.item.description = toQString(trimmed(fields[1]));
+    parsed.item.quantity = int(quantity);
+    parsed.item.price = price;
+    chunk.items.push_back(std::move(parsed));
+}
+
+// Syntax checks only; references and quantities are checked by OrderValidator
+void parseOrderLine(Chunk& chunk, qint64 line, const std::vector<std::string_view>& fields)
+{
+    if (fields.size() != 5) {
+        chunk.reject(line, QString("Expected 5 fields (order_number,date,type,item_code,quantity), found %1")
+                               .arg(fields.size()));
+        return;
+    }
+
+    std::string_view number = trimmed(fields[0]);
+    if (number.empty()) {
+        chunk.reject(line, "Order number is empty");
+        return;
+    }
+
+    QDate date;
+    if (!parseDate(fields[1], date)) {
+        chunk.reject(line, QString("Invalid date: %1").arg(toQString(fields[1])));
+        return;
+    }
+
+    std::string_view type = trimmed(fields[2]);
+    if (type != "to" && type != "from") {
+        chunk.reject(line, QString("Invalid order type: %1").arg(toQString(type)));
+        return;
+    }
+
+    qint64 quantity = 0;
+    if (!parseInt(fields[4], quantity)) {
+        chunk.reject(line, QString("Invalid quantity: %1").arg(toQString(fields[4])));
+        return;
+    }
+
+    InboundOrderLine parsed;
+    parsed.line = line;
+    parsed.orderNumber = toQString(number);
+    parsed.date = date;
+    parsed.type = type == "from" ? OrderTypeFrom : OrderTypeTo;
+    parsed.itemCode = std::string(trimmed(fields[3]));
+    parsed.quantity = quantity;
+    chunk.orderLines.push_back(std::move(parsed));
+}
+
+void parseChunk(Chunk& chunk, CsvImporter::Kind kind, const KeySnapshot& keys)
+{
+    std::vector<std::string_view> fields;
+    fields.reserve(kMaxFields);
+    std::array<std::string, kMaxFields> scratch;
+
+    const char* p = chunk.begin;
+    while (p < chunk.end) {
+        const char* newline = findNewline(p, chunk.end);
+        const char* recordEnd = newline;
+        if (recordEnd > p && recordEnd[-1] == '\r') {
+            --recordEnd;
+        }
+        qint64 line = ++chunk.lineCount;
+
+        if (recordEnd > p) {
+            if (!splitFields(p, recordEnd, fields, scratch)) {
+                // Both halves of a field broken by a line break have an odd quote count
+                bool openQuote = std::count(p, recordEnd, '"') % 2 != 0;
+                chunk.reject(line, openQuote ? "Unterminated quoted field (line breaks inside fields are not supported)"
+                                             : "Malformed record (unbalanced quotes or too many fields)");
+            } else if (chunk.first && line == 1
+                       && isHeader(fields[0], kind == CsvImporter::Kind::Items ? "code" : "order_number")) {
+                // header row
+            } else if (kind == CsvImporter::Kind::Items) {
+                parseItem(chunk, line, fields, keys);
+            } else {
+                parseOrderLine(chunk, line, fields);
+            }
+        }
+
+        p = newline + 1;
+    }
+}
+
+// Splits [data, data + size) into up to parts chunks ending on line boundaries
+std::vector<Chunk> splitChunks(const char* data, qint64 size, int parts)
+{
+    std::vector<Chunk> chunks;
+    const char* end = data + size;
+    const char* begin = data;
+
+    for (int i = 1; i <= parts && begin < end; ++i) {
+        const char* chunkEnd = end;
+        if (i < parts) {
+            const char* target = data + size * i / parts;
+            if (target > begin) {
+                chunkEnd = findNewline(target, end);
+                if (chunkEnd < end) {
+                    ++chunkEnd;
+                }
+            } else {
+                continue;
+            }
+        }
+
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.end = chunkEnd;
+        chunk.first = chunks.empty();
+        chunks.push_back(std::move(chunk));
+        begin = chunkEnd;
+    }
+    return chunks;
+}
+
+} // namespace
+
+QString CsvImportReport::summary() const
+{
+    if (!succeeded()) {
+        return fatalError;
+    }
+    if (rejectedWholeFile) {
+        return QString("Rejected %1 of %2 lines in %3 ms; nothing was imported.")
+            .arg(errorCount).arg(linesRead).arg(elapsedMs);
+    }
+    return QString("Imported %1 rows from %2 lines in %3 ms; %4 lines rejected.")
+        .arg(rowsImported).arg(linesRead).arg(elapsedMs).arg(errorCount);
+}
+
+bool CsvImportReport::writeErrors(const QString& filePath) const
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Failed to write import errors:" << file.errorString();
+        return false;
+    }
+
+    file.write("line,message\n");
+    for (const CsvImportError& error : errors) {
+        QString message = error.message;
+        message.replace('"', "\"\"");
+        file.write(QString("%1,\"%2\"\n").arg(error.line).arg(message).toUtf8());
+    }
+    return file.commit();
+}
+
+CsvImporter::CsvImporter(const QSqlDatabase& db) : m_db(db), m_threads(QThread::idealThreadCount())
+{
+}
+
+CsvImportReport CsvImporter::import(Kind kind, const QString& filePath)
+{
+    WMS_TRACE_SCOPE_CAT("CsvImporter::import", "import");
+    const QString kindLabel = QString("kind=\"%1\"").arg(kind == Kind::Items ? "items" : "order_lines");
+
+    CsvImportReport report;
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        report.fatalError = QString("Cannot open %1: %2").arg(filePath, file.errorString());
+        return report;
+    }
+
+    // Map the whole file; fall back to reading it for files that cannot be mapped
+    const qint64 size = file.size();
+    QByteArray buffer;
+    const char* data = nullptr;
+    if (size > 0) {
+        data = reinterpret_cast<const char*>(file.map(0, size));
+        if (!data) {
+            buffer = file.readAll();
+            data = buffer.constData();
+        }
+    }
+
+    // Snapshot of the item codes and order numbers; read concurrently by
+    // the parser and validation threads
+    std::shared_ptr<const KeySnapshot> keys = KeySnapshot::load(m_db);
+
+    int parts = int(qBound<qint64>(1, size / kMinChunkBytes + 1, qMax(1, m_threads)));
+    std::vector<Chunk> chunks = data ? splitChunks(data, size, parts) : std::vector<Chunk>();
+
+    {
+        WMS_TRACE_SCOPE_CAT("CsvImporter::parse", "import");
+        std::vector<QThread*> threads;
+        for (size_t i = 1; i < chunks.size(); ++i) {
+            Chunk* chunk = &chunks[i];
+            threads.push_back(QThread::create([chunk, kind, &keys]() {
+                WMS_TRACE_SCOPE_CAT("CsvImporter::parseChunk", "import");
+                parseChunk(*chunk, kind, *keys);
+            }));
+            threads.back()->start();
+        }
+        if (!chunks.empty()) {
+            parseChunk(chunks.front(), kind, *keys);
+        }
+        for (QThread* thread : threads) {
+            thread->wait();
+            delete thread;
+        }
+    }
+
+    // Turn chunk-relative line numbers into file line numbers
+    qint64 lineOffset = 0;
+    for (Chunk& chunk : chunks) {
+        for (CsvImportError& error : chunk.errors) {
+            error.line += lineOffset;
+        }
+        for (ParsedItem& row : chunk.items) {
+            row.line += lineOffset;
+        }
+        for (InboundOrderLine& row : chunk.orderLines) {
+            row.line += lineOffset;
+        }
+        lineOffset += chunk.lineCount;
+
+        report.errorCount += chunk.errorCount;
+        for (CsvImportError& error : chunk.errors) {
+            if (report.errors.size() < size_t(kMaxReportedErrors)) {
+                report.errors.push_back(std::move(error));
+            }
+        }
+    }
+    report.linesRead = lineOffset;
+
+    auto reject = [&report](qint64 line, const QString& message) {
+        ++report.errorCount;
+        if (report.errors.size() < size_t(kMaxReportedErrors)) {
+            report.errors.push_back({line, message});
+        }
+    };
+
+    // Inbound order files are all-or-nothing: every line is validated up
+    // front, and nothing is written if any line was rejected
+    std::vector<InboundOrderLine> orderLines;
+    if (kind == Kind::OrderLines) {
+        for (Chunk& chunk : chunks) {
+            std::move(chunk.orderLines.begin(), chunk.orderLines.end(), std::back_inserter(orderLines));
+            chunk.orderLines = std::vector<InboundOrderLine>();
+        }
+
+        OrderValidator validator(keys);
+        validator.setThreadCount(m_threads);
+        if (!validator.validate(orderLines, report) || report.errorCount > 0) {
+            report.rejectedWholeFile = true;
+            orderLines.clear();
+        }
+    }
+
+    {
+        WMS_TRACE_SCOPE_CAT("CsvImporter::insert", "import");
+
+        if (kind == Kind::Items) {
+            ItemRepository repository(m_db);
+            QSet<QString> seen;
+            std::vector<Item> batch;
+            std::vector<qint64> batchLines;
+            batch.reserve(kBatchSize);
+
+            auto flush = [&]() {
+                if (batch.empty()) {
+                    return;
+                }
+                if (repository.insertMany(batch)) {
+                    report.rowsImported += qint64(batch.size());
+                } else {
+                    for (qint64 line : batchLines) {
+                        reject(line, QString("Batch rejected by the database: %1").arg(repository.lastError()));
+                    }
+                }
+                batch.clear();
+                batchLines.clear();
+            };
+
+            for (Chunk& chunk : chunks) {
+                for (ParsedItem& row : chunk.items) {
+                    if (seen.contains(row.item.code)) {
+                        reject(row.line, QString("Duplicate item code %1 in file").arg(row.item.code));
+                        continue;
+                    }
+                    seen.insert(row.item.code);
+                    batch.push_back(std::move(row.item));
+                    batchLines.push_back(row.line);
+                    if (batch.size() == size_t(kBatchSize)) {
+                        flush();
+                    }
+                }
+            }
+            flush();
+        } else {
+            OrderRepository orderRepository(m_db);
+            OrderLineRepository lineRepository(m_db);
+
+            // Every order in the file is new; validation rejected existing numbers
+            QHash<QString, int> orderIds;
+            std::vector<Order> newOrders;
+            std::vector<OrderLine> batch;
+            std::vector<qint64> batchLines;
+            batch.reserve(kBatchSize);
+
+            // The whole file goes into one transaction, so a database error
+            // part way through leaves none of its orders behind
+            bool ok = orderLines.empty() || m_db.transaction();
+            if (!ok) {
+                report.fatalError = QString("Cannot begin the import: %1").arg(m_db.lastError().text());
+            }
+            qint64 inserted = 0;
+
+            auto flush = [&]() {
+                if (!ok || batch.empty()) {
+                    return;
+                }
+
+                QString error;
+                if (!newOrders.empty()) {
+                    ok = orderRepository.insertMany(newOrders);
+                    error = orderRepository.lastError();
+                    for (const Order& order : newOrders) {
+                        orderIds.insert(order.number, order.id);
+                    }
+                }
+                for (OrderLine& line : batch) {
+                    if (!ok) {
+                        break;
+                    }
+                    line.orderId = orderIds.value(line.orderNumber);
+                    if (line.orderId <= 0) {
+                        ok = false;
+                        error = QString("Order %1 was not created").arg(line.orderNumber);
+                    }
+                }
+                if (ok) {
+                    ok = lineRepository.insertMany(batch);
+                    error = lineRepository.lastError();
+                }
+
+                if (ok) {
+                    inserted += qint64(batch.size());
+                } else {
+                    for (qint64 line : batchLines) {
+                        reject(line, QString("Batch rejected by the database: %1").arg(error));
+                    }
+                }
+
+                newOrders.clear();
+                batch.clear();
+                batchLines.clear();
+            };
+
+            QSet<QString> seenOrders;
+            for (const InboundOrderLine& row : orderLines) {
+                if (!seenOrders.contains(row.orderNumber)) {
+                    seenOrders.insert(row.orderNumber);
+                    Order order;
+                    order.number = row.orderNumber;
+                    order.date = row.date;
+                    order.type = row.type;
+                    newOrders.push_back(order);
+                }
+
+                OrderLine line;
+                line.orderNumber = row.orderNumber;
+                line.itemId = row.itemId;
+                line.quantity = int(row.quantity);
+                batch.push_back(std::move(line));
+                batchLines.push_back(row.line);
+                if (batch.size() == size_t(kBatchSize)) {
+                    flush();
+                    if (!ok) {
+                        break;
+                    }
+                }
+            }
+            flush();
+
+            if (ok && !orderLines.empty() && !m_db.commit()) {
+                ok = false;
+                report.fatalError = QString("Cannot commit the import: %1").arg(m_db.lastError().text());
+            }
+            if (ok) {
+                report.rowsImported += inserted;
+            } else if (!orderLines.empty()) {
+                m_db.rollback();
+                report.rejectedWholeFile = true;
+            }
+        }
+    }
+
+    std::sort(report.errors.begin(), report.errors.end(),
+              [](const CsvImportError& a, const CsvImportError& b) { return a.line < b.line; });
+    report.elapsedMs = timer.elapsed();
+
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    metrics.counter("wms_import_rows_total", "Rows imported from CSV files", kindLabel)->inc(quint64(report.rowsImported));
+    metrics.counter("wms_import_rejected_rows_total", "CSV lines rejected during import", kindLabel)->inc(quint64(report.errorCount));
+    metrics.histogram("wms_import_duration_seconds", "Duration of CSV imports", kindLabel)->record(quint64(report.elapsedMs) * 1000);
+
+    qDebug() << "CSV import of" << filePath << "finished:" << report.summary();
+    return report;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QSqlDatabase>
+#include <QString>
+#include <vector>
+
+// One rejected input line
+struct CsvImportError
+{
+    qint64 line = 0;
+    QString message;
+};
+
+struct CsvImportReport
+{
+    qint64 linesRead = 0;
+    qint64 rowsImported = 0;
+    qint64 errorCount = 0;
+    qint64 elapsedMs = 0;
+
+    // Up to kMaxReportedErrors of the rejected lines, sorted by line number
+    std::vector<CsvImportError> errors;
+
+    // Set when validation failed and the file was not imported at all
+    bool rejectedWholeFile = false;
+
+    // Set when the import could not run at all (unreadable file, database error)
+    QString fatalError;
+
+    bool succeeded() const { return fatalError.isEmpty(); }
+    QString summary() const;
+
+    // Writes the rejected lines as "line,message" CSV
+    bool writeErrors(const QString& filePath) const;
+};
+
+// Bulk import of supplier catalogues and ASN files.
+//
+// The file is memory-mapped and split at line boundaries into one chunk per
+// worker thread. Chunks are parsed in parallel (delimiters are located 16
+// bytes at a time with SSE2 where available) and validated against an
+// immutable snapshot of the item codes taken before parsing starts. The
+// accepted rows are then inserted on the calling thread in batches of
+// kBatchSize through the repositories' native insertMany() path.
+//
+// Records are one per line; fields are separated by commas and may be
+// enclosed in double quotes ("" inside quotes is a literal quote). Unlike
+// RFC 4180, a quoted field cannot contain a line break: chunks are split at
+// any newline, so such a record is rejected as an unterminated field, with
+// the line that follows it. A first line whose first field is the expected
+// column name is treated as a header.
+//
+//   Items:       code,description,quantity,price
+//   Order lines: order_number,date,type,item_code,quantity
+//
+// Items files are imported partially: valid rows are inserted, one
+// transaction per batch, and the bad ones reported. Inbound order files are
+// all-or-nothing: after parsing, every line goes through OrderValidator
+// (ordervalidator.h), the file is only written if no line was rejected, and
+// all of its batches share one transaction, so a database error in any of
+// them leaves nothing behind. Each order number in the file creates a new
+// order with the date (yyyy-MM-dd) and type ("to" or "from") of its lines.
+class CsvImporter
+{
+public:
+    enum class Kind { Items, OrderLines };
+
+    static constexpr int kBatchSize = 10000;
+    static constexpr int kMaxReportedErrors = 1000;
+
+    explicit CsvImporter(const QSqlDatabase& db = QSqlDatabase::database());
+
+    // Number of parser threads; defaults to QThread::idealThreadCount()
+    void setThreadCount(int threads) { m_threads = threads; }
+
+    CsvImportReport import(Kind kind, const QString& filePath);
+    CsvImportReport importItems(const QString& filePath) { return import(Kind::Items, filePath); }
+    CsvImportReport importOrderLines(const QString& filePath) { return import(Kind::OrderLines, filePath); }
+
+private:
+    QSqlDatabase m_db;
+    int m_threads;
+};
@@ -1,25 +1,97 @@
 #include "databasemanager.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "queryrecorder.h"
+#include "repositories.h"
+#include "sqlitestatement.h"
+#include "sqlitebackup.h"
+#include "maintenancescheduler.h"
+#include "tuningprofile.h"
+#include "changesets.h"
+#include "changecapture.h"
+#include "remotesqldriver.h"
 
 #include <QStandardPaths>
 #include <QDir>
 #include <QDateTime>
+#include <QSettings>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSet>
+#include <QSysInfo>
 
-DatabaseManager::DatabaseManager(QObject* parent) : QObject(parent)
+static MetricHistogram* operationLatency(const char* op)
 {
-    m_db = QSqlDatabase::addDatabase("QSQLITE");
-    QString dbPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
-    QDir dir(dbPath);
+    return MetricsRegistry::instance().histogram("wms_db_operation_duration_seconds",
+                                                 "Latency of DatabaseManager operations",
+                                                 QString("op=\"%1\"").arg(op));
+}
+
+static void countOperationError(const char* op)
+{
+    MetricsRegistry::instance().counter("wms_db_operation_errors_total",
+                                        "Failed DatabaseManager operations",
+                                        QString("op=\"%1\"").arg(op))->inc();
+}
+
+// Bumped whenever the on-disk schema changes; see migrateSchema()
+static const int kSchemaVersion = 8;
+
+// Times the enclosing DatabaseManager operation and records it as a trace span
+#define WMS_DB_OPERATION(op) \
+    static MetricHistogram* const opLatency_ = operationLatency(op); \
+    ScopedMetricsTimer opTimer_(opLatency_); \
+    WMS_TRACE_SCOPE_CAT("DatabaseManager::" op, "sql")
+
+// Set by useLocalDatabase() before the first instance() call
+static bool s_forceLocal = false;
+
+static QString replicaConnectionName(int index)
+{
+    return index == 0 ? "wms_replica_a" : "wms_replica_b";
+}
+
+DatabaseManager::DatabaseManager(QObject* parent)
+    : QObject(parent), m_itemMasterAttached(false), m_recorder(nullptr), m_archiveAttached(false),
+      m_replicaJob(nullptr), m_maintenance(nullptr),
+      m_changesets(new ChangesetRecorder()), m_changeCapture(nullptr), m_replicaIndex(-1), m_remote(false),
+      m_databaseGeneration(0)
+{
+    connect(&m_snapshotTimer, &QTimer::timeout, this, &DatabaseManager::takeStockSnapshots);
+    connect(&m_replicaTimer, &QTimer::timeout, this, &DatabaseManager::refreshReplica);
+
+    connect(&m_itemSyncTimer, &QTimer::timeout, this, [this]() { syncItemMaster(); });
+    connect(&m_syncTimer, &QTimer::timeout, this, &DatabaseManager::exchangeChangesets);
+
+    if (!s_forceLocal) {
+        m_server = QSettings().value("database/server").toString().trimmed();
+    }
+    m_remote = !m_server.isEmpty();
+    m_db = m_remote ? addServerConnection(QSqlDatabase::defaultConnection) : QSqlDatabase::addDatabase("QSQLITE");
+    m_dataDirectory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir dir(m_dataDirectory);
     if (!dir.exists()) {
         dir.mkpath(".");
     }
-    m_db.setDatabaseName(dbPath + "/wms.db");
+
+    m_site = QSettings().value("sites/current", defaultSite()).toString();
+    if (!isValidSiteCode(m_site)) {
+        qDebug() << "Invalid site" << m_site << "- using" << defaultSite();
+        m_site = defaultSite();
+    }
+    if (!m_remote) {
+        m_db.setDatabaseName(sitePath(m_site));
+    }
+
+    m_maintenance = new MaintenanceScheduler(m_db, this);
+    m_changeCapture = new ChangeCapture(m_db, this);
 }
 
 DatabaseManager::~DatabaseManager()
 {
-    if (m_db.isOpen()) {
-        m_db.close();
-    }
+    // Also stops the replica backup, which reads from m_db
+    closeDatabase();
+    delete m_changesets;
 }
 
 DatabaseManager& DatabaseManager::instance()
@@ -28,6 +100,25 @@ DatabaseManager& DatabaseManager::instance()
     return instance;
 }
 
+void DatabaseManager::useLocalDatabase()
+{
+    s_forceLocal = true;
+}
+
+QSqlDatabase DatabaseManager::addServerConnection(const QString& connectionName) const
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase(new RemoteSqlDriver(), connectionName);
+    qsizetype colon = m_server.lastIndexOf(':');
+    if (colon > 0) {
+        db.setHostName(m_server.left(colon));
+        db.setPort(m_server.mid(colon + 1).toInt());
+    } else {
+        db.setDatabaseName(m_server);
+    }
+    db.setPassword(QSettings().value("database/serverToken").toString());
+    return db;
+}
+
 bool DatabaseManager::initializeDatabase()
 {
     if (!m_db.open()) {
@@ -35,29 +126,240 @@ bool DatabaseManager::initializeDatabase()
         return false;
     }
 
+    // Everything else is done by the daemon on its own connection
+    if (m_remote) {
+        m_site = static_cast<const RemoteSqlDriver*>(m_db.driver())->serverSite();
+        qDebug() << "Connected to wmsd at" << m_server << "- site" << m_site;
+        return true;
+    }
+
     QSqlQuery query;
     query.exec("PRAGMA foreign_keys = ON");
 
     QFile dbFile(m_db.databaseName());
     bool dbExists = dbFile.exists() && dbFile.size() > 0;
 
+    QSettings settings;
+    const TuningProfile* profile = TuningProfile::find(settings.value("database/tuningProfile", "balanced").toString());
+
     if (!dbExists) {
         qDebug() << "Creating new database...";
+        // Only possible before the first table exists; lets the maintenance
+        // scheduler return deleted pages to the file system in small slices
+        query.exec("PRAGMA auto_vacuum = INCREMENTAL");
+        if (profile) {
+            query.exec(QString("PRAGMA page_size = %1").arg(profile->pageSize));
+        }
+
         if (!createTables()) {
             qDebug() << "Failed to create tables";
             return false;
         }
 
-        if (!populateSampleData()) {
+        // Sample data only for the first site; later ones share its users
+        // and get their items from the item master
+        if (m_site == defaultSite() ? !populateSampleData() : !seedSiteFromMain()) {
             qDebug() << "Failed to populate sample data";
             return false;
         }
 
+        query.exec(QString("PRAGMA user_version = %1").arg(kSchemaVersion));
         qDebug() << "Database initialized successfully";
     } else {
         qDebug() << "Database already exists";
+        if (!migrateSchema()) {
+            qDebug() << "Failed to migrate database schema";
+            return false;
+        }
+    }
+
+    setNativeBackendEnabled(settings.value("database/nativeBackend", true).toBool());
+
+    // In WAL mode readers (replica refreshes, reports) and the writer do not
+    // block each other, and checkpoints can run without a write lock
+    query.exec(QString("PRAGMA journal_mode = %1").arg(settings.value("database/journalMode", "WAL").toString()));
+
+    if (profile) {
+        applyTuningProfile(profile->name);
+    } else {
+        qDebug() << "Unknown tuning profile" << settings.value("database/tuningProfile").toString()
+                 << "- keeping SQLite defaults";
+    }
+
+    // Archived orders stay queryable as archive.orders / archive.order_lines
+    attachArchive(settings.value("archive/databasePath", defaultArchivePath()).toString());
+
+    if (sites().size() > 1
+        && attachItemMaster(settings.value("sites/itemMasterPath", m_dataDirectory + "/wms_items.db").toString())) {
+        int syncInterval = settings.value("sites/itemSyncIntervalMs", 60000).toInt();
+        if (syncInterval > 0) {
+            m_itemSyncTimer.start(syncInterval);
+        }
+    }
+
+    // Periodic ledger checkpoints keep the tail read by stockAsOf() short
+    int snapshotInterval = settings.value("ledger/snapshotIntervalMs", 3600000).toInt();
+    if (snapshotInterval > 0) {
+        m_snapshotTimer.start(snapshotInterval);
+    }
+
+    if (settings.value("replica/enabled", true).toBool() && nativeHandle()) {
+        m_replicaTimer.start(settings.value("replica/refreshIntervalMs", 300000).toInt());
+        refreshReplica();
+    }
+
+    if (settings.value("sync/enabled", false).toBool()) {
+        QString error;
+        if (m_changesets->start(nativeHandle(), &error)) {
+            m_syncTimer.start(settings.value("sync/intervalMs", 60000).toInt());
+        } else {
+            qDebug() << "Failed to start change recording:" << error;
+        }
+    }
+
+    if (settings.value("cdc/enabled", false).toBool()) {
+        QString error;
+        if (!m_changeCapture->start(settings.value("cdc/directory", defaultChangeLogDirectory()).toString(), &error)) {
+            qDebug() << "Failed to start change capture:" << error;
+        }
+    } else {
+        QString error;
+        if (!ChangeCapture::uninstall(m_db, &error)) {
+            qDebug() << "Failed to remove change capture:" << error;
+        }
+    }
+
+    if (settings.value("maintenance/enabled", true).toBool()) {
+        m_maintenance->start();
+    }
+
+    if (settings.value("recorder/enabled", false).toBool()) {
+        QString fileName = QString("workload-%1.wlog").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+        QString defaultPath = QFileInfo(m_db.databaseName()).absolutePath() + "/" + fileName;
+        startRecording(settings.value("recorder/file", defaultPath).toString());
+    }
+
+    return true;
+}
+
+bool DatabaseManager::applyTuningProfile(const QString& name, QString* errorMessage)
+{
+    WMS_DB_OPERATION("applyTuningProfile");
+
+    const TuningProfile* profile = TuningProfile::find(name);
+    if (!profile) {
+        qDebug() << "Unknown tuning profile" << name;
+        countOperationError("applyTuningProfile");
+        if (errorMessage) {
+            *errorMessage = QString("Unknown tuning profile %1").arg(name);
+        }
+        return false;
+    }
+
+    if (!profile->apply(m_db, errorMessage)) {
+        countOperationError("applyTuningProfile");
+        return false;
+    }
+    if (m_replicaIndex >= 0) {
+        profile->apply(replicaDatabase());
+    }
+
+    m_tuningProfile = profile->name;
+    qDebug() << "Applied tuning profile" << m_tuningProfile;
+    return true;
+}
+
+int DatabaseManager::schemaVersion()
+{
+    return kSchemaVersion;
+}
+
+void DatabaseManager::closeDatabase()
+{
+    emit databaseClosing();
+
+    // Changes not yet written would be lost with the session
+    if (m_changesets->isRecording()) {
+        writeChangeset();
+        m_changesets->stop();
+    }
+    m_syncTimer.stop();
+    // Moves what is left in the outbox to the change log
+    m_changeCapture->stop();
+
+    stopRecording();
+    m_maintenance->stop();
+    m_snapshotTimer.stop();
+    m_itemSyncTimer.stop();
+    m_replicaTimer.stop();
+    delete m_replicaJob;
+    m_replicaJob = nullptr;
+    for (int index = 0; index < 2; ++index) {
+        if (QSqlDatabase::contains(replicaConnectionName(index))) {
+            QSqlDatabase::database(replicaConnectionName(index), false).close();
+        }
+    }
+    m_replicaIndex = -1;
+    m_replicaRefreshedAt = QDateTime();
+    m_db.close();
+
+    // Attachments and TEMP triggers end with the connection
+    m_archiveAttached = false;
+    m_itemMasterAttached = false;
+}
+
+bool DatabaseManager::replaceDatabaseFile(const QString& filePath, QString* errorMessage)
+{
+    WMS_DB_OPERATION("replaceDatabaseFile");
+
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to replace database file:" << message;
+        countOperationError("replaceDatabaseFile");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    if (m_remote) {
+        return fail("The database belongs to wmsd");
+    }
+
+    // Nothing may hold the file open while it is renamed
+    closeDatabase();
+
+    // Journal files belong to the file they were written for and move with it
+    QString dbPath = m_db.databaseName();
+    QString oldPath = dbPath + ".old";
+    const QStringList suffixes = {QString(), "-journal", "-wal", "-shm"};
+    auto moveFiles = [&suffixes](const QString& from, const QString& to) {
+        bool ok = true;
+        for (const QString& suffix : suffixes) {
+            if (QFile::exists(from + suffix)) {
+                QFile::remove(to + suffix);
+                ok = QFile::rename(from + suffix, to + suffix) && ok;
+            }
+        }
+        return ok;
+    };
+
+    if (!moveFiles(dbPath, oldPath)) {
+        moveFiles(oldPath, dbPath);
+        initializeDatabase();
+        return fail(QString("Could not move %1 aside").arg(dbPath));
+    }
+
+    if (!QFile::rename(filePath, dbPath) || !initializeDatabase()) {
+        m_db.close();
+        QFile::remove(dbPath);
+        moveFiles(oldPath, dbPath);
+        initializeDatabase();
+        return fail(QString("Could not open %1 as the database").arg(filePath));
     }
 
+    // Readers on other threads still have the old file open under its new name
+    ++m_databaseGeneration;
+    qDebug() << "Database replaced with" << filePath << "- previous file kept as" << oldPath;
     return true;
 }
 
@@ -68,57 +370,457 @@ QString DatabaseManager::hashPassword(const QString& password)
     return QString(hash.toHex());
 }
 
+// Readable view of orders for the SQL console
+static const char* const kOrdersViewSql =
+    "CREATE VIEW IF NOT EXISTS v_orders AS "
+    "SELECT id, order_number, date(date - 0.5) AS date, "
+    "CASE type WHEN 0 THEN 'to' ELSE 'from' END AS type, "
+    "CASE status WHEN 0 THEN 'open' ELSE 'posted' END AS status FROM orders";
+
+// Indexes used by posting, and triggers that freeze posted orders: their
+// header can no longer change (including un-posting), and lines can no
+// longer be added, edited or removed, since both are already reflected in
+// stock. Since version 8 the triggers let changesets from other nodes
+// (changesets.h) pass: they carry the posted order as it is on the sending
+// node, lines included. Migrations before version 8 create the triggers
+// as they were then, without that exception.
+static QStringList orderPostingStatements(bool passChangesets)
+{
+    auto when = [passChangesets](const QString& condition) {
+        return passChangesets ? "WHEN NOT EXISTS (SELECT 1 FROM changeset_applying) AND (" + condition + ") "
+                              : "WHEN " + condition + " ";
+    };
+    return {"CREATE INDEX IF NOT EXISTS idx_order_lines_order ON order_lines(order_id)",
+            "CREATE INDEX IF NOT EXISTS idx_orders_open_date ON orders(date) WHERE status = 0",
+            "CREATE TRIGGER IF NOT EXISTS trg_orders_posted_update BEFORE UPDATE ON orders "
+            + when("OLD.status = 1 AND (NEW.status <> 1 OR NEW.order_number IS NOT OLD.order_number "
+                   "OR NEW.date IS NOT OLD.date OR NEW.type IS NOT OLD.type)")
+            + "BEGIN SELECT RAISE(ABORT, 'posted orders cannot be changed'); END",
+            "CREATE TRIGGER IF NOT EXISTS trg_order_lines_posted_insert BEFORE INSERT ON order_lines "
+            + when("(SELECT status FROM orders WHERE id = NEW.order_id) = 1")
+            + "BEGIN SELECT RAISE(ABORT, 'posted orders cannot be changed'); END",
+            "CREATE TRIGGER IF NOT EXISTS trg_order_lines_posted_update BEFORE UPDATE ON order_lines "
+            + when("(SELECT status FROM orders WHERE id = OLD.order_id) = 1 "
+                   "OR (SELECT status FROM orders WHERE id = NEW.order_id) = 1")
+            + "BEGIN SELECT RAISE(ABORT, 'posted orders cannot be changed'); END",
+            // Deleting the posted order itself (archiving) still works: its
+            // lines are cascaded after the order row is gone, so the lookup
+            // finds no status
+            "CREATE TRIGGER IF NOT EXISTS trg_order_lines_posted_delete BEFORE DELETE ON order_lines "
+            + when("(SELECT status FROM orders WHERE id = OLD.order_id) = 1")
+            + "BEGIN SELECT RAISE(ABORT, 'posted orders cannot be changed'); END"};
+}
+
+// Ledger tables and the triggers that feed them. Every change of
+// items.quantity, whatever its source (posting, the items window, the SQL
+// console), appends a movement; movements can never be updated or deleted.
+static QStringList stockLedgerStatements()
+{
+    return {sqlString(createTableSql<StockMovementsTable>()),
+            sqlString(createTableSql<StockSnapshotsTable>()),
+            "CREATE INDEX IF NOT EXISTS idx_stock_movements_item ON stock_movements(item_id)",
+            "CREATE INDEX IF NOT EXISTS idx_stock_movements_item_time ON stock_movements(item_id, moved_at)",
+            "CREATE INDEX IF NOT EXISTS idx_stock_snapshots_item_time ON stock_snapshots(item_id, taken_at)",
+            "CREATE TRIGGER IF NOT EXISTS trg_items_insert_ledger AFTER INSERT ON items "
+            "WHEN COALESCE(NEW.quantity, 0) <> 0 "
+            "BEGIN INSERT INTO stock_movements (item_id, moved_at, delta) "
+            "VALUES (NEW.id, CAST(strftime('%s', 'now') AS INTEGER), NEW.quantity); END",
+            "CREATE TRIGGER IF NOT EXISTS trg_items_quantity_ledger AFTER UPDATE OF quantity ON items "
+            "WHEN COALESCE(NEW.quantity, 0) <> COALESCE(OLD.quantity, 0) "
+            "BEGIN INSERT INTO stock_movements (item_id, moved_at, delta) "
+            "VALUES (NEW.id, CAST(strftime('%s', 'now') AS INTEGER), "
+            "COALESCE(NEW.quantity, 0) - COALESCE(OLD.quantity, 0)); END",
+            "CREATE TRIGGER IF NOT EXISTS trg_stock_movements_no_update BEFORE UPDATE ON stock_movements "
+            "BEGIN SELECT RAISE(ABORT, 'stock_movements is append-only'); END",
+            "CREATE TRIGGER IF NOT EXISTS trg_stock_movements_no_delete BEFORE DELETE ON stock_movements "
+            "BEGIN SELECT RAISE(ABORT, 'stock_movements is append-only'); END"};
+}
+
+// order_summary and the triggers that keep it in step with orders,
+// order_lines and item prices. Each trigger touches only the affected
+// summary rows, so reading the aggregates costs one lookup per order.
+static QStringList orderSummaryStatements()
+{
+    // Units and value contributed by one line
+    const QString add = "UPDATE order_summary SET line_count = line_count + 1, "
+                        "total_units = total_units + NEW.quantity, "
+                        "total_value = total_value + NEW.quantity * "
+                        "(SELECT COALESCE(price, 0) FROM items WHERE id = NEW.item_id) "
+                        "WHERE order_id = NEW.order_id;";
+    const QString remove = "UPDATE order_summary SET line_count = line_count - 1, "
+                           "total_units = total_units - OLD.quantity, "
+                           "total_value = total_value - OLD.quantity * "
+                           "(SELECT COALESCE(price, 0) FROM items WHERE id = OLD.item_id) "
+                           "WHERE order_id = OLD.order_id;";
+
+    return {sqlString(createTableSql<OrderSummaryTable>()),
+            "CREATE INDEX IF NOT EXISTS idx_order_lines_item ON order_lines(item_id)",
+            "CREATE TRIGGER IF NOT EXISTS trg_orders_summary_insert AFTER INSERT ON orders "
+            "BEGIN INSERT INTO order_summary (order_id) VALUES (NEW.id); END",
+            "CREATE TRIGGER IF NOT EXISTS trg_order_lines_summary_insert AFTER INSERT ON order_lines "
+            "BEGIN " + add + " END",
+            "CREATE TRIGGER IF NOT EXISTS trg_order_lines_summary_delete AFTER DELETE ON order_lines "
+            "BEGIN " + remove + " END",
+            "CREATE TRIGGER IF NOT EXISTS trg_order_lines_summary_update "
+            "AFTER UPDATE OF order_id, item_id, quantity ON order_lines "
+            "BEGIN " + remove + " " + add + " END",
+            "CREATE TRIGGER IF NOT EXISTS trg_items_price_summary AFTER UPDATE OF price ON items "
+            "WHEN COALESCE(NEW.price, 0) <> COALESCE(OLD.price, 0) "
+            "BEGIN UPDATE order_summary SET total_value = total_value + "
+            "(COALESCE(NEW.price, 0) - COALESCE(OLD.price, 0)) * "
+            "(SELECT SUM(quantity) FROM order_lines WHERE item_id = NEW.id AND order_id = order_summary.order_id) "
+            "WHERE order_id IN (SELECT order_id FROM order_lines WHERE item_id = NEW.id); END"};
+}
+
+// The order_number foreign key cascades deletes from orders; without an
+// index on the child column every deleted order scans all of order_lines
+static QStringList orderArchivingStatements()
+{
+    return {"CREATE INDEX IF NOT EXISTS idx_order_lines_order_number ON order_lines(order_number)",
+            "CREATE INDEX IF NOT EXISTS idx_orders_posted_date ON orders(date) WHERE status = 1"};
+}
+
+// Archive copy of a table: same columns and types, keyed by the first
+// column, but no other constraints. The tables foreign keys refer to are not
+// in the archive, and order numbers may be reused once an order is archived.
+template <typename Table>
+static QString archiveTableSql()
+{
+    QStringList columns;
+    for (const SqlColumn& column : Table::columns) {
+        std::string_view type = column.definition.substr(0, column.definition.find(' '));
+        columns << sqlString(column.name) + " " + sqlString(type) + (columns.isEmpty() ? " PRIMARY KEY" : "");
+    }
+    return QString("CREATE TABLE IF NOT EXISTS archive.%1 (%2)").arg(sqlString(Table::name), columns.join(", "));
+}
+
 bool DatabaseManager::createTables()
+{
+    // Table definitions live in schema.h
+    return runStatements(QStringList{sqlString(createTableSql<UsersTable>()),
+                                     sqlString(createTableSql<ItemsTable>()),
+                                     sqlString(createTableSql<OrdersTable>()),
+                                     sqlString(createTableSql<OrderLinesTable>()),
+                                     // Date indexes partitioned by direction
+                                     "CREATE INDEX IF NOT EXISTS idx_orders_to_date ON orders(date) WHERE type = 0",
+                                     "CREATE INDEX IF NOT EXISTS idx_orders_from_date ON orders(date) WHERE type = 1",
+                                     kOrdersViewSql}
+                         + changesetStateStatements()
+                         + orderPostingStatements(true)
+                         + stockLedgerStatements()
+                         + orderSummaryStatements()
+                         + orderArchivingStatements());
+}
+
+bool DatabaseManager::runStatements(const QStringList& statements)
+{
+    QSqlQuery query;
+    for (const QString& statement : statements) {
+        if (!query.exec(statement)) {
+            qDebug() << "Failed to execute" << statement << ":" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DatabaseManager::migrateSchema()
 {
     QSqlQuery query;
+    if (!query.exec("PRAGMA user_version") || !query.next()) {
+        qDebug() << "Failed to read schema version:" << query.lastError().text();
+        return false;
+    }
+
+    int version = query.value(0).toInt();
+    if (version > kSchemaVersion) {
+        qDebug() << "Database schema version" << version << "is newer than supported version" << kSchemaVersion;
+        return false;
+    }
+
+    if (version < 1 && !migrateToVersion1()) {
+        return false;
+    }
+
+    if (version < 2 && !migrateToVersion2()) {
+        return false;
+    }
+
+    if (version < 3 && !migrateToVersion3()) {
+        return false;
+    }
+
+    if (version < 4 && !migrateToVersion4()) {
+        return false;
+    }
 
-    // Users table
-    if (!query.exec("CREATE TABLE IF NOT EXISTS users ("
-                    "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                    "login TEXT UNIQUE NOT NULL, "
-                    "password TEXT NOT NULL)")) {
-        qDebug() << "Failed to create users table:" << query.lastError().text();
+    if (version < 5 && !migrateToVersion5()) {
         return false;
     }
 
-    // Items table
-    if (!query.exec("CREATE TABLE IF NOT EXISTS items ("
-                    "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                    "item_code TEXT UNIQUE NOT NULL, "
-                    "item_description TEXT, "
-                    "quantity INTEGER DEFAULT 0, "
-                    "price REAL DEFAULT 0)")) {
-        qDebug() << "Failed to create items table:" << query.lastError().text();
+    if (version < 6 && !migrateToVersion6()) {
         return false;
     }
 
-    // Orders table
-    if (!query.exec("CREATE TABLE IF NOT EXISTS orders ("
-                    "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                    "order_number TEXT UNIQUE NOT NULL, "
-                    "date TEXT NOT NULL, "
-                    "type TEXT NOT NULL)")) {
-        qDebug() << "Failed to create orders table:" << query.lastError().text();
+    if (version < 7 && !migrateToVersion7()) {
         return false;
     }
 
-    // Order Lines table
-    if (!query.exec("CREATE TABLE IF NOT EXISTS order_lines ("
-                    "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                    "order_id INTEGER NOT NULL, "
-                    "order_number TEXT NOT NULL, "
-                    "item_id INTEGER NOT NULL, "
-                    "quantity INTEGER NOT NULL, "
-                    "FOREIGN KEY (order_id) REFERENCES orders(id) ON DELETE CASCADE, "
-                    "FOREIGN KEY (order_number) REFERENCES orders(order_number) ON DELETE CASCADE, "
-                    "FOREIGN KEY (item_id) REFERENCES items(id) ON DELETE RESTRICT)")) {
-        qDebug() << "Failed to create order_lines table:" << query.lastError().text();
+    if (version < 8 && !migrateToVersion8()) {
         return false;
     }
 
     return true;
 }
 
+bool DatabaseManager::migrateToVersion1()
+{
+    qDebug() << "Migrating orders to integer date/type encoding...";
+
+    // Table rebuild, with foreign keys off so dropping the old table does not
+    // cascade into order_lines (the pragma is a no-op inside a transaction)
+    QSqlQuery query;
+    query.exec("PRAGMA foreign_keys = OFF");
+
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        query.exec("PRAGMA foreign_keys = ON");
+        return false;
+    }
+    bool ok = runStatements({
+        "CREATE TABLE orders_new ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "order_number TEXT UNIQUE NOT NULL, "
+        "date INTEGER NOT NULL, "
+        "type INTEGER NOT NULL CHECK (type IN (0, 1)))",
+        "INSERT INTO orders_new (id, order_number, date, type) "
+        "SELECT id, order_number, CAST(julianday(date) + 0.5 AS INTEGER), "
+        "CASE type WHEN 'from' THEN 1 ELSE 0 END FROM orders",
+        "DROP TABLE orders",
+        "ALTER TABLE orders_new RENAME TO orders",
+        "CREATE INDEX idx_orders_to_date ON orders(date) WHERE type = 0",
+        "CREATE INDEX idx_orders_from_date ON orders(date) WHERE type = 1",
+        "CREATE VIEW IF NOT EXISTS v_orders AS "
+        "SELECT id, order_number, date(date - 0.5) AS date, "
+        "CASE type WHEN 0 THEN 'to' ELSE 'from' END AS type FROM orders",
+        "PRAGMA user_version = 1"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    query.exec("PRAGMA foreign_keys = ON");
+    return ok;
+}
+
+bool DatabaseManager::migrateToVersion2()
+{
+    qDebug() << "Migrating item prices to integer minor units...";
+
+    QSqlQuery query;
+    query.exec("PRAGMA foreign_keys = OFF");
+
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        query.exec("PRAGMA foreign_keys = ON");
+        return false;
+    }
+    bool ok = runStatements({
+        "CREATE TABLE items_new ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "item_code TEXT UNIQUE NOT NULL, "
+        "item_description TEXT, "
+        "quantity INTEGER DEFAULT 0, "
+        "price INTEGER NOT NULL DEFAULT 0)",
+        QString("INSERT INTO items_new (id, item_code, item_description, quantity, price) "
+                "SELECT id, item_code, item_description, quantity, "
+                "CAST(ROUND(COALESCE(price, 0) * %1) AS INTEGER) FROM items").arg(Money::kMinorPerMajor),
+        "DROP TABLE items",
+        "ALTER TABLE items_new RENAME TO items",
+        "PRAGMA user_version = 2"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    query.exec("PRAGMA foreign_keys = ON");
+    return ok;
+}
+
+bool DatabaseManager::migrateToVersion3()
+{
+    qDebug() << "Adding order status for posting...";
+
+    // Existing orders start out open; nothing has been applied to stock yet
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        return false;
+    }
+    bool ok = runStatements(QStringList{"ALTER TABLE orders ADD COLUMN status INTEGER NOT NULL DEFAULT 0 "
+                                        "CHECK (status IN (0, 1))",
+                                        "DROP VIEW IF EXISTS v_orders",
+                                        kOrdersViewSql}
+                            + orderPostingStatements(false)
+                            + QStringList{"PRAGMA user_version = 3"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    return ok;
+}
+
+bool DatabaseManager::migrateToVersion4()
+{
+    qDebug() << "Adding stock ledger...";
+
+    // The ledger starts with one opening movement per item, checkpointed
+    // right away so as-of queries never need to look before it
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        return false;
+    }
+    bool ok = runStatements(stockLedgerStatements()
+                            + QStringList{"INSERT INTO stock_movements (item_id, moved_at, delta) "
+                                          "SELECT id, CAST(strftime('%s', 'now') AS INTEGER), quantity FROM items "
+                                          "WHERE COALESCE(quantity, 0) <> 0",
+                                          "INSERT INTO stock_snapshots (item_id, movement_id, taken_at, quantity) "
+                                          "SELECT item_id, id, moved_at, delta FROM stock_movements",
+                                          "PRAGMA user_version = 4"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    return ok;
+}
+
+bool DatabaseManager::migrateToVersion5()
+{
+    qDebug() << "Adding order summaries...";
+
+    // One full aggregation to seed the table; the triggers take over from here
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        return false;
+    }
+    bool ok = runStatements(orderSummaryStatements()
+                            + QStringList{"INSERT INTO order_summary (order_id, line_count, total_units, total_value) "
+                                          "SELECT o.id, COUNT(l.id), COALESCE(SUM(l.quantity), 0), "
+                                          "COALESCE(SUM(l.quantity * COALESCE(i.price, 0)), 0) "
+                                          "FROM orders o "
+                                          "LEFT JOIN order_lines l ON l.order_id = o.id "
+                                          "LEFT JOIN items i ON i.id = l.item_id "
+                                          "GROUP BY o.id",
+                                          "PRAGMA user_version = 5"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    return ok;
+}
+
+bool DatabaseManager::migrateToVersion6()
+{
+    qDebug() << "Adding order archiving indexes...";
+
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        return false;
+    }
+    bool ok = runStatements(orderArchivingStatements() + QStringList{"PRAGMA user_version = 6"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    return ok;
+}
+
+bool DatabaseManager::migrateToVersion7()
+{
+    qDebug() << "Protecting lines of posted orders from deletion...";
+
+    // Only the new delete trigger is missing; the others exist already
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        return false;
+    }
+    bool ok = runStatements(orderPostingStatements(false) + QStringList{"PRAGMA user_version = 7"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    return ok;
+}
+
+bool DatabaseManager::migrateToVersion8()
+{
+    qDebug() << "Letting replicated changes pass the posting triggers...";
+
+    if (!m_db.transaction()) {
+        qDebug() << "Migration could not begin a transaction:" << m_db.lastError().text();
+        return false;
+    }
+    bool ok = runStatements(changesetStateStatements()
+                            + QStringList{"DROP TRIGGER IF EXISTS trg_orders_posted_update",
+                                          "DROP TRIGGER IF EXISTS trg_order_lines_posted_insert",
+                                          "DROP TRIGGER IF EXISTS trg_order_lines_posted_update",
+                                          "DROP TRIGGER IF EXISTS trg_order_lines_posted_delete"}
+                            + orderPostingStatements(true));
+
+    // Applied and written changeset sequences used to be kept in the
+    // settings, outside the database they describe
+    if (ok) {
+        QSettings settings;
+        QSqlQuery query(m_db);
+        query.prepare("UPDATE changeset_sent SET sequence = ?");
+        query.addBindValue(settings.value("sync/sequence", 0).toLongLong());
+        ok = query.exec();
+        if (!ok) {
+            qDebug() << "Migration failed:" << query.lastError().text();
+        }
+        settings.beginGroup("sync/applied");
+        query.prepare("INSERT OR REPLACE INTO changeset_applied (node_id, sequence) VALUES (?, ?)");
+        const QStringList nodeIds = settings.childKeys();
+        for (int i = 0; ok && i < nodeIds.size(); ++i) {
+            const QString& nodeId = nodeIds[i];
+            query.addBindValue(nodeId);
+            query.addBindValue(settings.value(nodeId).toLongLong());
+            if (!query.exec()) {
+                qDebug() << "Migration failed:" << query.lastError().text();
+                ok = false;
+                break;
+            }
+        }
+    }
+    ok = ok && runStatements({"PRAGMA user_version = 8"});
+
+    if (ok) {
+        ok = m_db.commit();
+    } else {
+        m_db.rollback();
+    }
+
+    return ok;
+}
+
 bool DatabaseManager::populateSampleData()
 {
     // Add admin user
@@ -134,17 +836,17 @@ bool DatabaseManager::populateSampleData()
     }
 
     // Add sample items
-    if (!addItem("IT001", "Laptop", 10, 1200.00)) {
+    if (!addItem("IT001", "Laptop", 10, Money::fromString("1200.00"))) {
         qDebug() << "Failed to add sample item 1";
         return false;
     }
 
-    if (!addItem("IT002", "Mouse", 50, 25.00)) {
+    if (!addItem("IT002", "Mouse", 50, Money::fromString("25.00"))) {
         qDebug() << "Failed to add sample item 2";
         return false;
     }
 
-    if (!addItem("IT003", "Keyboard", 30, 45.00)) {
+    if (!addItem("IT003", "Keyboard", 30, Money::fromString("45.00"))) {
         qDebug() << "Failed to add sample item 3";
         return false;
     }
@@ -182,29 +884,26 @@ bool DatabaseManager::populateSampleData()
 
 bool DatabaseManager::validateUser(const QString& username, const QString& password)
 {
-    QSqlQuery query;
-    query.prepare("SELECT password FROM users WHERE login = :login");
-    query.bindValue(":login", username);
+    WMS_DB_OPERATION("validateUser");
 
-    if (!query.exec() || !query.next()) {
+    std::optional<User> user = UserRepository(m_db).byLogin(username);
+    if (!user) {
         return false;
     }
 
-    QString storedHash = query.value(0).toString();
-    QString inputHash = hashPassword(password);
-
-    return storedHash == inputHash;
+    return user->passwordHash == hashPassword(password);
 }
 
 bool DatabaseManager::addUser(const QString& login, const QString& password)
 {
-    QSqlQuery query;
-    query.prepare("INSERT INTO users (login, password) VALUES (:login, :password)");
-    query.bindValue(":login", login);
-    query.bindValue(":password", hashPassword(password));
+    WMS_DB_OPERATION("addUser");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to add user:" << query.lastError().text();
+    UserRepository repo(m_db);
+    User user{0, login, hashPassword(password)};
+
+    if (!repo.insert(user)) {
+        qDebug() << "Failed to add user:" << repo.lastError();
+        countOperationError("addUser");
         return false;
     }
 
@@ -213,14 +912,13 @@ bool DatabaseManager::addUser(const QString& login, const QString& password)
 
 bool DatabaseManager::updateUser(int id, const QString& login, const QString& password)
 {
-    QSqlQuery query;
-    query.prepare("UPDATE users SET login = :login, password = :password WHERE id = :id");
-    query.bindValue(":id", id);
-    query.bindValue(":login", login);
-    query.bindValue(":password", hashPassword(password));
+    WMS_DB_OPERATION("updateUser");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to update user:" << query.lastError().text();
+    UserRepository repo(m_db);
+
+    if (!repo.update(User{id, login, hashPassword(password)})) {
+        qDebug() << "Failed to update user:" << repo.lastError();
+        countOperationError("updateUser");
         return false;
     }
 
@@ -229,49 +927,44 @@ bool DatabaseManager::updateUser(int id, const QString& login, const QString& pa
 
 bool DatabaseManager::deleteUser(int id)
 {
-    QSqlQuery query;
-    query.prepare("DELETE FROM users WHERE id = :id");
-    query.bindValue(":id", id);
+    WMS_DB_OPERATION("deleteUser");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to delete user:" << query.lastError().text();
+    UserRepository repo(m_db);
+
+    if (!repo.remove(id)) {
+        qDebug() << "Failed to delete user:" << repo.lastError();
+        countOperationError("deleteUser");
         return false;
     }
 
     return true;
 }
 
-bool DatabaseManager::addItem(const QString& code, const QString& description, int quantity, double price)
+bool DatabaseManager::addItem(const QString& code, const QString& description, int quantity, const Money& price)
 {
-    QSqlQuery query;
-    query.prepare("INSERT INTO items (item_code, item_description, quantity, price) "
-                  "VALUES (:code, :description, :quantity, :price)");
-    query.bindValue(":code", code);
-    query.bindValue(":description", description);
-    query.bindValue(":quantity", quantity);
-    query.bindValue(":price", price);
+    WMS_DB_OPERATION("addItem");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to add item:" << query.lastError().text();
+    ItemRepository repo(m_db);
+    Item item{0, code, description, quantity, price};
+
+    if (!repo.insert(item)) {
+        qDebug() << "Failed to add item:" << repo.lastError();
+        countOperationError("addItem");
         return false;
     }
 
     return true;
 }
 
-bool DatabaseManager::updateItem(int id, const QString& code, const QString& description, int quantity, double price)
+bool DatabaseManager::updateItem(int id, const QString& code, const QString& description, int quantity, const Money& price)
 {
-    QSqlQuery query;
-    query.prepare("UPDATE items SET item_code = :code, item_description = :description, "
-                  "quantity = :quantity, price = :price WHERE id = :id");
-    query.bindValue(":id", id);
-    query.bindValue(":code", code);
-    query.bindValue(":description", description);
-    query.bindValue(":quantity", quantity);
-    query.bindValue(":price", price);
+    WMS_DB_OPERATION("updateItem");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to update item:" << query.lastError().text();
+    ItemRepository repo(m_db);
+
+    if (!repo.update(Item{id, code, description, quantity, price})) {
+        qDebug() << "Failed to update item:" << repo.lastError();
+        countOperationError("updateItem");
         return false;
     }
 
@@ -280,45 +973,71 @@ bool DatabaseManager::updateItem(int id, const QString& code, const QString& des
 
 bool DatabaseManager::deleteItem(int id)
 {
-    QSqlQuery query;
-    query.prepare("DELETE FROM items WHERE id = :id");
-    query.bindValue(":id", id);
+    WMS_DB_OPERATION("deleteItem");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to delete item:" << query.lastError().text();
+    ItemRepository repo(m_db);
+
+    if (!repo.remove(id)) {
+        qDebug() << "Failed to delete item:" << repo.lastError();
+        countOperationError("deleteItem");
         return false;
     }
 
     return true;
 }
 
-bool DatabaseManager::addOrder(const QString& orderNumber, const QDate& date, const QString& type)
+Money DatabaseManager::totalStockValue()
 {
-    QSqlQuery query;
-    query.prepare("INSERT INTO orders (order_number, date, type) VALUES (:order_number, :date, :type)");
-    query.bindValue(":order_number", orderNumber);
-    query.bindValue(":date", date.toString(Qt::ISODate));
-    query.bindValue(":type", type);
+    WMS_DB_OPERATION("totalStockValue");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to add order:" << query.lastError().text();
-        return false;
+    // Integer arithmetic in SQLite; SUM() raises an error rather than losing precision
+    static constexpr std::string_view sql = "SELECT COALESCE(SUM(quantity * price), 0) FROM items";
+
+    if (sqlite3* handle = nativeBackendHandle(m_db)) {
+        SqliteStatement stmt(handle, sql);
+        if (!stmt.step()) {
+            qDebug() << "Failed to compute stock value:" << stmt.lastError();
+            countOperationError("totalStockValue");
+            return Money();
+        }
+        return Money::fromMinorUnits(stmt.columnInt64(0));
     }
 
-    return true;
+    QSqlQuery query;
+    if (!query.exec(sqlString(sql)) || !query.next()) {
+        qDebug() << "Failed to compute stock value:" << query.lastError().text();
+        countOperationError("totalStockValue");
+        return Money();
+    }
+
+    return Money::fromMinorUnits(query.value(0).toLongLong());
+}
+
+bool DatabaseManager::addOrder(const QString& orderNumber, const QDate& date, const QString& type)
+{
+    WMS_DB_OPERATION("addOrder");
+
+    OrderRepository repo(m_db);
+    Order order{0, orderNumber, date, OrderType(encodeOrderType(type))};
+
+    if (!repo.insert(order)) {
+        qDebug() << "Failed to add order:" << repo.lastError();
+        countOperationError("addOrder");
+        return false;
+    }
+
+    return true;
 }
 
 bool DatabaseManager::updateOrder(int id, const QString& orderNumber, const QDate& date, const QString& type)
 {
-    QSqlQuery query;
-    query.prepare("UPDATE orders SET order_number = :order_number, date = :date, type = :type WHERE id = :id");
-    query.bindValue(":id", id);
-    query.bindValue(":order_number", orderNumber);
-    query.bindValue(":date", date.toString(Qt::ISODate));
-    query.bindValue(":type", type);
+    WMS_DB_OPERATION("updateOrder");
 
-    if (!query.exec()) {
-        qDebug() << "Failed to update order:" << query.lastError().text();
+    OrderRepository repo(m_db);
+
+    if (!repo.update(Order{id, orderNumber, date, OrderType(encodeOrderType(type))})) {
+        qDebug() << "Failed to update order:" << repo.lastError();
+        countOperationError("updateOrder");
         return false;
     }
 
@@ -327,70 +1046,1139 @@ bool DatabaseManager::updateOrder(int id, const QString& orderNumber, const QDat
 
 bool DatabaseManager::deleteOrder(int id)
 {
+    WMS_DB_OPERATION("deleteOrder");
+
+    OrderRepository repo(m_db);
+
+    if (!repo.remove(id)) {
+        qDebug() << "Failed to delete order:" << repo.lastError();
+        countOperationError("deleteOrder");
+        return false;
+    }
+
+    return true;
+}
+
+QSqlQuery DatabaseManager::ordersInDateRange(const QDate& from, const QDate& to, const QString& type)
+{
+    WMS_DB_OPERATION("ordersInDateRange");
+
+    // Each branch is served by the matching partial date index
+    QString branch = "SELECT id, order_number, date, type FROM orders WHERE type = %1 AND date BETWEEN :from AND :to";
+    QString sql;
+    if (type.isEmpty()) {
+        sql = branch.arg(OrderTypeTo) + " UNION ALL " + branch.arg(OrderTypeFrom) + " ORDER BY date, id";
+    } else {
+        sql = branch.arg(encodeOrderType(type)) + " ORDER BY date, id";
+    }
+
     QSqlQuery query;
-    query.prepare("DELETE FROM orders WHERE id = :id");
-    query.bindValue(":id", id);
+    query.setForwardOnly(true);
+    query.prepare(sql);
+    query.bindValue(":from", encodeOrderDate(from));
+    query.bindValue(":to", encodeOrderDate(to));
 
     if (!query.exec()) {
-        qDebug() << "Failed to delete order:" << query.lastError().text();
+        qDebug() << "Failed to query orders by date:" << query.lastError().text();
+        countOperationError("ordersInDateRange");
+    }
+
+    return query;
+}
+
+qint64 DatabaseManager::encodeOrderDate(const QDate& date)
+{
+    return date.toJulianDay();
+}
+
+QDate DatabaseManager::decodeOrderDate(const QVariant& value)
+{
+    return QDate::fromJulianDay(value.toLongLong());
+}
+
+int DatabaseManager::encodeOrderType(const QString& type)
+{
+    return type == "from" ? OrderTypeFrom : OrderTypeTo;
+}
+
+QString DatabaseManager::decodeOrderType(const QVariant& value)
+{
+    return value.toInt() == OrderTypeFrom ? "from" : "to";
+}
+
+bool DatabaseManager::postOrder(int orderId, QString* errorMessage)
+{
+    return postOrders(QList<int>{orderId}, nullptr, errorMessage);
+}
+
+bool DatabaseManager::postOrders(const QList<int>& orderIds, int* postedCount, QString* errorMessage)
+{
+    WMS_DB_OPERATION("postOrders");
+
+    return postBatch([&orderIds](QSqlQuery& query) {
+        QVariantList ids;
+        ids.reserve(orderIds.size());
+        for (int id : orderIds) {
+            ids.append(id);
+        }
+
+        query.prepare("INSERT OR IGNORE INTO temp.posting_batch (order_id) "
+                      "SELECT id FROM orders WHERE id = ? AND status = 0");
+        query.addBindValue(ids);
+        return query.execBatch();
+    }, postedCount, errorMessage);
+}
+
+bool DatabaseManager::postOrders(const QDate& from, const QDate& to, int* postedCount, QString* errorMessage)
+{
+    WMS_DB_OPERATION("postOrdersInDateRange");
+
+    return postBatch([&from, &to](QSqlQuery& query) {
+        // Served by idx_orders_open_date
+        query.prepare("INSERT INTO temp.posting_batch (order_id) "
+                      "SELECT id FROM orders WHERE status = 0 AND date BETWEEN ? AND ?");
+        query.addBindValue(encodeOrderDate(from));
+        query.addBindValue(encodeOrderDate(to));
+        return query.exec();
+    }, postedCount, errorMessage);
+}
+
+// Collects the orders to post in temp.posting_batch (via fillBatch), folds
+// their lines into one signed delta per item and applies the deltas with a
+// single UPDATE ... FROM, all inside one transaction
+bool DatabaseManager::postBatch(const std::function<bool(QSqlQuery&)>& fillBatch, int* postedCount, QString* errorMessage)
+{
+    static MetricCounter* const postedOrders = MetricsRegistry::instance().counter(
+        "wms_orders_posted_total", "Orders applied to stock");
+
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to post orders:" << message;
+        countOperationError("postOrders");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        m_db.rollback();
         return false;
+    };
+
+    if (postedCount) {
+        *postedCount = 0;
+    }
+
+    if (!m_db.transaction()) {
+        return fail(m_db.lastError().text());
+    }
+
+    QSqlQuery query(m_db);
+    if (!query.exec("CREATE TEMP TABLE IF NOT EXISTS posting_batch (order_id INTEGER PRIMARY KEY)")
+        || !query.exec("CREATE TEMP TABLE IF NOT EXISTS posting_delta (item_id INTEGER PRIMARY KEY, delta INTEGER NOT NULL)")
+        || !query.exec("DELETE FROM temp.posting_batch")
+        || !query.exec("DELETE FROM temp.posting_delta")) {
+        return fail(query.lastError().text());
+    }
+
+    if (!fillBatch(query)) {
+        return fail(query.lastError().text());
+    }
+
+    if (!query.exec(QString("INSERT INTO temp.posting_delta (item_id, delta) "
+                            "SELECT l.item_id, SUM(CASE o.type WHEN %1 THEN l.quantity ELSE -l.quantity END) "
+                            "FROM temp.posting_batch b "
+                            "JOIN orders o ON o.id = b.order_id "
+                            "JOIN order_lines l ON l.order_id = b.order_id "
+                            "GROUP BY l.item_id").arg(OrderTypeTo))) {
+        return fail(query.lastError().text());
+    }
+
+    if (!query.exec("SELECT i.item_code, COALESCE(i.quantity, 0), d.delta FROM items i "
+                    "JOIN temp.posting_delta d ON d.item_id = i.id "
+                    "WHERE COALESCE(i.quantity, 0) + d.delta < 0 LIMIT 1")) {
+        return fail(query.lastError().text());
+    }
+    if (query.next()) {
+        return fail(QString("Insufficient stock for item %1: %2 on hand, %3 required")
+                        .arg(query.value(0).toString())
+                        .arg(query.value(1).toLongLong())
+                        .arg(-query.value(2).toLongLong()));
     }
 
+    if (!query.exec("UPDATE items SET quantity = COALESCE(items.quantity, 0) + d.delta "
+                    "FROM temp.posting_delta d WHERE items.id = d.item_id")) {
+        return fail(query.lastError().text());
+    }
+
+    if (!query.exec(QString("UPDATE orders SET status = %1 "
+                            "WHERE id IN (SELECT order_id FROM temp.posting_batch)").arg(OrderStatusPosted))) {
+        return fail(query.lastError().text());
+    }
+    int posted = query.numRowsAffected();
+
+    if (!m_db.commit()) {
+        return fail(m_db.lastError().text());
+    }
+
+    postedOrders->inc(quint64(posted));
+    if (postedCount) {
+        *postedCount = posted;
+    }
     return true;
 }
 
-bool DatabaseManager::addOrderLine(int orderId, const QString& orderNumber, int itemId, int quantity)
+qint64 DatabaseManager::stockAsOf(int itemId, const QDateTime& at, bool* ok)
 {
-    QSqlQuery query;
-    query.prepare("INSERT INTO order_lines (order_id, order_number, item_id, quantity) VALUES (:order_id, :order_number, :item_id, :quantity)");
-    query.bindValue(":order_id", orderId);
-    query.bindValue(":order_number", orderNumber);
-    query.bindValue(":item_id", itemId);
-    query.bindValue(":quantity", quantity);
+    WMS_DB_OPERATION("stockAsOf");
+
+    StockLedgerRepository repo(m_db);
+    std::optional<qint64> quantity = repo.quantityAsOf(itemId, at);
+    if (ok) {
+        *ok = quantity.has_value();
+    }
+    if (!quantity) {
+        qDebug() << "Failed to compute stock as of" << at << ":" << repo.lastError();
+        countOperationError("stockAsOf");
+        return 0;
+    }
+    return *quantity;
+}
+
+std::vector<StockMovement> DatabaseManager::stockMovements(int itemId, const QDateTime& from, const QDateTime& to)
+{
+    WMS_DB_OPERATION("stockMovements");
+    return StockLedgerRepository(m_db).movements(itemId, from, to);
+}
+
+int DatabaseManager::takeStockSnapshots()
+{
+    WMS_DB_OPERATION("takeStockSnapshots");
+
+    StockLedgerRepository repo(m_db);
+    int written = repo.takeSnapshots();
+    if (written < 0) {
+        qDebug() << "Failed to take stock snapshots:" << repo.lastError();
+        countOperationError("takeStockSnapshots");
+    }
+    return written;
+}
+
+QString DatabaseManager::defaultArchivePath() const
+{
+    QFileInfo file(m_db.databaseName());
+    return file.absolutePath() + "/" + file.completeBaseName() + "_archive.db";
+}
+
+QString DatabaseManager::defaultChangeLogDirectory() const
+{
+    QFileInfo file(m_db.databaseName());
+    return file.absolutePath() + "/" + file.completeBaseName() + "_cdc";
+}
+
+bool DatabaseManager::attachArchive(const QString& filePath, QString* errorMessage)
+{
+    WMS_DB_OPERATION("attachArchive");
 
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to attach order archive:" << message;
+        countOperationError("attachArchive");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    if (m_archiveAttached) {
+        return true;
+    }
+
+    QSqlQuery query(m_db);
+    query.prepare("ATTACH DATABASE ? AS archive");
+    query.addBindValue(filePath);
     if (!query.exec()) {
-        qDebug() << "Failed to add order line:" << query.lastError().text();
+        return fail(query.lastError().text());
+    }
+
+    if (!runStatements({archiveTableSql<OrdersTable>(),
+                        archiveTableSql<OrderLinesTable>(),
+                        "CREATE INDEX IF NOT EXISTS archive.idx_orders_date ON orders(date)",
+                        "CREATE INDEX IF NOT EXISTS archive.idx_orders_number ON orders(order_number)",
+                        "CREATE INDEX IF NOT EXISTS archive.idx_order_lines_order ON order_lines(order_id)"})) {
+        query.exec("DETACH DATABASE archive");
+        return fail("Could not create the archive tables");
+    }
+
+    m_archiveAttached = true;
+    m_archivePath = filePath;
+    return true;
+}
+
+bool DatabaseManager::isValidSiteCode(const QString& site)
+{
+    // Used in file names and, quoted, as schema names
+    static const QRegularExpression pattern("^[A-Za-z0-9_-]{1,32}$");
+    return pattern.match(site).hasMatch();
+}
+
+QStringList DatabaseManager::sites() const
+{
+    QStringList list;
+    for (const QString& site : QSettings().value("sites/list").toStringList()) {
+        QString code = site.trimmed();
+        if (isValidSiteCode(code) && !list.contains(code)) {
+            list.append(code);
+        }
+    }
+    if (!list.contains(m_site)) {
+        list.prepend(m_site);
+    }
+    return list;
+}
+
+QString DatabaseManager::sitePath(const QString& site) const
+{
+    if (site == defaultSite()) {
+        return m_dataDirectory + "/wms.db";
+    }
+    return m_dataDirectory + QString("/wms_site_%1.db").arg(site);
+}
+
+bool DatabaseManager::switchSite(const QString& site, QString* errorMessage)
+{
+    WMS_DB_OPERATION("switchSite");
+
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to switch site:" << message;
+        countOperationError("switchSite");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
         return false;
+    };
+
+    if (!isValidSiteCode(site)) {
+        return fail(QString("Invalid site code %1").arg(site));
+    }
+    if (site == m_site && m_db.isOpen()) {
+        return true;
+    }
+    if (m_remote) {
+        return fail("The site is chosen by wmsd");
+    }
+
+    QString previous = m_site;
+    closeDatabase();
+    m_site = site;
+    m_db.setDatabaseName(sitePath(site));
+    if (!initializeDatabase()) {
+        closeDatabase();
+        m_site = previous;
+        m_db.setDatabaseName(sitePath(previous));
+        initializeDatabase();
+        return fail(QString("Could not open the database of site %1").arg(site));
     }
 
+    QSettings().setValue("sites/current", site);
+    qDebug() << "Switched to site" << site;
+    emit siteChanged(site);
     return true;
 }
 
-bool DatabaseManager::updateOrderLine(int id, int orderId, const QString& orderNumber, int itemId, int quantity)
+bool DatabaseManager::seedSiteFromMain()
 {
-    QSqlQuery query;
-    query.prepare("UPDATE order_lines SET order_id = :order_id, order_number = :order_number, item_id = :item_id, quantity = :quantity WHERE id = :id");
-    query.bindValue(":id", id);
-    query.bindValue(":order_id", orderId);
-    query.bindValue(":order_number", orderNumber);
-    query.bindValue(":item_id", itemId);
-    query.bindValue(":quantity", quantity);
+    QString mainPath = sitePath(defaultSite());
+    if (!QFile::exists(mainPath)) {
+        return addUser("admin", "admin123");
+    }
 
+    QSqlQuery query(m_db);
+    query.prepare("ATTACH DATABASE ? AS seed");
+    query.addBindValue(mainPath);
     if (!query.exec()) {
-        qDebug() << "Failed to update order line:" << query.lastError().text();
+        qDebug() << "Failed to attach the main site:" << query.lastError().text();
         return false;
     }
+    bool ok = query.exec("INSERT INTO users (login, password) SELECT login, password FROM seed.users");
+    if (!ok) {
+        qDebug() << "Failed to copy users:" << query.lastError().text();
+    }
+    query.exec("DETACH DATABASE seed");
+    return ok;
+}
+
+// Milliseconds since the epoch, but always past the newest change in the
+// master: writers of the master are serialized, so every commit gets
+// updated_at values above all earlier ones, whatever the clocks of the sites
+// say, and syncItemMaster() can pull from a watermark
+#define ITEM_MASTER_NOW \
+    "MAX(CAST((julianday('now') - 2440587.5) * 86400000 AS INTEGER), " \
+    "COALESCE((SELECT MAX(updated_at) FROM master.items), 0) + 1)"
+
+#define ITEM_MASTER_UPSERT(row) \
+    "INSERT INTO master.items (item_code, item_description, price, updated_at, deleted) " \
+    "VALUES (" row ".item_code, " row ".item_description, " row ".price, " ITEM_MASTER_NOW ", 0) " \
+    "ON CONFLICT(item_code) DO UPDATE SET item_description = excluded.item_description, " \
+    "price = excluded.price, updated_at = excluded.updated_at, deleted = 0;"
+
+// Writes local item changes through to the item master. Changes applied by
+// syncItemMaster() are marked in temp.item_master_pull and not echoed back.
+static const QStringList kItemMasterTriggers = {
+    "CREATE TEMP TRIGGER IF NOT EXISTS item_master_insert AFTER INSERT ON main.items "
+    "WHEN NOT EXISTS (SELECT 1 FROM temp.item_master_pull) "
+    "BEGIN " ITEM_MASTER_UPSERT("NEW") " END",
+    "CREATE TEMP TRIGGER IF NOT EXISTS item_master_update "
+    "AFTER UPDATE OF item_code, item_description, price ON main.items "
+    "WHEN NOT EXISTS (SELECT 1 FROM temp.item_master_pull) BEGIN "
+    "UPDATE master.items SET deleted = 1, updated_at = " ITEM_MASTER_NOW " "
+    "WHERE item_code = OLD.item_code AND OLD.item_code <> NEW.item_code; "
+    ITEM_MASTER_UPSERT("NEW") " END",
+    "CREATE TEMP TRIGGER IF NOT EXISTS item_master_delete AFTER DELETE ON main.items "
+    "WHEN NOT EXISTS (SELECT 1 FROM temp.item_master_pull) BEGIN "
+    "UPDATE master.items SET deleted = 1, updated_at = " ITEM_MASTER_NOW " WHERE item_code = OLD.item_code; END",
+};
+
+bool DatabaseManager::attachItemMaster(const QString& filePath, QString* errorMessage)
+{
+    WMS_DB_OPERATION("attachItemMaster");
 
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to attach item master:" << message;
+        countOperationError("attachItemMaster");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    if (m_itemMasterAttached) {
+        return true;
+    }
+
+    QSqlQuery query(m_db);
+    query.prepare("ATTACH DATABASE ? AS master");
+    query.addBindValue(filePath);
+    if (!query.exec()) {
+        return fail(query.lastError().text());
+    }
+
+    // Deleted items stay as tombstones, so other sites learn about them.
+    // main.item_master_sync holds the newest updated_at this site has pulled.
+    if (!runStatements(QStringList{"CREATE TABLE IF NOT EXISTS master.items ("
+                                   "item_code TEXT PRIMARY KEY, item_description TEXT, "
+                                   "price INTEGER NOT NULL DEFAULT 0, updated_at INTEGER NOT NULL, "
+                                   "deleted INTEGER NOT NULL DEFAULT 0)",
+                                   "CREATE INDEX IF NOT EXISTS master.idx_items_updated_at ON items(updated_at)",
+                                   "CREATE TABLE IF NOT EXISTS main.item_master_sync (pulled_up_to INTEGER NOT NULL)",
+                                   "INSERT INTO main.item_master_sync SELECT 0 "
+                                   "WHERE NOT EXISTS (SELECT 1 FROM main.item_master_sync)",
+                                   "CREATE TEMP TABLE IF NOT EXISTS item_master_pull (active INTEGER)"}
+                       + kItemMasterTriggers)) {
+        query.exec("DETACH DATABASE master");
+        return fail("Could not create the item master tables");
+    }
+
+    // Items created here while the master was not attached; from now on the
+    // triggers push every local change as it is made
+    if (!runStatements({"INSERT INTO master.items (item_code, item_description, price, updated_at, deleted) "
+                        "SELECT item_code, item_description, price, " ITEM_MASTER_NOW ", 0 FROM main.items WHERE true "
+                        "ON CONFLICT(item_code) DO NOTHING"})) {
+        query.exec("DETACH DATABASE master");
+        return fail("Could not copy local items to the item master");
+    }
+
+    m_itemMasterAttached = true;
+    return syncItemMaster(errorMessage);
+}
+
+bool DatabaseManager::syncItemMaster(QString* errorMessage)
+{
+    WMS_DB_OPERATION("syncItemMaster");
+
+    auto fail = [&]() {
+        qDebug() << "Failed to sync item master";
+        countOperationError("syncItemMaster");
+        if (errorMessage) {
+            *errorMessage = "Could not synchronize the item master";
+        }
+        return false;
+    };
+
+    if (!m_itemMasterAttached) {
+        return true;
+    }
+
+    // Two index lookups; the write transaction is only opened when some
+    // site changed an item since the last pull
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT (SELECT MAX(updated_at) FROM master.items), "
+                    "(SELECT pulled_up_to FROM main.item_master_sync)")
+        || !query.next()) {
+        return fail();
+    }
+    qint64 newest = query.value(0).toLongLong();
+    qint64 pulled = query.value(1).toLongLong();
+    query.finish();
+    if (newest <= pulled) {
+        return true;
+    }
+
+    // Without the transaction a failure would leave the pull marker set, and
+    // the triggers would stop copying local edits to the master. Rows this
+    // site pushed itself come back too, but match and change nothing.
+    QString since = QString::number(pulled);
+    bool ok = m_db.transaction() && runStatements({
+        "INSERT INTO temp.item_master_pull VALUES (1)",
+        // New and changed items; quantities stay local
+        "INSERT INTO main.items (item_code, item_description, quantity, price) "
+        "SELECT item_code, item_description, 0, price FROM master.items WHERE updated_at > " + since + " AND deleted = 0 "
+        "ON CONFLICT(item_code) DO UPDATE SET item_description = excluded.item_description, price = excluded.price "
+        "WHERE items.item_description IS NOT excluded.item_description OR items.price <> excluded.price",
+        // Deleted elsewhere; items this site's order lines still use are kept
+        "DELETE FROM main.items WHERE item_code IN "
+        "(SELECT item_code FROM master.items WHERE updated_at > " + since + " AND deleted = 1) "
+        "AND NOT EXISTS (SELECT 1 FROM main.order_lines WHERE order_lines.item_id = items.id)",
+        "UPDATE main.item_master_sync SET pulled_up_to = (SELECT MAX(updated_at) FROM master.items)",
+        "DELETE FROM temp.item_master_pull"});
+
+    if (!ok || !m_db.commit()) {
+        m_db.rollback();
+        return fail();
+    }
     return true;
 }
 
-bool DatabaseManager::deleteOrderLine(int id)
+std::vector<SiteStock> DatabaseManager::stockBySite(const QStringList& sites, QString* errorMessage)
 {
-    QSqlQuery query;
-    query.prepare("DELETE FROM order_lines WHERE id = :id");
-    query.bindValue(":id", id);
+    WMS_DB_OPERATION("stockBySite");
+
+    std::vector<SiteStock> result;
+    QStringList parts;
+    QStringList attached;
+    QSqlQuery query(m_db);
+    QString error;
+
+    for (const QString& site : sites.isEmpty() ? this->sites() : sites) {
+        if (!isValidSiteCode(site)) {
+            error = QString("Invalid site code %1").arg(site);
+            break;
+        }
+
+        QString schema = "main";
+        if (site != m_site) {
+            if (!QFile::exists(sitePath(site))) {
+                qDebug() << "No database for site" << site;
+                continue;
+            }
+            schema = QString("\"site_%1\"").arg(site);
+            query.prepare(QString("ATTACH DATABASE ? AS %1").arg(schema));
+            query.addBindValue(sitePath(site));
+            if (!query.exec()) {
+                error = query.lastError().text();
+                break;
+            }
+            attached.append(schema);
+        }
+        parts.append(QString("SELECT '%1', item_code, item_description, quantity FROM %2.items").arg(site, schema));
+    }
+
+    if (error.isEmpty() && !parts.isEmpty()) {
+        query.setForwardOnly(true);
+        if (query.exec(parts.join(" UNION ALL ") + " ORDER BY 2, 1")) {
+            while (query.next()) {
+                result.push_back(SiteStock{query.value(0).toString(), query.value(1).toString(),
+                                           query.value(2).toString(), query.value(3).toLongLong()});
+            }
+        } else {
+            error = query.lastError().text();
+        }
+        query.finish();
+    }
+
+    for (const QString& schema : attached) {
+        query.exec(QString("DETACH DATABASE %1").arg(schema));
+    }
+
+    if (!error.isEmpty()) {
+        qDebug() << "Failed to read stock by site:" << error;
+        countOperationError("stockBySite");
+        if (errorMessage) {
+            *errorMessage = error;
+        }
+    }
+    return result;
+}
+
+QString DatabaseManager::syncNodeId() const
+{
+    QString defaultId = QString("%1-%2").arg(m_site, QSysInfo::machineHostName());
+    QString id = QSettings().value("sync/nodeId", defaultId).toString();
+    // Used in file names
+    return id.replace(QRegularExpression("[^A-Za-z0-9_.-]"), "_");
+}
+
+static QString syncDirectory(const QString& dataDirectory, const char* name)
+{
+    QString path = QSettings().value(QString("sync/%1").arg(name), dataDirectory + "/sync/" + name).toString();
+    QDir().mkpath(path);
+    return path;
+}
+
+bool DatabaseManager::writeChangeset(QString* filePath, QString* errorMessage)
+{
+    WMS_DB_OPERATION("writeChangeset");
+
+    static MetricCounter* const bytesWritten = MetricsRegistry::instance().counter(
+        "wms_changeset_bytes_written_total", "Compressed changeset bytes written for replication");
 
+    if (filePath) {
+        filePath->clear();
+    }
+
+    // Kept in the database, so it stays with the site and with backups.
+    // Read before taking the changes, which are lost if nothing is written
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT sequence FROM changeset_sent") || !query.next()) {
+        qDebug() << "Failed to read the changeset sequence:" << query.lastError().text();
+        countOperationError("writeChangeset");
+        if (errorMessage) {
+            *errorMessage = query.lastError().text();
+        }
+        return false;
+    }
+
+    ChangesetFile file;
+    file.sequence = query.value(0).toULongLong() + 1;
+    QString error;
+    if (!m_changesets->take(file.changeset, &error)) {
+        qDebug() << "Failed to collect changes:" << error;
+        countOperationError("writeChangeset");
+        if (errorMessage) {
+            *errorMessage = error;
+        }
+        return false;
+    }
+    if (file.changeset.isEmpty()) {
+        return true;
+    }
+
+    file.nodeId = syncNodeId();
+    file.createdAt = QDateTime::currentDateTimeUtc();
+
+    QString path = syncDirectory(m_dataDirectory, "outbox")
+                   + QString("/%1-%2.wchg").arg(file.nodeId).arg(file.sequence, 10, 10, QChar('0'));
+    if (!file.write(path, &error)) {
+        // The changes are gone from the session; they can only be recovered
+        // by comparing databases (wms_sync diff)
+        qDebug() << "Failed to write changeset:" << error;
+        countOperationError("writeChangeset");
+        if (errorMessage) {
+            *errorMessage = error;
+        }
+        return false;
+    }
+
+    query.prepare("UPDATE changeset_sent SET sequence = ?");
+    query.addBindValue(qint64(file.sequence));
     if (!query.exec()) {
-        qDebug() << "Failed to delete order line:" << query.lastError().text();
+        // The file is written; the next one would reuse its sequence
+        qDebug() << "Failed to store the changeset sequence:" << query.lastError().text();
+        countOperationError("writeChangeset");
+        if (errorMessage) {
+            *errorMessage = query.lastError().text();
+        }
+        return false;
+    }
+    bytesWritten->inc(quint64(QFileInfo(path).size()));
+    if (filePath) {
+        *filePath = path;
+    }
+    return true;
+}
+
+bool DatabaseManager::applyChangesetFile(const QString& filePath, ChangesetApplyReport* report, QString* errorMessage)
+{
+    WMS_DB_OPERATION("applyChangesetFile");
+
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to apply changeset" << filePath << ":" << message;
+        countOperationError("applyChangesetFile");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    ChangesetFile file;
+    QString error;
+    if (!file.read(filePath, &error)) {
+        return fail(error);
+    }
+    if (file.nodeId == syncNodeId()) {
+        return fail("The changeset was written by this node");
+    }
+
+    ChangesetApplyReport localReport;
+    ChangesetApplyReport& result = report ? *report : localReport;
+
+    // Applied changes must not be sent on to other nodes as our own
+    m_changesets->setEnabled(false);
+    bool ok = applyChangeset(nativeHandle(), file, result, &error);
+    m_changesets->setEnabled(true);
+    if (!ok) {
+        return fail(error);
+    }
+    if (result.alreadyApplied) {
+        return true;
+    }
+
+    qDebug() << "Applied changeset" << file.sequence << "of" << file.nodeId << "-" << result.replaced << "replaced,"
+             << result.merged << "merged," << result.omitted << "skipped";
+    for (const QString& message : result.messages) {
+        qDebug() << "  " << message;
+    }
+    return true;
+}
+
+int DatabaseManager::exchangeChangesets()
+{
+    WMS_TRACE_SCOPE_CAT("DatabaseManager::exchangeChangesets", "sql");
+
+    writeChangeset();
+
+    // File names sort by node, then by zero-padded sequence number
+    QDir inbox(syncDirectory(m_dataDirectory, "inbox"));
+    QString appliedPath = inbox.filePath("applied");
+    inbox.mkpath("applied");
+
+    int appliedFiles = 0;
+    QSet<QString> blockedNodes;
+    for (const QFileInfo& info : inbox.entryInfoList({"*.wchg"}, QDir::Files, QDir::Name)) {
+        QString node = info.completeBaseName().section('-', 0, -2);
+        if (blockedNodes.contains(node)) {
+            continue;
+        }
+        if (!applyChangesetFile(info.absoluteFilePath())) {
+            // Later files of this node depend on this one
+            blockedNodes.insert(node);
+            continue;
+        }
+        QString target = appliedPath + "/" + info.fileName();
+        QFile::remove(target);
+        QFile::rename(info.absoluteFilePath(), target);
+        ++appliedFiles;
+    }
+    return appliedFiles;
+}
+
+bool DatabaseManager::archiveOrders(const QDate& before, int batchSize, int* archivedOrders, int* archivedLines,
+                                    QString* errorMessage)
+{
+    WMS_DB_OPERATION("archiveOrders");
+
+    static MetricCounter* const archivedCounter = MetricsRegistry::instance().counter(
+        "wms_orders_archived_total", "Orders moved to the archive database");
+
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to archive orders:" << message;
+        countOperationError("archiveOrders");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        m_db.rollback();
+        return false;
+    };
+
+    if (archivedOrders) {
+        *archivedOrders = 0;
+    }
+    if (archivedLines) {
+        *archivedLines = 0;
+    }
+    if (!m_archiveAttached) {
+        if (errorMessage) {
+            *errorMessage = "The order archive is not attached";
+        }
+        return false;
+    }
+
+    if (!m_db.transaction()) {
+        return fail(m_db.lastError().text());
+    }
+
+    // Only posted orders are moved; open ones may still change stock
+    QSqlQuery query(m_db);
+    if (!query.exec("CREATE TEMP TABLE IF NOT EXISTS archive_batch (order_id INTEGER PRIMARY KEY)")
+        || !query.exec("DELETE FROM temp.archive_batch")) {
+        return fail(query.lastError().text());
+    }
+
+    query.prepare(QString("INSERT INTO temp.archive_batch (order_id) "
+                          "SELECT id FROM main.orders WHERE status = %1 AND date < ? "
+                          "ORDER BY date, id LIMIT ?").arg(OrderStatusPosted));
+    query.addBindValue(encodeOrderDate(before));
+    query.addBindValue(qMax(1, batchSize));
+    if (!query.exec()) {
+        return fail(query.lastError().text());
+    }
+    int orders = query.numRowsAffected();
+
+    if (!query.exec("INSERT INTO archive.orders (id, order_number, date, type, status) "
+                    "SELECT o.id, o.order_number, o.date, o.type, o.status FROM main.orders o "
+                    "JOIN temp.archive_batch b ON b.order_id = o.id")) {
+        return fail(query.lastError().text());
+    }
+
+    if (!query.exec("INSERT INTO archive.order_lines (id, order_id, order_number, item_id, quantity) "
+                    "SELECT l.id, l.order_id, l.order_number, l.item_id, l.quantity FROM main.order_lines l "
+                    "JOIN temp.archive_batch b ON b.order_id = l.order_id")) {
+        return fail(query.lastError().text());
+    }
+    int lines = query.numRowsAffected();
+
+    // Lines and summaries follow through ON DELETE CASCADE; stock and the
+    // ledger are untouched, as the orders are already posted
+    if (!query.exec("DELETE FROM main.orders WHERE id IN (SELECT order_id FROM temp.archive_batch)")) {
+        return fail(query.lastError().text());
+    }
+
+    if (!m_db.commit()) {
+        return fail(m_db.lastError().text());
+    }
+
+    archivedCounter->inc(quint64(orders));
+    if (archivedOrders) {
+        *archivedOrders = orders;
+    }
+    if (archivedLines) {
+        *archivedLines = lines;
+    }
+    return true;
+}
+
+QString DatabaseManager::containsPattern(const QString& text)
+{
+    QString escaped = text;
+    escaped.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+    return "%" + escaped + "%";
+}
+
+QSqlQuery DatabaseManager::searchOrders(const QString& text, bool includeArchived)
+{
+    WMS_DB_OPERATION("searchOrders");
+
+    QString pattern = containsPattern(text);
+    QString sql = "SELECT id, order_number, date, type, status, 0 AS archived FROM main.orders "
+                  "WHERE order_number LIKE ? ESCAPE '\\'";
+    if (includeArchived && m_archiveAttached) {
+        sql += " UNION ALL SELECT id, order_number, date, type, status, 1 FROM archive.orders "
+               "WHERE order_number LIKE ? ESCAPE '\\'";
+    }
+    sql += " ORDER BY date DESC, id DESC LIMIT 1000";
+
+    QSqlQuery query(m_db);
+    query.setForwardOnly(true);
+    query.prepare(sql);
+    query.addBindValue(pattern);
+    if (includeArchived && m_archiveAttached) {
+        query.addBindValue(pattern);
+    }
+
+    if (!query.exec()) {
+        qDebug() << "Failed to search orders:" << query.lastError().text();
+        countOperationError("searchOrders");
+    }
+
+    return query;
+}
+
+bool DatabaseManager::addOrderLine(int orderId, const QString& orderNumber, int itemId, int quantity)
+{
+    WMS_DB_OPERATION("addOrderLine");
+
+    OrderLineRepository repo(m_db);
+    OrderLine line{0, orderId, orderNumber, itemId, quantity};
+
+    if (!repo.insert(line)) {
+        qDebug() << "Failed to add order line:" << repo.lastError();
+        countOperationError("addOrderLine");
+        return false;
+    }
+
+    return true;
+}
+
+bool DatabaseManager::updateOrderLine(int id, int orderId, const QString& orderNumber, int itemId, int quantity)
+{
+    WMS_DB_OPERATION("updateOrderLine");
+
+    OrderLineRepository repo(m_db);
+
+    if (!repo.update(OrderLine{id, orderId, orderNumber, itemId, quantity})) {
+        qDebug() << "Failed to update order line:" << repo.lastError();
+        countOperationError("updateOrderLine");
+        return false;
+    }
+
+    return true;
+}
+
+bool DatabaseManager::deleteOrderLine(int id)
+{
+    WMS_DB_OPERATION("deleteOrderLine");
+
+    OrderLineRepository repo(m_db);
+
+    if (!repo.remove(id)) {
+        qDebug() << "Failed to delete order line:" << repo.lastError();
+        countOperationError("deleteOrderLine");
+        return false;
+    }
+
+    return true;
+}
+
+bool DatabaseManager::applyScans(const std::vector<Scan>& scans, std::vector<ScanResult>& results,
+                                 QString* errorMessage)
+{
+    WMS_DB_OPERATION("applyScans");
+
+    static MetricCounter* const appliedScans = MetricsRegistry::instance().counter(
+        "wms_scans_applied_total", "Handheld scans written to the database");
+
+    results.assign(scans.size(), ScanResult());
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to apply scans:" << message;
+        countOperationError("applyScans");
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        m_db.rollback();
+        for (ScanResult& result : results) {
+            result = ScanResult();
+            result.error = message;
+        }
         return false;
+    };
+
+    if (!m_db.transaction()) {
+        return fail(m_db.lastError().text());
+    }
+
+    QSqlQuery item(m_db);
+    QSqlQuery order(m_db);
+    QSqlQuery insertLine(m_db);
+    QSqlQuery adjust(m_db);
+    if (!item.prepare("SELECT id, COALESCE(quantity, 0) FROM items WHERE item_code = ?")
+        || !order.prepare("SELECT id, status FROM orders WHERE order_number = ?")
+        || !insertLine.prepare(sqlString(insertSql<OrderLinesTable>()))
+        || !adjust.prepare("UPDATE items SET quantity = COALESCE(quantity, 0) + ? WHERE id = ?")) {
+        return fail(m_db.lastError().text());
+    }
+
+    int applied = 0;
+    for (size_t i = 0; i < scans.size(); ++i) {
+        const Scan& scan = scans[i];
+        ScanResult& result = results[i];
+
+        item.addBindValue(scan.itemCode);
+        if (!item.exec()) {
+            return fail(item.lastError().text());
+        }
+        if (!item.next()) {
+            result.error = QString("Unknown item %1").arg(scan.itemCode);
+            continue;
+        }
+        int itemId = item.value(0).toInt();
+        qint64 onHand = item.value(1).toLongLong();
+        item.finish();
+
+        if (scan.kind == Scan::AdjustStock) {
+            if (onHand + scan.quantity < 0) {
+                result.error = QString("Insufficient stock for item %1: %2 on hand").arg(scan.itemCode).arg(onHand);
+                continue;
+            }
+            adjust.addBindValue(scan.quantity);
+            adjust.addBindValue(itemId);
+            if (!adjust.exec()) {
+                return fail(adjust.lastError().text());
+            }
+            result.quantity = onHand + scan.quantity;
+        } else {
+            if (scan.quantity <= 0) {
+                result.error = "Quantity must be positive";
+                continue;
+            }
+            order.addBindValue(scan.orderNumber);
+            if (!order.exec()) {
+                return fail(order.lastError().text());
+            }
+            if (!order.next()) {
+                result.error = QString("Unknown order %1").arg(scan.orderNumber);
+                continue;
+            }
+            int orderId = order.value(0).toInt();
+            bool posted = order.value(1).toInt() == OrderStatusPosted;
+            order.finish();
+            if (posted) {
+                result.error = QString("Order %1 is already posted").arg(scan.orderNumber);
+                continue;
+            }
+
+            // A failed statement is rolled back on its own; the transaction goes on
+            insertLine.addBindValue(orderId);
+            insertLine.addBindValue(scan.orderNumber);
+            insertLine.addBindValue(itemId);
+            insertLine.addBindValue(scan.quantity);
+            if (!insertLine.exec()) {
+                result.error = insertLine.lastError().text();
+                continue;
+            }
+            result.id = insertLine.lastInsertId().toLongLong();
+        }
+        result.ok = true;
+        ++applied;
     }
 
+    if (!m_db.commit()) {
+        return fail(m_db.lastError().text());
+    }
+    appliedScans->inc(applied);
     return true;
 }
 
 QSqlQuery DatabaseManager::executeQuery(const QString& queryStr)
 {
+    WMS_DB_OPERATION("executeQuery");
+
     QSqlQuery query;
     query.exec(queryStr);
     return query;
 }
+
+QString DatabaseManager::replicaPath(int index) const
+{
+    QFileInfo file(m_db.databaseName());
+    return file.absolutePath() + "/" + file.completeBaseName() + (index == 0 ? "_replica_a.db" : "_replica_b.db");
+}
+
+QSqlDatabase DatabaseManager::replicaDatabase() const
+{
+    if (m_replicaIndex < 0) {
+        return m_db;
+    }
+    return QSqlDatabase::database(replicaConnectionName(m_replicaIndex));
+}
+
+bool DatabaseManager::refreshReplica()
+{
+    WMS_TRACE_SCOPE_CAT("DatabaseManager::refreshReplica", "sql");
+
+    if (m_replicaJob) {
+        return false;
+    }
+
+    // Refresh the copy not in use; close it first, as the copy overwrites it
+    int target = m_replicaIndex == 0 ? 1 : 0;
+    QString connectionName = replicaConnectionName(target);
+    if (QSqlDatabase::contains(connectionName)) {
+        QSqlDatabase::database(connectionName, false).close();
+    }
+
+    QSettings settings;
+    m_replicaJob = new SqliteBackupJob(nativeHandle(), replicaPath(target), this);
+    m_replicaJob->setPagesPerStep(settings.value("replica/pagesPerStep", SqliteBackupJob::kDefaultPagesPerStep).toInt());
+    m_replicaJob->setStepInterval(settings.value("replica/stepIntervalMs", SqliteBackupJob::kDefaultStepIntervalMs).toInt());
+    connect(m_replicaJob, &SqliteBackupJob::finished, this, [this, target](bool ok, const QString& error) {
+        replicaJobFinished(target, ok, error);
+    });
+
+    QString error;
+    if (!m_replicaJob->start(&error)) {
+        delete m_replicaJob;
+        m_replicaJob = nullptr;
+        countOperationError("refreshReplica");
+        return false;
+    }
+    return true;
+}
+
+void DatabaseManager::replicaJobFinished(int index, bool ok, const QString& errorMessage)
+{
+    m_replicaJob->deleteLater();
+    m_replicaJob = nullptr;
+
+    if (!ok) {
+        qDebug() << "Failed to refresh read replica:" << errorMessage;
+        countOperationError("refreshReplica");
+        return;
+    }
+
+    QString connectionName = replicaConnectionName(index);
+    QSqlDatabase replica = QSqlDatabase::contains(connectionName)
+                               ? QSqlDatabase::database(connectionName, false)
+                               : QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    replica.setDatabaseName(replicaPath(index));
+    replica.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+    if (!replica.open()) {
+        qDebug() << "Failed to open read replica:" << replica.lastError().text();
+        countOperationError("refreshReplica");
+        return;
+    }
+
+    if (const TuningProfile* profile = TuningProfile::find(m_tuningProfile)) {
+        profile->apply(replica);
+    }
+
+    // Archived orders are read from the live archive file; without it,
+    // reports would silently miss them, so the previous copy stays in use
+    if (m_archiveAttached) {
+        QSqlQuery attach(replica);
+        attach.prepare("ATTACH DATABASE ? AS archive");
+        attach.addBindValue(m_archivePath);
+        if (!attach.exec()) {
+            qDebug() << "Failed to attach the archive to the read replica:" << attach.lastError().text();
+            countOperationError("refreshReplica");
+            replica.close();
+            return;
+        }
+    }
+
+    m_replicaIndex = index;
+    m_replicaRefreshedAt = QDateTime::currentDateTime();
+    emit replicaRefreshed(m_replicaRefreshedAt);
+}
+
+sqlite3* DatabaseManager::nativeHandle() const
+{
+    return sqliteHandle(m_db);
+}
+
+bool DatabaseManager::startRecording(const QString& filePath)
+{
+    sqlite3* handle = nativeHandle();
+    if (!handle) {
+        qDebug() << "Workload recording requires the QSQLITE driver";
+        return false;
+    }
+
+    stopRecording();
+    m_recorder = new QueryRecorder();
+    if (!m_recorder->start(filePath)) {
+        delete m_recorder;
+        m_recorder = nullptr;
+        return false;
+    }
+
+    m_recorder->attach(handle, 0);
+    return true;
+}
+
+void DatabaseManager::stopRecording()
+{
+    if (m_recorder) {
+        delete m_recorder;
+        m_recorder = nullptr;
+    }
+}
+
+bool DatabaseManager::isRecording() const
+{
+    return m_recorder && m_recorder->isRecording();
+}
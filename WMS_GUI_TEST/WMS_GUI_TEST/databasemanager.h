@@ -7,6 +7,20 @@
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QFile>
+#include <QDate>
+#include <QDateTime>
+#include <QTimer>
+#include <functional>
+#include <vector>
+#include "entities.h"
+
+struct sqlite3;
+class QueryRecorder;
+class SqliteBackupJob;
+class MaintenanceScheduler;
+class ChangesetRecorder;
+class ChangeCapture;
+struct ChangesetApplyReport;
 
 class DatabaseManager : public QObject
 {
@@ -15,6 +29,18 @@ class DatabaseManager : public QObject
 public:
     static DatabaseManager& instance();
     bool initializeDatabase();
+    // Newest schema version this build creates and can open
+    static int schemaVersion();
+    QString databasePath() const { return m_db.databaseName(); }
+
+    // Swaps in another database file (see BackupManager): closes the
+    // connection, keeps the current file as wms.db.old, renames filePath to
+    // wms.db and initializes again. The old file is put back if the new one
+    // cannot be opened. Models and queries on the connection must be gone.
+    bool replaceDatabaseFile(const QString& filePath, QString* errorMessage = nullptr);
+    // Bumped by every replaceDatabaseFile(); connections that other threads
+    // keep open on databasePath() must be reopened when it changes
+    quint64 databaseGeneration() const { return m_databaseGeneration; }
     bool validateUser(const QString& username, const QString& password);
 
     // Users
@@ -23,22 +49,185 @@ public:
     bool deleteUser(int id);
 
     // Items
-    bool addItem(const QString& code, const QString& description, int quantity, double price);
-    bool updateItem(int id, const QString& code, const QString& description, int quantity, double price);
+    bool addItem(const QString& code, const QString& description, int quantity, const Money& price);
+    bool updateItem(int id, const QString& code, const QString& description, int quantity, const Money& price);
     bool deleteItem(int id);
 
+    // Sum of quantity * price over all items, computed in integer minor units
+    Money totalStockValue();
+
     // Orders
     bool addOrder(const QString& orderNumber, const QDate& date, const QString& type);
     bool updateOrder(int id, const QString& orderNumber, const QDate& date, const QString& type);
     bool deleteOrder(int id);
 
+    // Orders dated within [from, to]; type is "to", "from" or empty for both.
+    // Columns: id, order_number, date, type in storage encoding (see below)
+    QSqlQuery ordersInDateRange(const QDate& from, const QDate& to, const QString& type = QString());
+
+    // Conversion between the UI representation and the stored columns:
+    // dates are Julian day numbers, types are OrderType values (entities.h)
+    static qint64 encodeOrderDate(const QDate& date);
+    static QDate decodeOrderDate(const QVariant& value);
+    static int encodeOrderType(const QString& type);
+    static QString decodeOrderType(const QVariant& value);
+
+    // Posting applies the lines of open orders to items.quantity: "to" orders
+    // add stock, "from" orders remove it. Posted orders are marked as such and
+    // skipped by later calls, so posting is idempotent. A call posts all its
+    // orders in one transaction with set-based quantity = quantity + delta
+    // updates, and is rejected as a whole if any item would drop below zero.
+    bool postOrder(int orderId, QString* errorMessage = nullptr);
+    bool postOrders(const QList<int>& orderIds, int* postedCount = nullptr, QString* errorMessage = nullptr);
+    // Posts every open order dated within [from, to]
+    bool postOrders(const QDate& from, const QDate& to, int* postedCount = nullptr, QString* errorMessage = nullptr);
+
+    // Stock ledger: every change of items.quantity is recorded in
+    // stock_movements and periodically checkpointed in stock_snapshots
+    // ("ledger/snapshotIntervalMs" setting, default one hour)
+    qint64 stockAsOf(int itemId, const QDateTime& at, bool* ok = nullptr);
+    std::vector<StockMovement> stockMovements(int itemId, const QDateTime& from, const QDateTime& to);
+    int takeStockSnapshots();
+
+    // Order archive: a second database file attached to the connection as
+    // schema "archive" (wms_archive.db next to wms.db, or
+    // wms_site_<code>_archive.db for other sites, unless the
+    // "archive/databasePath" setting names another file). Archived orders and
+    // their lines keep their ids and leave the main tables entirely.
+    QString defaultArchivePath() const;
+    bool attachArchive(const QString& filePath, QString* errorMessage = nullptr);
+    bool isArchiveAttached() const { return m_archiveAttached; }
+    // File of the attached archive, or empty if none is attached
+    QString archiveDatabasePath() const { return m_archiveAttached ? m_archivePath : QString(); }
+    // Moves up to batchSize posted orders dated before the given day, oldest
+    // first, into the archive in one transaction
+    bool archiveOrders(const QDate& before, int batchSize, int* archivedOrders = nullptr,
+                       int* archivedLines = nullptr, QString* errorMessage = nullptr);
+    // Up to 1000 orders whose number contains text, newest first, optionally
+    // including archived ones. Columns: id, order_number, date, type, status, archived
+    QSqlQuery searchOrders(const QString& text, bool includeArchived = false);
+    // LIKE pattern matching values that contain text; use with ESCAPE '\'
+    static QString containsPattern(const QString& text);
+
     // Order Lines
     bool addOrderLine(int orderId, const QString& orderNumber, int itemId, int quantity);
     bool updateOrderLine(int id, int orderId, const QString& orderNumber, int itemId, int quantity);
     bool deleteOrderLine(int id);
 
+    // Applies handheld scans (see ApiServer) in one transaction. A scan
+    // that cannot be applied (unknown item or order, posted order, stock
+    // dropping below zero) only fails itself; results has one entry per
+    // scan. Returns false, with every scan failed, if the transaction does.
+    bool applyScans(const std::vector<Scan>& scans, std::vector<ScanResult>& results,
+                    QString* errorMessage = nullptr);
+
     QSqlQuery executeQuery(const QString& query);
 
+    // Sites: every warehouse has its own database file. Site "main" is
+    // wms.db, any other site is wms_site_<code>.db in the same directory;
+    // "sites/list" names the configured sites and "sites/current" the one
+    // this instance works on. All operations go to the current site's file,
+    // so each site's data stays small and sites can run as separate
+    // instances without sharing locks. With more than one site, item codes,
+    // descriptions and prices are shared through an item master
+    // (wms_items.db, attached as schema "master"): local item changes are
+    // written through to it by TEMP triggers, and changes made at other
+    // sites are pulled every "sites/itemSyncIntervalMs" (default one minute).
+    // A pull reads only the master rows changed since the previous one and
+    // opens no write transaction when there are none. Stock quantities stay
+    // per site.
+    static QString defaultSite() { return "main"; }
+    static bool isValidSiteCode(const QString& site);
+    QString currentSite() const { return m_site; }
+    QStringList sites() const;
+    QString sitePath(const QString& site) const;
+    // Closes the current site and opens (creating if needed) another one; a
+    // new site starts with the users of site "main" and the item master.
+    // Change capture, sync, the replica and maintenance are stopped with the
+    // old connection and started again on the new one.
+    bool switchSite(const QString& site, QString* errorMessage = nullptr);
+    bool syncItemMaster(QString* errorMessage = nullptr);
+    // Stock of the given sites (all configured ones if empty) for cross-site
+    // reports. The other sites' files are attached only during the call;
+    // SQLite attaches at most ten databases per connection, including the
+    // archive and the item master.
+    std::vector<SiteStock> stockBySite(const QStringList& sites = QStringList(), QString* errorMessage = nullptr);
+
+    // Read replica: a copy of wms.db refreshed every "replica/refreshIntervalMs"
+    // (default five minutes) with the online backup API, in steps of
+    // "replica/pagesPerStep" pages. Two files are used in turn, so readers
+    // of the current copy are never disturbed by the next refresh. Heavy
+    // read-only work (SQL console, reports) should use replicaDatabase(),
+    // which is the main connection until the first refresh has completed.
+    QSqlDatabase replicaDatabase() const;
+    bool hasReplica() const { return m_replicaIndex >= 0; }
+    QDateTime replicaRefreshedAt() const { return m_replicaRefreshedAt; }
+    bool refreshReplica();
+
+    // Replication between nodes (changesets.h), enabled by "sync/enabled".
+    // Changes to items, orders and order_lines are recorded with the SQLite
+    // session extension and every "sync/intervalMs" (default one minute)
+    // written to the "sync/outbox" directory as <node>-<sequence>.wchg; the
+    // last sequence written is kept in the table changeset_sent.
+    // Files placed in "sync/inbox" are applied in sequence order per sending
+    // node and then moved to its "applied" subdirectory. "sync/nodeId" names
+    // this node (default: site code and host name).
+    QString syncNodeId() const;
+    // Writes the changes recorded since the previous call; no file is
+    // written (and filePath is left empty) if nothing changed
+    bool writeChangeset(QString* filePath = nullptr, QString* errorMessage = nullptr);
+    bool applyChangesetFile(const QString& filePath, ChangesetApplyReport* report = nullptr,
+                            QString* errorMessage = nullptr);
+    // Writes the outbox and applies the inbox; returns the number of files applied
+    int exchangeChangesets();
+
+    // Change data capture (changecapture.h), enabled by "cdc/enabled":
+    // committed changes to items, orders, order_lines and users are appended
+    // to a binary change log in "cdc/directory" (default wms_cdc next to
+    // wms.db, wms_site_<code>_cdc for other sites), which downstream systems
+    // follow with CdcLogReader. Archiving orders shows up as their deletion.
+    // Switching it off removes the capture triggers again.
+    QString defaultChangeLogDirectory() const;
+    ChangeCapture* changeCapture() const { return m_changeCapture; }
+
+    // Storage tuning (tuningprofile.h): the "database/tuningProfile" setting
+    // (default "balanced") is applied at startup; applyTuningProfile()
+    // switches the main connection and the read replica at runtime
+    bool applyTuningProfile(const QString& name, QString* errorMessage = nullptr);
+    QString tuningProfile() const { return m_tuningProfile; }
+
+    // Idle-time ANALYZE/optimize, incremental vacuum and WAL checkpoints
+    // ("maintenance/enabled" setting, default true; see maintenancescheduler.h)
+    MaintenanceScheduler* maintenance() const { return m_maintenance; }
+
+    // Underlying SQLite connection, or nullptr if the driver does not expose one
+    sqlite3* nativeHandle() const;
+
+    // Shared database: with "database/server" set to a local socket name or
+    // host:port, the default connection goes to wmsd (rpcserver.h) through
+    // RemoteSqlDriver, with "database/serverToken" as the password. The
+    // daemon owns the file and runs schema migration, maintenance, change
+    // capture, replication and backups; this instance only opens the
+    // connection. Switching sites, replacing the file, the archive, the read
+    // replica and the handheld API (--server) need a local database.
+    bool isRemote() const { return m_remote; }
+    // Another connection to the same server, e.g. for a worker thread
+    QSqlDatabase addServerConnection(const QString& connectionName) const;
+    // Makes instance() open the file itself whatever the settings say (wmsd)
+    static void useLocalDatabase();
+
+    // Workload recording (replayed with the wms_replay tool)
+    bool startRecording(const QString& filePath);
+    void stopRecording();
+    bool isRecording() const;
+
+signals:
+    void replicaRefreshed(const QDateTime& refreshedAt);
+    // Emitted before the connection is closed for a site switch or a
+    // restore; whatever holds its native handle must let go of it here
+    void databaseClosing();
+    void siteChanged(const QString& site);
+
 private:
     DatabaseManager(QObject* parent = nullptr);
     ~DatabaseManager();
@@ -46,9 +235,46 @@ private:
     DatabaseManager& operator=(const DatabaseManager&) = delete;
 
     bool createTables();
+    bool migrateSchema();
+    bool migrateToVersion1();
+    bool migrateToVersion2();
+    bool migrateToVersion3();
+    bool migrateToVersion4();
+    bool migrateToVersion5();
+    bool migrateToVersion6();
+    bool migrateToVersion7();
+    bool migrateToVersion8();
+    bool postBatch(const std::function<bool(QSqlQuery&)>& fillBatch, int* postedCount, QString* errorMessage);
+    bool runStatements(const QStringList& statements);
     bool populateSampleData();
+    bool seedSiteFromMain();
+    bool attachItemMaster(const QString& filePath, QString* errorMessage = nullptr);
+    // Stops everything that uses the connection and closes it
+    void closeDatabase();
+    QString replicaPath(int index) const;
+    void replicaJobFinished(int index, bool ok, const QString& errorMessage);
 
     QString hashPassword(const QString& password);
 
     QSqlDatabase m_db;
+    QString m_dataDirectory;
+    QString m_site;
+    bool m_itemMasterAttached;
+    QTimer m_itemSyncTimer;
+    QueryRecorder* m_recorder;
+    bool m_archiveAttached;
+    QString m_archivePath;
+    QTimer m_snapshotTimer;
+    QTimer m_replicaTimer;
+    SqliteBackupJob* m_replicaJob;
+    MaintenanceScheduler* m_maintenance;
+    ChangesetRecorder* m_changesets;
+    ChangeCapture* m_changeCapture;
+    QTimer m_syncTimer;
+    int m_replicaIndex;
+    QDateTime m_replicaRefreshedAt;
+    QString m_tuningProfile;
+    QString m_server;
+    bool m_remote;
+    quint64 m_databaseGeneration;
 };
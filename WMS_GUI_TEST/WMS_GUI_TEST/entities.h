@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QDate>
+#include <QDateTime>
+#include <QString>
+#include "money.h"
+
+// Plain row types for the tables in wms.db. Repositories (repositories.h)
+// decode result rows straight into these.
+
+// Storage encoding of orders.type
+enum OrderType {
+    OrderTypeTo = 0,
+    OrderTypeFrom = 1
+};
+
+// Storage encoding of orders.status. Posted orders have been applied to
+// items.quantity and can no longer be changed.
+enum OrderStatus {
+    OrderStatusOpen = 0,
+    OrderStatusPosted = 1
+};
+
+struct User
+{
+    int id = 0;
+    QString login;
+    QString passwordHash;
+};
+
+struct Item
+{
+    int id = 0;
+    QString code;
+    QString description;
+    int quantity = 0;
+    Money price;
+};
+
+struct Order
+{
+    int id = 0;
+    QString number;
+    QDate date;
+    OrderType type = OrderTypeTo;
+    OrderStatus status = OrderStatusOpen;
+};
+
+struct OrderLine
+{
+    int id = 0;
+    int orderId = 0;
+    QString orderNumber;
+    int itemId = 0;
+    int quantity = 0;
+};
+
+struct StockMovement
+{
+    qint64 id = 0;
+    int itemId = 0;
+    QDateTime movedAt;
+    qint64 delta = 0;
+};
+
+// One item's stock at one site (DatabaseManager::stockBySite)
+struct SiteStock
+{
+    QString site;
+    QString itemCode;
+    QString description;
+    qint64 quantity = 0;
+};
+
+// One handheld scan for DatabaseManager::applyScans(): a line added to an
+// open order, or a stock correction of an item
+struct Scan
+{
+    enum Kind { AddOrderLine, AdjustStock };
+
+    Kind kind = AddOrderLine;
+    QString orderNumber;   // AddOrderLine only
+    QString itemCode;
+    qint64 quantity = 0;   // line quantity, or the stock delta (may be negative)
+};
+
+struct ScanResult
+{
+    bool ok = false;
+    QString error;
+    qint64 id = 0;         // AddOrderLine: the new order line
+    qint64 quantity = 0;   // AdjustStock: stock after the correction
+};
@@ -0,0 +1,31 @@
+#include "importreportdialog.h"
+#include "csvimporter.h"
+
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QObject>
+
+void showImportReport(QWidget* parent, const CsvImportReport& report)
+{
+    if (!report.succeeded()) {
+        QMessageBox::warning(parent, QObject::tr("Import Failed"), report.summary());
+        return;
+    }
+
+    if (report.errorCount == 0) {
+        QMessageBox::information(parent, QObject::tr("Import Finished"), report.summary());
+        return;
+    }
+
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question(parent, QObject::tr("Import Finished"),
+                                  QObject::tr("%1\n\nSave the list of rejected lines?").arg(report.summary()),
+                                  QMessageBox::Yes | QMessageBox::No);
+    if (reply == QMessageBox::Yes) {
+        QString errorPath = QFileDialog::getSaveFileName(parent, QObject::tr("Save Rejected Lines"), QString(),
+                                                         QObject::tr("CSV files (*.csv)"));
+        if (!errorPath.isEmpty() && !report.writeErrors(errorPath)) {
+            QMessageBox::warning(parent, QObject::tr("Import"), QObject::tr("Failed to write %1").arg(errorPath));
+        }
+    }
+}
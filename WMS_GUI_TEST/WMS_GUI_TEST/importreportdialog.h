@@ -0,0 +1,8 @@
+#pragma once
+
+class QWidget;
+struct CsvImportReport;
+
+// Shows the outcome of a CSV import; when lines were rejected, offers to
+// save them as CSV (CsvImportReport::writeErrors)
+void showImportReport(QWidget* parent, const CsvImportReport& report);
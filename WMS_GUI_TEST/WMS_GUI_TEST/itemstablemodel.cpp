@@ -0,0 +1,46 @@
+#include "itemstablemodel.h"
+#include "money.h"
+
+ItemsTableModel::ItemsTableModel(QObject *parent) : QSqlTableModel(parent)
+{
+}
+
+QVariant ItemsTableModel::data(const QModelIndex &index, int role) const
+{
+    if (index.column() != ItemsTable::Price) {
+        return QSqlTableModel::data(index, role);
+    }
+
+    if (role == Qt::TextAlignmentRole) {
+        return QVariant(Qt::AlignRight | Qt::AlignVCenter);
+    }
+
+    QVariant value = QSqlTableModel::data(index, role);
+    if ((role != Qt::DisplayRole && role != Qt::EditRole) || value.isNull()) {
+        return value;
+    }
+
+    Money price = Money::fromMinorUnits(value.toLongLong());
+    return role == Qt::DisplayRole ? QVariant(price.toString()) : QVariant(price.toDouble());
+}
+
+bool ItemsTableModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (index.column() == ItemsTable::Price && role == Qt::EditRole && !value.isNull()) {
+        Money price;
+        if (value.userType() == qMetaTypeId<Money>()) {
+            price = value.value<Money>();
+        } else if (value.userType() == QMetaType::QString) {
+            bool ok = false;
+            price = Money::fromString(value.toString(), &ok);
+            if (!ok) {
+                return false;
+            }
+        } else {
+            price = Money::fromDouble(value.toDouble());
+        }
+        return QSqlTableModel::setData(index, price.minorUnits(), role);
+    }
+
+    return QSqlTableModel::setData(index, value, role);
+}
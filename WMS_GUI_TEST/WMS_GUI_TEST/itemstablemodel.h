@@ -0,0 +1,18 @@
+#pragma once
+
+#include <QSqlTableModel>
+#include "schema.h"
+
+// Table model for "items" that converts the stored price (integer minor
+// units) to a formatted amount for display and to a two-decimal value for
+// editors, and back to minor units on setData().
+class ItemsTableModel : public QSqlTableModel
+{
+    Q_OBJECT
+
+public:
+    explicit ItemsTableModel(QObject *parent = nullptr);
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+};
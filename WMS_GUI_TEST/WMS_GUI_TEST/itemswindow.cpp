@@ -5,6 +5,13 @@
 #include <QScreen>
 #include <QGuiApplication>
 #include <QSqlQuery>
+#include <QFileDialog>
+#include <QApplication>
+#include "metrics.h"
+#include "databasemanager.h"
+#include "tracing.h"
+#include "csvimporter.h"
+#include "importreportdialog.h"
 
 ItemsWindow::ItemsWindow(QWidget *parent) :
     QWidget(parent),
@@ -46,38 +53,51 @@ ItemsWindow::~ItemsWindow()
 
 void ItemsWindow::setupModel()
 {
-    model = new QSqlTableModel(this);
+    WMS_TRACE_SCOPE("ItemsWindow::setupModel");
+
+    model = new ItemsTableModel(this);
     model->setTable("items");
 
     // Set headers
-    model->setHeaderData(0, Qt::Horizontal, tr("ID"));
-    model->setHeaderData(1, Qt::Horizontal, tr("Item Code"));
-    model->setHeaderData(2, Qt::Horizontal, tr("Description"));
-    model->setHeaderData(3, Qt::Horizontal, tr("Quantity"));
-    model->setHeaderData(4, Qt::Horizontal, tr("Price"));
+    model->setHeaderData(ItemsTable::Id, Qt::Horizontal, tr("ID"));
+    model->setHeaderData(ItemsTable::Code, Qt::Horizontal, tr("Item Code"));
+    model->setHeaderData(ItemsTable::Description, Qt::Horizontal, tr("Description"));
+    model->setHeaderData(ItemsTable::Quantity, Qt::Horizontal, tr("Quantity"));
+    model->setHeaderData(ItemsTable::Price, Qt::Horizontal, tr("Price"));
 
     // Load data
-    model->select();
+    {
+        static MetricHistogram* const reloadTime = MetricsRegistry::instance().histogram(
+            "wms_model_reload_duration_seconds", "Time spent in model select()", "model=\"items\"");
+        ScopedMetricsTimer timer(reloadTime);
+        WMS_TRACE_SCOPE_CAT("QSqlTableModel::select", "model");
+        model->select();
+    }
 
     // Set model to table view
     ui->tableView->setModel(model);
 
     // Hide ID column
-    ui->tableView->hideColumn(0);
+    ui->tableView->hideColumn(ItemsTable::Id);
+
+    updateTotalValue();
 }
 
 void ItemsWindow::setupMapper()
 {
+    WMS_TRACE_SCOPE("ItemsWindow::setupMapper");
+
     mapper = new QDataWidgetMapper(this);
     mapper->setModel(model);
     mapper->setSubmitPolicy(QDataWidgetMapper::ManualSubmit);
 
     // Map fields to form controls
-    mapper->addMapping(ui->idLineEdit, 0);
-    mapper->addMapping(ui->codeLineEdit, 1);
-    mapper->addMapping(ui->descriptionLineEdit, 2);
-    mapper->addMapping(ui->quantitySpinBox, 3);
-    mapper->addMapping(ui->priceDoubleSpinBox, 4);
+    mapper->addMapping(ui->idLineEdit, ItemsTable::Id);
+    mapper->addMapping(ui->codeLineEdit, ItemsTable::Code);
+    mapper->addMapping(ui->descriptionLineEdit, ItemsTable::Description);
+    mapper->addMapping(ui->quantitySpinBox, ItemsTable::Quantity);
+    ui->priceDoubleSpinBox->setDecimals(Money::kDecimals);
+    mapper->addMapping(ui->priceDoubleSpinBox, ItemsTable::Price);
     if (model->rowCount() > 0) {
         ui->tableView->selectRow(0);
         mapper->setCurrentIndex(0);
@@ -106,11 +126,18 @@ void ItemsWindow::updateButtonStates(bool editMode)
     ui->addButton->setEnabled(!editMode);
     ui->editButton->setEnabled(!editMode && ui->tableView->currentIndex().isValid());
     ui->deleteButton->setEnabled(!editMode && ui->tableView->currentIndex().isValid());
+    ui->importButton->setEnabled(!editMode);
     ui->saveButton->setEnabled(editMode);
     ui->cancelButton->setEnabled(editMode);
     ui->tableView->setEnabled(!editMode);
 }
 
+void ItemsWindow::updateTotalValue()
+{
+    Money total = DatabaseManager::instance().totalStockValue();
+    ui->totalValueLabel->setText(tr("Total stock value: %1").arg(total.toString()));
+}
+
 void ItemsWindow::on_addButton_clicked()
 {
     isAdding = true;
@@ -135,13 +162,15 @@ void ItemsWindow::on_editButton_clicked()
 
 void ItemsWindow::on_deleteButton_clicked()
 {
+    WMS_TRACE_SCOPE("ItemsWindow::on_deleteButton_clicked");
+
     if (!ui->tableView->currentIndex().isValid()) {
         QMessageBox::warning(this, tr("Delete Item"), tr("Please select an item to delete."));
         return;
     }
 
     int row = ui->tableView->currentIndex().row();
-    int itemId = model->data(model->index(row, 0)).toInt();
+    int itemId = model->data(model->index(row, ItemsTable::Id)).toInt();
 
     QMessageBox::StandardButton reply;
     reply = QMessageBox::question(this, tr("Delete Item"),
@@ -168,6 +197,7 @@ void ItemsWindow::on_deleteButton_clicked()
         if (model->submitAll()) {
             model->select();
             clearForm();
+            updateTotalValue();
         } else {
             QMessageBox::warning(this, tr("Database Error"),
                                  tr("Failed to delete item: %1").arg(model->lastError().text()));
@@ -175,8 +205,29 @@ void ItemsWindow::on_deleteButton_clicked()
     }
 }
 
+void ItemsWindow::on_importButton_clicked()
+{
+    WMS_TRACE_SCOPE("ItemsWindow::on_importButton_clicked");
+
+    QString filePath = QFileDialog::getOpenFileName(this, tr("Import Items"), QString(),
+                                                    tr("CSV files (*.csv *.txt);;All files (*)"));
+    if (filePath.isEmpty()) {
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    CsvImportReport report = CsvImporter().importItems(filePath);
+    QApplication::restoreOverrideCursor();
+
+    model->select();
+    updateTotalValue();
+    showImportReport(this, report);
+}
+
 void ItemsWindow::on_saveButton_clicked()
 {
+    WMS_TRACE_SCOPE("ItemsWindow::on_saveButton_clicked");
+
     // Validate input
     if (ui->codeLineEdit->text().isEmpty()) {
         QMessageBox::warning(this, tr("Save Item"), tr("Item Code is required."));
@@ -189,10 +240,10 @@ void ItemsWindow::on_saveButton_clicked()
         int row = model->rowCount();
         model->insertRow(row);
 
-        model->setData(model->index(row, 1), ui->codeLineEdit->text());
-        model->setData(model->index(row, 2), ui->descriptionLineEdit->text());
-        model->setData(model->index(row, 3), ui->quantitySpinBox->value());
-        model->setData(model->index(row, 4), ui->priceDoubleSpinBox->value());
+        model->setData(model->index(row, ItemsTable::Code), ui->codeLineEdit->text());
+        model->setData(model->index(row, ItemsTable::Description), ui->descriptionLineEdit->text());
+        model->setData(model->index(row, ItemsTable::Quantity), ui->quantitySpinBox->value());
+        model->setData(model->index(row, ItemsTable::Price), ui->priceDoubleSpinBox->value());
     } else {
         // Update existing record
         mapper->submit();
@@ -203,6 +254,7 @@ void ItemsWindow::on_saveButton_clicked()
         enableFormFields(false);
         updateButtonStates(false);
         isAdding = false;
+        updateTotalValue();
     } else {
         QMessageBox::warning(this, tr("Database Error"),
                              tr("Failed to save item: %1").arg(model->lastError().text()));
@@ -227,6 +279,8 @@ void ItemsWindow::on_cancelButton_clicked()
 
 void ItemsWindow::on_tableView_clicked(const QModelIndex &index)
 {
+    WMS_TRACE_SCOPE("ItemsWindow::on_tableView_clicked");
+
     if (index.isValid()) {
         mapper->setCurrentIndex(index.row());
         updateButtonStates(false);
@@ -3,6 +3,7 @@
 #include <QWidget>
 #include <QSqlTableModel>
 #include <QDataWidgetMapper>
+#include "itemstablemodel.h"
 
 namespace Ui {
 class ItemsWindow;
@@ -20,13 +21,14 @@ private slots:
     void on_addButton_clicked();
     void on_editButton_clicked();
     void on_deleteButton_clicked();
+    void on_importButton_clicked();
     void on_saveButton_clicked();
     void on_cancelButton_clicked();
     void on_tableView_clicked(const QModelIndex &index);
 
 private:
     Ui::ItemsWindow *ui;
-    QSqlTableModel *model;
+    ItemsTableModel *model;
     QDataWidgetMapper *mapper;
     bool isAdding;
 
@@ -35,4 +37,5 @@ private:
     void enableFormFields(bool enable);
     void clearForm();
     void updateButtonStates(bool editMode);
+    void updateTotalValue();
 };
@@ -1,24 +1,76 @@
 #include "loginwindow.h"
 #include "mainwindow.h"
 #include "databasemanager.h"
+#include "backupmanager.h"
+#include "apiserver.h"
 #include "itemswindow.h"
 #include "orderswindow.h"
 #include "userswindow.h"
 #include "sqlquerywindow.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "wmsapplication.h"
 
-#include <QApplication>
 #include <QScreen>
 #include <QGuiApplication>
 #include <QDebug>
+#include <QSettings>
+#include <QStandardPaths>
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
+    // --server runs the handheld API (apiserver.h) without any windows
+    bool serverMode = false;
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--server") == 0) {
+            serverMode = true;
+        }
+    }
+    if (serverMode && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    WmsApplication a(argc, argv);
 
     // Set application info
     QApplication::setApplicationName("Warehouse Management System");
     QApplication::setOrganizationName("WMS Corp");
 
+    // Opt-in: expose runtime metrics on localhost and in a periodically rewritten file
+    QSettings settings;
+    if (settings.value("metrics/enabled", false).toBool()) {
+        MetricsRegistry& metrics = MetricsRegistry::instance();
+        metrics.startExporter(quint16(settings.value("metrics/port", 9464).toUInt()));
+
+        QString defaultDump = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/metrics.prom";
+        metrics.startDumping(settings.value("metrics/dumpFile", defaultDump).toString(),
+                             settings.value("metrics/dumpIntervalMs", 60000).toInt());
+    }
+
+    // Tracing can also be toggled at runtime from the main window (Ctrl+Shift+T)
+    Tracer::instance().setEnabled(settings.value("tracing/enabled", false).toBool());
+
+    if (serverMode) {
+        // Handheld workers read the database file directly
+        if (DatabaseManager::instance().isRemote()) {
+            qCritical() << "--server needs a local database; unset database/server";
+            return 1;
+        }
+        if (!DatabaseManager::instance().initializeDatabase()) {
+            qCritical() << "Failed to open the database";
+            return 1;
+        }
+        BackupManager::instance().startSchedule();
+
+        ApiServer server;
+        QString error;
+        if (!server.start(&error)) {
+            qCritical() << "Failed to start the API server:" << error;
+            return 1;
+        }
+        return a.exec();
+    }
+
     // Create the main window and login window
     LoginWindow loginWindow;
     MainWindow mainWindow;
@@ -35,6 +87,11 @@ int main(int argc, char *argv[])
         loginWindow.show();
     });
 
+    // The database is open once the login window exists; wmsd backs up a shared one
+    if (!DatabaseManager::instance().isRemote()) {
+        BackupManager::instance().startSchedule();
+    }
+
     // Show the login window
     loginWindow.show();
 
@@ -0,0 +1,293 @@
+#include "maintenancescheduler.h"
+#include "metrics.h"
+#include "tracing.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QEvent>
+#include <QSettings>
+#include <QSqlError>
+#include <QSqlQuery>
+
+// Upper bound for the adaptive incremental_vacuum slice
+static const int kMaxSlicePages = 2048;
+
+static MetricHistogram* stepDuration(const char* step)
+{
+    return MetricsRegistry::instance().histogram("wms_maintenance_step_duration_seconds",
+                                                 "Duration of idle-time database maintenance steps",
+                                                 QString("step=\"%1\"").arg(step));
+}
+
+MaintenanceScheduler::MaintenanceScheduler(const QSqlDatabase& db, QObject* parent)
+    : QObject(parent),
+      m_db(db),
+      m_lastChanges(-1),
+      m_step(StepNone),
+      m_forced(false),
+      m_hasRun(false),
+      m_idleMs(120000),
+      m_intervalMs(3600000),
+      m_analysisLimit(400),
+      m_sliceBudgetMs(5),
+      m_slicePages(16),
+      m_freedPages(0)
+{
+    connect(&m_idleTimer, &QTimer::timeout, this, &MaintenanceScheduler::checkIdle);
+    m_stepTimer.setSingleShot(true);
+    connect(&m_stepTimer, &QTimer::timeout, this, &MaintenanceScheduler::runStep);
+}
+
+MaintenanceScheduler::~MaintenanceScheduler()
+{
+    if (qApp) {
+        qApp->removeEventFilter(this);
+    }
+}
+
+void MaintenanceScheduler::start()
+{
+    QSettings settings;
+    m_idleMs = settings.value("maintenance/idleMs", 120000).toInt();
+    m_intervalMs = settings.value("maintenance/intervalMs", 3600000).toInt();
+    m_analysisLimit = settings.value("maintenance/analysisLimit", 400).toInt();
+    m_sliceBudgetMs = qMax(1, settings.value("maintenance/sliceBudgetMs", 5).toInt());
+
+    if (qApp) {
+        qApp->installEventFilter(this);
+    }
+    m_sinceActivity.start();
+    m_lastChanges = totalChanges();
+    m_idleTimer.start(qBound(1000, m_idleMs / 4, 10000));
+}
+
+void MaintenanceScheduler::stop()
+{
+    m_idleTimer.stop();
+    m_stepTimer.stop();
+    if (qApp) {
+        qApp->removeEventFilter(this);
+    }
+    m_step = StepNone;
+}
+
+void MaintenanceScheduler::runNow()
+{
+    if (isRunning()) {
+        return;
+    }
+    m_forced = true;
+    m_step = StepOptimize;
+    m_stepTimer.start(0);
+}
+
+bool MaintenanceScheduler::eventFilter(QObject* watched, QEvent* event)
+{
+    switch (event->type()) {
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::KeyPress:
+    case QEvent::Wheel:
+        m_sinceActivity.restart();
+        break;
+    default:
+        break;
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+qint64 MaintenanceScheduler::totalChanges()
+{
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT total_changes()") || !query.next()) {
+        return -1;
+    }
+    return query.value(0).toLongLong();
+}
+
+void MaintenanceScheduler::checkIdle()
+{
+    // Writes by the application count as activity as much as input does
+    qint64 changes = totalChanges();
+    if (changes != m_lastChanges) {
+        m_lastChanges = changes;
+        m_sinceActivity.restart();
+    }
+
+    if (isRunning() || m_sinceActivity.elapsed() < m_idleMs) {
+        return;
+    }
+    if (m_hasRun && m_sinceRun.elapsed() < m_intervalMs) {
+        return;
+    }
+
+    m_forced = false;
+    m_step = StepOptimize;
+    m_stepTimer.start(0);
+}
+
+void MaintenanceScheduler::runStep()
+{
+    WMS_TRACE_SCOPE_CAT("MaintenanceScheduler::runStep", "sql");
+
+    if (!m_db.isOpen()) {
+        finishRun(false);
+        return;
+    }
+
+    // Back off as soon as the user or the application is busy again
+    if (!m_forced && (m_sinceActivity.elapsed() < m_idleMs || totalChanges() != m_lastChanges)) {
+        qDebug() << "Database maintenance paused: activity resumed";
+        finishRun(false);
+        return;
+    }
+
+    bool ok = true;
+    switch (m_step) {
+    case StepOptimize:
+        ok = optimize();
+        m_step = StepVacuum;
+        m_freedPages = 0;
+        break;
+    case StepVacuum: {
+        bool done = false;
+        ok = vacuumSlice(&done);
+        if (done || !ok) {
+            m_step = StepCheckpoint;
+        }
+        break;
+    }
+    case StepCheckpoint:
+        ok = checkpoint();
+        finishRun(true);
+        return;
+    case StepNone:
+        return;
+    }
+
+    if (!ok) {
+        qDebug() << "Database maintenance step failed, continuing with the next one";
+    }
+    // Our own statements must not look like activity
+    m_lastChanges = totalChanges();
+    m_stepTimer.start(0);
+}
+
+bool MaintenanceScheduler::optimize()
+{
+    static MetricHistogram* const duration = stepDuration("optimize");
+    QElapsedTimer timer;
+    timer.start();
+
+    // analysis_limit caps the rows ANALYZE looks at per index, which bounds
+    // how long the statistics tables stay locked
+    QSqlQuery query(m_db);
+    query.exec(QString("PRAGMA analysis_limit = %1").arg(m_analysisLimit));
+    bool hasStatistics = query.exec("SELECT 1 FROM sqlite_master WHERE name = 'sqlite_stat1'") && query.next();
+    const char* statement = hasStatistics ? "PRAGMA optimize" : "ANALYZE";
+    bool ok = query.exec(statement);
+    query.finish();
+
+    qint64 micros = timer.nsecsElapsed() / 1000;
+    duration->record(quint64(micros));
+    logStep("optimize", micros, ok ? QString(statement) : query.lastError().text());
+    return ok;
+}
+
+bool MaintenanceScheduler::vacuumSlice(bool* done)
+{
+    static MetricHistogram* const duration = stepDuration("vacuum");
+
+    QSqlQuery query(m_db);
+    if (!query.exec("PRAGMA auto_vacuum") || !query.next()) {
+        return false;
+    }
+    if (query.value(0).toInt() != 2) {
+        // Not an incremental auto-vacuum database; nothing to do
+        *done = true;
+        return true;
+    }
+
+    if (!query.exec("PRAGMA freelist_count") || !query.next()) {
+        return false;
+    }
+    int freePages = query.value(0).toInt();
+    if (freePages == 0) {
+        *done = true;
+        if (m_freedPages > 0) {
+            logStep("vacuum", 0, QString("%1 pages freed in total").arg(m_freedPages));
+        }
+        return true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // The pragma frees pages as it is stepped, so it has to run to completion
+    int pages = qMin(freePages, m_slicePages);
+    bool ok = query.exec(QString("PRAGMA incremental_vacuum(%1)").arg(pages));
+    while (ok && query.next()) {
+    }
+    query.finish();
+
+    qint64 micros = timer.nsecsElapsed() / 1000;
+    duration->record(quint64(micros));
+    if (!ok) {
+        logStep("vacuum", micros, query.lastError().text());
+        return false;
+    }
+    m_freedPages += pages;
+
+    // Keep every slice's write transaction within the budget
+    qint64 budget = qint64(m_sliceBudgetMs) * 1000;
+    if (micros > budget) {
+        m_slicePages = qMax(1, m_slicePages / 2);
+        logStep("vacuum", micros, QString("%1 pages, over budget; slice reduced to %2 pages").arg(pages).arg(m_slicePages));
+    } else if (micros < budget / 2 && pages == m_slicePages) {
+        m_slicePages = qMin(kMaxSlicePages, m_slicePages * 2);
+    }
+    return true;
+}
+
+bool MaintenanceScheduler::checkpoint()
+{
+    static MetricHistogram* const duration = stepDuration("checkpoint");
+    QElapsedTimer timer;
+    timer.start();
+
+    // PASSIVE copies what it can without waiting for readers or writers
+    QSqlQuery query(m_db);
+    bool ok = query.exec("PRAGMA wal_checkpoint(PASSIVE)") && query.next();
+    QString details = ok ? QString("busy %1, %2 WAL frames, %3 checkpointed")
+                               .arg(query.value(0).toInt())
+                               .arg(query.value(1).toInt())
+                               .arg(query.value(2).toInt())
+                         : query.lastError().text();
+    query.finish();
+
+    qint64 micros = timer.nsecsElapsed() / 1000;
+    duration->record(quint64(micros));
+    logStep("checkpoint", micros, details);
+    return ok;
+}
+
+void MaintenanceScheduler::finishRun(bool completed)
+{
+    m_stepTimer.stop();
+    m_step = StepNone;
+    m_forced = false;
+    m_lastChanges = totalChanges();
+    if (completed) {
+        m_hasRun = true;
+        m_sinceRun.start();
+    }
+    emit runFinished(completed);
+}
+
+void MaintenanceScheduler::logStep(const char* step, qint64 micros, const QString& details)
+{
+    qDebug().noquote() << QString("Database maintenance: %1 took %2 ms (%3)")
+                              .arg(step)
+                              .arg(micros / 1000.0, 0, 'f', 1)
+                              .arg(details);
+}
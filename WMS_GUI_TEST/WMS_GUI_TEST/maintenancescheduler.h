@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSqlDatabase>
+#include <QString>
+#include <QTimer>
+
+// Housekeeping on the main connection while the application is idle:
+//   optimize    PRAGMA optimize under PRAGMA analysis_limit, so planner
+//               statistics follow the data (a bounded ANALYZE on first run)
+//   vacuum      PRAGMA incremental_vacuum in slices of a few pages, each its
+//               own short write transaction; the slice size adapts so a
+//               slice stays within "maintenance/sliceBudgetMs"
+//   checkpoint  PRAGMA wal_checkpoint(PASSIVE), which never waits for or
+//               blocks other connections
+//
+// The connection counts as idle once no keyboard or mouse input reached the
+// application and total_changes() stayed the same for "maintenance/idleMs".
+// A run is one pass over the steps, at most every "maintenance/intervalMs";
+// it yields to the event loop between steps and slices and stops as soon as
+// activity resumes, continuing at the next idle period. Every step is logged
+// with its duration and recorded in wms_maintenance_step_duration_seconds.
+//
+// incremental_vacuum only frees pages in databases created with
+// auto_vacuum = INCREMENTAL, which DatabaseManager does for new files; older
+// files need a one-off VACUUM, which is not done here as it locks the
+// database for its whole duration.
+class MaintenanceScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    MaintenanceScheduler(const QSqlDatabase& db, QObject* parent = nullptr);
+    ~MaintenanceScheduler();
+
+    // Reads the "maintenance/*" settings and starts watching for idle periods
+    void start();
+    void stop();
+    bool isRunning() const { return m_step != StepNone; }
+
+    // Starts a run immediately, ignoring idle detection and the interval
+    void runNow();
+
+signals:
+    void runFinished(bool completed);
+
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+
+private:
+    enum Step { StepNone, StepOptimize, StepVacuum, StepCheckpoint };
+
+    void checkIdle();
+    void runStep();
+    bool optimize();
+    bool vacuumSlice(bool* done);
+    bool checkpoint();
+    void finishRun(bool completed);
+    qint64 totalChanges();
+    void logStep(const char* step, qint64 micros, const QString& details);
+
+    QSqlDatabase m_db;
+    QTimer m_idleTimer;
+    QTimer m_stepTimer;
+    QElapsedTimer m_sinceActivity;
+    QElapsedTimer m_sinceRun;
+    qint64 m_lastChanges;
+    Step m_step;
+    bool m_forced;
+    bool m_hasRun;
+    int m_idleMs;
+    int m_intervalMs;
+    int m_analysisLimit;
+    int m_sliceBudgetMs;
+    int m_slicePages;
+    int m_freedPages;
+};
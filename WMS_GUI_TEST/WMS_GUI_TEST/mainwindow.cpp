@@ -4,6 +4,23 @@
 #include <QScreen>
 #include <QMessageBox>
 #include <QDebug>
+#include "metrics.h"
+#include "tracing.h"
+#include "backupmanager.h"
+#include "databasemanager.h"
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QShortcut>
+#include <QStatusBar>
+#include <QStandardPaths>
+#include <QDateTime>
+
+static MetricHistogram* windowOpenTime(const char* window)
+{
+    return MetricsRegistry::instance().histogram("wms_window_open_duration_seconds",
+                                                 "Time to create and show a child window",
+                                                 QString("window=\"%1\"").arg(window));
+}
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
@@ -20,7 +37,8 @@ void MainWindow::closeEvent(QCloseEvent *event)
     itemsWindow(nullptr),
     ordersWindow(nullptr),
     usersWindow(nullptr),
-    sqlQueryWindow(nullptr)
+    sqlQueryWindow(nullptr),
+    reportsWindow(nullptr)
 {
     ui->setupUi(this);
 
@@ -33,6 +51,24 @@ void MainWindow::closeEvent(QCloseEvent *event)
     int x = (screenGeometry.width() - width()) / 2;
     int y = (screenGeometry.height() - height()) / 2;
     move(x, y);
+
+    // Ctrl+Shift+T starts a trace; pressing it again writes the trace file
+    QShortcut *traceShortcut = new QShortcut(QKeySequence(tr("Ctrl+Shift+T")), this);
+    traceShortcut->setContext(Qt::ApplicationShortcut);
+    connect(traceShortcut, &QShortcut::activated, this, &MainWindow::toggleTracing);
+
+    // Scheduled backups report here as well as the ones started by hand
+    BackupManager &backups = BackupManager::instance();
+    connect(&backups, &BackupManager::backupProgress, this, [this](int percent) {
+        statusBar()->showMessage(tr("Backing up database... %1%").arg(percent));
+    });
+    connect(&backups, &BackupManager::restoreProgress, this, [this](int percent) {
+        statusBar()->showMessage(tr("Restoring database... %1%").arg(percent));
+    });
+    connect(&backups, &BackupManager::backupFinished, this, &MainWindow::backupFinished);
+    connect(&backups, &BackupManager::restoreFinished, this, &MainWindow::restoreFinished);
+
+    loadSites();
 }
 
 MainWindow::~MainWindow()
@@ -48,6 +84,9 @@ void MainWindow::show()
 
 void MainWindow::on_itemsButton_clicked()
 {
+    static MetricHistogram* const openTime = windowOpenTime("items");
+    ScopedMetricsTimer timer(openTime);
+
     if (!itemsWindow) {
         itemsWindow = new ItemsWindow();
         childWindows.append(itemsWindow);
@@ -60,6 +99,9 @@ void MainWindow::on_itemsButton_clicked()
 
 void MainWindow::on_ordersButton_clicked()
 {
+    static MetricHistogram* const openTime = windowOpenTime("orders");
+    ScopedMetricsTimer timer(openTime);
+
     if (!ordersWindow) {
         ordersWindow = new OrdersWindow();
         childWindows.append(ordersWindow);
@@ -72,6 +114,9 @@ void MainWindow::on_ordersButton_clicked()
 
 void MainWindow::on_usersButton_clicked()
 {
+    static MetricHistogram* const openTime = windowOpenTime("users");
+    ScopedMetricsTimer timer(openTime);
+
     if (!usersWindow) {
         usersWindow = new UsersWindow();
         childWindows.append(usersWindow);
@@ -84,6 +129,9 @@ void MainWindow::on_usersButton_clicked()
 
 void MainWindow::on_sqlQueryButton_clicked()
 {
+    static MetricHistogram* const openTime = windowOpenTime("sql_query");
+    ScopedMetricsTimer timer(openTime);
+
     if (!sqlQueryWindow) {
         sqlQueryWindow = new SQLQueryWindow();
         childWindows.append(sqlQueryWindow);
@@ -94,6 +142,21 @@ void MainWindow::on_sqlQueryButton_clicked()
     sqlQueryWindow->activateWindow();
 }
 
+void MainWindow::on_reportsButton_clicked()
+{
+    static MetricHistogram* const openTime = windowOpenTime("reports");
+    ScopedMetricsTimer timer(openTime);
+
+    if (!reportsWindow) {
+        reportsWindow = new ReportsWindow();
+        childWindows.append(reportsWindow);
+    }
+
+    reportsWindow->show();
+    reportsWindow->raise();
+    reportsWindow->activateWindow();
+}
+
 void MainWindow::on_logoutButton_clicked()
 {
     QMessageBox::StandardButton reply;
@@ -133,5 +196,141 @@ void MainWindow::closeAllChildWindows()
         sqlQueryWindow = nullptr;
     }
 
+    if (reportsWindow) {
+        reportsWindow->close();
+        delete reportsWindow;
+        reportsWindow = nullptr;
+    }
+
     childWindows.clear();
 }
+
+void MainWindow::toggleTracing()
+{
+    Tracer &tracer = Tracer::instance();
+
+    if (!Tracer::isEnabled()) {
+        tracer.clear();
+        tracer.setEnabled(true);
+        statusBar()->showMessage(tr("Tracing started. Press Ctrl+Shift+T again to save the trace."));
+        return;
+    }
+
+    tracer.setEnabled(false);
+    QString fileName = QString("trace-%1.json").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+    QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/" + fileName;
+
+    if (tracer.writeTrace(path)) {
+        statusBar()->showMessage(tr("Trace saved to %1").arg(path));
+    } else {
+        statusBar()->showMessage(tr("Failed to save trace to %1").arg(path));
+    }
+}
+
+void MainWindow::on_backupButton_clicked()
+{
+    QString error;
+    if (!BackupManager::instance().backupNow(&error)) {
+        QMessageBox::warning(this, tr("Backup"), tr("Could not start the backup: %1").arg(error));
+        return;
+    }
+    statusBar()->showMessage(tr("Backing up database..."));
+}
+
+void MainWindow::on_restoreButton_clicked()
+{
+    BackupManager &backups = BackupManager::instance();
+    if (backups.isBusy()) {
+        QMessageBox::information(this, tr("Restore"), tr("A backup or restore is already running."));
+        return;
+    }
+
+    QString path = QFileDialog::getOpenFileName(this, tr("Restore Database"), backups.backupDirectory(),
+                                                tr("Database backups (*.db);;All files (*)"));
+    if (path.isEmpty()) {
+        return;
+    }
+
+    QMessageBox::StandardButton reply = QMessageBox::question(
+        this, tr("Restore"),
+        tr("Replace the current database with %1?\n\nAll open windows will be closed. "
+           "The current database is kept as wms.db.old.").arg(QFileInfo(path).fileName()),
+        QMessageBox::Yes | QMessageBox::No);
+    if (reply != QMessageBox::Yes) {
+        return;
+    }
+
+    // Their models hold the connection that is about to be closed
+    closeAllChildWindows();
+
+    QString error;
+    if (!backups.restore(path, &error)) {
+        QMessageBox::warning(this, tr("Restore"), tr("Could not start the restore: %1").arg(error));
+        return;
+    }
+    centralWidget()->setEnabled(false);
+    statusBar()->showMessage(tr("Restoring database..."));
+}
+
+void MainWindow::loadSites()
+{
+    // Only offered when more than one site is configured ("sites/list")
+    DatabaseManager &db = DatabaseManager::instance();
+    QStringList sites = db.sites();
+    ui->siteComboBox->clear();
+    ui->siteComboBox->addItems(sites);
+    ui->siteComboBox->setCurrentText(db.currentSite());
+    ui->siteLabel->setVisible(sites.size() > 1);
+    ui->siteComboBox->setVisible(sites.size() > 1);
+}
+
+void MainWindow::on_siteComboBox_activated(int index)
+{
+    DatabaseManager &db = DatabaseManager::instance();
+    QString site = ui->siteComboBox->itemText(index);
+    if (site == db.currentSite()) {
+        return;
+    }
+
+    QMessageBox::StandardButton reply = QMessageBox::question(
+        this, tr("Switch Site"), tr("Switch to site %1?\n\nAll open windows will be closed.").arg(site),
+        QMessageBox::Yes | QMessageBox::No);
+    if (reply != QMessageBox::Yes) {
+        ui->siteComboBox->setCurrentText(db.currentSite());
+        return;
+    }
+
+    // Their models hold the connection that is about to be closed
+    closeAllChildWindows();
+
+    QString error;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    bool ok = db.switchSite(site, &error);
+    QApplication::restoreOverrideCursor();
+    if (!ok) {
+        QMessageBox::critical(this, tr("Switch Site"), tr("Could not switch to site %1: %2").arg(site, error));
+    } else {
+        statusBar()->showMessage(tr("Switched to site %1").arg(site));
+    }
+    loadSites();
+}
+
+void MainWindow::backupFinished(bool ok, const QString& filePathOrError)
+{
+    if (ok) {
+        statusBar()->showMessage(tr("Database backed up to %1").arg(filePathOrError));
+    } else {
+        statusBar()->showMessage(tr("Backup failed: %1").arg(filePathOrError));
+    }
+}
+
+void MainWindow::restoreFinished(bool ok, const QString& errorMessage)
+{
+    centralWidget()->setEnabled(true);
+    if (ok) {
+        statusBar()->showMessage(tr("Database restored"));
+    } else {
+        statusBar()->clearMessage();
+        QMessageBox::critical(this, tr("Restore"), tr("Restore failed: %1").arg(errorMessage));
+    }
+}
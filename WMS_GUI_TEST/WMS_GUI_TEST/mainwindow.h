@@ -7,6 +7,7 @@
 #include "orderswindow.h"
 #include "userswindow.h"
 #include "sqlquerywindow.h"
+#include "reportswindow.h"
 
 namespace Ui {
 class MainWindow;
@@ -31,7 +32,14 @@ private slots:
     void on_ordersButton_clicked();
     void on_usersButton_clicked();
     void on_sqlQueryButton_clicked();
+    void on_reportsButton_clicked();
     void on_logoutButton_clicked();
+    void on_backupButton_clicked();
+    void on_restoreButton_clicked();
+    void on_siteComboBox_activated(int index);
+    void toggleTracing();
+    void backupFinished(bool ok, const QString& filePathOrError);
+    void restoreFinished(bool ok, const QString& errorMessage);
 
 signals:
     void logoutRequested();
@@ -42,7 +50,9 @@ private:
     OrdersWindow* ordersWindow;
     UsersWindow* usersWindow;
     SQLQueryWindow* sqlQueryWindow;
+    ReportsWindow* reportsWindow;
     QVector<QWidget*> childWindows;
 
     void closeAllChildWindows();
+    void loadSites();
 };
@@ -0,0 +1,290 @@
+#include "metrics.h"
+#include "metricsserver.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QDebug>
+#include <bit>
+
+void MetricHistogram::record(quint64 micros)
+{
+    m_buckets[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(micros, std::memory_order_relaxed);
+
+    quint64 currentMax = m_max.load(std::memory_order_relaxed);
+    while (micros > currentMax
+           && !m_max.compare_exchange_weak(currentMax, micros, std::memory_order_relaxed)) {
+    }
+}
+
+int MetricHistogram::bucketIndex(quint64 micros)
+{
+    if (micros < kLinearBuckets) {
+        return int(micros);
+    }
+
+    int exponent = 63 - std::countl_zero(micros);
+    if (exponent > kMaxExponent) {
+        return kBucketCount - 1;
+    }
+
+    int sub = int((micros >> (exponent - 3)) & (kSubBuckets - 1));
+    return kLinearBuckets + (exponent - 4) * kSubBuckets + sub;
+}
+
+quint64 MetricHistogram::bucketUpperBound(int index)
+{
+    if (index < kLinearBuckets) {
+        return quint64(index);
+    }
+
+    int exponent = (index - kLinearBuckets) / kSubBuckets + 4;
+    int sub = (index - kLinearBuckets) % kSubBuckets;
+    return (quint64(kSubBuckets + sub + 1) << (exponent - 3)) - 1;
+}
+
+quint64 MetricHistogram::quantile(double q) const
+{
+    quint64 total = count();
+    if (total == 0) {
+        return 0;
+    }
+
+    quint64 rank = quint64(q * double(total));
+    quint64 seen = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+        seen += bucketValue(i);
+        if (seen > rank) {
+            return qMin(bucketUpperBound(i), max());
+        }
+    }
+    return max();
+}
+
+MetricsRegistry::MetricsRegistry(QObject* parent) : QObject(parent), m_server(nullptr)
+{
+    connect(&m_dumpTimer, &QTimer::timeout, this, [this]() {
+        writeDump(m_dumpPath);
+    });
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+}
+
+MetricsRegistry& MetricsRegistry::instance()
+{
+    static MetricsRegistry instance;
+    return instance;
+}
+
+MetricsRegistry::Family* MetricsRegistry::family(const QString& name, const QString& help, Kind kind)
+{
+    Family* existing = m_familyByName.value(name, nullptr);
+    if (existing) {
+        if (existing->kind != kind) {
+            qDebug() << "Metric" << name << "registered with conflicting types";
+        }
+        return existing;
+    }
+
+    auto created = std::make_unique<Family>();
+    created->name = name;
+    created->help = help;
+    created->kind = kind;
+    Family* result = created.get();
+    m_families.push_back(std::move(created));
+    m_familyByName.insert(name, result);
+    return result;
+}
+
+int MetricsRegistry::seriesIndex(Family* family, const QString& labels)
+{
+    for (size_t i = 0; i < family->labels.size(); ++i) {
+        if (family->labels[i] == labels) {
+            return int(i);
+        }
+    }
+
+    family->labels.push_back(labels);
+    switch (family->kind) {
+    case Kind::Counter:
+        family->counters.push_back(std::make_unique<MetricCounter>());
+        break;
+    case Kind::Gauge:
+        family->gauges.push_back(std::make_unique<MetricGauge>());
+        break;
+    case Kind::Histogram:
+        family->histograms.push_back(std::make_unique<MetricHistogram>());
+        break;
+    }
+    return int(family->labels.size() - 1);
+}
+
+MetricCounter* MetricsRegistry::counter(const QString& name, const QString& help, const QString& labels)
+{
+    QMutexLocker locker(&m_mutex);
+    Family* f = family(name, help, Kind::Counter);
+    if (f->kind != Kind::Counter) {
+        return nullptr;
+    }
+    return f->counters[seriesIndex(f, labels)].get();
+}
+
+MetricGauge* MetricsRegistry::gauge(const QString& name, const QString& help, const QString& labels)
+{
+    QMutexLocker locker(&m_mutex);
+    Family* f = family(name, help, Kind::Gauge);
+    if (f->kind != Kind::Gauge) {
+        return nullptr;
+    }
+    return f->gauges[seriesIndex(f, labels)].get();
+}
+
+MetricHistogram* MetricsRegistry::histogram(const QString& name, const QString& help, const QString& labels)
+{
+    QMutexLocker locker(&m_mutex);
+    Family* f = family(name, help, Kind::Histogram);
+    if (f->kind != Kind::Histogram) {
+        return nullptr;
+    }
+    return f->histograms[seriesIndex(f, labels)].get();
+}
+
+static QString joinLabels(const QString& labels, const QString& extra)
+{
+    if (labels.isEmpty() && extra.isEmpty()) {
+        return QString();
+    }
+    if (labels.isEmpty()) {
+        return "{" + extra + "}";
+    }
+    if (extra.isEmpty()) {
+        return "{" + labels + "}";
+    }
+    return "{" + labels + "," + extra + "}";
+}
+
+QByteArray MetricsRegistry::prometheusText() const
+{
+    // Exported bucket boundaries in seconds; the internal buckets are folded into these
+    static const double bounds[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+                                    0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+
+    QMutexLocker locker(&m_mutex);
+    QString out;
+
+    for (const auto& f : m_families) {
+        out += QString("# HELP %1 %2\n").arg(f->name, f->help);
+
+        switch (f->kind) {
+        case Kind::Counter:
+            out += QString("# TYPE %1 counter\n").arg(f->name);
+            for (size_t i = 0; i < f->labels.size(); ++i) {
+                out += QString("%1%2 %3\n").arg(f->name, joinLabels(f->labels[i], QString()))
+                           .arg(f->counters[i]->value());
+            }
+            break;
+
+        case Kind::Gauge:
+            out += QString("# TYPE %1 gauge\n").arg(f->name);
+            for (size_t i = 0; i < f->labels.size(); ++i) {
+                out += QString("%1%2 %3\n").arg(f->name, joinLabels(f->labels[i], QString()))
+                           .arg(f->gauges[i]->value());
+            }
+            break;
+
+        case Kind::Histogram:
+            out += QString("# TYPE %1 histogram\n").arg(f->name);
+            for (size_t i = 0; i < f->labels.size(); ++i) {
+                const MetricHistogram* h = f->histograms[i].get();
+                quint64 cumulative = 0;
+                int bucket = 0;
+                for (double bound : bounds) {
+                    quint64 boundMicros = quint64(bound * 1e6);
+                    while (bucket < MetricHistogram::kBucketCount
+                           && MetricHistogram::bucketUpperBound(bucket) <= boundMicros) {
+                        cumulative += h->bucketValue(bucket);
+                        ++bucket;
+                    }
+                    out += QString("%1_bucket%2 %3\n")
+                               .arg(f->name, joinLabels(f->labels[i], QString("le=\"%1\"").arg(bound)))
+                               .arg(cumulative);
+                }
+                out += QString("%1_bucket%2 %3\n")
+                           .arg(f->name, joinLabels(f->labels[i], "le=\"+Inf\""))
+                           .arg(h->count());
+                // arg(double) keeps only six significant digits
+                out += QString("%1_sum%2 %3\n").arg(f->name, joinLabels(f->labels[i], QString()))
+                           .arg(QString::number(double(h->sum()) / 1e6, 'g', 17));
+                out += QString("%1_count%2 %3\n").arg(f->name, joinLabels(f->labels[i], QString()))
+                           .arg(h->count());
+            }
+            break;
+        }
+    }
+
+    return out.toUtf8();
+}
+
+bool MetricsRegistry::startExporter(quint16 port)
+{
+    stopOnQuit();
+    if (!m_server) {
+        m_server = new MetricsServer(this);
+    }
+
+    if (m_server->isListening()) {
+        return true;
+    }
+
+    if (!m_server->listen(QHostAddress::LocalHost, port)) {
+        qDebug() << "Failed to start metrics endpoint:" << m_server->errorString();
+        return false;
+    }
+
+    qDebug() << "Metrics endpoint listening on" << QString("http://127.0.0.1:%1/metrics").arg(port);
+    return true;
+}
+
+void MetricsRegistry::startDumping(const QString& filePath, int intervalMs)
+{
+    stopOnQuit();
+    m_dumpPath = filePath;
+    if (intervalMs > 0 && !filePath.isEmpty()) {
+        m_dumpTimer.start(intervalMs);
+    } else {
+        m_dumpTimer.stop();
+    }
+}
+
+void MetricsRegistry::stopOnQuit()
+{
+    // The registry is a function-local static and outlives the application,
+    // so its timer and server must go while the event loop still exists
+    if (QCoreApplication* app = QCoreApplication::instance()) {
+        connect(app, &QCoreApplication::aboutToQuit, this, &MetricsRegistry::shutdown, Qt::UniqueConnection);
+    }
+}
+
+void MetricsRegistry::shutdown()
+{
+    m_dumpTimer.stop();
+    delete m_server;
+    m_server = nullptr;
+}
+
+bool MetricsRegistry::writeDump(const QString& filePath) const
+{
+    // QSaveFile renames into place, so a scraper never sees a half-written file
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to write metrics dump:" << file.errorString();
+        return false;
+    }
+
+    file.write(prometheusText());
+    return file.commit();
+}
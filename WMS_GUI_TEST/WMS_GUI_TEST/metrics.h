@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <atomic>
+#include <array>
+#include <memory>
+#include <vector>
+
+class MetricsServer;
+
+// Monotonic counter, safe to increment from any thread
+class MetricCounter
+{
+public:
+    void inc(quint64 n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value{0};
+};
+
+// Value that can go up and down (queue depths, open windows, ...)
+class MetricGauge
+{
+public:
+    void set(qint64 v) { m_value.store(v, std::memory_order_relaxed); }
+    void add(qint64 n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_value{0};
+};
+
+// Log-linear histogram of microsecond values (HDR style, ~12% relative error).
+// Values below 16us get one bucket each, above that every power of two is
+// split into 8 sub-buckets.
+class MetricHistogram
+{
+public:
+    static constexpr int kLinearBuckets = 16;
+    static constexpr int kSubBuckets = 8;
+    static constexpr int kMaxExponent = 40;
+    static constexpr int kBucketCount = kLinearBuckets + (kMaxExponent - 4 + 1) * kSubBuckets;
+
+    void record(quint64 micros);
+
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    quint64 sum() const { return m_sum.load(std::memory_order_relaxed); }
+    quint64 max() const { return m_max.load(std::memory_order_relaxed); }
+    quint64 bucketValue(int index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+
+    // Approximate value (upper bucket bound) below which q of the samples fall
+    quint64 quantile(double q) const;
+
+    static int bucketIndex(quint64 micros);
+    static quint64 bucketUpperBound(int index);
+
+private:
+    std::array<std::atomic<quint64>, kBucketCount> m_buckets{};
+    std::atomic<quint64> m_count{0};
+    std::atomic<quint64> m_sum{0};
+    std::atomic<quint64> m_max{0};
+};
+
+// Records the lifetime of the scope into a histogram
+class ScopedMetricsTimer
+{
+public:
+    explicit ScopedMetricsTimer(MetricHistogram* histogram) : m_histogram(histogram) { m_timer.start(); }
+    ~ScopedMetricsTimer() { if (m_histogram) m_histogram->record(quint64(m_timer.nsecsElapsed() / 1000)); }
+
+private:
+    MetricHistogram* m_histogram;
+    QElapsedTimer m_timer;
+};
+
+class MetricsRegistry : public QObject
+{
+    Q_OBJECT
+
+public:
+    static MetricsRegistry& instance();
+
+    // Registration takes a lock; callers on hot paths should cache the returned
+    // pointer (e.g. in a function-local static). Pointers stay valid for the
+    // lifetime of the process. Labels use Prometheus syntax: op="addItem"
+    MetricCounter* counter(const QString& name, const QString& help, const QString& labels = QString());
+    MetricGauge* gauge(const QString& name, const QString& help, const QString& labels = QString());
+    MetricHistogram* histogram(const QString& name, const QString& help, const QString& labels = QString());
+
+    QByteArray prometheusText() const;
+
+    bool startExporter(quint16 port);
+    void startDumping(const QString& filePath, int intervalMs);
+    bool writeDump(const QString& filePath) const;
+    // Stops the exporter and the dump timer; called on QCoreApplication::aboutToQuit
+    void shutdown();
+
+private:
+    MetricsRegistry(QObject* parent = nullptr);
+    ~MetricsRegistry();
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    enum class Kind { Counter, Gauge, Histogram };
+
+    struct Family {
+        QString name;
+        QString help;
+        Kind kind;
+        std::vector<QString> labels;
+        std::vector<std::unique_ptr<MetricCounter>> counters;
+        std::vector<std::unique_ptr<MetricGauge>> gauges;
+        std::vector<std::unique_ptr<MetricHistogram>> histograms;
+    };
+
+    Family* family(const QString& name, const QString& help, Kind kind);
+    int seriesIndex(Family* family, const QString& labels);
+    void stopOnQuit();
+
+    mutable QMutex m_mutex;
+    std::vector<std::unique_ptr<Family>> m_families;
+    QHash<QString, Family*> m_familyByName;
+
+    MetricsServer* m_server;
+    QTimer m_dumpTimer;
+    QString m_dumpPath;
+};
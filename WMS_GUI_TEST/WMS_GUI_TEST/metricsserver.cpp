@@ -0,0 +1,49 @@
+#include "metricsserver.h"
+#include "metrics.h"
+
+MetricsServer::MetricsServer(QObject *parent) : QTcpServer(parent)
+{
+    connect(this, &QTcpServer::newConnection, this, &MetricsServer::handleNewConnection);
+}
+
+void MetricsServer::handleNewConnection()
+{
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            handleRequest(socket);
+        });
+    }
+}
+
+void MetricsServer::handleRequest(QTcpSocket *socket)
+{
+    // Wait until the full request header has arrived
+    if (!socket->peek(socket->bytesAvailable()).contains("\r\n\r\n")) {
+        if (socket->bytesAvailable() > 8192) {
+            socket->abort();
+        }
+        return;
+    }
+
+    QByteArray requestLine = socket->readLine().trimmed();
+    socket->readAll();
+
+    QList<QByteArray> parts = requestLine.split(' ');
+    QByteArray status;
+    QByteArray body;
+    if (parts.size() >= 2 && parts[0] == "GET" && (parts[1] == "/metrics" || parts[1] == "/")) {
+        status = "200 OK";
+        body = MetricsRegistry::instance().prometheusText();
+    } else {
+        status = "404 Not Found";
+        body = "Not found\n";
+    }
+
+    QByteArray response = "HTTP/1.1 " + status + "\r\n"
+                          "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                          "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n" + body;
+    socket->write(response);
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <QTcpServer>
+#include <QTcpSocket>
+
+// Minimal HTTP endpoint serving the metrics registry in Prometheus text format.
+// Only GET /metrics is understood; the connection is closed after each response.
+class MetricsServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsServer(QObject *parent = nullptr);
+
+private slots:
+    void handleNewConnection();
+
+private:
+    void handleRequest(QTcpSocket *socket);
+};
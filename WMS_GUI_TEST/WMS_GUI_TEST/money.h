@@ -0,0 +1,135 @@
+#pragma once
+
+#include <QMetaType>
+#include <QString>
+#include <cmath>
+#include <compare>
+#include <cstddef>
+#include <limits>
+#include <string_view>
+
+// Fixed-point currency amount stored as a signed count of minor units
+// (cents). Used for items.price, which is persisted as an INTEGER column,
+// so sums over the items table are exact.
+class Money
+{
+public:
+    static constexpr int kDecimals = 2;
+    static constexpr qint64 kMinorPerMajor = 100;
+
+    constexpr Money() = default;
+
+    static constexpr Money fromMinorUnits(qint64 minor) { return Money(minor); }
+
+    // Rounds to the nearest minor unit; meant for values coming from
+    // QDoubleSpinBox and similar editors that already hold two decimals
+    static Money fromDouble(double value) { return Money(std::llround(value * double(kMinorPerMajor))); }
+
+    // Parses "1234", "1234.5", "-0.05" with surrounding whitespace; more
+    // than kDecimals fraction digits or an amount outside the range of
+    // qint64 minor units is an error
+    static bool parse(std::string_view text, Money& value);
+    static Money fromString(const QString& text, bool* ok = nullptr);
+
+    constexpr qint64 minorUnits() const { return m_minor; }
+    double toDouble() const { return double(m_minor) / double(kMinorPerMajor); }
+    QString toString() const;
+
+    // Exact sum of prices[i] * quantities[i]; a plain loop the compiler can vectorize
+    static Money sumProducts(const qint64* prices, const qint64* quantities, std::size_t count);
+
+    constexpr Money operator+(Money other) const { return Money(m_minor + other.m_minor); }
+    constexpr Money operator-(Money other) const { return Money(m_minor - other.m_minor); }
+    constexpr Money operator*(qint64 factor) const { return Money(m_minor * factor); }
+    constexpr Money operator-() const { return Money(-m_minor); }
+    Money& operator+=(Money other) { m_minor += other.m_minor; return *this; }
+    Money& operator-=(Money other) { m_minor -= other.m_minor; return *this; }
+
+    constexpr bool operator==(const Money& other) const = default;
+    constexpr auto operator<=>(const Money& other) const = default;
+
+private:
+    constexpr explicit Money(qint64 minor) : m_minor(minor) {}
+
+    qint64 m_minor = 0;
+};
+
+Q_DECLARE_METATYPE(Money)
+
+inline bool Money::parse(std::string_view text, Money& value)
+{
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v'; };
+    while (!text.empty() && isSpace(text.front())) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && isSpace(text.back())) {
+        text.remove_suffix(1);
+    }
+    bool negative = !text.empty() && text.front() == '-';
+    if (negative || (!text.empty() && text.front() == '+')) {
+        text.remove_prefix(1);
+    }
+
+    size_t dot = text.find('.');
+    std::string_view whole = text.substr(0, dot);
+    std::string_view fraction = dot == std::string_view::npos ? std::string_view() : text.substr(dot + 1);
+    if ((whole.empty() && fraction.empty()) || fraction.size() > size_t(kDecimals)) {
+        return false;
+    }
+
+    qint64 major = 0;
+    for (char c : whole) {
+        if (c < '0' || c > '9' || major > (std::numeric_limits<qint64>::max() - (c - '0')) / 10) {
+            return false;
+        }
+        major = major * 10 + (c - '0');
+    }
+
+    qint64 minor = 0;
+    for (char c : fraction) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        minor = minor * 10 + (c - '0');
+    }
+    for (size_t i = fraction.size(); i < size_t(kDecimals); ++i) {
+        minor *= 10;
+    }
+
+    // major * kMinorPerMajor + minor must fit in qint64
+    if (major > (std::numeric_limits<qint64>::max() - minor) / kMinorPerMajor) {
+        return false;
+    }
+    qint64 total = major * kMinorPerMajor + minor;
+    value = Money(negative ? -total : total);
+    return true;
+}
+
+inline Money Money::fromString(const QString& text, bool* ok)
+{
+    QByteArray utf8 = text.toUtf8();
+    Money value;
+    bool valid = parse(std::string_view(utf8.constData(), size_t(utf8.size())), value);
+    if (ok) {
+        *ok = valid;
+    }
+    return valid ? value : Money();
+}
+
+inline QString Money::toString() const
+{
+    qint64 absolute = m_minor < 0 ? -m_minor : m_minor;
+    return QString("%1%2.%3")
+        .arg(QString(m_minor < 0 ? "-" : ""))
+        .arg(absolute / kMinorPerMajor)
+        .arg(absolute % kMinorPerMajor, kDecimals, 10, QChar('0'));
+}
+
+inline Money Money::sumProducts(const qint64* prices, const qint64* quantities, std::size_t count)
+{
+    qint64 total = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        total += prices[i] * quantities[i];
+    }
+    return Money(total);
+}
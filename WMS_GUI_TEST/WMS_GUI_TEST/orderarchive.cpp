@@ -0,0 +1,536 @@
+#include "orderarchive.h"
+#include "databasemanager.h"
+#include "repositories.h"
+#include "sqlitestatement.h"
+#include "tracing.h"
+#include "varint.h"
+
+#include <QHash>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+static const char kMagic[] = "WMSARC01";
+static const qsizetype kMagicSize = 8;
+static const quint64 kFormatVersion = 1;
+
+namespace {
+
+enum PageEncoding : quint8 { DeltaEncoding, DictionaryEncoding, PlainEncoding, StringEncoding };
+
+constexpr std::array<PageEncoding, ArchiveColumnCount> kColumnEncodings = {
+    DeltaEncoding,       // ArchiveLineId
+    DeltaEncoding,       // ArchiveOrderId
+    StringEncoding,      // ArchiveOrderNumber
+    DeltaEncoding,       // ArchiveDate
+    DictionaryEncoding,  // ArchiveType
+    DictionaryEncoding,  // ArchiveStatus
+    DictionaryEncoding,  // ArchiveItemId
+    PlainEncoding,       // ArchiveQuantity
+};
+
+void encodeDelta(QByteArray& out, const std::vector<qint64>& values)
+{
+    qint64 previous = 0;
+    for (qint64 value : values) {
+        appendSignedVarint(out, value - previous);
+        previous = value;
+    }
+}
+
+void encodeDictionary(QByteArray& out, const std::vector<qint64>& values)
+{
+    std::vector<qint64> dictionary(values);
+    std::sort(dictionary.begin(), dictionary.end());
+    dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+
+    appendVarint(out, dictionary.size());
+    encodeDelta(out, dictionary);
+    for (qint64 value : values) {
+        appendVarint(out, quint64(std::lower_bound(dictionary.begin(), dictionary.end(), value) - dictionary.begin()));
+    }
+}
+
+void encodePlain(QByteArray& out, const std::vector<qint64>& values)
+{
+    for (qint64 value : values) {
+        appendSignedVarint(out, value);
+    }
+}
+
+void encodeStrings(QByteArray& out, const std::vector<QByteArray>& values)
+{
+    QHash<QByteArray, quint64> ids;
+    std::vector<const QByteArray*> dictionary;
+    std::vector<quint64> indices;
+    indices.reserve(values.size());
+    for (const QByteArray& value : values) {
+        auto it = ids.constFind(value);
+        if (it == ids.constEnd()) {
+            it = ids.insert(value, dictionary.size());
+            dictionary.push_back(&value);
+        }
+        indices.push_back(*it);
+    }
+
+    appendVarint(out, dictionary.size());
+    for (const QByteArray* value : dictionary) {
+        appendVarint(out, quint64(value->size()));
+        out.append(*value);
+    }
+    for (quint64 index : indices) {
+        appendVarint(out, index);
+    }
+}
+
+bool decodeDelta(const QByteArray& page, qsizetype& pos, quint64 count, std::vector<qint64>& values)
+{
+    values.resize(count);
+    qint64 previous = 0;
+    for (quint64 i = 0; i < count; ++i) {
+        qint64 delta;
+        if (!readSignedVarint(page.constData(), page.size(), pos, delta)) {
+            return false;
+        }
+        previous += delta;
+        values[i] = previous;
+    }
+    return true;
+}
+
+bool decodePage(quint8 encoding, const QByteArray& page, quint64 rowCount,
+                std::vector<qint64>& values, std::vector<QByteArray>& strings)
+{
+    const char* data = page.constData();
+    qsizetype size = page.size();
+    qsizetype pos = 0;
+
+    // Every encoding spends at least one byte per row; a larger count comes
+    // from a corrupt footer and must not size the output vectors
+    if (rowCount > quint64(size)) {
+        return false;
+    }
+
+    switch (encoding) {
+    case DeltaEncoding:
+        return decodeDelta(page, pos, rowCount, values);
+
+    case PlainEncoding:
+        values.resize(rowCount);
+        for (quint64 i = 0; i < rowCount; ++i) {
+            if (!readSignedVarint(data, size, pos, values[i])) {
+                return false;
+            }
+        }
+        return true;
+
+    case DictionaryEncoding: {
+        quint64 count;
+        std::vector<qint64> dictionary;
+        if (!readVarint(data, size, pos, count) || count > quint64(size) || !decodeDelta(page, pos, count, dictionary)) {
+            return false;
+        }
+        values.resize(rowCount);
+        for (quint64 i = 0; i < rowCount; ++i) {
+            quint64 index;
+            if (!readVarint(data, size, pos, index) || index >= count) {
+                return false;
+            }
+            values[i] = dictionary[index];
+        }
+        return true;
+    }
+
+    case StringEncoding: {
+        quint64 count;
+        if (!readVarint(data, size, pos, count) || count > quint64(size)) {
+            return false;
+        }
+        std::vector<QByteArray> dictionary(count);
+        for (QByteArray& value : dictionary) {
+            quint64 length;
+            if (!readVarint(data, size, pos, length) || quint64(size - pos) < length) {
+                return false;
+            }
+            value = QByteArray(data + pos, qsizetype(length));
+            pos += qsizetype(length);
+        }
+        strings.resize(rowCount);
+        for (quint64 i = 0; i < rowCount; ++i) {
+            quint64 index;
+            if (!readVarint(data, size, pos, index) || index >= count) {
+                return false;
+            }
+            strings[i] = dictionary[index];
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+// Keeps the entries whose keep flag is set, preserving order
+template <typename T>
+void compact(std::vector<T>& values, const std::vector<quint8>& keep)
+{
+    if (values.empty()) {
+        return;
+    }
+    size_t out = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (keep[i]) {
+            values[out++] = std::move(values[i]);
+        }
+    }
+    values.resize(out);
+}
+
+} // namespace
+
+// Writer
+
+OrderArchiveWriter::~OrderArchiveWriter()
+{
+    if (m_file.isOpen()) {
+        m_file.cancelWriting();
+    }
+}
+
+bool OrderArchiveWriter::open(const QString& filePath, QString* errorMessage)
+{
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::WriteOnly)) {
+        if (errorMessage) {
+            *errorMessage = m_file.errorString();
+        }
+        return false;
+    }
+
+    for (std::vector<qint64>& column : m_values) {
+        column.clear();
+    }
+    m_orderNumbers.clear();
+    m_groups.clear();
+    m_rowCount = 0;
+    m_file.write(kMagic, kMagicSize);
+    return true;
+}
+
+void OrderArchiveWriter::append(qint64 lineId, qint64 orderId, const QByteArray& orderNumber, qint64 date,
+                                int type, int status, qint64 itemId, qint64 quantity)
+{
+    m_values[ArchiveLineId].push_back(lineId);
+    m_values[ArchiveOrderId].push_back(orderId);
+    m_orderNumbers.push_back(orderNumber);
+    m_values[ArchiveDate].push_back(date);
+    m_values[ArchiveType].push_back(type);
+    m_values[ArchiveStatus].push_back(status);
+    m_values[ArchiveItemId].push_back(itemId);
+    m_values[ArchiveQuantity].push_back(quantity);
+    ++m_rowCount;
+
+    if (m_orderNumbers.size() >= size_t(kRowsPerGroup)) {
+        flushGroup();
+    }
+}
+
+void OrderArchiveWriter::flushGroup()
+{
+    WMS_TRACE_SCOPE_CAT("OrderArchiveWriter::flushGroup", "archive");
+
+    if (m_orderNumbers.empty()) {
+        return;
+    }
+
+    ArchiveGroupInfo group;
+    group.rowCount = m_orderNumbers.size();
+
+    for (int c = 0; c < ArchiveColumnCount; ++c) {
+        const std::vector<qint64>& values = m_values[c];
+        QByteArray page;
+        page.reserve(qsizetype(group.rowCount) * 2);
+
+        ArchivePageInfo& info = group.pages[c];
+        info.encoding = kColumnEncodings[c];
+        switch (kColumnEncodings[c]) {
+        case DeltaEncoding: encodeDelta(page, values); break;
+        case DictionaryEncoding: encodeDictionary(page, values); break;
+        case PlainEncoding: encodePlain(page, values); break;
+        case StringEncoding: encodeStrings(page, m_orderNumbers); break;
+        }
+        if (!values.empty()) {
+            auto [min, max] = std::minmax_element(values.begin(), values.end());
+            info.min = *min;
+            info.max = *max;
+        }
+
+        QByteArray compressed = qCompress(page);
+        info.offset = quint64(m_file.pos());
+        info.size = quint64(compressed.size());
+        m_file.write(compressed);
+    }
+
+    m_groups.push_back(group);
+    for (std::vector<qint64>& column : m_values) {
+        column.clear();
+    }
+    m_orderNumbers.clear();
+}
+
+bool OrderArchiveWriter::finish(QString* errorMessage)
+{
+    flushGroup();
+
+    QByteArray footer;
+    appendVarint(footer, kFormatVersion);
+    appendVarint(footer, ArchiveColumnCount);
+    appendVarint(footer, m_groups.size());
+    for (const ArchiveGroupInfo& group : m_groups) {
+        appendVarint(footer, group.rowCount);
+        for (const ArchivePageInfo& page : group.pages) {
+            appendVarint(footer, page.encoding);
+            appendVarint(footer, page.offset);
+            appendVarint(footer, page.size);
+            appendSignedVarint(footer, page.min);
+            appendSignedVarint(footer, page.max);
+        }
+    }
+
+    quint32 footerLength = qToLittleEndian(quint32(footer.size()));
+    m_file.write(footer);
+    m_file.write(reinterpret_cast<const char*>(&footerLength), sizeof(footerLength));
+    m_file.write(kMagic, kMagicSize);
+
+    if (!m_file.commit()) {
+        if (errorMessage) {
+            *errorMessage = m_file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
+
+bool OrderArchiveWriter::exportOrderLines(const QSqlDatabase& db, const QString& filePath, const QDate& before,
+                                          qint64* rowCount, QString* errorMessage)
+{
+    WMS_TRACE_SCOPE_CAT("OrderArchiveWriter::exportOrderLines", "archive");
+
+    static constexpr std::string_view kExportSql =
+        "SELECT l.id, l.order_id, o.order_number, o.date, o.type, o.status, l.item_id, l.quantity "
+        "FROM order_lines l JOIN orders o ON o.id = l.order_id "
+        "WHERE o.date < ? ORDER BY o.date, l.order_id, l.id";
+
+    OrderArchiveWriter writer;
+    if (!writer.open(filePath, errorMessage)) {
+        return false;
+    }
+
+    qint64 beforeDay = DatabaseManager::encodeOrderDate(before);
+    QString error;
+
+    if (sqlite3* handle = nativeBackendHandle(db)) {
+        SqliteStatement stmt(handle, kExportSql);
+        stmt.bind(0, beforeDay);
+        while (stmt.step()) {
+            std::string_view number = stmt.columnText(2);
+            writer.append(stmt.columnInt64(0), stmt.columnInt64(1),
+                          QByteArray(number.data(), qsizetype(number.size())), stmt.columnInt64(3),
+                          stmt.columnInt(4), stmt.columnInt(5), stmt.columnInt64(6), stmt.columnInt64(7));
+        }
+        error = stmt.lastError();
+    } else {
+        QSqlQuery query(db);
+        query.setForwardOnly(true);
+        query.prepare(sqlString(kExportSql));
+        query.addBindValue(beforeDay);
+        if (query.exec()) {
+            while (query.next()) {
+                writer.append(query.value(0).toLongLong(), query.value(1).toLongLong(),
+                              query.value(2).toString().toUtf8(), query.value(3).toLongLong(),
+                              query.value(4).toInt(), query.value(5).toInt(),
+                              query.value(6).toLongLong(), query.value(7).toLongLong());
+            }
+        }
+        if (query.lastError().isValid()) {
+            error = query.lastError().text();
+        }
+    }
+
+    if (!error.isEmpty()) {
+        if (errorMessage) {
+            *errorMessage = error;
+        }
+        return false;
+    }
+    if (!writer.finish(errorMessage)) {
+        return false;
+    }
+    if (rowCount) {
+        *rowCount = writer.rowCount();
+    }
+    return true;
+}
+
+// Reader
+
+OrderArchiveReader::~OrderArchiveReader()
+{
+    close();
+}
+
+void OrderArchiveReader::close()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar*>(m_data));
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_size = 0;
+    m_rowCount = 0;
+    m_groups.clear();
+}
+
+bool OrderArchiveReader::open(const QString& filePath, QString* errorMessage)
+{
+    auto fail = [this, errorMessage](const QString& message) {
+        close();
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    close();
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return fail(m_file.errorString());
+    }
+
+    m_size = m_file.size();
+    const qint64 trailerSize = qint64(sizeof(quint32)) + kMagicSize;
+    if (m_size < kMagicSize + trailerSize) {
+        return fail("Not an order archive file");
+    }
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        return fail(m_file.errorString());
+    }
+
+    const char* data = reinterpret_cast<const char*>(m_data);
+    if (memcmp(data, kMagic, kMagicSize) != 0 || memcmp(data + m_size - kMagicSize, kMagic, kMagicSize) != 0) {
+        return fail("Not an order archive file");
+    }
+
+    quint32 footerLength = qFromLittleEndian<quint32>(m_data + m_size - trailerSize);
+    qint64 footerStart = m_size - trailerSize - qint64(footerLength);
+    if (footerStart < kMagicSize) {
+        return fail("Corrupt order archive footer");
+    }
+
+    const char* footer = data + footerStart;
+    qsizetype size = qsizetype(footerLength);
+    qsizetype pos = 0;
+    quint64 version, columns, groups;
+    if (!readVarint(footer, size, pos, version) || version != kFormatVersion
+        || !readVarint(footer, size, pos, columns) || columns != ArchiveColumnCount
+        || !readVarint(footer, size, pos, groups) || groups > quint64(size)) {
+        return fail("Unsupported order archive version");
+    }
+
+    m_groups.resize(groups);
+    for (ArchiveGroupInfo& group : m_groups) {
+        if (!readVarint(footer, size, pos, group.rowCount)) {
+            return fail("Corrupt order archive footer");
+        }
+        for (ArchivePageInfo& page : group.pages) {
+            quint64 encoding;
+            if (!readVarint(footer, size, pos, encoding) || encoding > StringEncoding
+                || !readVarint(footer, size, pos, page.offset) || !readVarint(footer, size, pos, page.size)
+                || !readSignedVarint(footer, size, pos, page.min) || !readSignedVarint(footer, size, pos, page.max)
+                || page.offset < quint64(kMagicSize) || page.size > quint64(footerStart)
+                || page.offset > quint64(footerStart) - page.size) {
+                return fail("Corrupt order archive footer");
+            }
+            page.encoding = quint8(encoding);
+        }
+        m_rowCount += qint64(group.rowCount);
+    }
+    return true;
+}
+
+bool OrderArchiveReader::scan(ArchiveScan& scan, const std::function<void(const ArchiveBatch&)>& callback,
+                              QString* errorMessage) const
+{
+    WMS_TRACE_SCOPE_CAT("OrderArchiveReader::scan", "archive");
+
+    bool filtered = scan.filterColumn >= 0 && scan.filterColumn < ArchiveColumnCount
+                    && scan.filterColumn != ArchiveOrderNumber;
+    quint32 needed = scan.columns & kAllArchiveColumns;
+    if (filtered) {
+        needed |= 1u << scan.filterColumn;
+    }
+
+    ArchiveBatch batch;
+    std::vector<quint8> keep;
+
+    for (size_t g = 0; g < m_groups.size(); ++g) {
+        const ArchiveGroupInfo& group = m_groups[g];
+
+        // Zone map: skip groups that cannot contain a matching row
+        bool wholeGroup = true;
+        if (filtered) {
+            const ArchivePageInfo& zone = group.pages[scan.filterColumn];
+            if (zone.max < scan.min || zone.min > scan.max) {
+                ++scan.groupsSkipped;
+                continue;
+            }
+            wholeGroup = zone.min >= scan.min && zone.max <= scan.max;
+        }
+        ++scan.groupsRead;
+
+        batch.rowCount = qint64(group.rowCount);
+        for (int c = 0; c < ArchiveColumnCount; ++c) {
+            batch.values[c].clear();
+            if (c == ArchiveOrderNumber) {
+                batch.orderNumbers.clear();
+            }
+            if (!(needed & (1u << c))) {
+                continue;
+            }
+
+            const ArchivePageInfo& info = group.pages[c];
+            QByteArray page = qUncompress(m_data + info.offset, qsizetype(info.size));
+            if (!decodePage(info.encoding, page, group.rowCount, batch.values[c], batch.orderNumbers)) {
+                if (errorMessage) {
+                    *errorMessage = QString("Corrupt page for column %1 in row group %2").arg(c).arg(g);
+                }
+                return false;
+            }
+        }
+
+        if (!wholeGroup) {
+            const std::vector<qint64>& filter = batch.values[scan.filterColumn];
+            keep.resize(filter.size());
+            qint64 kept = 0;
+            for (size_t i = 0; i < filter.size(); ++i) {
+                keep[i] = filter[i] >= scan.min && filter[i] <= scan.max;
+                kept += keep[i];
+            }
+            for (std::vector<qint64>& column : batch.values) {
+                compact(column, keep);
+            }
+            compact(batch.orderNumbers, keep);
+            batch.rowCount = kept;
+        }
+        if (filtered && !(scan.columns & (1u << scan.filterColumn))) {
+            batch.values[scan.filterColumn].clear();
+        }
+
+        if (batch.rowCount > 0) {
+            callback(batch);
+        }
+    }
+    return true;
+}
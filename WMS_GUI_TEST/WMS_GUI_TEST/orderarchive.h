@@ -0,0 +1,150 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDate>
+#include <QFile>
+#include <QSaveFile>
+#include <QSqlDatabase>
+#include <QString>
+#include <array>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// Columns of an order archive: order lines denormalized with their order
+enum ArchiveColumn {
+    ArchiveLineId,
+    ArchiveOrderId,
+    ArchiveOrderNumber,
+    ArchiveDate,        // Julian day
+    ArchiveType,        // OrderType
+    ArchiveStatus,      // OrderStatus
+    ArchiveItemId,
+    ArchiveQuantity,
+    ArchiveColumnCount
+};
+
+constexpr quint32 archiveColumnBit(ArchiveColumn column) { return 1u << column; }
+constexpr quint32 kAllArchiveColumns = (1u << ArchiveColumnCount) - 1;
+
+// Footer entries of OrderArchiveWriter files
+struct ArchivePageInfo
+{
+    quint8 encoding = 0;
+    quint64 offset = 0;
+    quint64 size = 0;
+    qint64 min = 0;
+    qint64 max = 0;
+};
+
+struct ArchiveGroupInfo
+{
+    quint64 rowCount = 0;
+    std::array<ArchivePageInfo, ArchiveColumnCount> pages;
+};
+
+// Columnar archive of historical order lines.
+//
+// File layout: the 8-byte magic "WMSARC01", then row groups of up to
+// kRowsPerGroup rows, then a footer, a 4-byte little-endian footer length
+// and the magic again. Within a row group every column is one page,
+// compressed with qCompress. Pages are encoded per column:
+//   delta       zigzag varint first value, then zigzag varint differences
+//               (line id, order id, date; rows are written in date order)
+//   dictionary  varint count and delta-encoded sorted distinct values, then
+//               one varint dictionary index per row (type, status, item id)
+//   plain       one zigzag varint per row (quantity)
+//   strings     varint count and length-prefixed distinct strings in first
+//               seen order, then one varint index per row (order number)
+// The footer holds a format version, the column and row group counts and,
+// per row group, its row count and for every column the page's encoding,
+// offset, compressed size and the minimum and maximum value (zone map;
+// zero for the string column).
+class OrderArchiveWriter
+{
+public:
+    static constexpr int kRowsPerGroup = 65536;
+
+    OrderArchiveWriter() = default;
+    ~OrderArchiveWriter();
+    OrderArchiveWriter(const OrderArchiveWriter&) = delete;
+    OrderArchiveWriter& operator=(const OrderArchiveWriter&) = delete;
+
+    // The file only appears under its name once finish() succeeds
+    bool open(const QString& filePath, QString* errorMessage = nullptr);
+    void append(qint64 lineId, qint64 orderId, const QByteArray& orderNumber, qint64 date,
+                int type, int status, qint64 itemId, qint64 quantity);
+    bool finish(QString* errorMessage = nullptr);
+
+    qint64 rowCount() const { return m_rowCount; }
+
+    // Writes the lines of all orders dated before the given day, oldest first
+    static bool exportOrderLines(const QSqlDatabase& db, const QString& filePath, const QDate& before,
+                                 qint64* rowCount = nullptr, QString* errorMessage = nullptr);
+
+private:
+    void flushGroup();
+
+    QSaveFile m_file;
+    std::array<std::vector<qint64>, ArchiveColumnCount> m_values;
+    std::vector<QByteArray> m_orderNumbers;
+    std::vector<ArchiveGroupInfo> m_groups;
+    qint64 m_rowCount = 0;
+};
+
+// One decoded row group, restricted to the requested columns and to the
+// rows matching the scan's range. Columns that were not requested are empty.
+struct ArchiveBatch
+{
+    qint64 rowCount = 0;
+    std::array<std::vector<qint64>, ArchiveColumnCount> values;
+    std::vector<QByteArray> orderNumbers;
+
+    const std::vector<qint64>& column(ArchiveColumn c) const { return values[c]; }
+};
+
+struct ArchiveScan
+{
+    // archiveColumnBit() mask of the columns to decode
+    quint32 columns = kAllArchiveColumns;
+
+    // Optional range predicate; row groups whose zone map lies outside it
+    // are skipped without being read
+    int filterColumn = -1;
+    qint64 min = std::numeric_limits<qint64>::min();
+    qint64 max = std::numeric_limits<qint64>::max();
+
+    // Filled in by the scan
+    int groupsRead = 0;
+    int groupsSkipped = 0;
+};
+
+// Reads an archive through a read-only memory mapping; only the pages of
+// the requested columns in row groups that can match are decompressed.
+// scan() does not modify the reader and may run on several threads at once.
+class OrderArchiveReader
+{
+public:
+    OrderArchiveReader() = default;
+    ~OrderArchiveReader();
+    OrderArchiveReader(const OrderArchiveReader&) = delete;
+    OrderArchiveReader& operator=(const OrderArchiveReader&) = delete;
+
+    bool open(const QString& filePath, QString* errorMessage = nullptr);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+
+    qint64 rowCount() const { return m_rowCount; }
+    int groupCount() const { return int(m_groups.size()); }
+
+    // Calls the callback once per row group with matching rows
+    bool scan(ArchiveScan& scan, const std::function<void(const ArchiveBatch&)>& callback,
+              QString* errorMessage = nullptr) const;
+
+private:
+    QFile m_file;
+    const uchar* m_data = nullptr;
+    qint64 m_size = 0;
+    qint64 m_rowCount = 0;
+    std::vector<ArchiveGroupInfo> m_groups;
+};
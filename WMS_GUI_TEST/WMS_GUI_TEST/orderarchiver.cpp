@@ -0,0 +1,83 @@
+#include "orderarchiver.h"
+#include "databasemanager.h"
+#include "tracing.h"
+
+#include <QSettings>
+
+OrderArchiver::OrderArchiver(QObject* parent)
+    : QObject(parent),
+      m_archivedOrders(0),
+      m_archivedLines(0),
+      m_running(false)
+{
+    QSettings settings;
+    m_retentionDays = settings.value("archive/retentionDays", 365).toInt();
+    m_batchSize = settings.value("archive/batchSize", 500).toInt();
+
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(settings.value("archive/batchIntervalMs", 250).toInt());
+    connect(&m_timer, &QTimer::timeout, this, &OrderArchiver::runBatch);
+}
+
+bool OrderArchiver::start()
+{
+    if (m_running) {
+        return false;
+    }
+    if (!DatabaseManager::instance().isArchiveAttached()) {
+        qDebug() << "Order archiver: no archive database attached";
+        return false;
+    }
+
+    m_cutoff = QDate::currentDate().addDays(-qMax(0, m_retentionDays));
+    m_archivedOrders = 0;
+    m_archivedLines = 0;
+    m_running = true;
+
+    // The first batch runs on the next event loop pass
+    QTimer::singleShot(0, this, &OrderArchiver::runBatch);
+    return true;
+}
+
+void OrderArchiver::stop()
+{
+    if (m_running) {
+        m_timer.stop();
+        finish(QString());
+    }
+}
+
+void OrderArchiver::runBatch()
+{
+    WMS_TRACE_SCOPE("OrderArchiver::runBatch");
+
+    if (!m_running) {
+        return;
+    }
+
+    int orders = 0;
+    int lines = 0;
+    QString error;
+    if (!DatabaseManager::instance().archiveOrders(m_cutoff, m_batchSize, &orders, &lines, &error)) {
+        finish(error);
+        return;
+    }
+
+    m_archivedOrders += orders;
+    m_archivedLines += lines;
+    emit progress(m_archivedOrders, m_archivedLines);
+
+    // A short batch means nothing older than the cutoff is left
+    if (orders == 0 || orders < m_batchSize) {
+        finish(QString());
+    } else {
+        m_timer.start();
+    }
+}
+
+void OrderArchiver::finish(const QString& errorMessage)
+{
+    m_running = false;
+    qDebug() << "Order archiver:" << m_archivedOrders << "orders and" << m_archivedLines << "lines archived";
+    emit finished(m_archivedOrders, m_archivedLines, errorMessage);
+}
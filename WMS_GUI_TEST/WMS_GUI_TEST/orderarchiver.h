@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QObject>
+#include <QDate>
+#include <QTimer>
+
+// Moves posted orders older than the retention window, with their lines,
+// from the main tables into the attached archive database (see
+// DatabaseManager::archiveOrders). Work is split into small transactions
+// spaced out by a timer, so the GUI and other writers are never blocked for
+// more than one batch. Settings: "archive/retentionDays" (default 365),
+// "archive/batchSize" (orders per transaction, default 500) and
+// "archive/batchIntervalMs" (pause between batches, default 250).
+class OrderArchiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit OrderArchiver(QObject* parent = nullptr);
+
+    void setRetentionDays(int days) { m_retentionDays = days; }
+    int retentionDays() const { return m_retentionDays; }
+    void setBatchSize(int orders) { m_batchSize = orders; }
+    void setBatchInterval(int ms) { m_timer.setInterval(ms); }
+
+    // Starts archiving orders dated before today minus the retention window
+    bool start();
+    void stop();
+    bool isRunning() const { return m_running; }
+
+signals:
+    void progress(int archivedOrders, int archivedLines);
+    void finished(int archivedOrders, int archivedLines, const QString& errorMessage);
+
+private slots:
+    void runBatch();
+
+private:
+    void finish(const QString& errorMessage);
+
+    QTimer m_timer;
+    QDate m_cutoff;
+    int m_retentionDays;
+    int m_batchSize;
+    int m_archivedOrders;
+    int m_archivedLines;
+    bool m_running;
+};
@@ -1,6 +1,7 @@
 #include "orderlineswindow.h"
 #include "ui_orderlineswindow.h"
 #include "databasemanager.h"
+#include "repositories.h"
 #include <QMessageBox>
 #include <QSqlError>
 #include <QScreen>
@@ -8,6 +9,8 @@
 #include <QSqlRelationalDelegate>
 #include <QInputDialog>
 #include <QCompleter>
+#include "metrics.h"
+#include "tracing.h"
 
 OrderLinesWindow::OrderLinesWindow(QWidget *parent) :
     QWidget(parent),
@@ -54,6 +57,8 @@ OrderLinesWindow::~OrderLinesWindow()
 
 void OrderLinesWindow::setupItemComboBox()
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::setupItemComboBox");
+
     QSqlQuery itemsQuery("SELECT id, item_code, item_description FROM items");
     QStringList completionList;
 
@@ -82,16 +87,16 @@ void OrderLinesWindow::setupItemComboBox()
 
 void OrderLinesWindow::updateItemDescription(int index)
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::updateItemDescription");
+
     if (index >= 0) {
         int itemId = ui->itemComboBox->currentData().toInt();
         qDebug()<< "itemId:" <<itemId;
-        QSqlQuery query;
-        query.prepare("SELECT item_description FROM items WHERE id = :id");
-        query.bindValue(":id", itemId);
+        std::optional<Item> item = ItemRepository().byId(itemId);
 
-        if (query.exec() && query.next()) {
-            ui->itemDescriptionLineEdit->setText(query.value(0).toString());
-            qDebug()<< "Desc:" <<query.value(0).toString();
+        if (item) {
+            ui->itemDescriptionLineEdit->setText(item->description);
+            qDebug()<< "Desc:" << item->description;
         } else {
             ui->itemDescriptionLineEdit->clear();
         }
@@ -102,35 +107,43 @@ void OrderLinesWindow::updateItemDescription(int index)
 
 void OrderLinesWindow::loadOrderData()
 {
-    orderIdsList.clear();
-    orderDataMap.clear();
-
-    QSqlQuery query("SELECT id, order_number, date, type FROM orders ORDER BY id");
-    while (query.next()) {
-        int orderId = query.value(0).toInt();
-        orderIdsList.append(orderId);
+    WMS_TRACE_SCOPE("OrderLinesWindow::loadOrderData");
 
-        QList<QVariant> orderData;
-        orderData.append(query.value(1)); // order_number
-        orderData.append(query.value(2)); // date
-        orderData.append(query.value(3)); // type
+    orders = OrderRepository().all();
 
-        orderDataMap[orderId] = orderData;
+    orderIndexById.clear();
+    orderIndexById.reserve(int(orders.size()));
+    for (int i = 0; i < int(orders.size()); ++i) {
+        orderIndexById.insert(orders[i].id, i);
     }
 }
 
 void OrderLinesWindow::loadOrder(int orderId)
 {
-    if (orderId <= 0 || !orderDataMap.contains(orderId)) {
+    WMS_TRACE_SCOPE("OrderLinesWindow::loadOrder");
+
+    static MetricCounter* const cacheHits = MetricsRegistry::instance().counter(
+        "wms_cache_requests_total", "Lookups in in-memory caches", "cache=\"order_headers\",result=\"hit\"");
+    static MetricCounter* const cacheMisses = MetricsRegistry::instance().counter(
+        "wms_cache_requests_total", "Lookups in in-memory caches", "cache=\"order_headers\",result=\"miss\"");
+
+    // An invalid ID is not a lookup, so it does not count against the hit rate
+    if (orderId <= 0) {
         QMessageBox::warning(this, tr("Load Order"), tr("Invalid order ID."));
         return;
     }
 
-    currentOrderId = orderId;
-    currentOrderNumber = orderDataMap[orderId][0].toString();
+    bool cached = orderIndexById.contains(orderId);
+    (cached ? cacheHits : cacheMisses)->inc();
+    if (!cached) {
+        QMessageBox::warning(this, tr("Load Order"), tr("Invalid order ID."));
+        return;
+    }
 
     // Find the index of this order in the list
-    currentOrderIndex = orderIdsList.indexOf(orderId);
+    currentOrderIndex = orderIndexById.value(orderId);
+    currentOrderId = orderId;
+    currentOrderNumber = orders[currentOrderIndex].number;
 
     // Update UI
     updateOrderHeaderInfo();
@@ -142,7 +155,7 @@ void OrderLinesWindow::loadOrder(int orderId)
     // Select the first row if any exists
     if (model->rowCount() > 0) {
         ui->tableView->selectRow(0);
-        on_tableView_clicked(model->index(0, 0));
+        on_tableView_clicked(model->index(0, OrderLinesTable::Id));
     } else {
         clearForm();
     }
@@ -150,19 +163,22 @@ void OrderLinesWindow::loadOrder(int orderId)
 
 void OrderLinesWindow::loadOrderByNumber(const QString& orderNumber)
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::loadOrderByNumber");
+
     if (orderNumber.isEmpty()) {
         QMessageBox::warning(this, tr("Load Order"), tr("Invalid order number."));
         return;
     }
 
     // Find the order ID for this order number
-    QSqlQuery query;
-    query.prepare("SELECT id FROM orders WHERE order_number = :order_number");
-    query.bindValue(":order_number", orderNumber);
+    std::optional<Order> order = OrderRepository().byNumber(orderNumber);
 
-    if (query.exec() && query.next()) {
-        int orderId = query.value(0).toInt();
-        loadOrder(orderId);
+    if (order) {
+        // Orders created since the window opened are not in the cache yet
+        if (!orderIndexById.contains(order->id)) {
+            loadOrderData();
+        }
+        loadOrder(order->id);
     } else {
         QMessageBox::warning(this, tr("Load Order"), tr("Order number not found."));
     }
@@ -170,27 +186,29 @@ void OrderLinesWindow::loadOrderByNumber(const QString& orderNumber)
 
 void OrderLinesWindow::updateOrderHeaderInfo()
 {
-    if (currentOrderId <= 0 || !orderDataMap.contains(currentOrderId)) {
+    if (currentOrderId <= 0 || !orderIndexById.contains(currentOrderId)) {
         return;
     }
 
-    QList<QVariant> orderData = orderDataMap[currentOrderId];
+    const Order &order = orders[orderIndexById.value(currentOrderId)];
     ui->orderIdEdit->setText(QString::number(currentOrderId));
-    ui->orderNumberEdit->setText(orderData[0].toString());
-    ui->orderDateEdit->setText(orderData[1].toString());
-    ui->orderTypeEdit->setText(orderData[2].toString());
+    ui->orderNumberEdit->setText(order.number);
+    ui->orderDateEdit->setText(order.date.toString(Qt::ISODate));
+    ui->orderTypeEdit->setText(DatabaseManager::decodeOrderType(int(order.type)));
 
-    setWindowTitle(tr("Order Lines - Order #%1").arg(orderData[0].toString()));
+    setWindowTitle(tr("Order Lines - Order #%1").arg(order.number));
 }
 
 void OrderLinesWindow::updateOrderNavigation()
 {
     ui->prevOrderButton->setEnabled(currentOrderIndex > 0);
-    ui->nextOrderButton->setEnabled(currentOrderIndex < orderIdsList.size() - 1);
+    ui->nextOrderButton->setEnabled(currentOrderIndex < int(orders.size()) - 1);
 }
 
 void OrderLinesWindow::setupLineModel()
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::setupLineModel");
+
     // If already initialized, just update the model
     if (model) {
         delete model;
@@ -202,20 +220,26 @@ void OrderLinesWindow::setupLineModel()
     model->setEditStrategy(QSqlTableModel::OnManualSubmit);
 
     // Set relations - change this to show only item code
-    model->setRelation(3, QSqlRelation("items", "id", "item_code"));
+    model->setRelation(OrderLinesTable::ItemId, QSqlRelation("items", "id", "item_code"));
 
     // Filter by current order
     model->setFilter(QString("order_id = %1").arg(currentOrderId));
 
     // Set headers
-    model->setHeaderData(0, Qt::Horizontal, tr("ID"));
-    model->setHeaderData(1, Qt::Horizontal, tr("Order ID"));
-    model->setHeaderData(2, Qt::Horizontal, tr("Order Number"));
-    model->setHeaderData(3, Qt::Horizontal, tr("Item Code"));
-    model->setHeaderData(4, Qt::Horizontal, tr("Quantity"));
+    model->setHeaderData(OrderLinesTable::Id, Qt::Horizontal, tr("ID"));
+    model->setHeaderData(OrderLinesTable::OrderId, Qt::Horizontal, tr("Order ID"));
+    model->setHeaderData(OrderLinesTable::OrderNumber, Qt::Horizontal, tr("Order Number"));
+    model->setHeaderData(OrderLinesTable::ItemId, Qt::Horizontal, tr("Item Code"));
+    model->setHeaderData(OrderLinesTable::Quantity, Qt::Horizontal, tr("Quantity"));
 
     // Load data
-    model->select();
+    {
+        static MetricHistogram* const reloadTime = MetricsRegistry::instance().histogram(
+            "wms_model_reload_duration_seconds", "Time spent in model select()", "model=\"order_lines\"");
+        ScopedMetricsTimer timer(reloadTime);
+        WMS_TRACE_SCOPE_CAT("QSqlTableModel::select", "model");
+        model->select();
+    }
 
     // Set model to table view
     ui->tableView->setModel(model);
@@ -223,9 +247,9 @@ void OrderLinesWindow::setupLineModel()
     // Use custom delegate that makes item code column read-only
     ui->tableView->setItemDelegate(new CustomOrderLinesDelegate(ui->tableView));
 
-    ui->tableView->hideColumn(0); // Hide ID column
-    ui->tableView->hideColumn(1); // Hide Order ID column
-    ui->tableView->hideColumn(2); // Hide Order Number column
+    ui->tableView->hideColumn(OrderLinesTable::Id); // Hide ID column
+    ui->tableView->hideColumn(OrderLinesTable::OrderId); // Hide Order ID column
+    ui->tableView->hideColumn(OrderLinesTable::OrderNumber); // Hide Order Number column
 
     // Connect to data changes in the model
     connect(model, &QAbstractItemModel::dataChanged, this, [this](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
@@ -240,7 +264,7 @@ void OrderLinesWindow::setupLineModel()
             // Reselect the same row after refresh if it still exists
             if (currentRow >= 0 && currentRow < model->rowCount()) {
                 ui->tableView->selectRow(currentRow);
-                on_tableView_clicked(model->index(currentRow, 0));
+                on_tableView_clicked(model->index(currentRow, OrderLinesTable::Id));
             }
         }
     });
@@ -251,6 +275,8 @@ void OrderLinesWindow::setupLineModel()
 
 void OrderLinesWindow::setupMapper()
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::setupMapper");
+
     if (mapper) {
         delete mapper;
         mapper = nullptr;
@@ -265,9 +291,9 @@ void OrderLinesWindow::setupMapper()
     mapper->setSubmitPolicy(QDataWidgetMapper::ManualSubmit);
 
     // Map fields to form controls
-    mapper->addMapping(ui->lineIdEdit, 0); // ID
-    mapper->addMapping(ui->itemComboBox, 3); // Item ID
-    mapper->addMapping(ui->quantitySpinBox, 4); // Quantity
+    mapper->addMapping(ui->lineIdEdit, OrderLinesTable::Id); // ID
+    mapper->addMapping(ui->itemComboBox, OrderLinesTable::ItemId); // Item ID
+    mapper->addMapping(ui->quantitySpinBox, OrderLinesTable::Quantity); // Quantity
     // Note: We don't map itemDescriptionLineEdit since it's calculated from itemComboBox
 }
 
@@ -303,6 +329,8 @@ void OrderLinesWindow::updateButtonStates(bool editMode)
 
 void OrderLinesWindow::refreshOrderLinesTable()
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::refreshOrderLinesTable");
+
     model->select();
 }
 
@@ -330,6 +358,8 @@ void OrderLinesWindow::on_editLineButton_clicked()
 
 void OrderLinesWindow::on_deleteLineButton_clicked()
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::on_deleteLineButton_clicked");
+
     if (!ui->tableView->currentIndex().isValid()) {
         QMessageBox::warning(this, tr("Delete Line"), tr("Please select a line to delete."));
         return;
@@ -355,6 +385,8 @@ void OrderLinesWindow::on_deleteLineButton_clicked()
 
 void OrderLinesWindow::on_saveLineButton_clicked()
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::on_saveLineButton_clicked");
+
     // Validate input
     if (ui->itemComboBox->currentIndex() == -1) {
         QMessageBox::warning(this, tr("Save Line"), tr("Please select an item."));
@@ -373,15 +405,15 @@ void OrderLinesWindow::on_saveLineButton_clicked()
         int row = model->rowCount();
         model->insertRow(row);
 
-        model->setData(model->index(row, 1), currentOrderId); // Order ID
-        model->setData(model->index(row, 2), currentOrderNumber); // Order Number
-        model->setData(model->index(row, 3), ui->itemComboBox->currentData()); // Item ID
-        model->setData(model->index(row, 4), ui->quantitySpinBox->value()); // Quantity
+        model->setData(model->index(row, OrderLinesTable::OrderId), currentOrderId); // Order ID
+        model->setData(model->index(row, OrderLinesTable::OrderNumber), currentOrderNumber); // Order Number
+        model->setData(model->index(row, OrderLinesTable::ItemId), ui->itemComboBox->currentData()); // Item ID
+        model->setData(model->index(row, OrderLinesTable::Quantity), ui->quantitySpinBox->value()); // Quantity
     } else {
         // Update existing record (we don't need to update order_id/order_number as they shouldn't change)
         int currentRow = ui->tableView->currentIndex().row();
-        model->setData(model->index(currentRow, 3), ui->itemComboBox->currentData()); // Item ID
-        model->setData(model->index(currentRow, 4), ui->quantitySpinBox->value()); // Quantity
+        model->setData(model->index(currentRow, OrderLinesTable::ItemId), ui->itemComboBox->currentData()); // Item ID
+        model->setData(model->index(currentRow, OrderLinesTable::Quantity), ui->quantitySpinBox->value()); // Quantity
     }
 
     // Submit changes to database
@@ -414,6 +446,8 @@ void OrderLinesWindow::on_cancelLineButton_clicked()
 
 void OrderLinesWindow::on_tableView_clicked(const QModelIndex &index)
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::on_tableView_clicked");
+
     if (index.isValid()) {
         // Get the row
         int row = index.row();
@@ -422,33 +456,32 @@ void OrderLinesWindow::on_tableView_clicked(const QModelIndex &index)
         mapper->setCurrentIndex(row);
 
         // Get the item ID directly from the model
-        QModelIndex itemIdIndex = model->index(row, 3);  // Column 3 contains the item_id
+        QModelIndex itemIdIndex = model->index(row, OrderLinesTable::ItemId);
         QVariant itemData = model->data(itemIdIndex, Qt::EditRole);
 
         // Try to determine if we have an ID or a code
         bool isNumber;
         int itemId = itemData.toInt(&isNumber);
 
-        QSqlQuery query;
+        ItemRepository items;
+        std::optional<Item> item;
         if (isNumber) {
             // We have an ID
-            query.prepare("SELECT item_description FROM items WHERE id = :id");
-            query.bindValue(":id", itemId);
+            item = items.byId(itemId);
             qDebug() << "Looking up by item ID:" << itemId;
         } else {
             // We have a code
             QString itemCode = itemData.toString();
-            query.prepare("SELECT item_description FROM items WHERE item_code = :item_code");
-            query.bindValue(":item_code", itemCode);
+            item = items.byCode(itemCode);
             qDebug() << "Looking up by item code:" << itemCode;
         }
 
-        if (query.exec() && query.next()) {
-            ui->itemDescriptionLineEdit->setText(query.value(0).toString());
-            qDebug() << "Description text:" << query.value(0).toString();
+        if (item) {
+            ui->itemDescriptionLineEdit->setText(item->description);
+            qDebug() << "Description text:" << item->description;
         } else {
             ui->itemDescriptionLineEdit->clear();
-            qDebug() << "No description found. Query error:" << query.lastError().text();
+            qDebug() << "No description found. Query error:" << items.lastError();
         }
 
         updateButtonStates(false);
@@ -457,17 +490,21 @@ void OrderLinesWindow::on_tableView_clicked(const QModelIndex &index)
 
 void OrderLinesWindow::on_prevOrderButton_clicked()
 {
+    WMS_TRACE_SCOPE("OrderLinesWindow::on_prevOrderButton_clicked");
+
     if (currentOrderIndex > 0) {
         currentOrderIndex--;
-        loadOrder(orderIdsList[currentOrderIndex]);
+        loadOrder(orders[currentOrderIndex].id);
     }
 }
 
 void OrderLinesWindow::on_nextOrderButton_clicked()
 {
-    if (currentOrderIndex < orderIdsList.size() - 1) {
+    WMS_TRACE_SCOPE("OrderLinesWindow::on_nextOrderButton_clicked");
+
+    if (currentOrderIndex < int(orders.size()) - 1) {
         currentOrderIndex++;
-        loadOrder(orderIdsList[currentOrderIndex]);
+        loadOrder(orders[currentOrderIndex].id);
     }
 }
 
@@ -7,6 +7,10 @@
 #include <QSqlRecord>
 #include <QCompleter>
 #include <QSqlRelationalDelegate>
+#include <QHash>
+#include <vector>
+#include "entities.h"
+#include "schema.h"
 
 namespace Ui {
 class OrderLinesWindow;
@@ -23,8 +27,8 @@ public:
     virtual QWidget *createEditor(QWidget *parent, const QStyleOptionViewItem &option,
                                   const QModelIndex &index) const override
     {
-        // Only allow editing for quantity column (column 4)
-        if (index.column() != 4) {
+        // Only allow editing for the quantity column
+        if (index.column() != OrderLinesTable::Quantity) {
             return nullptr; // No editor will be created, making it read-only
         }
         return QSqlRelationalDelegate::createEditor(parent, option, index);
@@ -61,8 +65,8 @@ private:
     bool isAdding;
     int currentOrderId;
     QString currentOrderNumber;
-    QMap<int, QList<QVariant>> orderDataMap;
-    QList<int> orderIdsList;
+    std::vector<Order> orders;          // all order headers, by id
+    QHash<int, int> orderIndexById;     // order id -> index into orders
     int currentOrderIndex;
 
     void setupOrderModel();
@@ -0,0 +1,108 @@
+#include "orderstablemodel.h"
+#include "databasemanager.h"
+#include "money.h"
+
+OrdersTableModel::OrdersTableModel(QObject *parent)
+    : QSqlTableModel(parent), m_sortColumn(-1), m_sortOrder(Qt::AscendingOrder)
+{
+}
+
+QString OrdersTableModel::selectStatement() const
+{
+    QString statement = "SELECT orders.id, orders.order_number, orders.date, orders.type, orders.status, "
+                        "s.line_count, s.total_units, s.total_value "
+                        "FROM orders LEFT JOIN order_summary s ON s.order_id = orders.id";
+    if (!filter().isEmpty()) {
+        statement += " WHERE " + filter();
+    }
+
+    QString orderBy = orderByClause();
+    if (!orderBy.isEmpty()) {
+        statement += " " + orderBy;
+    }
+    return statement;
+}
+
+QString OrdersTableModel::orderByClause() const
+{
+    // The base class only knows the orders columns
+    if (m_sortColumn >= LineCountColumn && m_sortColumn <= TotalValueColumn) {
+        static const char* const columns[] = {"s.line_count", "s.total_units", "s.total_value"};
+        return QString("ORDER BY %1 %2").arg(QString(columns[m_sortColumn - LineCountColumn]),
+                                             QString(m_sortOrder == Qt::AscendingOrder ? "ASC" : "DESC"));
+    }
+    return QSqlTableModel::orderByClause();
+}
+
+void OrdersTableModel::setSort(int column, Qt::SortOrder order)
+{
+    m_sortColumn = column;
+    m_sortOrder = order;
+    QSqlTableModel::setSort(column, order);
+}
+
+bool OrdersTableModel::selectRow(int row)
+{
+    // The base implementation re-reads only the orders columns, which would
+    // drop the joined ones and leave the summary stale; reload instead
+    Q_UNUSED(row);
+    return select();
+}
+
+Qt::ItemFlags OrdersTableModel::flags(const QModelIndex &index) const
+{
+    Qt::ItemFlags result = QSqlTableModel::flags(index);
+    if (index.column() >= LineCountColumn) {
+        result &= ~Qt::ItemIsEditable;
+    }
+    return result;
+}
+
+QVariant OrdersTableModel::data(const QModelIndex &index, int role) const
+{
+    QVariant value = QSqlTableModel::data(index, role);
+    if ((role != Qt::DisplayRole && role != Qt::EditRole) || value.isNull()) {
+        return value;
+    }
+
+    switch (index.column()) {
+    case OrdersTable::Date:
+        return DatabaseManager::decodeOrderDate(value).toString(Qt::ISODate);
+    case OrdersTable::Type:
+        return DatabaseManager::decodeOrderType(value);
+    case OrdersTable::Status:
+        if (role == Qt::DisplayRole) {
+            return value.toInt() == OrderStatusPosted ? tr("Posted") : tr("Open");
+        }
+        return value;
+    case TotalValueColumn:
+        if (role == Qt::DisplayRole) {
+            return Money::fromMinorUnits(value.toLongLong()).toString();
+        }
+        return value;
+    default:
+        return value;
+    }
+}
+
+bool OrdersTableModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (role == Qt::EditRole && !value.isNull()) {
+        switch (index.column()) {
+        case OrdersTable::Date: {
+            QDate date = value.userType() == QMetaType::QDate ? value.toDate()
+                                                            : QDate::fromString(value.toString(), Qt::ISODate);
+            if (!date.isValid()) {
+                return false;
+            }
+            return QSqlTableModel::setData(index, DatabaseManager::encodeOrderDate(date), role);
+        }
+        case OrdersTable::Type:
+            return QSqlTableModel::setData(index, DatabaseManager::encodeOrderType(value.toString()), role);
+        default:
+            break;
+        }
+    }
+
+    return QSqlTableModel::setData(index, value, role);
+}
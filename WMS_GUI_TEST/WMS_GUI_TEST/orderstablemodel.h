@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QSqlTableModel>
+#include "schema.h"
+
+// Table model for "orders" that presents the stored Julian day numbers and
+// type codes as ISO date strings and "to"/"from", so views, mappers and
+// setData() callers keep working with the readable representation.
+//
+// The select joins order_summary, so the trigger-maintained line count,
+// unit total and value appear as read-only columns after the orders
+// columns and can be sorted on. Writes only ever touch the orders columns.
+class OrdersTableModel : public QSqlTableModel
+{
+    Q_OBJECT
+
+public:
+    enum SummaryColumn {
+        LineCountColumn = OrdersTable::Status + 1,
+        TotalUnitsColumn,
+        TotalValueColumn
+    };
+
+    explicit OrdersTableModel(QObject *parent = nullptr);
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+    void setSort(int column, Qt::SortOrder order) override;
+    bool selectRow(int row) override;
+
+protected:
+    QString selectStatement() const override;
+    QString orderByClause() const override;
+
+private:
+    int m_sortColumn;
+    Qt::SortOrder m_sortOrder;
+};
@@ -5,6 +5,18 @@
 #include <QScreen>
 #include <QGuiApplication>
 #include <QSqlQuery>
+#include <QFileDialog>
+#include <QApplication>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QHeaderView>
+#include <QStandardItemModel>
+#include <QVBoxLayout>
+#include "metrics.h"
+#include "databasemanager.h"
+#include "tracing.h"
+#include "csvimporter.h"
+#include "importreportdialog.h"
 
 OrdersWindow::OrdersWindow(QWidget *parent) :
     QWidget(parent),
@@ -12,6 +24,7 @@ OrdersWindow::OrdersWindow(QWidget *parent) :
     model(nullptr),
     mapper(nullptr),
     orderLinesWindow(nullptr),
+    archiver(new OrderArchiver(this)),
     isAdding(false)
 {
     ui->setupUi(this);
@@ -34,6 +47,10 @@ OrdersWindow::OrdersWindow(QWidget *parent) :
 
     // Connect double-click signal
     connect(ui->tableView, &QTableView::doubleClicked, this, &OrdersWindow::on_tableView_doubleClicked);
+
+    connect(ui->searchLineEdit, &QLineEdit::returnPressed, this, &OrdersWindow::on_searchButton_clicked);
+    connect(archiver, &OrderArchiver::finished, this, &OrdersWindow::archivingFinished);
+    ui->includeArchivedCheckBox->setEnabled(DatabaseManager::instance().isArchiveAttached());
 }
 
 OrdersWindow::~OrdersWindow()
@@ -59,36 +76,55 @@ OrdersWindow::~OrdersWindow()
 
 void OrdersWindow::setupModel()
 {
-    model = new QSqlTableModel(this);
+    WMS_TRACE_SCOPE("OrdersWindow::setupModel");
+
+    model = new OrdersTableModel(this);
     model->setTable("orders");
 
     // Set headers
-    model->setHeaderData(0, Qt::Horizontal, tr("ID"));
-    model->setHeaderData(1, Qt::Horizontal, tr("Order Number"));
-    model->setHeaderData(2, Qt::Horizontal, tr("Date"));
-    model->setHeaderData(3, Qt::Horizontal, tr("Type"));
+    model->setHeaderData(OrdersTable::Id, Qt::Horizontal, tr("ID"));
+    model->setHeaderData(OrdersTable::Number, Qt::Horizontal, tr("Order Number"));
+    model->setHeaderData(OrdersTable::Date, Qt::Horizontal, tr("Date"));
+    model->setHeaderData(OrdersTable::Type, Qt::Horizontal, tr("Type"));
+    model->setHeaderData(OrdersTable::Status, Qt::Horizontal, tr("Status"));
 
     // Load data
-    model->select();
+    {
+        static MetricHistogram* const reloadTime = MetricsRegistry::instance().histogram(
+            "wms_model_reload_duration_seconds", "Time spent in model select()", "model=\"orders\"");
+        ScopedMetricsTimer timer(reloadTime);
+        WMS_TRACE_SCOPE_CAT("QSqlTableModel::select", "model");
+        model->select();
+    }
+
+    // The summary columns only exist once the joined select has run
+    model->setHeaderData(OrdersTableModel::LineCountColumn, Qt::Horizontal, tr("Lines"));
+    model->setHeaderData(OrdersTableModel::TotalUnitsColumn, Qt::Horizontal, tr("Units"));
+    model->setHeaderData(OrdersTableModel::TotalValueColumn, Qt::Horizontal, tr("Value"));
 
     // Set model to table view
     ui->tableView->setModel(model);
 
     // Hide ID column
-    ui->tableView->hideColumn(0);
+    ui->tableView->hideColumn(OrdersTable::Id);
+
+    // Sorting re-selects through OrdersTableModel, so summary columns sort in SQL
+    ui->tableView->setSortingEnabled(true);
 }
 
 void OrdersWindow::setupMapper()
 {
+    WMS_TRACE_SCOPE("OrdersWindow::setupMapper");
+
     mapper = new QDataWidgetMapper(this);
     mapper->setModel(model);
     mapper->setSubmitPolicy(QDataWidgetMapper::ManualSubmit);
 
     // Map fields to form controls
-    mapper->addMapping(ui->idLineEdit, 0);
-    mapper->addMapping(ui->orderNumberLineEdit, 1);
+    mapper->addMapping(ui->idLineEdit, OrdersTable::Id);
+    mapper->addMapping(ui->orderNumberLineEdit, OrdersTable::Number);
     // Need a special delegate for date field
-    mapper->addMapping(ui->typeComboBox, 3);
+    mapper->addMapping(ui->typeComboBox, OrdersTable::Type);
     if (model->rowCount() > 0) {
         ui->tableView->selectRow(0);
         mapper->setCurrentIndex(0);
@@ -113,12 +149,18 @@ void OrdersWindow::clearForm()
 void OrdersWindow::updateButtonStates(bool editMode)
 {
     ui->addButton->setEnabled(!editMode);
-    ui->editButton->setEnabled(!editMode && ui->tableView->currentIndex().isValid());
+    ui->editButton->setEnabled(!editMode && ui->tableView->currentIndex().isValid()
+                               && !isPosted(ui->tableView->currentIndex().row()));
     ui->deleteButton->setEnabled(!editMode && ui->tableView->currentIndex().isValid());
+    ui->importButton->setEnabled(!editMode);
+    ui->archiveButton->setEnabled(!editMode && !archiver->isRunning()
+                                  && DatabaseManager::instance().isArchiveAttached());
     ui->saveButton->setEnabled(editMode);
     ui->cancelButton->setEnabled(editMode);
     ui->tableView->setEnabled(!editMode);
     ui->viewLinesButton->setEnabled(!editMode && ui->tableView->currentIndex().isValid());
+    ui->postButton->setEnabled(!editMode && ui->tableView->currentIndex().isValid()
+                               && !isPosted(ui->tableView->currentIndex().row()));
 }
 
 void OrdersWindow::on_addButton_clicked()
@@ -144,12 +186,14 @@ void OrdersWindow::on_editButton_clicked()
 
     // Set date field from model data
     int row = ui->tableView->currentIndex().row();
-    QString dateStr = model->data(model->index(row, 2)).toString();
+    QString dateStr = model->data(model->index(row, OrdersTable::Date)).toString();
     ui->dateEdit->setDate(QDate::fromString(dateStr, Qt::ISODate));
 }
 
 void OrdersWindow::on_deleteButton_clicked()
 {
+    WMS_TRACE_SCOPE("OrdersWindow::on_deleteButton_clicked");
+
     if (!ui->tableView->currentIndex().isValid()) {
         QMessageBox::warning(this, tr("Delete Order"), tr("Please select an order to delete."));
         return;
@@ -157,6 +201,12 @@ void OrdersWindow::on_deleteButton_clicked()
 
     int row = ui->tableView->currentIndex().row();
 
+    if (isPosted(row)) {
+        QMessageBox::warning(this, tr("Delete Order"),
+                             tr("This order has been posted to stock and cannot be deleted."));
+        return;
+    }
+
     QMessageBox::StandardButton reply;
     reply = QMessageBox::question(this, tr("Delete Order"),
                                   tr("Are you sure you want to delete this order?"),
@@ -174,8 +224,152 @@ void OrdersWindow::on_deleteButton_clicked()
     }
 }
 
+void OrdersWindow::on_postButton_clicked()
+{
+    WMS_TRACE_SCOPE("OrdersWindow::on_postButton_clicked");
+
+    if (!ui->tableView->currentIndex().isValid()) {
+        QMessageBox::warning(this, tr("Post Order"), tr("Please select an order to post."));
+        return;
+    }
+
+    int row = ui->tableView->currentIndex().row();
+    int orderId = model->data(model->index(row, OrdersTable::Id)).toInt();
+    QString orderNumber = model->data(model->index(row, OrdersTable::Number)).toString();
+
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question(this, tr("Post Order"),
+                                  tr("Apply order %1 to stock? Posted orders can no longer be changed.").arg(orderNumber),
+                                  QMessageBox::Yes | QMessageBox::No);
+    if (reply != QMessageBox::Yes) {
+        return;
+    }
+
+    QString error;
+    if (!DatabaseManager::instance().postOrder(orderId, &error)) {
+        QMessageBox::warning(this, tr("Post Order"), tr("Failed to post order: %1").arg(error));
+        return;
+    }
+
+    model->select();
+    ui->tableView->selectRow(row);
+    updateButtonStates(false);
+}
+
+bool OrdersWindow::isPosted(int row) const
+{
+    return model->data(model->index(row, OrdersTable::Status), Qt::EditRole).toInt() == OrderStatusPosted;
+}
+
+void OrdersWindow::on_archiveButton_clicked()
+{
+    WMS_TRACE_SCOPE("OrdersWindow::on_archiveButton_clicked");
+
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question(this, tr("Archive Orders"),
+                                  tr("Move posted orders dated before %1 and their lines to the archive database?")
+                                      .arg(QDate::currentDate().addDays(-archiver->retentionDays()).toString(Qt::ISODate)),
+                                  QMessageBox::Yes | QMessageBox::No);
+    if (reply != QMessageBox::Yes) {
+        return;
+    }
+
+    if (archiver->start()) {
+        ui->archiveButton->setEnabled(false);
+        ui->archiveButton->setText(tr("Archiving..."));
+    }
+}
+
+void OrdersWindow::archivingFinished(int archivedOrders, int archivedLines, const QString& errorMessage)
+{
+    ui->archiveButton->setText(tr("Archive Old..."));
+    model->select();
+    updateButtonStates(false);
+
+    if (!errorMessage.isEmpty()) {
+        QMessageBox::warning(this, tr("Archive Orders"),
+                             tr("Archiving stopped after %1 orders: %2").arg(archivedOrders).arg(errorMessage));
+        return;
+    }
+    QMessageBox::information(this, tr("Archive Orders"),
+                             tr("Archived %1 orders with %2 lines.").arg(archivedOrders).arg(archivedLines));
+}
+
+void OrdersWindow::on_searchButton_clicked()
+{
+    WMS_TRACE_SCOPE("OrdersWindow::on_searchButton_clicked");
+
+    QString text = ui->searchLineEdit->text().trimmed();
+    if (text.isEmpty()) {
+        model->setFilter(QString());
+    } else {
+        QString pattern = DatabaseManager::containsPattern(text).replace("'", "''");
+        model->setFilter(QString("orders.order_number LIKE '%1' ESCAPE '\\'").arg(pattern));
+    }
+    model->select();
+    updateButtonStates(false);
+
+    // The editable table only holds live orders; archived matches are listed separately
+    if (!text.isEmpty() && ui->includeArchivedCheckBox->isChecked()) {
+        showSearchResults(text);
+    }
+}
+
+void OrdersWindow::showSearchResults(const QString& text)
+{
+    QSqlQuery query = DatabaseManager::instance().searchOrders(text, true);
+
+    auto *results = new QStandardItemModel(0, 5);
+    results->setHorizontalHeaderLabels({tr("Order Number"), tr("Date"), tr("Type"), tr("Status"), tr("Archived")});
+    while (query.next()) {
+        results->appendRow({new QStandardItem(query.value(1).toString()),
+                            new QStandardItem(DatabaseManager::decodeOrderDate(query.value(2)).toString(Qt::ISODate)),
+                            new QStandardItem(DatabaseManager::decodeOrderType(query.value(3))),
+                            new QStandardItem(query.value(4).toInt() == OrderStatusPosted ? tr("Posted") : tr("Open")),
+                            new QStandardItem(query.value(5).toInt() ? tr("Yes") : tr("No"))});
+    }
+
+    QDialog dialog(this);
+    dialog.setWindowTitle(tr("Orders matching \"%1\"").arg(text));
+    dialog.resize(600, 400);
+    results->setParent(&dialog);
+
+    auto *layout = new QVBoxLayout(&dialog);
+    auto *view = new QTableView(&dialog);
+    view->setModel(results);
+    view->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    view->setSelectionBehavior(QAbstractItemView::SelectRows);
+    view->horizontalHeader()->setStretchLastSection(true);
+    layout->addWidget(view);
+    auto *buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    layout->addWidget(buttons);
+
+    dialog.exec();
+}
+
+void OrdersWindow::on_importButton_clicked()
+{
+    WMS_TRACE_SCOPE("OrdersWindow::on_importButton_clicked");
+
+    QString filePath = QFileDialog::getOpenFileName(this, tr("Import ASN"), QString(),
+                                                    tr("CSV files (*.csv *.txt);;All files (*)"));
+    if (filePath.isEmpty()) {
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    CsvImportReport report = CsvImporter().importOrderLines(filePath);
+    QApplication::restoreOverrideCursor();
+
+    model->select();
+    showImportReport(this, report);
+}
+
 void OrdersWindow::on_saveButton_clicked()
 {
+    WMS_TRACE_SCOPE("OrdersWindow::on_saveButton_clicked");
+
     // Validate input
     if (ui->orderNumberLineEdit->text().isEmpty()) {
         QMessageBox::warning(this, tr("Save Order"), tr("Order Number is required."));
@@ -188,16 +382,16 @@ void OrdersWindow::on_saveButton_clicked()
         int row = model->rowCount();
         model->insertRow(row);
 
-        model->setData(model->index(row, 1), ui->orderNumberLineEdit->text());
-        model->setData(model->index(row, 2), ui->dateEdit->date().toString(Qt::ISODate));
-        model->setData(model->index(row, 3), ui->typeComboBox->currentText());
+        model->setData(model->index(row, OrdersTable::Number), ui->orderNumberLineEdit->text());
+        model->setData(model->index(row, OrdersTable::Date), ui->dateEdit->date().toString(Qt::ISODate));
+        model->setData(model->index(row, OrdersTable::Type), ui->typeComboBox->currentText());
     } else {
         // Update existing record
         int row = ui->tableView->currentIndex().row();
 
-        model->setData(model->index(row, 1), ui->orderNumberLineEdit->text());
-        model->setData(model->index(row, 2), ui->dateEdit->date().toString(Qt::ISODate));
-        model->setData(model->index(row, 3), ui->typeComboBox->currentText());
+        model->setData(model->index(row, OrdersTable::Number), ui->orderNumberLineEdit->text());
+        model->setData(model->index(row, OrdersTable::Date), ui->dateEdit->date().toString(Qt::ISODate));
+        model->setData(model->index(row, OrdersTable::Type), ui->typeComboBox->currentText());
     }
 
     // Submit changes to database
@@ -222,7 +416,7 @@ void OrdersWindow::on_cancelButton_clicked()
         mapper->setCurrentIndex(currentRow);
 
         // Set date field from model data
-        QString dateStr = model->data(model->index(currentRow, 2)).toString();
+        QString dateStr = model->data(model->index(currentRow, OrdersTable::Date)).toString();
         ui->dateEdit->setDate(QDate::fromString(dateStr, Qt::ISODate));
     }
 
@@ -233,11 +427,13 @@ void OrdersWindow::on_cancelButton_clicked()
 
 void OrdersWindow::on_tableView_clicked(const QModelIndex &index)
 {
+    WMS_TRACE_SCOPE("OrdersWindow::on_tableView_clicked");
+
     if (index.isValid()) {
         mapper->setCurrentIndex(index.row());
 
         // Set date field from model data
-        QString dateStr = model->data(model->index(index.row(), 2)).toString();
+        QString dateStr = model->data(model->index(index.row(), OrdersTable::Date)).toString();
         ui->dateEdit->setDate(QDate::fromString(dateStr, Qt::ISODate));
 
         updateButtonStates(false);
@@ -246,6 +442,8 @@ void OrdersWindow::on_tableView_clicked(const QModelIndex &index)
 
 void OrdersWindow::openOrderLines(int orderId)
 {
+    WMS_TRACE_SCOPE("OrdersWindow::openOrderLines");
+
     if (orderId <= 0) {
         QMessageBox::warning(this, tr("View Order Lines"), tr("Invalid order ID."));
         return;
@@ -269,14 +467,14 @@ void OrdersWindow::on_viewLinesButton_clicked()
         return;
     }
 
-    int orderId = model->data(model->index(ui->tableView->currentIndex().row(), 0)).toInt();
+    int orderId = model->data(model->index(ui->tableView->currentIndex().row(), OrdersTable::Id)).toInt();
     openOrderLines(orderId);
 }
 
 void OrdersWindow::on_tableView_doubleClicked(const QModelIndex &index)
 {
     if (index.isValid()) {
-        int orderId = model->data(model->index(index.row(), 0)).toInt();
+        int orderId = model->data(model->index(index.row(), OrdersTable::Id)).toInt();
         openOrderLines(orderId);
     }
 }
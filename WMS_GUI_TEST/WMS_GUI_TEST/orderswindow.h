@@ -6,6 +6,8 @@
 #include <QDataWidgetMapper>
 #include <QDate>
 #include "orderlineswindow.h"
+#include "orderstablemodel.h"
+#include "orderarchiver.h"
 
 namespace Ui {
 class OrdersWindow;
@@ -23,6 +25,11 @@ private slots:
     void on_addButton_clicked();
     void on_editButton_clicked();
     void on_deleteButton_clicked();
+    void on_importButton_clicked();
+    void on_postButton_clicked();
+    void on_archiveButton_clicked();
+    void on_searchButton_clicked();
+    void archivingFinished(int archivedOrders, int archivedLines, const QString& errorMessage);
     void on_saveButton_clicked();
     void on_cancelButton_clicked();
     void on_tableView_clicked(const QModelIndex &index);
@@ -31,9 +38,10 @@ private slots:
 
 private:
     Ui::OrdersWindow *ui;
-    QSqlTableModel *model;
+    OrdersTableModel *model;
     QDataWidgetMapper *mapper;
     OrderLinesWindow *orderLinesWindow;
+    OrderArchiver *archiver;
     bool isAdding;
 
     void setupModel();
@@ -42,4 +50,6 @@ private:
     void clearForm();
     void updateButtonStates(bool editMode);
     void openOrderLines(int orderId);
+    bool isPosted(int row) const;
+    void showSearchResults(const QString& text);
 };
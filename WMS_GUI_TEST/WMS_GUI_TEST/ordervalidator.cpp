@@ -0,0 +1,124 @@
+#include "ordervalidator.h"
+#include "repositories.h"
+#include "tracing.h"
+
+#include <QThread>
+#include <QThreadPool>
+#include <QHash>
+#include <algorithm>
+#include <limits>
+
+std::shared_ptr<const KeySnapshot> KeySnapshot::load(const QSqlDatabase& db)
+{
+    WMS_TRACE_SCOPE_CAT("KeySnapshot::load", "import");
+
+    auto keys = std::make_shared<KeySnapshot>();
+    for (const Item& item : ItemRepository(db).all()) {
+        keys->itemIds.emplace(item.code.toStdString(), item.id);
+    }
+    for (const Order& order : OrderRepository(db).all()) {
+        keys->orderIds.emplace(order.number.toStdString(), order.id);
+    }
+    return keys;
+}
+
+OrderValidator::OrderValidator(std::shared_ptr<const KeySnapshot> keys)
+    : m_keys(std::move(keys)), m_threads(QThread::idealThreadCount())
+{
+}
+
+namespace {
+
+struct Shard
+{
+    std::vector<size_t> lines;
+    qint64 errorCount = 0;
+    std::vector<CsvImportError> errors;
+
+    void reject(qint64 line, const QString& message)
+    {
+        ++errorCount;
+        if (errors.size() < size_t(CsvImporter::kMaxReportedErrors)) {
+            errors.push_back({line, message});
+        }
+    }
+};
+
+void validateShard(Shard& shard, std::vector<InboundOrderLine>& lines, const KeySnapshot& keys)
+{
+    WMS_TRACE_SCOPE_CAT("OrderValidator::validateShard", "import");
+
+    // First line seen for each order number in this shard
+    QHash<QString, size_t> firstLine;
+
+    for (size_t index : shard.lines) {
+        InboundOrderLine& line = lines[index];
+
+        auto item = keys.itemIds.find(std::string_view(line.itemCode));
+        if (item == keys.itemIds.end()) {
+            shard.reject(line.line, QString("Unknown item code: %1").arg(QString::fromStdString(line.itemCode)));
+        } else {
+            line.itemId = item->second;
+        }
+
+        if (line.quantity <= 0 || line.quantity > std::numeric_limits<int>::max()) {
+            shard.reject(line.line, QString("Quantity must be positive: %1").arg(line.quantity));
+        }
+
+        QByteArray number = line.orderNumber.toUtf8();
+        if (keys.orderIds.find(std::string_view(number.constData(), size_t(number.size()))) != keys.orderIds.end()) {
+            shard.reject(line.line, QString("Order number %1 already exists").arg(line.orderNumber));
+            continue;
+        }
+
+        auto first = firstLine.constFind(line.orderNumber);
+        if (first == firstLine.constEnd()) {
+            firstLine.insert(line.orderNumber, index);
+        } else {
+            const InboundOrderLine& header = lines[*first];
+            if (header.date != line.date || header.type != line.type) {
+                shard.reject(line.line, QString("Date or type differs from line %1 of order %2")
+                                            .arg(header.line).arg(line.orderNumber));
+            }
+        }
+    }
+}
+
+} // namespace
+
+bool OrderValidator::validate(std::vector<InboundOrderLine>& lines, CsvImportReport& report) const
+{
+    WMS_TRACE_SCOPE_CAT("OrderValidator::validate", "import");
+
+    // Shard by order number; every line of an order lands in the same shard
+    size_t shardCount = size_t(qMax(1, m_threads));
+    std::vector<Shard> shards(shardCount);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        shards[qHash(lines[i].orderNumber) % shardCount].lines.push_back(i);
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(int(shardCount));
+    for (Shard& shard : shards) {
+        if (!shard.lines.empty()) {
+            pool.start([&shard, &lines, this]() {
+                validateShard(shard, lines, *m_keys);
+            });
+        }
+    }
+    pool.waitForDone();
+
+    qint64 errorsBefore = report.errorCount;
+    for (Shard& shard : shards) {
+        report.errorCount += shard.errorCount;
+        for (CsvImportError& error : shard.errors) {
+            if (report.errors.size() < size_t(CsvImporter::kMaxReportedErrors)) {
+                report.errors.push_back(std::move(error));
+            }
+        }
+    }
+    std::sort(report.errors.begin(), report.errors.end(),
+              [](const CsvImportError& a, const CsvImportError& b) { return a.line < b.line; });
+
+    return report.errorCount == errorsBefore;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QSqlDatabase>
+#include <QDate>
+#include <QString>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "entities.h"
+#include "csvimporter.h"
+
+// Hash for std::string keys that can be probed with a string_view, so
+// lookups with text straight from an input file do not allocate
+struct KeyHash
+{
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+};
+using KeyIndex = std::unordered_map<std::string, int, KeyHash, std::equal_to<>>;
+
+// Read-only copy of the keys inbound files are checked against: item codes
+// and existing order numbers (UTF-8) mapped to their ids. Loaded once before
+// validation and then shared, unmodified, by all worker threads.
+struct KeySnapshot
+{
+    KeyIndex itemIds;
+    KeyIndex orderIds;
+
+    static std::shared_ptr<const KeySnapshot> load(const QSqlDatabase& db = QSqlDatabase::database());
+};
+
+// One line of an inbound order file that passed the syntax checks
+struct InboundOrderLine
+{
+    qint64 line = 0;
+    QString orderNumber;
+    QDate date;
+    OrderType type = OrderTypeTo;
+    std::string itemCode;
+    qint64 quantity = 0;
+
+    // Filled in by OrderValidator
+    int itemId = 0;
+};
+
+// Pre-validation of inbound order lines, run before any write transaction
+// is opened. Lines are sharded by order number across a thread pool, so all
+// lines of one order are seen by the same worker and per-order checks need
+// no locking. Each line must reference an existing item, have a positive
+// quantity, and carry an order number that is not already in the orders
+// table (order_number is UNIQUE) and whose date and type agree with the
+// order's other lines in the file.
+class OrderValidator
+{
+public:
+    explicit OrderValidator(std::shared_ptr<const KeySnapshot> keys);
+
+    // Number of worker threads; defaults to QThread::idealThreadCount()
+    void setThreadCount(int threads) { m_threads = threads; }
+
+    // Checks every line, resolving itemId, and appends all problems to the
+    // report. Returns true if no line was rejected.
+    bool validate(std::vector<InboundOrderLine>& lines, CsvImportReport& report) const;
+
+private:
+    std::shared_ptr<const KeySnapshot> m_keys;
+    int m_threads;
+};
@@ -0,0 +1,87 @@
+#include "queryrecorder.h"
+
+#include <QDebug>
+#include <sqlite3.h>
+
+QueryRecorder::~QueryRecorder()
+{
+    stop();
+}
+
+bool QueryRecorder::start(const QString& filePath)
+{
+    if (!m_writer.open(filePath)) {
+        qDebug() << "Failed to open workload log:" << filePath;
+        return false;
+    }
+
+    m_clock.start();
+    qDebug() << "Recording workload to" << filePath;
+    return true;
+}
+
+void QueryRecorder::stop()
+{
+    while (!m_handles.isEmpty()) {
+        detach(m_handles.first());
+    }
+    m_writer.close();
+}
+
+void QueryRecorder::attach(sqlite3* db, quint32 session)
+{
+    if (!db || m_handles.contains(db)) {
+        return;
+    }
+
+    Connection* connection = new Connection{this, session};
+    sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, &QueryRecorder::traceCallback, connection);
+    m_handles.append(db);
+    m_connections.append(connection);
+}
+
+void QueryRecorder::detach(sqlite3* db)
+{
+    int index = m_handles.indexOf(db);
+    if (index < 0) {
+        return;
+    }
+
+    sqlite3_trace_v2(db, 0, nullptr, nullptr);
+    delete m_connections.takeAt(index);
+    m_handles.removeAt(index);
+}
+
+// Statements that may bind a password hash (writes to users and logins) are
+// recorded with their placeholders; replaying them binds NULL
+static bool bindsPassword(const QByteArray& statement)
+{
+    QByteArray lower = statement.toLower();
+    return lower.contains("users") && lower.contains("password");
+}
+
+int QueryRecorder::traceCallback(unsigned type, void* context, void* p, void* x)
+{
+    if (type != SQLITE_TRACE_PROFILE) {
+        return 0;
+    }
+
+    Connection* connection = static_cast<Connection*>(context);
+    QueryRecorder* recorder = connection->recorder;
+    sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(p);
+    qint64 durationUs = *static_cast<sqlite3_int64*>(x) / 1000;
+    qint64 startUs = recorder->m_clock.nsecsElapsed() / 1000 - durationUs;
+
+    QByteArray statement(sqlite3_sql(stmt));
+    QByteArray expanded;
+    if (sqlite3_bind_parameter_count(stmt) > 0 && !bindsPassword(statement)) {
+        char* text = sqlite3_expanded_sql(stmt);
+        if (text) {
+            expanded = QByteArray(text);
+            sqlite3_free(text);
+        }
+    }
+
+    recorder->m_writer.append(connection->session, startUs, durationUs, statement, expanded);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "workloadlog.h"
+
+#include <QElapsedTimer>
+#include <QString>
+
+struct sqlite3;
+
+// Captures every statement executed on a SQLite connection (QSqlQuery,
+// QSqlTableModel, ...) into a workload log via sqlite3_trace_v2, so the
+// session can later be replayed with wms_replay. Bound parameters are
+// inlined, except for statements on users.password, so password hashes
+// never reach the log.
+class QueryRecorder
+{
+public:
+    QueryRecorder() = default;
+    ~QueryRecorder();
+
+    bool start(const QString& filePath);
+    void stop();
+    bool isRecording() const { return m_writer.isOpen(); }
+
+    void attach(sqlite3* db, quint32 session);
+    void detach(sqlite3* db);
+
+private:
+    static int traceCallback(unsigned type, void* context, void* p, void* x);
+
+    struct Connection {
+        QueryRecorder* recorder;
+        quint32 session;
+    };
+
+    WorkloadLogWriter m_writer;
+    QElapsedTimer m_clock;
+    QList<Connection*> m_connections;
+    QList<sqlite3*> m_handles;
+};
@@ -0,0 +1,527 @@
+#include "remotesqldriver.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "varint.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QSettings>
+#include <QSqlField>
+#include <QSqlIndex>
+#include <QTcpSocket>
+
+static QSqlField makeField(const QString& name, const QVariant& sample)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return QSqlField(name, QMetaType(sample.userType()));
+#else
+    return QSqlField(name, QVariant::Type(sample.userType()));
+#endif
+}
+
+// Type of a column as QSQLITE derives it from the declared type
+static QVariant declaredTypeSample(const QString& declaredType)
+{
+    QString type = declaredType.toUpper();
+    if (type.contains("INT")) {
+        return QVariant(qlonglong(0));
+    }
+    if (type.contains("REAL") || type.contains("FLOA") || type.contains("DOUB")) {
+        return QVariant(0.0);
+    }
+    if (type.contains("BLOB")) {
+        return QVariant(QByteArray());
+    }
+    return QVariant(QString());
+}
+
+RemoteSqlDriver::RemoteSqlDriver(QObject* parent)
+    : QSqlDriver(parent),
+      m_timeoutMs(30000),
+      m_nextId(1),
+      m_pendingBegin(0)
+{
+}
+
+RemoteSqlDriver::~RemoteSqlDriver()
+{
+    close();
+}
+
+bool RemoteSqlDriver::hasFeature(DriverFeature feature) const
+{
+    switch (feature) {
+    case Transactions:
+    case QuerySize:
+    case BLOB:
+    case Unicode:
+    case PreparedQueries:
+    case PositionalPlaceholders:
+    case LastInsertId:
+    case BatchOperations:
+        return true;
+    default:
+        // Named placeholders are rewritten to positional ones by QSqlResult
+        return false;
+    }
+}
+
+void RemoteSqlDriver::fail(const QString& message, QSqlError::ErrorType type)
+{
+    qDebug() << "wmsd:" << message;
+    setLastError(QSqlError(QString("Unable to open connection"), message, type));
+}
+
+bool RemoteSqlDriver::open(const QString& db, const QString& user, const QString& password, const QString& host,
+                           int port, const QString& connectOptions)
+{
+    Q_UNUSED(user);
+    Q_UNUSED(connectOptions);
+
+    close();
+    m_timeoutMs = qMax(100, QSettings().value("rpc/timeoutMs", 30000).toInt());
+
+    if (host.isEmpty()) {
+        auto socket = std::make_unique<QLocalSocket>();
+        socket->connectToServer(db.isEmpty() ? QString("wmsd") : db);
+        if (!socket->waitForConnected(m_timeoutMs)) {
+            fail(socket->errorString(), QSqlError::ConnectionError);
+            setOpenError(true);
+            return false;
+        }
+        m_socket = std::move(socket);
+    } else {
+        auto socket = std::make_unique<QTcpSocket>();
+        socket->connectToHost(host, port > 0 ? quint16(port) : kDefaultPort);
+        if (!socket->waitForConnected(m_timeoutMs)) {
+            fail(socket->errorString(), QSqlError::ConnectionError);
+            setOpenError(true);
+            return false;
+        }
+        // Requests are small and answered one by one
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        m_socket = std::move(socket);
+    }
+
+    QByteArray hello;
+    appendVarint(hello, kRpcProtocolVersion);
+    hello.append(encodeRpcString(password));
+    RpcFrame reply;
+    QString error;
+    if (!call(RpcType::Hello, hello, reply, &error) || !decodeRpcString(reply.payload, m_serverSite)) {
+        m_socket.reset();
+        fail(error.isEmpty() ? QString("Invalid reply to the handshake") : error, QSqlError::ConnectionError);
+        setOpenError(true);
+        return false;
+    }
+
+    setOpen(true);
+    setOpenError(false);
+    return true;
+}
+
+void RemoteSqlDriver::close()
+{
+    if (m_socket) {
+        if (auto local = qobject_cast<QLocalSocket*>(m_socket.get())) {
+            local->disconnectFromServer();
+        } else if (auto tcp = qobject_cast<QTcpSocket*>(m_socket.get())) {
+            tcp->disconnectFromHost();
+        }
+        m_socket.reset();
+    }
+    m_buffer.clear();
+    m_replies.clear();
+    m_abandoned.clear();
+    m_pendingBegin = 0;
+    if (isOpen()) {
+        setOpen(false);
+        setOpenError(false);
+    }
+}
+
+QSqlResult* RemoteSqlDriver::createResult() const
+{
+    return new RemoteSqlResult(this);
+}
+
+quint64 RemoteSqlDriver::send(RpcType type, const QByteArray& payload) const
+{
+    quint64 id = m_nextId++;
+    m_socket->write(encodeRpcFrame(id, type, payload));
+    return id;
+}
+
+bool RemoteSqlDriver::waitFor(quint64 id, RpcFrame& reply, QString* errorMessage) const
+{
+    auto setError = [&](const QString& message) {
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        auto it = m_replies.find(id);
+        if (it != m_replies.end()) {
+            reply = std::move(it->second);
+            m_replies.erase(it);
+            break;
+        }
+
+        m_buffer.append(m_socket->readAll());
+        RpcFrame frame;
+        bool corrupt = false;
+        bool received = false;
+        while (takeRpcFrame(m_buffer, frame, &corrupt)) {
+            // Late replies to calls that gave up waiting are dropped rather
+            // than kept in m_replies for good
+            if (m_abandoned.erase(frame.id) == 0) {
+                m_replies[frame.id] = std::move(frame);
+            }
+            received = true;
+        }
+        if (corrupt) {
+            return setError("Invalid data from wmsd");
+        }
+        if (received) {
+            continue;
+        }
+
+        // Unsent requests would wait forever for their replies
+        if (m_socket->bytesToWrite() > 0) {
+            m_socket->waitForBytesWritten(0);
+        }
+        qint64 remaining = m_timeoutMs - timer.elapsed();
+        if (remaining <= 0) {
+            m_abandoned.insert(id);
+            return setError("No reply from wmsd; the statement may still be carried out");
+        }
+        if (!m_socket->waitForReadyRead(int(remaining)) && m_socket->bytesAvailable() == 0) {
+            m_abandoned.insert(id);
+            return setError(timer.elapsed() >= m_timeoutMs ? QString("No reply from wmsd; the statement may still be carried out")
+                                                           : QString("Connection to wmsd lost: %1").arg(m_socket->errorString()));
+        }
+    }
+
+    // A failed BEGIN also fails the statements sent after it, so its own
+    // reply only needs logging
+    if (m_pendingBegin != 0) {
+        auto begin = m_replies.find(m_pendingBegin);
+        if (begin != m_replies.end()) {
+            if (begin->second.type == RpcType::Error) {
+                QString message;
+                decodeRpcString(begin->second.payload, message);
+                qDebug() << "wmsd: BEGIN failed:" << message;
+            }
+            m_replies.erase(begin);
+            m_pendingBegin = 0;
+        }
+    }
+
+    if (reply.type == RpcType::Error) {
+        QString message;
+        decodeRpcString(reply.payload, message);
+        return setError(message);
+    }
+    return true;
+}
+
+bool RemoteSqlDriver::call(RpcType type, const QByteArray& payload, RpcFrame& reply, QString* errorMessage) const
+{
+    WMS_TRACE_SCOPE_CAT("RemoteSqlDriver::call", "sql");
+
+    static MetricHistogram* const roundTrips = MetricsRegistry::instance().histogram(
+        "wms_rpc_client_call_duration_seconds", "Time from sending a request to wmsd until its reply arrived");
+    ScopedMetricsTimer metricsTimer(roundTrips);
+
+    if (!m_socket) {
+        if (errorMessage) {
+            *errorMessage = "Not connected to wmsd";
+        }
+        return false;
+    }
+    return waitFor(send(type, payload), reply, errorMessage);
+}
+
+bool RemoteSqlDriver::run(const QString& sql, RpcResult& result, QString* errorMessage) const
+{
+    RpcFrame reply;
+    if (!call(RpcType::Exec, encodeRpcStatement(sql, {QVariantList()}), reply, errorMessage)) {
+        return false;
+    }
+    if (!result.decode(reply.payload)) {
+        if (errorMessage) {
+            *errorMessage = "Invalid result from wmsd";
+        }
+        return false;
+    }
+    return true;
+}
+
+bool RemoteSqlDriver::beginTransaction()
+{
+    if (!isOpen() || !m_socket) {
+        return false;
+    }
+    // Goes out together with the first statement of the transaction
+    m_pendingBegin = send(RpcType::Begin, QByteArray());
+    return true;
+}
+
+bool RemoteSqlDriver::commitTransaction()
+{
+    RpcFrame reply;
+    QString error;
+    if (!call(RpcType::Commit, QByteArray(), reply, &error)) {
+        setLastError(QSqlError(QString("Unable to commit transaction"), error, QSqlError::TransactionError));
+        return false;
+    }
+    return true;
+}
+
+bool RemoteSqlDriver::rollbackTransaction()
+{
+    RpcFrame reply;
+    QString error;
+    if (!call(RpcType::Rollback, QByteArray(), reply, &error)) {
+        setLastError(QSqlError(QString("Unable to rollback transaction"), error, QSqlError::TransactionError));
+        return false;
+    }
+    return true;
+}
+
+QStringList RemoteSqlDriver::tables(QSql::TableType type) const
+{
+    QStringList conditions;
+    if (type & QSql::Tables) {
+        conditions << "(type = 'table' AND name NOT LIKE 'sqlite_%')";
+    }
+    if (type & QSql::Views) {
+        conditions << "type = 'view'";
+    }
+    if (type & QSql::SystemTables) {
+        conditions << "(type = 'table' AND name LIKE 'sqlite_%')";
+    }
+
+    QStringList names;
+    RpcResult result;
+    QString error;
+    if (conditions.isEmpty()
+        || !run("SELECT name FROM sqlite_master WHERE " + conditions.join(" OR "), result, &error)) {
+        return names;
+    }
+    for (const QVariantList& row : result.rows) {
+        names << row.value(0).toString();
+    }
+    return names;
+}
+
+QSqlRecord RemoteSqlDriver::record(const QString& tableName) const
+{
+    QSqlRecord fields;
+    RpcResult result;
+    QString error;
+    if (!run(QString("PRAGMA table_info(%1)").arg(escapeIdentifier(tableName, TableName)), result, &error)) {
+        return fields;
+    }
+    // Columns: cid, name, type, notnull, dflt_value, pk
+    for (const QVariantList& row : result.rows) {
+        QString type = row.value(2).toString();
+        QSqlField field = makeField(row.value(1).toString(), declaredTypeSample(type));
+        field.setTableName(tableName);
+        field.setRequiredStatus(row.value(3).toInt() != 0 ? QSqlField::Required : QSqlField::Optional);
+        field.setAutoValue(row.value(5).toInt() == 1 && type.compare("INTEGER", Qt::CaseInsensitive) == 0);
+        fields.append(field);
+    }
+    return fields;
+}
+
+QSqlIndex RemoteSqlDriver::primaryIndex(const QString& tableName) const
+{
+    QSqlIndex index(tableName);
+    RpcResult result;
+    QString error;
+    if (!run(QString("PRAGMA table_info(%1)").arg(escapeIdentifier(tableName, TableName)), result, &error)) {
+        return index;
+    }
+    std::map<int, QSqlField> keyFields;
+    for (const QVariantList& row : result.rows) {
+        int position = row.value(5).toInt();
+        if (position > 0) {
+            QSqlField field = makeField(row.value(1).toString(), declaredTypeSample(row.value(2).toString()));
+            field.setTableName(tableName);
+            keyFields.emplace(position, field);
+        }
+    }
+    for (const auto& [position, field] : keyFields) {
+        index.append(field);
+    }
+    return index;
+}
+
+QString RemoteSqlDriver::escapeIdentifier(const QString& identifier, IdentifierType type) const
+{
+    if (identifier.isEmpty() || isIdentifierEscaped(identifier, type)) {
+        return identifier;
+    }
+    // schema.table is quoted part by part, as QSQLITE does
+    QStringList parts = identifier.split('.');
+    for (QString& part : parts) {
+        part = '"' + part.replace('"', "\"\"") + '"';
+    }
+    return parts.join('.');
+}
+
+RemoteSqlResult::RemoteSqlResult(const RemoteSqlDriver* driver)
+    : QSqlResult(driver),
+      m_driver(driver)
+{
+}
+
+bool RemoteSqlResult::reset(const QString& query)
+{
+    prepare(query);
+    return run(RpcType::Exec, {QVariantList()});
+}
+
+bool RemoteSqlResult::prepare(const QString& query)
+{
+    // The server prepares (and caches) the statement when it first runs
+    m_sql = query;
+    m_result = RpcResult();
+    m_record.clear();
+    setActive(false);
+    setAt(QSql::BeforeFirstRow);
+    return true;
+}
+
+bool RemoteSqlResult::run(RpcType type, const std::vector<QVariantList>& rows)
+{
+    m_result = RpcResult();
+    m_record.clear();
+    setActive(false);
+    setAt(QSql::BeforeFirstRow);
+
+    RpcFrame reply;
+    QString error;
+    if (!m_driver->call(type, encodeRpcStatement(m_sql, rows), reply, &error)) {
+        setLastError(QSqlError(QString("Unable to execute statement"), error, QSqlError::StatementError));
+        return false;
+    }
+    if (!m_result.decode(reply.payload)) {
+        setLastError(QSqlError(QString("Unable to fetch row"), QString("Invalid result from wmsd"),
+                               QSqlError::ConnectionError));
+        return false;
+    }
+
+    // Column types come from the first row with a value in that column
+    for (int column = 0; column < m_result.columns.size(); ++column) {
+        QVariant sample(QString{});
+        for (const QVariantList& row : m_result.rows) {
+            if (!row.value(column).isNull()) {
+                sample = row.value(column);
+                break;
+            }
+        }
+        m_record.append(makeField(m_result.columns.at(column), sample));
+    }
+
+    setSelect(!m_result.columns.isEmpty());
+    setActive(true);
+    return true;
+}
+
+bool RemoteSqlResult::exec()
+{
+    QVariantList values;
+    for (const QVariant& value : boundValues()) {
+        values << value;
+    }
+    return run(RpcType::Exec, {values});
+}
+
+bool RemoteSqlResult::execBatch(bool arrayBind)
+{
+    Q_UNUSED(arrayBind);
+
+    // Bound values are one list per placeholder; the protocol wants rows
+    QList<QVariantList> columns;
+    qsizetype rowCount = -1;
+    for (const QVariant& value : boundValues()) {
+        QVariantList column = value.toList();
+        if (rowCount >= 0 && column.size() != rowCount) {
+            setLastError(QSqlError(QString("Unable to execute batch"),
+                                   QString("Parameter lists differ in length"), QSqlError::StatementError));
+            return false;
+        }
+        rowCount = column.size();
+        columns << column;
+    }
+
+    std::vector<QVariantList> rows(size_t(qMax<qsizetype>(rowCount, 0)));
+    for (const QVariantList& column : columns) {
+        for (qsizetype i = 0; i < column.size(); ++i) {
+            rows[size_t(i)] << column.at(i);
+        }
+    }
+    return run(RpcType::Batch, rows);
+}
+
+QVariant RemoteSqlResult::data(int index)
+{
+    if (at() < 0 || size_t(at()) >= m_result.rows.size()) {
+        return QVariant();
+    }
+    return m_result.rows[size_t(at())].value(index);
+}
+
+bool RemoteSqlResult::isNull(int index)
+{
+    return data(index).isNull();
+}
+
+bool RemoteSqlResult::fetch(int index)
+{
+    if (!isSelect() || index < 0 || size_t(index) >= m_result.rows.size()) {
+        return false;
+    }
+    setAt(index);
+    return true;
+}
+
+bool RemoteSqlResult::fetchFirst()
+{
+    return fetch(0);
+}
+
+bool RemoteSqlResult::fetchLast()
+{
+    return fetch(int(m_result.rows.size()) - 1);
+}
+
+int RemoteSqlResult::size()
+{
+    return isSelect() ? int(m_result.rows.size()) : -1;
+}
+
+int RemoteSqlResult::numRowsAffected()
+{
+    return int(m_result.rowsAffected);
+}
+
+QSqlRecord RemoteSqlResult::record() const
+{
+    return isActive() && isSelect() ? m_record : QSqlRecord();
+}
+
+QVariant RemoteSqlResult::lastInsertId() const
+{
+    if (!isActive() || m_result.lastInsertId == 0) {
+        return QVariant();
+    }
+    return QVariant(qlonglong(m_result.lastInsertId));
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QSqlResult>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+#include "rpcprotocol.h"
+
+class QIODevice;
+
+// Qt SQL driver that sends every statement to wmsd (rpcserver.h) instead of
+// opening wms.db itself, so models and queries written for QSQLITE work
+// unchanged against a database shared by many clients. Connection settings:
+//
+//   host name empty   local socket named by the database name (default "wmsd")
+//   host name set     TCP to host name and port (default 7878)
+//   password          the daemon's "rpc/token", if it has one
+//
+// Statements are prepared on the server; prepare() itself costs no round
+// trip. Result rows are sent in full with the reply, so queries that select
+// large tables should be limited. QSqlQuery::execBatch() is one request, and
+// the server applies its rows in one transaction. beginTransaction() does
+// not wait for its reply; a failure shows up as the error of the next
+// statement. Each call waits at most "rpc/timeoutMs" (default 30 s); a
+// statement that timed out may still be carried out by the server, and its
+// late reply is discarded.
+class RemoteSqlDriver : public QSqlDriver
+{
+    Q_OBJECT
+
+public:
+    static constexpr quint16 kDefaultPort = 7878;
+
+    explicit RemoteSqlDriver(QObject* parent = nullptr);
+    ~RemoteSqlDriver();
+
+    bool hasFeature(DriverFeature feature) const override;
+    bool open(const QString& db, const QString& user, const QString& password, const QString& host, int port,
+              const QString& connectOptions) override;
+    void close() override;
+    QSqlResult* createResult() const override;
+
+    bool beginTransaction() override;
+    bool commitTransaction() override;
+    bool rollbackTransaction() override;
+
+    QStringList tables(QSql::TableType type) const override;
+    QSqlIndex primaryIndex(const QString& tableName) const override;
+    QSqlRecord record(const QString& tableName) const override;
+    QString escapeIdentifier(const QString& identifier, IdentifierType type) const override;
+
+    // Site the daemon works on, as reported when the connection was opened
+    QString serverSite() const { return m_serverSite; }
+
+    // Sends a request and waits for its reply; an Error reply or a broken
+    // connection sets errorMessage and returns false
+    bool call(RpcType type, const QByteArray& payload, RpcFrame& reply, QString* errorMessage) const;
+
+private:
+    quint64 send(RpcType type, const QByteArray& payload) const;
+    bool waitFor(quint64 id, RpcFrame& reply, QString* errorMessage) const;
+    bool run(const QString& sql, RpcResult& result, QString* errorMessage) const;
+    void fail(const QString& message, QSqlError::ErrorType type);
+
+    std::unique_ptr<QIODevice> m_socket;
+    QString m_serverSite;
+    int m_timeoutMs;
+    mutable QByteArray m_buffer;
+    mutable quint64 m_nextId;
+    mutable std::map<quint64, RpcFrame> m_replies;
+    // Requests whose caller timed out; their replies are discarded
+    mutable std::set<quint64> m_abandoned;
+    mutable quint64 m_pendingBegin;
+};
+
+class RemoteSqlResult : public QSqlResult
+{
+public:
+    explicit RemoteSqlResult(const RemoteSqlDriver* driver);
+
+protected:
+    QVariant data(int index) override;
+    bool isNull(int index) override;
+    bool reset(const QString& query) override;
+    bool prepare(const QString& query) override;
+    bool exec() override;
+    bool execBatch(bool arrayBind) override;
+    bool fetch(int index) override;
+    bool fetchFirst() override;
+    bool fetchLast() override;
+    int size() override;
+    int numRowsAffected() override;
+    QSqlRecord record() const override;
+    QVariant lastInsertId() const override;
+
+private:
+    bool run(RpcType type, const std::vector<QVariantList>& rows);
+
+    const RemoteSqlDriver* m_driver;
+    QString m_sql;
+    RpcResult m_result;
+    QSqlRecord m_record;
+};
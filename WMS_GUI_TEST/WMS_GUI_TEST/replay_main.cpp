@@ -0,0 +1,105 @@
+#include "workloadlog.h"
+#include "workloadreplayer.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTextStream>
+
+// Copies through SQLite rather than the file system, so changes still in
+// the -wal file of a live database are part of the copy
+static bool copyDatabase(const QString& sourcePath, const QString& copyPath, QString* errorMessage)
+{
+    QFile::remove(copyPath);
+    bool ok = true;
+    {
+        QSqlDatabase source = QSqlDatabase::addDatabase("QSQLITE", "replay-source");
+        source.setDatabaseName(sourcePath);
+        source.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+        ok = source.open();
+        QSqlQuery query(source);
+        ok = ok && query.prepare("VACUUM INTO ?");
+        if (ok) {
+            query.addBindValue(copyPath);
+            ok = query.exec();
+        }
+        if (!ok && errorMessage) {
+            *errorMessage = source.isOpen() ? query.lastError().text() : source.lastError().text();
+        }
+    }
+    QSqlDatabase::removeDatabase("replay-source");
+    return ok;
+}
+
+// wms_replay: replays a workload log recorded by the application
+// (recorder/enabled setting) against a copy of wms.db and prints latency
+// distributions per statement kind.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("wms_replay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replay a recorded WMS workload against a database copy.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("log", "Workload log (.wlog) to replay.");
+    QCommandLineOption dbOption("db", "Database file to replay against (copied first).", "file");
+    QCommandLineOption sessionsOption("sessions", "Number of parallel copies of the recorded sessions.", "n", "1");
+    QCommandLineOption speedOption("speed", "Pacing factor relative to the recording (1 = original).", "x", "1");
+    QCommandLineOption maxOption("max", "Replay as fast as possible, ignoring recorded timing.");
+    QCommandLineOption readOnlyOption("read-only", "Only replay statements that do not modify data.");
+    QCommandLineOption inPlaceOption("in-place", "Replay directly against --db instead of a copy.");
+    parser.addOptions({dbOption, sessionsOption, speedOption, maxOption, readOnlyOption, inPlaceOption});
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    if (parser.positionalArguments().size() != 1 || !parser.isSet(dbOption)) {
+        parser.showHelp(1);
+    }
+
+    std::vector<WorkloadEvent> events;
+    QString errorMessage;
+    if (!WorkloadLogReader::readAll(parser.positionalArguments().first(), events, &errorMessage)) {
+        err << "Failed to read workload log: " << errorMessage << "\n";
+        return 1;
+    }
+
+    ReplayOptions options;
+    options.sessions = parser.value(sessionsOption).toInt();
+    options.speed = parser.isSet(maxOption) ? 0.0 : parser.value(speedOption).toDouble();
+    options.readOnly = parser.isSet(readOnlyOption);
+    options.databasePath = parser.value(dbOption);
+
+    // Work on a throwaway copy so repeated runs start from the same state
+    if (!parser.isSet(inPlaceOption)) {
+        QString copyPath = QDir::temp().filePath("wms_replay_copy.db");
+        if (!copyDatabase(options.databasePath, copyPath, &errorMessage)) {
+            err << "Failed to copy " << options.databasePath << " to " << copyPath << ": " << errorMessage << "\n";
+            return 1;
+        }
+        options.databasePath = copyPath;
+    }
+
+    size_t statementCount = events.size();
+    WorkloadReplayer replayer(std::move(events));
+    out << "Replaying " << statementCount << " statements from " << replayer.recordedSessions()
+        << " recorded session(s) x " << qMax(1, options.sessions)
+        << (options.speed > 0 ? QString(" at %1x speed").arg(options.speed) : QString(" at maximum speed"))
+        << (options.readOnly ? " (read-only)" : "") << "\n\n";
+    out.flush();
+
+    ReplayReport report;
+    if (!replayer.run(options, report, &errorMessage)) {
+        err << errorMessage << "\n";
+        return 1;
+    }
+
+    report.print(out);
+    return 0;
+}
@@ -0,0 +1,263 @@
+#include "reportswindow.h"
+#include "ui_reportswindow.h"
+#include <QAbstractTableModel>
+#include <QScreen>
+#include <QGuiApplication>
+#include <QHeaderView>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QSettings>
+#include <QStandardItemModel>
+#include <QApplication>
+#include "databasemanager.h"
+#include "orderarchive.h"
+#include "tracing.h"
+
+// Read-only table over one section of an AnalyticsReport. Cells are
+// formatted on demand, so a new report is shown by swapping the pointer.
+class ReportTableModel : public QAbstractTableModel
+{
+public:
+    enum View { Valuation, Abc, Turnover };
+
+    ReportTableModel(View view, QObject *parent) : QAbstractTableModel(parent), m_view(view) {}
+
+    void setReport(AnalyticsReportPtr report)
+    {
+        beginResetModel();
+        m_report = std::move(report);
+        endResetModel();
+    }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        return parent.isValid() || !m_report ? 0 : int(m_report->itemCount());
+    }
+
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        if (parent.isValid()) {
+            return 0;
+        }
+        return m_view == Abc ? 5 : 6;
+    }
+
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const override
+    {
+        if (orientation != Qt::Horizontal || role != Qt::DisplayRole) {
+            return QAbstractTableModel::headerData(section, orientation, role);
+        }
+        static const char *valuation[] = {"Code", "Description", "Quantity", "Price", "Value", "Share"};
+        static const char *abc[] = {"Rank", "Code", "Moved Units", "Cumulative", "Class"};
+        static const char *turnover[] = {"Code", "Opening", "Inbound", "Outbound", "Closing", "Turnover"};
+        const char **names = m_view == Valuation ? valuation : m_view == Abc ? abc : turnover;
+        return tr(names[section]);
+    }
+
+    QVariant data(const QModelIndex &index, int role) const override
+    {
+        if (!m_report || !index.isValid()) {
+            return QVariant();
+        }
+        if (role == Qt::TextAlignmentRole) {
+            bool text = (m_view == Abc) ? index.column() == 1 : index.column() <= (m_view == Valuation ? 1 : 0);
+            return int((text ? Qt::AlignLeft : Qt::AlignRight) | Qt::AlignVCenter);
+        }
+        if (role != Qt::DisplayRole) {
+            return QVariant();
+        }
+
+        const AnalyticsReport &r = *m_report;
+        const AnalyticsSnapshot &s = *r.snapshot;
+        size_t row = size_t(index.row());
+
+        switch (m_view) {
+        case Valuation: {
+            size_t i = size_t(r.valueOrder[row]);
+            switch (index.column()) {
+            case 0: return s.itemCodes[i];
+            case 1: return s.itemDescriptions[i];
+            case 2: return s.quantities[i];
+            case 3: return Money::fromMinorUnits(s.prices[i]).toString();
+            case 4: return Money::fromMinorUnits(r.values[i]).toString();
+            case 5: return percent(r.values[i], r.totalValue.minorUnits());
+            }
+            break;
+        }
+        case Abc: {
+            size_t i = size_t(r.abcOrder[row]);
+            switch (index.column()) {
+            case 0: return qint64(row + 1);
+            case 1: return s.itemCodes[i];
+            case 2: return r.inboundUnits[i] + r.outboundUnits[i];
+            case 3: return QString::number(r.abcCumulativeShare[row] * 100.0, 'f', 1) + "%";
+            case 4: return QString(QChar('A' + r.abcClass[i]));
+            }
+            break;
+        }
+        case Turnover:
+            switch (index.column()) {
+            case 0: return s.itemCodes[row];
+            case 1: return r.openingQuantity[row];
+            case 2: return r.inboundUnits[row];
+            case 3: return r.outboundUnits[row];
+            case 4: return r.closingQuantity[row];
+            case 5: return QString::number(r.turnover[row], 'f', 2);
+            }
+            break;
+        }
+        return QVariant();
+    }
+
+private:
+    static QString percent(qint64 part, qint64 total)
+    {
+        return total > 0 ? QString::number(double(part) * 100.0 / double(total), 'f', 1) + "%" : QString();
+    }
+
+    View m_view;
+    AnalyticsReportPtr m_report;
+};
+
+ReportsWindow::ReportsWindow(QWidget *parent) :
+    QWidget(parent),
+    ui(new Ui::ReportsWindow),
+    engine(new AnalyticsEngine(this)),
+    valuationModel(new ReportTableModel(ReportTableModel::Valuation, this)),
+    abcModel(new ReportTableModel(ReportTableModel::Abc, this)),
+    turnoverModel(new ReportTableModel(ReportTableModel::Turnover, this)),
+    siteStockModel(new QStandardItemModel(0, 4, this))
+{
+    ui->setupUi(this);
+
+    // Center window on screen
+    QScreen *screen = QGuiApplication::primaryScreen();
+    QRect screenGeometry = screen->geometry();
+    int x = (screenGeometry.width() - width()) / 2;
+    int y = (screenGeometry.height() - height()) / 2;
+    move(x, y);
+
+    // Default range: the last 30 days
+    ui->toDateEdit->setDate(QDate::currentDate());
+    ui->fromDateEdit->setDate(QDate::currentDate().addDays(-30));
+
+    ui->valuationTableView->setModel(valuationModel);
+    ui->abcTableView->setModel(abcModel);
+    ui->turnoverTableView->setModel(turnoverModel);
+    ui->siteStockTableView->setModel(siteStockModel);
+    for (QTableView *view : {ui->valuationTableView, ui->abcTableView, ui->turnoverTableView, ui->siteStockTableView}) {
+        view->horizontalHeader()->setStretchLastSection(true);
+        view->verticalHeader()->setVisible(false);
+    }
+
+    // History exported with "Export History..." is included in the reports
+    engine->setArchivePath(QSettings().value("archive/columnarPath").toString());
+
+    if (DatabaseManager::instance().sites().size() < 2) {
+        ui->tabWidget->removeTab(ui->tabWidget->indexOf(ui->siteStockTab));
+    }
+
+    connect(engine, &AnalyticsEngine::reportReady, this, &ReportsWindow::showReport);
+    connect(engine, &AnalyticsEngine::refreshFailed, this, &ReportsWindow::showError);
+
+    on_refreshButton_clicked();
+}
+
+ReportsWindow::~ReportsWindow()
+{
+    delete ui;
+}
+
+void ReportsWindow::on_refreshButton_clicked()
+{
+    WMS_TRACE_SCOPE("ReportsWindow::refresh");
+
+    QDate from = ui->fromDateEdit->date();
+    QDate to = ui->toDateEdit->date();
+    if (from > to) {
+        ui->statusLabel->setText(tr("The start date must not be after the end date."));
+        return;
+    }
+
+    ui->statusLabel->setText(tr("Computing reports..."));
+    engine->refresh(from, to);
+    showSiteStock();
+}
+
+void ReportsWindow::showSiteStock()
+{
+    WMS_TRACE_SCOPE("ReportsWindow::showSiteStock");
+
+    DatabaseManager &db = DatabaseManager::instance();
+    siteStockModel->clear();
+    siteStockModel->setHorizontalHeaderLabels({tr("Code"), tr("Description"), tr("Site"), tr("Quantity")});
+    if (db.sites().size() < 2) {
+        return;
+    }
+
+    // Reads the other sites' files directly, so it is current rather than
+    // as of the last replica refresh
+    QString error;
+    for (const SiteStock &stock : db.stockBySite(QStringList(), &error)) {
+        auto *quantity = new QStandardItem(QString::number(stock.quantity));
+        quantity->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+        siteStockModel->appendRow({new QStandardItem(stock.itemCode), new QStandardItem(stock.description),
+                                   new QStandardItem(stock.site), quantity});
+    }
+    if (!error.isEmpty()) {
+        QMessageBox::warning(this, tr("Stock by Site"), tr("Failed to read the stock of other sites: %1").arg(error));
+    }
+}
+
+void ReportsWindow::on_exportHistoryButton_clicked()
+{
+    WMS_TRACE_SCOPE("ReportsWindow::exportHistory");
+
+    QDate before = ui->fromDateEdit->date();
+    QString filePath = QFileDialog::getSaveFileName(this, tr("Export order history before %1").arg(before.toString("yyyy-MM-dd")),
+                                                    QString(), tr("Order archives (*.wmsarc);;All files (*)"));
+    if (filePath.isEmpty()) {
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    qint64 rowCount = 0;
+    QString error;
+    bool ok = OrderArchiveWriter::exportOrderLines(DatabaseManager::instance().replicaDatabase(), filePath, before, &rowCount, &error);
+    QApplication::restoreOverrideCursor();
+
+    if (!ok) {
+        QMessageBox::critical(this, tr("Export History"), tr("Failed to export order history: %1").arg(error));
+        return;
+    }
+
+    QSettings().setValue("archive/columnarPath", filePath);
+    engine->setArchivePath(filePath);
+    QMessageBox::information(this, tr("Export History"),
+                             tr("Exported %1 order lines to %2.").arg(rowCount).arg(filePath));
+}
+
+void ReportsWindow::showReport(AnalyticsReportPtr report)
+{
+    WMS_TRACE_SCOPE("ReportsWindow::showReport");
+
+    valuationModel->setReport(report);
+    abcModel->setReport(report);
+    turnoverModel->setReport(report);
+
+    ui->statusLabel->setText(tr("%1 items, %2 order lines from %3 to %4. Stock value: %5. Data as of %6. "
+                                "Loaded in %7 ms, computed in %8 ms.")
+                                 .arg(report->itemCount())
+                                 .arg(report->snapshot->lineCount())
+                                 .arg(report->from.toString("yyyy-MM-dd"))
+                                 .arg(report->to.toString("yyyy-MM-dd"))
+                                 .arg(report->totalValue.toString())
+                                 .arg(report->dataAsOf.toString("yyyy-MM-dd HH:mm:ss"))
+                                 .arg(report->loadMs)
+                                 .arg(report->computeMs));
+}
+
+void ReportsWindow::showError(const QString& message)
+{
+    ui->statusLabel->setText(tr("Failed to compute reports: %1").arg(message));
+}
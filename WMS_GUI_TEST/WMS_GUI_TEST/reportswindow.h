@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QWidget>
+#include "analyticsengine.h"
+
+namespace Ui {
+class ReportsWindow;
+}
+
+class QStandardItemModel;
+class ReportTableModel;
+
+// Management reports computed in the background by AnalyticsEngine. The
+// tables show views over the finished report; nothing is aggregated on the
+// GUI thread. With more than one site, "Stock by Site" lists the stock
+// of every site side by side.
+class ReportsWindow : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ReportsWindow(QWidget *parent = nullptr);
+    ~ReportsWindow();
+
+private slots:
+    void on_refreshButton_clicked();
+    void on_exportHistoryButton_clicked();
+    void showReport(AnalyticsReportPtr report);
+    void showError(const QString& message);
+
+private:
+    void showSiteStock();
+
+    Ui::ReportsWindow *ui;
+    AnalyticsEngine *engine;
+    ReportTableModel *valuationModel;
+    ReportTableModel *abcModel;
+    ReportTableModel *turnoverModel;
+    QStandardItemModel *siteStockModel;
+};
@@ -0,0 +1,541 @@
+#include "repositories.h"
+#include "sqlitestatement.h"
+
+#include <QSqlError>
+#include <QVariant>
+#include <sqlite3.h>
+#include <string>
+
+QSqlQuery Repository::prepare(std::string_view sql) const
+{
+    QSqlQuery query(m_db);
+    query.setForwardOnly(true);
+    if (!query.prepare(sqlString(sql))) {
+        m_lastError = query.lastError().text();
+    }
+    return query;
+}
+
+bool Repository::exec(QSqlQuery& query) const
+{
+    if (!query.exec()) {
+        m_lastError = query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// Binds one value per writable column, in schema order (see schema.h)
+template <typename Table, typename... Values>
+static void bindColumns(QSqlQuery& query, const Values&... values)
+{
+    static_assert(sizeof...(Values) == writableColumnCount<Table>(), "one value per writable column");
+    (query.addBindValue(QVariant::fromValue(values)), ...);
+}
+
+template <typename Table, typename... Values>
+static void bindColumns(SqliteStatement& stmt, const Values&... values)
+{
+    static_assert(sizeof...(Values) == writableColumnCount<Table>(), "one value per writable column");
+    int index = 0;
+    (stmt.bind(index++, values), ...);
+}
+
+// Runs insertRow for every element inside one transaction, rolling back if
+// any insert fails. Joins the caller's transaction if one is already open;
+// a BEGIN that fails for any other reason (e.g. a locked database) fails the
+// whole insert instead of falling back to one autocommit per row.
+template <typename Rows, typename InsertRow>
+static bool insertInTransaction(QSqlDatabase& db, Rows& rows, QString& error, InsertRow insertRow)
+{
+    sqlite3* handle = sqliteHandle(db);
+    bool joined = handle && !sqlite3_get_autocommit(handle);
+    bool ownTransaction = !joined && db.transaction();
+    if (!joined && !ownTransaction) {
+        error = db.lastError().text();
+        return false;
+    }
+
+    for (auto& row : rows) {
+        if (!insertRow(row)) {
+            if (ownTransaction) {
+                db.rollback();
+            }
+            return false;
+        }
+    }
+
+    if (ownTransaction && !db.commit()) {
+        error = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+// Row decoders; selectSql<Table>() returns the columns in Column order
+
+static User userFromRow(const QSqlQuery& query)
+{
+    User user;
+    user.id = query.value(UsersTable::Id).toInt();
+    user.login = query.value(UsersTable::Login).toString();
+    user.passwordHash = query.value(UsersTable::Password).toString();
+    return user;
+}
+
+static Item itemFromRow(const QSqlQuery& query)
+{
+    Item item;
+    item.id = query.value(ItemsTable::Id).toInt();
+    item.code = query.value(ItemsTable::Code).toString();
+    item.description = query.value(ItemsTable::Description).toString();
+    item.quantity = query.value(ItemsTable::Quantity).toInt();
+    item.price = Money::fromMinorUnits(query.value(ItemsTable::Price).toLongLong());
+    return item;
+}
+
+static Order orderFromRow(const QSqlQuery& query)
+{
+    Order order;
+    order.id = query.value(OrdersTable::Id).toInt();
+    order.number = query.value(OrdersTable::Number).toString();
+    order.date = QDate::fromJulianDay(query.value(OrdersTable::Date).toLongLong());
+    order.type = query.value(OrdersTable::Type).toInt() == OrderTypeFrom ? OrderTypeFrom : OrderTypeTo;
+    order.status = query.value(OrdersTable::Status).toInt() == OrderStatusPosted ? OrderStatusPosted : OrderStatusOpen;
+    return order;
+}
+
+static OrderLine orderLineFromRow(const QSqlQuery& query)
+{
+    OrderLine line;
+    line.id = query.value(OrderLinesTable::Id).toInt();
+    line.orderId = query.value(OrderLinesTable::OrderId).toInt();
+    line.orderNumber = query.value(OrderLinesTable::OrderNumber).toString();
+    line.itemId = query.value(OrderLinesTable::ItemId).toInt();
+    line.quantity = query.value(OrderLinesTable::Quantity).toInt();
+    return line;
+}
+
+// Native-path counterparts of the decoders above; same columns, same values
+
+static Item itemFromRow(const SqliteStatement& stmt)
+{
+    Item item;
+    item.id = stmt.columnInt(ItemsTable::Id);
+    item.code = stmt.columnString(ItemsTable::Code);
+    item.description = stmt.columnString(ItemsTable::Description);
+    item.quantity = stmt.columnInt(ItemsTable::Quantity);
+    item.price = Money::fromMinorUnits(stmt.columnInt64(ItemsTable::Price));
+    return item;
+}
+
+static Order orderFromRow(const SqliteStatement& stmt)
+{
+    Order order;
+    order.id = stmt.columnInt(OrdersTable::Id);
+    order.number = stmt.columnString(OrdersTable::Number);
+    order.date = QDate::fromJulianDay(stmt.columnInt64(OrdersTable::Date));
+    order.type = stmt.columnInt(OrdersTable::Type) == OrderTypeFrom ? OrderTypeFrom : OrderTypeTo;
+    order.status = stmt.columnInt(OrdersTable::Status) == OrderStatusPosted ? OrderStatusPosted : OrderStatusOpen;
+    return order;
+}
+
+// Users
+
+std::optional<User> UserRepository::byLogin(const QString& login) const
+{
+    QSqlQuery query = prepare(selectSql<UsersTable, "WHERE login = ?">());
+    query.addBindValue(login);
+    if (!exec(query) || !query.next()) {
+        return std::nullopt;
+    }
+    return userFromRow(query);
+}
+
+bool UserRepository::insert(User& user)
+{
+    QSqlQuery query = prepare(insertSql<UsersTable>());
+    bindColumns<UsersTable>(query, user.login, user.passwordHash);
+    if (!exec(query)) {
+        return false;
+    }
+    user.id = query.lastInsertId().toInt();
+    return true;
+}
+
+bool UserRepository::update(const User& user)
+{
+    QSqlQuery query = prepare(updateSql<UsersTable>());
+    bindColumns<UsersTable>(query, user.login, user.passwordHash);
+    query.addBindValue(user.id);
+    return exec(query);
+}
+
+bool UserRepository::remove(int id)
+{
+    QSqlQuery query = prepare(deleteSql<UsersTable>());
+    query.addBindValue(id);
+    return exec(query);
+}
+
+// Items
+
+std::vector<Item> ItemRepository::all() const
+{
+    std::vector<Item> items;
+
+    if (sqlite3* handle = nativeBackendHandle(m_db)) {
+        SqliteStatement stmt(handle, selectSql<ItemsTable, "ORDER BY id">());
+        while (stmt.step()) {
+            items.push_back(itemFromRow(stmt));
+        }
+        m_lastError = stmt.lastError();
+        return items;
+    }
+
+    QSqlQuery query = prepare(selectSql<ItemsTable, "ORDER BY id">());
+    if (exec(query)) {
+        while (query.next()) {
+            items.push_back(itemFromRow(query));
+        }
+    }
+    return items;
+}
+
+std::optional<Item> ItemRepository::byId(int id) const
+{
+    QSqlQuery query = prepare(selectSql<ItemsTable, "WHERE id = ?">());
+    query.addBindValue(id);
+    if (!exec(query) || !query.next()) {
+        return std::nullopt;
+    }
+    return itemFromRow(query);
+}
+
+std::optional<Item> ItemRepository::byCode(const QString& code) const
+{
+    QSqlQuery query = prepare(selectSql<ItemsTable, "WHERE item_code = ?">());
+    query.addBindValue(code);
+    if (!exec(query) || !query.next()) {
+        return std::nullopt;
+    }
+    return itemFromRow(query);
+}
+
+std::vector<Item> ItemRepository::byCodes(const QStringList& codes) const
+{
+    // Well below SQLite's limit on bound parameters
+    static const int kChunk = 500;
+
+    std::vector<Item> items;
+    items.reserve(size_t(codes.size()));
+    for (qsizetype first = 0; first < codes.size(); first += kChunk) {
+        qsizetype count = qMin<qsizetype>(kChunk, codes.size() - first);
+        std::string sql(selectSql<ItemsTable>());
+        sql += " WHERE item_code IN (?";
+        for (qsizetype i = 1; i < count; ++i) {
+            sql += ", ?";
+        }
+        sql += ")";
+
+        QSqlQuery query = prepare(sql);
+        for (qsizetype i = 0; i < count; ++i) {
+            query.addBindValue(codes.at(first + i));
+        }
+        if (!exec(query)) {
+            return {};
+        }
+        while (query.next()) {
+            items.push_back(itemFromRow(query));
+        }
+    }
+    return items;
+}
+
+bool ItemRepository::insert(Item& item)
+{
+    QSqlQuery query = prepare(insertSql<ItemsTable>());
+    bindColumns<ItemsTable>(query, item.code, item.description, item.quantity, item.price.minorUnits());
+    if (!exec(query)) {
+        return false;
+    }
+    item.id = query.lastInsertId().toInt();
+    return true;
+}
+
+bool ItemRepository::insertMany(std::vector<Item>& items)
+{
+    if (sqlite3* handle = nativeBackendHandle(m_db)) {
+        SqliteStatement stmt(handle, insertSql<ItemsTable>());
+        return insertInTransaction(m_db, items, m_lastError, [&](Item& item) {
+            stmt.reset();
+            bindColumns<ItemsTable>(stmt, item.code, item.description, item.quantity, item.price.minorUnits());
+            if (!stmt.exec()) {
+                m_lastError = stmt.lastError();
+                return false;
+            }
+            item.id = int(stmt.lastInsertId());
+            return true;
+        });
+    }
+
+    QSqlQuery query = prepare(insertSql<ItemsTable>());
+    return insertInTransaction(m_db, items, m_lastError, [&](Item& item) {
+        bindColumns<ItemsTable>(query, item.code, item.description, item.quantity, item.price.minorUnits());
+        if (!exec(query)) {
+            return false;
+        }
+        item.id = query.lastInsertId().toInt();
+        return true;
+    });
+}
+
+bool ItemRepository::update(const Item& item)
+{
+    QSqlQuery query = prepare(updateSql<ItemsTable>());
+    bindColumns<ItemsTable>(query, item.code, item.description, item.quantity, item.price.minorUnits());
+    query.addBindValue(item.id);
+    return exec(query);
+}
+
+bool ItemRepository::remove(int id)
+{
+    QSqlQuery query = prepare(deleteSql<ItemsTable>());
+    query.addBindValue(id);
+    return exec(query);
+}
+
+// Orders
+
+std::vector<Order> OrderRepository::all() const
+{
+    std::vector<Order> orders;
+
+    if (sqlite3* handle = nativeBackendHandle(m_db)) {
+        SqliteStatement stmt(handle, selectSql<OrdersTable, "ORDER BY id">());
+        while (stmt.step()) {
+            orders.push_back(orderFromRow(stmt));
+        }
+        m_lastError = stmt.lastError();
+        return orders;
+    }
+
+    QSqlQuery query = prepare(selectSql<OrdersTable, "ORDER BY id">());
+    if (exec(query)) {
+        while (query.next()) {
+            orders.push_back(orderFromRow(query));
+        }
+    }
+    return orders;
+}
+
+std::optional<Order> OrderRepository::byId(int id) const
+{
+    QSqlQuery query = prepare(selectSql<OrdersTable, "WHERE id = ?">());
+    query.addBindValue(id);
+    if (!exec(query) || !query.next()) {
+        return std::nullopt;
+    }
+    return orderFromRow(query);
+}
+
+std::optional<Order> OrderRepository::byNumber(const QString& number) const
+{
+    QSqlQuery query = prepare(selectSql<OrdersTable, "WHERE order_number = ?">());
+    query.addBindValue(number);
+    if (!exec(query) || !query.next()) {
+        return std::nullopt;
+    }
+    return orderFromRow(query);
+}
+
+bool OrderRepository::insert(Order& order)
+{
+    QSqlQuery query = prepare(insertSql<OrdersTable>());
+    bindColumns<OrdersTable>(query, order.number, order.date.toJulianDay(), int(order.type), int(order.status));
+    if (!exec(query)) {
+        return false;
+    }
+    order.id = query.lastInsertId().toInt();
+    return true;
+}
+
+bool OrderRepository::insertMany(std::vector<Order>& orders)
+{
+    if (sqlite3* handle = nativeBackendHandle(m_db)) {
+        SqliteStatement stmt(handle, insertSql<OrdersTable>());
+        return insertInTransaction(m_db, orders, m_lastError, [&](Order& order) {
+            stmt.reset();
+            bindColumns<OrdersTable>(stmt, order.number, order.date.toJulianDay(), int(order.type), int(order.status));
+            if (!stmt.exec()) {
+                m_lastError = stmt.lastError();
+                return false;
+            }
+            order.id = int(stmt.lastInsertId());
+            return true;
+        });
+    }
+
+    QSqlQuery query = prepare(insertSql<OrdersTable>());
+    return insertInTransaction(m_db, orders, m_lastError, [&](Order& order) {
+        bindColumns<OrdersTable>(query, order.number, order.date.toJulianDay(), int(order.type), int(order.status));
+        if (!exec(query)) {
+            return false;
+        }
+        order.id = query.lastInsertId().toInt();
+        return true;
+    });
+}
+
+bool OrderRepository::update(const Order& order)
+{
+    QSqlQuery query = prepare(updateSql<OrdersTable>());
+    bindColumns<OrdersTable>(query, order.number, order.date.toJulianDay(), int(order.type), int(order.status));
+    query.addBindValue(order.id);
+    return exec(query);
+}
+
+bool OrderRepository::remove(int id)
+{
+    QSqlQuery query = prepare(deleteSql<OrdersTable>());
+    query.addBindValue(id);
+    return exec(query);
+}
+
+// Order lines
+
+std::vector<OrderLine> OrderLineRepository::forOrder(int orderId) const
+{
+    std::vector<OrderLine> lines;
+    QSqlQuery query = prepare(selectSql<OrderLinesTable, "WHERE order_id = ? ORDER BY id">());
+    query.addBindValue(orderId);
+    if (exec(query)) {
+        while (query.next()) {
+            lines.push_back(orderLineFromRow(query));
+        }
+    }
+    return lines;
+}
+
+bool OrderLineRepository::insert(OrderLine& line)
+{
+    QSqlQuery query = prepare(insertSql<OrderLinesTable>());
+    bindColumns<OrderLinesTable>(query, line.orderId, line.orderNumber, line.itemId, line.quantity);
+    if (!exec(query)) {
+        return false;
+    }
+    line.id = query.lastInsertId().toInt();
+    return true;
+}
+
+bool OrderLineRepository::insertMany(std::vector<OrderLine>& lines)
+{
+    if (sqlite3* handle = nativeBackendHandle(m_db)) {
+        SqliteStatement stmt(handle, insertSql<OrderLinesTable>());
+        return insertInTransaction(m_db, lines, m_lastError, [&](OrderLine& line) {
+            stmt.reset();
+            bindColumns<OrderLinesTable>(stmt, line.orderId, line.orderNumber, line.itemId, line.quantity);
+            if (!stmt.exec()) {
+                m_lastError = stmt.lastError();
+                return false;
+            }
+            line.id = int(stmt.lastInsertId());
+            return true;
+        });
+    }
+
+    QSqlQuery query = prepare(insertSql<OrderLinesTable>());
+    return insertInTransaction(m_db, lines, m_lastError, [&](OrderLine& line) {
+        bindColumns<OrderLinesTable>(query, line.orderId, line.orderNumber, line.itemId, line.quantity);
+        if (!exec(query)) {
+            return false;
+        }
+        line.id = query.lastInsertId().toInt();
+        return true;
+    });
+}
+
+bool OrderLineRepository::update(const OrderLine& line)
+{
+    QSqlQuery query = prepare(updateSql<OrderLinesTable>());
+    bindColumns<OrderLinesTable>(query, line.orderId, line.orderNumber, line.itemId, line.quantity);
+    query.addBindValue(line.id);
+    return exec(query);
+}
+
+bool OrderLineRepository::remove(int id)
+{
+    QSqlQuery query = prepare(deleteSql<OrderLinesTable>());
+    query.addBindValue(id);
+    return exec(query);
+}
+
+// Stock ledger
+
+std::vector<StockMovement> StockLedgerRepository::movements(int itemId, const QDateTime& from, const QDateTime& to) const
+{
+    std::vector<StockMovement> movements;
+    QSqlQuery query = prepare(selectSql<StockMovementsTable, "WHERE item_id = ? AND moved_at BETWEEN ? AND ? ORDER BY id">());
+    query.addBindValue(itemId);
+    query.addBindValue(from.toSecsSinceEpoch());
+    query.addBindValue(to.toSecsSinceEpoch());
+    if (exec(query)) {
+        while (query.next()) {
+            StockMovement movement;
+            movement.id = query.value(StockMovementsTable::Id).toLongLong();
+            movement.itemId = query.value(StockMovementsTable::ItemId).toInt();
+            movement.movedAt = QDateTime::fromSecsSinceEpoch(query.value(StockMovementsTable::MovedAt).toLongLong());
+            movement.delta = query.value(StockMovementsTable::Delta).toLongLong();
+            movements.push_back(movement);
+        }
+    }
+    return movements;
+}
+
+std::optional<qint64> StockLedgerRepository::quantityAsOf(int itemId, const QDateTime& at) const
+{
+    qint64 seconds = at.toSecsSinceEpoch();
+
+    QSqlQuery snapshot = prepare("SELECT movement_id, quantity FROM stock_snapshots "
+                                 "WHERE item_id = ? AND taken_at <= ? ORDER BY taken_at DESC, id DESC LIMIT 1");
+    snapshot.addBindValue(itemId);
+    snapshot.addBindValue(seconds);
+    if (!exec(snapshot)) {
+        return std::nullopt;
+    }
+
+    qint64 movementId = 0;
+    qint64 quantity = 0;
+    if (snapshot.next()) {
+        movementId = snapshot.value(0).toLongLong();
+        quantity = snapshot.value(1).toLongLong();
+    }
+
+    // Range scan over (item_id, id) past the snapshot, not the item's whole history
+    QSqlQuery tail = prepare("SELECT COALESCE(SUM(delta), 0) FROM stock_movements INDEXED BY idx_stock_movements_item "
+                             "WHERE item_id = ? AND id > ? AND moved_at <= ?");
+    tail.addBindValue(itemId);
+    tail.addBindValue(movementId);
+    tail.addBindValue(seconds);
+    if (!exec(tail) || !tail.next()) {
+        return std::nullopt;
+    }
+
+    return quantity + tail.value(0).toLongLong();
+}
+
+int StockLedgerRepository::takeSnapshots()
+{
+    // Only the ledger tail past the newest snapshot is scanned; items that did
+    // not move since then keep their previous snapshot
+    QSqlQuery query = prepare("INSERT INTO stock_snapshots (item_id, movement_id, taken_at, quantity) "
+                              "SELECT i.id, m.last_id, CAST(strftime('%s', 'now') AS INTEGER), COALESCE(i.quantity, 0) "
+                              "FROM items i JOIN (SELECT item_id, MAX(id) AS last_id FROM stock_movements "
+                              "WHERE id > (SELECT COALESCE(MAX(movement_id), 0) FROM stock_snapshots) "
+                              "GROUP BY item_id) m ON m.item_id = i.id");
+    if (!exec(query)) {
+        return -1;
+    }
+    return query.numRowsAffected();
+}
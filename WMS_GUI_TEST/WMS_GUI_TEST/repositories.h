@@ -0,0 +1,119 @@
+#pragma once
+
+#include "entities.h"
+#include "schema.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStringList>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Statement text from schema.h as a QString
+inline QString sqlString(std::string_view sql)
+{
+    return QString::fromLatin1(sql.data(), qsizetype(sql.size()));
+}
+
+// Typed access to the wms.db tables. Statements are generated from schema.h
+// at compile time and use positional placeholders; rows are decoded by
+// column index into contiguous vectors. Queries are forward-only so QtSql
+// does not cache rows it has already handed out.
+//
+// all() and insertMany() are bulk paths: when the native backend is enabled
+// (sqlitestatement.h) they step sqlite3 statements directly instead of going
+// through QSqlQuery, returning the same rows.
+//
+// Repositories are cheap to construct and hold no state besides the
+// connection and the last error message.
+class Repository
+{
+public:
+    explicit Repository(const QSqlDatabase& db = QSqlDatabase::database()) : m_db(db) {}
+
+    QString lastError() const { return m_lastError; }
+
+protected:
+    QSqlQuery prepare(std::string_view sql) const;
+    bool exec(QSqlQuery& query) const;
+
+    QSqlDatabase m_db;
+    mutable QString m_lastError;
+};
+
+class UserRepository : public Repository
+{
+public:
+    using Repository::Repository;
+
+    std::optional<User> byLogin(const QString& login) const;
+    bool insert(User& user);
+    bool update(const User& user);
+    bool remove(int id);
+};
+
+class ItemRepository : public Repository
+{
+public:
+    using Repository::Repository;
+
+    std::vector<Item> all() const;
+    std::optional<Item> byId(int id) const;
+    std::optional<Item> byCode(const QString& code) const;
+    // Items with any of the given codes, in no particular order; codes
+    // without an item are left out
+    std::vector<Item> byCodes(const QStringList& codes) const;
+    bool insert(Item& item);
+    // Inserts all items in one transaction and fills in their ids
+    bool insertMany(std::vector<Item>& items);
+    bool update(const Item& item);
+    bool remove(int id);
+};
+
+class OrderRepository : public Repository
+{
+public:
+    using Repository::Repository;
+
+    std::vector<Order> all() const;
+    std::optional<Order> byId(int id) const;
+    std::optional<Order> byNumber(const QString& number) const;
+    bool insert(Order& order);
+    // Inserts all orders in one transaction and fills in their ids
+    bool insertMany(std::vector<Order>& orders);
+    bool update(const Order& order);
+    bool remove(int id);
+};
+
+class OrderLineRepository : public Repository
+{
+public:
+    using Repository::Repository;
+
+    std::vector<OrderLine> forOrder(int orderId) const;
+    bool insert(OrderLine& line);
+    // Inserts all lines in one transaction and fills in their ids
+    bool insertMany(std::vector<OrderLine>& lines);
+    bool update(const OrderLine& line);
+    bool remove(int id);
+};
+
+// Read side of the stock ledger. Movements are only ever written by the
+// triggers on items; snapshots by takeSnapshots().
+class StockLedgerRepository : public Repository
+{
+public:
+    using Repository::Repository;
+
+    // Movements of one item with from <= moved_at <= to, oldest first
+    std::vector<StockMovement> movements(int itemId, const QDateTime& from, const QDateTime& to) const;
+
+    // Balance of an item at the given time: the latest snapshot taken by then
+    // plus the (short) tail of movements recorded after it
+    std::optional<qint64> quantityAsOf(int itemId, const QDateTime& at) const;
+
+    // Checkpoints every item that moved since the last snapshots were taken;
+    // returns the number of snapshots written, or -1 on error
+    int takeSnapshots();
+};
@@ -0,0 +1,143 @@
+#include "rpcprotocol.h"
+#include "valuecodec.h"
+#include "varint.h"
+
+#include <QtEndian>
+
+QByteArray encodeRpcFrame(quint64 id, RpcType type, const QByteArray& payload)
+{
+    QByteArray frame(4, '\0');
+    appendVarint(frame, id);
+    frame.append(char(type));
+    frame.append(payload);
+    qToLittleEndian(quint32(frame.size() - 4), frame.data());
+    return frame;
+}
+
+bool takeRpcFrame(QByteArray& buffer, RpcFrame& frame, bool* corrupt)
+{
+    *corrupt = false;
+    if (buffer.size() < 4) {
+        return false;
+    }
+    quint32 size = qFromLittleEndian<quint32>(buffer.constData());
+    if (size > kRpcMaxFrameBytes) {
+        *corrupt = true;
+        return false;
+    }
+    if (buffer.size() - 4 < qsizetype(size)) {
+        return false;
+    }
+
+    const char* data = buffer.constData() + 4;
+    qsizetype pos = 0;
+    if (!readVarint(data, size, pos, frame.id) || pos >= qsizetype(size)) {
+        *corrupt = true;
+        return false;
+    }
+    frame.type = RpcType(quint8(data[pos++]));
+    frame.payload = QByteArray(data + pos, qsizetype(size) - pos);
+    buffer.remove(0, 4 + qsizetype(size));
+    return true;
+}
+
+QByteArray encodeRpcString(const QString& text)
+{
+    QByteArray out;
+    appendBytes(out, text.toUtf8());
+    return out;
+}
+
+bool decodeRpcString(const QByteArray& payload, QString& text)
+{
+    if (payload.isEmpty()) {
+        text.clear();
+        return true;
+    }
+    qsizetype pos = 0;
+    QByteArray bytes;
+    if (!readBytes(payload.constData(), payload.size(), pos, bytes)) {
+        return false;
+    }
+    text = QString::fromUtf8(bytes);
+    return true;
+}
+
+QByteArray encodeRpcStatement(const QString& sql, const std::vector<QVariantList>& rows)
+{
+    QByteArray out;
+    appendBytes(out, sql.toUtf8());
+    appendVarint(out, rows.size());
+    for (const QVariantList& row : rows) {
+        appendRow(out, row);
+    }
+    return out;
+}
+
+bool decodeRpcStatement(const QByteArray& payload, QString& sql, std::vector<QVariantList>& rows)
+{
+    const char* data = payload.constData();
+    qsizetype size = payload.size();
+    qsizetype pos = 0;
+    QByteArray text;
+    quint64 count;
+    if (!readBytes(data, size, pos, text) || !readVarint(data, size, pos, count) || count > quint64(size - pos)) {
+        return false;
+    }
+    sql = QString::fromUtf8(text);
+    rows.resize(size_t(count));
+    for (QVariantList& row : rows) {
+        if (!readRow(data, size, pos, row)) {
+            return false;
+        }
+    }
+    return pos == size;
+}
+
+QByteArray RpcResult::encode() const
+{
+    QByteArray out;
+    appendVarint(out, quint64(columns.size()));
+    for (const QString& column : columns) {
+        appendBytes(out, column.toUtf8());
+    }
+    appendVarint(out, rows.size());
+    for (const QVariantList& row : rows) {
+        appendRow(out, row);
+    }
+    appendSignedVarint(out, rowsAffected);
+    appendSignedVarint(out, lastInsertId);
+    return out;
+}
+
+bool RpcResult::decode(const QByteArray& payload)
+{
+    const char* data = payload.constData();
+    qsizetype size = payload.size();
+    qsizetype pos = 0;
+
+    quint64 count;
+    if (!readVarint(data, size, pos, count) || count > quint64(size - pos)) {
+        return false;
+    }
+    columns.clear();
+    for (quint64 i = 0; i < count; ++i) {
+        QByteArray name;
+        if (!readBytes(data, size, pos, name)) {
+            return false;
+        }
+        columns << QString::fromUtf8(name);
+    }
+
+    if (!readVarint(data, size, pos, count) || count > quint64(size - pos)) {
+        return false;
+    }
+    rows.resize(size_t(count));
+    for (QVariantList& row : rows) {
+        if (!readRow(data, size, pos, row)) {
+            return false;
+        }
+    }
+    return readSignedVarint(data, size, pos, rowsAffected) && readSignedVarint(data, size, pos, lastInsertId)
+           && pos == size;
+}
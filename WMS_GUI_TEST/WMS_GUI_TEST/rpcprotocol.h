@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+#include <vector>
+
+// Protocol between wmsd (rpcserver.h) and RemoteSqlDriver (remotesqldriver.h),
+// over a local socket or TCP. Every message is a frame: 4-byte little-endian
+// size of the rest, varint request id, type byte and payload. Strings are
+// varint-length-prefixed UTF-8; rows are encoded as in valuecodec.h.
+//
+//   Hello     varint protocol version, token -> Ok with the site code
+//   Exec      statement, one parameter row -> Result
+//   Batch     statement, parameter rows -> Result; the statement runs once
+//             per row and either all rows are applied or none
+//   Begin, Commit, Rollback -> Ok
+//
+//   Ok        optional string
+//   Result    column names, rows, zigzag rows affected, zigzag last insert id
+//   Error     message
+//
+// Statements and their parameter rows share one layout: the SQL, a varint
+// row count and the rows. A client may send any number of requests without
+// waiting for replies; each reply carries the id of its request, and the
+// requests of one connection are answered in the order they were sent.
+
+enum class RpcType : quint8 {
+    Hello = 1,
+    Exec = 2,
+    Batch = 3,
+    Begin = 4,
+    Commit = 5,
+    Rollback = 6,
+    Ok = 64,
+    Result = 65,
+    Error = 66,
+};
+
+static constexpr quint64 kRpcProtocolVersion = 1;
+// Larger frames are treated as a broken stream
+static constexpr quint32 kRpcMaxFrameBytes = 256 * 1024 * 1024;
+
+struct RpcFrame
+{
+    quint64 id = 0;
+    RpcType type = RpcType::Ok;
+    QByteArray payload;
+};
+
+QByteArray encodeRpcFrame(quint64 id, RpcType type, const QByteArray& payload = QByteArray());
+// Takes one complete frame off the front of buffer; false if there is none
+// yet, or if the data is not a valid frame (corrupt is then set)
+bool takeRpcFrame(QByteArray& buffer, RpcFrame& frame, bool* corrupt);
+
+QByteArray encodeRpcString(const QString& text);
+bool decodeRpcString(const QByteArray& payload, QString& text);
+
+QByteArray encodeRpcStatement(const QString& sql, const std::vector<QVariantList>& rows);
+bool decodeRpcStatement(const QByteArray& payload, QString& sql, std::vector<QVariantList>& rows);
+
+struct RpcResult
+{
+    QStringList columns;
+    std::vector<QVariantList> rows;
+    qint64 rowsAffected = 0;
+    qint64 lastInsertId = 0;
+
+    QByteArray encode() const;
+    bool decode(const QByteArray& payload);
+};
@@ -0,0 +1,967 @@
+#include "rpcserver.h"
+#include "databasemanager.h"
+#include "metrics.h"
+#include "sqlitebackup.h"
+#include "tracing.h"
+#include "varint.h"
+
+#include <QDebug>
+#include <QHostAddress>
+#include <QLocalSocket>
+#include <QRegularExpression>
+#include <QSettings>
+#include <QTcpSocket>
+#include <QThread>
+#include <sqlite3.h>
+
+// Requests of one connection read ahead of the one being handled; further
+// input stays in the socket until they are done
+static const size_t kMaxQueuedRequests = 256;
+
+static bool setError(QString* errorMessage, const QString& message)
+{
+    if (errorMessage) {
+        *errorMessage = message;
+    }
+    return false;
+}
+
+static bool execSql(sqlite3* db, const char* sql, QString* errorMessage = nullptr)
+{
+    if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return setError(errorMessage, QString::fromUtf8(sqlite3_errmsg(db)));
+    }
+    return true;
+}
+
+// Statements that would change the state of the shared connection
+static QString refusedKeyword(const QString& sql)
+{
+    static const QRegularExpression keyword("^\\s*([A-Za-z]+)");
+    QString first = keyword.match(sql).captured(1).toUpper();
+    static const QStringList refused{"ATTACH", "DETACH", "BEGIN", "COMMIT", "END", "ROLLBACK", "SAVEPOINT", "RELEASE"};
+    return refused.contains(first) ? first : QString();
+}
+
+// Prepared statements of one connection by SQL text
+class RpcStatementCache
+{
+public:
+    explicit RpcStatementCache(sqlite3* db = nullptr) : m_db(nullptr) { setDatabase(db); }
+    ~RpcStatementCache() { setDatabase(nullptr); }
+    RpcStatementCache(const RpcStatementCache&) = delete;
+    RpcStatementCache& operator=(const RpcStatementCache&) = delete;
+
+    sqlite3* database() const { return m_db; }
+
+    // Statements belong to the connection they were prepared on. The
+    // authorizer stays installed, since setting it expires every statement
+    // of the connection; it only checks while prepare() runs.
+    void setDatabase(sqlite3* db)
+    {
+        if (db != m_db) {
+            clear();
+            if (m_db) {
+                sqlite3_set_authorizer(m_db, nullptr, nullptr);
+            }
+            m_db = db;
+            if (m_db) {
+                sqlite3_set_authorizer(m_db, authorize, this);
+            }
+        }
+    }
+
+    sqlite3_stmt* prepare(const QString& sql, QString* errorMessage)
+    {
+        auto it = m_statements.constFind(sql);
+        if (it != m_statements.constEnd()) {
+            return it.value();
+        }
+        if (!m_db) {
+            setError(errorMessage, "The database is not open");
+            return nullptr;
+        }
+        if (m_statements.size() >= RpcServer::kStatementCacheSize) {
+            clear();
+        }
+
+        QByteArray utf8 = sql.toUtf8();
+        sqlite3_stmt* statement = nullptr;
+        const char* tail = nullptr;
+        m_checking = true;
+        m_denied = false;
+        int rc = sqlite3_prepare_v3(m_db, utf8.constData(), int(utf8.size()), SQLITE_PREPARE_PERSISTENT, &statement,
+                                    &tail);
+        QString error;
+        if (rc != SQLITE_OK) {
+            error = m_denied ? QString("Transactions, savepoints, ATTACH, DETACH, TEMP objects and setting "
+                                       "pragmas are not available through wmsd")
+                             : QString::fromUtf8(sqlite3_errmsg(m_db));
+        } else if (!statement) {
+            error = "No statement to execute";
+        } else if (hasMoreStatements(tail, utf8.constData() + utf8.size())) {
+            // Only the first statement would run; the rest must not be
+            // dropped silently
+            error = "Send one statement per request";
+        }
+        m_checking = false;
+        if (!error.isEmpty()) {
+            sqlite3_finalize(statement);
+            setError(errorMessage, error);
+            return nullptr;
+        }
+        m_statements.insert(sql, statement);
+        return statement;
+    }
+
+    void clear()
+    {
+        for (sqlite3_stmt* statement : std::as_const(m_statements)) {
+            sqlite3_finalize(statement);
+        }
+        m_statements.clear();
+    }
+
+private:
+    // Client statements run on connections shared by every session, so
+    // they may not change the transaction state, the attached databases,
+    // connection settings (PRAGMA with a value) or the TEMP schema, which
+    // is private to the connection and would outlive the request (keywords
+    // hidden behind comments or WITH get past refusedKeyword())
+    static int authorize(void* cache, int action, const char* arg1, const char* arg2, const char*, const char*)
+    {
+        auto self = static_cast<RpcStatementCache*>(cache);
+        if (!self->m_checking) {
+            return SQLITE_OK;
+        }
+        switch (action) {
+        case SQLITE_PRAGMA:
+            // Read-only introspection that takes a table or index name;
+            // RemoteSqlDriver::record() uses table_info
+            if (!arg2 || isSchemaPragma(arg1)) {
+                return SQLITE_OK;
+            }
+            self->m_denied = true;
+            return SQLITE_DENY;
+        case SQLITE_TRANSACTION:
+        case SQLITE_SAVEPOINT:
+        case SQLITE_ATTACH:
+        case SQLITE_DETACH:
+        case SQLITE_CREATE_TEMP_INDEX:
+        case SQLITE_CREATE_TEMP_TABLE:
+        case SQLITE_CREATE_TEMP_TRIGGER:
+        case SQLITE_CREATE_TEMP_VIEW:
+        case SQLITE_DROP_TEMP_INDEX:
+        case SQLITE_DROP_TEMP_TABLE:
+        case SQLITE_DROP_TEMP_TRIGGER:
+        case SQLITE_DROP_TEMP_VIEW:
+            self->m_denied = true;
+            return SQLITE_DENY;
+        default:
+            return SQLITE_OK;
+        }
+    }
+
+    static bool isSchemaPragma(const char* name)
+    {
+        static const char* const names[] = {"table_info", "table_xinfo", "index_list",
+                                            "index_info", "index_xinfo", "foreign_key_list"};
+        for (const char* pragma : names) {
+            if (name && sqlite3_stricmp(name, pragma) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether SQL other than whitespace and comments follows the statement
+    bool hasMoreStatements(const char* tail, const char* end) const
+    {
+        while (tail && tail < end) {
+            sqlite3_stmt* next = nullptr;
+            const char* rest = nullptr;
+            if (sqlite3_prepare_v2(m_db, tail, int(end - tail), &next, &rest) != SQLITE_OK || next) {
+                sqlite3_finalize(next);
+                return true;
+            }
+            if (rest == tail) {
+                return false;
+            }
+            tail = rest;
+        }
+        return false;
+    }
+
+    sqlite3* m_db;
+    QHash<QString, sqlite3_stmt*> m_statements;
+    bool m_checking = false;
+    bool m_denied = false;
+};
+
+static bool bindValue(sqlite3_stmt* statement, int index, const QVariant& value)
+{
+    if (value.isNull()) {
+        return sqlite3_bind_null(statement, index) == SQLITE_OK;
+    }
+    switch (value.userType()) {
+    case QMetaType::Bool:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+        return sqlite3_bind_int64(statement, index, value.toLongLong()) == SQLITE_OK;
+    case QMetaType::Double:
+        return sqlite3_bind_double(statement, index, value.toDouble()) == SQLITE_OK;
+    case QMetaType::QByteArray: {
+        QByteArray bytes = value.toByteArray();
+        return sqlite3_bind_blob64(statement, index, bytes.constData(), sqlite3_uint64(bytes.size()),
+                                   SQLITE_TRANSIENT) == SQLITE_OK;
+    }
+    default: {
+        QByteArray text = value.toString().toUtf8();
+        return sqlite3_bind_text64(statement, index, text.constData(), sqlite3_uint64(text.size()), SQLITE_TRANSIENT,
+                                   SQLITE_UTF8) == SQLITE_OK;
+    }
+    }
+}
+
+static QVariant columnValue(sqlite3_stmt* statement, int column)
+{
+    switch (sqlite3_column_type(statement, column)) {
+    case SQLITE_INTEGER:
+        return QVariant(qlonglong(sqlite3_column_int64(statement, column)));
+    case SQLITE_FLOAT:
+        return QVariant(sqlite3_column_double(statement, column));
+    case SQLITE_TEXT:
+        return QVariant(QString::fromUtf8(reinterpret_cast<const char*>(sqlite3_column_text(statement, column)),
+                                          sqlite3_column_bytes(statement, column)));
+    case SQLITE_BLOB:
+        return QVariant(QByteArray(static_cast<const char*>(sqlite3_column_blob(statement, column)),
+                                   sqlite3_column_bytes(statement, column)));
+    default:
+        return QVariant();
+    }
+}
+
+// Runs the statement once per parameter row (once without parameters if
+// there are none); the result holds the rows of the last run
+static bool runStatement(RpcStatementCache& statements, const QString& sql, const std::vector<QVariantList>& rows,
+                         RpcResult& result, QString* errorMessage)
+{
+    sqlite3_stmt* statement = statements.prepare(sql, errorMessage);
+    if (!statement) {
+        return false;
+    }
+    sqlite3* db = statements.database();
+    bool readOnly = sqlite3_stmt_readonly(statement);
+
+    result = RpcResult();
+    int columns = sqlite3_column_count(statement);
+    for (int column = 0; column < columns; ++column) {
+        result.columns << QString::fromUtf8(sqlite3_column_name(statement, column));
+    }
+
+    static const std::vector<QVariantList> noParameters{QVariantList()};
+    for (const QVariantList& row : rows.empty() ? noParameters : rows) {
+        sqlite3_reset(statement);
+        sqlite3_clear_bindings(statement);
+        if (row.size() != sqlite3_bind_parameter_count(statement)) {
+            return setError(errorMessage, QString("Expected %1 parameters, got %2")
+                                              .arg(sqlite3_bind_parameter_count(statement))
+                                              .arg(row.size()));
+        }
+        for (int i = 0; i < row.size(); ++i) {
+            if (!bindValue(statement, i + 1, row.at(i))) {
+                QString error = QString::fromUtf8(sqlite3_errmsg(db));
+                sqlite3_clear_bindings(statement);
+                return setError(errorMessage, error);
+            }
+        }
+
+        result.rows.clear();
+        int rc;
+        while ((rc = sqlite3_step(statement)) == SQLITE_ROW) {
+            QVariantList values;
+            values.reserve(columns);
+            for (int column = 0; column < columns; ++column) {
+                values << columnValue(statement, column);
+            }
+            result.rows.push_back(std::move(values));
+        }
+        if (rc != SQLITE_DONE) {
+            QString error = QString::fromUtf8(sqlite3_errmsg(db));
+            sqlite3_reset(statement);
+            sqlite3_clear_bindings(statement);
+            return setError(errorMessage, error);
+        }
+        if (!readOnly) {
+            result.rowsAffected += sqlite3_changes(db);
+        }
+    }
+    // The rowid of another connection's insert means nothing to this one
+    if (!readOnly && result.rowsAffected > 0) {
+        result.lastInsertId = sqlite3_last_insert_rowid(db);
+    }
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+    return true;
+}
+
+struct RpcDatabaseFile
+{
+    QString schema;
+    QString path;
+
+    bool operator==(const RpcDatabaseFile& other) const { return schema == other.schema && path == other.path; }
+};
+
+// Pool thread with its own read-only connection, which attaches the same
+// databases as the writer so statements prepared there work here too
+class RpcReader : public QObject
+{
+public:
+    ~RpcReader() { close(); }
+
+    bool run(const std::vector<RpcDatabaseFile>& files, const QString& sql, const std::vector<QVariantList>& rows,
+             RpcResult& result, QString* errorMessage)
+    {
+        if (files != m_files && !open(files, errorMessage)) {
+            return false;
+        }
+        return runStatement(m_statements, sql, rows, result, errorMessage);
+    }
+
+private:
+    bool open(const std::vector<RpcDatabaseFile>& files, QString* errorMessage)
+    {
+        close();
+        if (files.empty()) {
+            return setError(errorMessage, "The database is not open");
+        }
+        m_db = SqliteBackupJob::openFile(files.front().path, true, errorMessage);
+        if (!m_db) {
+            return false;
+        }
+        // Attached files are opened read-only like the main one
+        for (size_t i = 1; i < files.size(); ++i) {
+            char* sql = sqlite3_mprintf("ATTACH DATABASE %Q AS %Q", files[i].path.toUtf8().constData(),
+                                        files[i].schema.toUtf8().constData());
+            bool ok = execSql(m_db, sql, errorMessage);
+            sqlite3_free(sql);
+            if (!ok) {
+                close();
+                return false;
+            }
+        }
+        m_statements.setDatabase(m_db);
+        m_files = files;
+        return true;
+    }
+
+    void close()
+    {
+        m_statements.setDatabase(nullptr);
+        if (m_db) {
+            sqlite3_close(m_db);
+            m_db = nullptr;
+        }
+        m_files.clear();
+    }
+
+    sqlite3* m_db = nullptr;
+    RpcStatementCache m_statements;
+    std::vector<RpcDatabaseFile> m_files;
+};
+
+// Files of the connection's databases, main first; temp and in-memory
+// databases cannot be shared and are left out
+static std::vector<RpcDatabaseFile> databaseFiles(sqlite3* db)
+{
+    std::vector<RpcDatabaseFile> files;
+    sqlite3_stmt* statement = nullptr;
+    if (!db || sqlite3_prepare_v2(db, "PRAGMA database_list", -1, &statement, nullptr) != SQLITE_OK) {
+        return files;
+    }
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        RpcDatabaseFile file;
+        file.schema = QString::fromUtf8(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
+        file.path = QString::fromUtf8(reinterpret_cast<const char*>(sqlite3_column_text(statement, 2)));
+        if (file.schema == "temp" || file.path.isEmpty()) {
+            continue;
+        }
+        if (file.schema == "main") {
+            files.insert(files.begin(), file);
+        } else {
+            files.push_back(file);
+        }
+    }
+    sqlite3_finalize(statement);
+    return files;
+}
+
+struct RpcServer::Session
+{
+    quint64 id = 0;
+    QIODevice* socket = nullptr;
+    QByteArray buffer;
+    std::deque<RpcFrame> requests;
+    bool authenticated = false;
+    // A read of this session runs on a reader thread
+    bool reading = false;
+    // Writes of this session waiting in the current group
+    int pendingWrites = 0;
+    // BEGIN failed; statements fail until the client ends the transaction
+    bool failedBegin = false;
+    bool closing = false;
+};
+
+static void closeSocket(QIODevice* socket)
+{
+    // Replies already written still go out before the socket closes
+    if (auto local = qobject_cast<QLocalSocket*>(socket)) {
+        if (local->state() == QLocalSocket::UnconnectedState) {
+            local->deleteLater();
+        } else {
+            QObject::connect(local, &QLocalSocket::disconnected, local, &QObject::deleteLater);
+            local->disconnectFromServer();
+        }
+    } else if (auto tcp = qobject_cast<QTcpSocket*>(socket)) {
+        if (tcp->state() == QAbstractSocket::UnconnectedState) {
+            tcp->deleteLater();
+        } else {
+            QObject::connect(tcp, &QTcpSocket::disconnected, tcp, &QObject::deleteLater);
+            tcp->disconnectFromHost();
+        }
+    }
+}
+
+RpcServer::RpcServer(QObject* parent)
+    : QObject(parent),
+      m_nextSessionId(1),
+      m_statements(new RpcStatementCache()),
+      m_nextReader(0),
+      m_transactionOwner(0),
+      m_transactionTimeoutMs(30000),
+      m_resumeScheduled(false)
+{
+    connect(&m_localServer, &QLocalServer::newConnection, this, [this]() {
+        while (QLocalSocket* socket = m_localServer.nextPendingConnection()) {
+            addSession(socket);
+        }
+    });
+    connect(&m_tcpServer, &QTcpServer::newConnection, this, [this]() {
+        while (QTcpSocket* socket = m_tcpServer.nextPendingConnection()) {
+            socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            addSession(socket);
+        }
+    });
+    m_writeTimer.setSingleShot(true);
+    connect(&m_writeTimer, &QTimer::timeout, this, &RpcServer::applyWrites);
+    connect(&m_transactionTimer, &QTimer::timeout, this, &RpcServer::checkTransactionTimeout);
+}
+
+RpcServer::~RpcServer()
+{
+    stop();
+}
+
+bool RpcServer::start(QString* errorMessage)
+{
+    stop();
+
+    auto fail = [&](const QString& message) {
+        qDebug() << "Failed to start the database server:" << message;
+        stop();
+        return setError(errorMessage, message);
+    };
+
+    sqlite3* db = DatabaseManager::instance().nativeHandle();
+    if (!db) {
+        return fail("The database is not open with the SQLite driver");
+    }
+    m_statements->setDatabase(db);
+    m_files = databaseFiles(db);
+
+    QSettings settings;
+    m_token = settings.value("rpc/token").toString();
+    m_transactionTimeoutMs = settings.value("rpc/transactionTimeoutMs", 30000).toInt();
+    int readers = qMax(1, settings.value("rpc/readers", QThread::idealThreadCount()).toInt());
+
+    QString localName = settings.value("rpc/localName", "wmsd").toString();
+    if (!localName.isEmpty()) {
+        // A server that crashed leaves its socket file behind
+        QLocalServer::removeServer(localName);
+        if (!m_localServer.listen(localName)) {
+            return fail(QString("Cannot listen on %1: %2").arg(localName, m_localServer.errorString()));
+        }
+    }
+    quint16 port = quint16(settings.value("rpc/port", 7878).toUInt());
+    if (port > 0) {
+        QHostAddress address(settings.value("rpc/address").toString());
+        if (address.isNull()) {
+            address = QHostAddress::LocalHost;
+        }
+        // Anyone who can reach the port could read and change every table
+        if (!address.isLoopback() && m_token.isEmpty()) {
+            return fail(QString("Refusing to listen on %1 without rpc/token; set a token or use a loopback address")
+                            .arg(address.toString()));
+        }
+        if (!m_tcpServer.listen(address, port)) {
+            return fail(QString("Cannot listen on %1:%2: %3").arg(address.toString()).arg(port).arg(m_tcpServer.errorString()));
+        }
+    }
+    if (!isListening()) {
+        return fail("Neither rpc/localName nor rpc/port is set");
+    }
+
+    for (int i = 0; i < readers; ++i) {
+        QThread* thread = new QThread(this);
+        RpcReader* reader = new RpcReader();
+        reader->moveToThread(thread);
+        connect(thread, &QThread::finished, reader, &QObject::deleteLater);
+        thread->start();
+        m_threads.push_back(thread);
+        m_readers.push_back(reader);
+    }
+
+    if (m_transactionTimeoutMs > 0) {
+        m_transactionTimer.start(qBound(100, m_transactionTimeoutMs / 4, 5000));
+    }
+    qDebug() << "Database server listening on" << (localName.isEmpty() ? QString("-") : m_localServer.fullServerName())
+             << "and port" << m_tcpServer.serverPort() << "with" << readers << "readers";
+    return true;
+}
+
+void RpcServer::stop()
+{
+    m_localServer.close();
+    m_tcpServer.close();
+    m_writeTimer.stop();
+    m_transactionTimer.stop();
+    // Writes already accepted are applied rather than dropped
+    applyWrites();
+
+    for (quint64 id : m_sessions.keys()) {
+        removeSession(id);
+    }
+
+    // Readers are deleted in their threads once these finish
+    for (QThread* thread : m_threads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    m_threads.clear();
+    m_readers.clear();
+
+    // DatabaseManager cannot close its connection while statements are prepared on it
+    m_statements->setDatabase(nullptr);
+    m_files.clear();
+}
+
+void RpcServer::addSession(QIODevice* socket)
+{
+    quint64 id = m_nextSessionId++;
+    Session* session = new Session;
+    session->id = id;
+    session->socket = socket;
+    m_sessions.insert(id, session);
+
+    connect(socket, &QIODevice::readyRead, this, [this, id]() { readRequests(id); });
+    if (auto local = qobject_cast<QLocalSocket*>(socket)) {
+        connect(local, &QLocalSocket::disconnected, this, [this, id]() { removeSession(id); });
+    } else if (auto tcp = qobject_cast<QTcpSocket*>(socket)) {
+        connect(tcp, &QTcpSocket::disconnected, this, [this, id]() { removeSession(id); });
+    }
+}
+
+void RpcServer::removeSession(quint64 sessionId)
+{
+    Session* session = m_sessions.take(sessionId);
+    if (!session) {
+        return;
+    }
+    if (m_transactionOwner == sessionId) {
+        qDebug() << "Database client disconnected inside a transaction; rolling it back";
+        endTransaction(false);
+    }
+    // Its writes in the current group are still applied; their replies are dropped
+    session->socket->disconnect(this);
+    closeSocket(session->socket);
+    delete session;
+    scheduleResume();
+}
+
+void RpcServer::closeSession(Session* session)
+{
+    session->closing = true;
+    session->requests.clear();
+    quint64 id = session->id;
+    QMetaObject::invokeMethod(this, [this, id]() { removeSession(id); }, Qt::QueuedConnection);
+}
+
+void RpcServer::readRequests(quint64 sessionId)
+{
+    Session* session = m_sessions.value(sessionId);
+    if (!session || session->closing) {
+        return;
+    }
+
+    while (session->requests.size() < kMaxQueuedRequests) {
+        RpcFrame frame;
+        bool corrupt = false;
+        if (takeRpcFrame(session->buffer, frame, &corrupt)) {
+            session->requests.push_back(std::move(frame));
+            continue;
+        }
+        if (corrupt) {
+            qDebug() << "Database client sent an invalid frame; closing the connection";
+            closeSession(session);
+            return;
+        }
+        if (session->socket->bytesAvailable() == 0) {
+            break;
+        }
+        session->buffer += session->socket->read(64 * 1024);
+    }
+    processSession(session);
+}
+
+void RpcServer::scheduleResume()
+{
+    if (!m_resumeScheduled) {
+        m_resumeScheduled = true;
+        QMetaObject::invokeMethod(this, [this]() { resumeSessions(); }, Qt::QueuedConnection);
+    }
+}
+
+void RpcServer::resumeSessions()
+{
+    m_resumeScheduled = false;
+    for (quint64 id : m_sessions.keys()) {
+        if (Session* session = m_sessions.value(id)) {
+            processSession(session);
+        }
+    }
+}
+
+void RpcServer::processSession(Session* session)
+{
+    bool handled = false;
+    while (!session->requests.empty() && !session->reading && !session->closing) {
+        if (!handleRequest(session, session->requests.front())) {
+            // Waits for the session's own writes or another session's transaction
+            break;
+        }
+        if (session->closing) {
+            return;
+        }
+        session->requests.pop_front();
+        handled = true;
+    }
+
+    // Input held back while the queue was full
+    if (handled && (session->socket->bytesAvailable() > 0 || !session->buffer.isEmpty())) {
+        quint64 id = session->id;
+        QMetaObject::invokeMethod(this, [this, id]() { readRequests(id); }, Qt::QueuedConnection);
+    }
+}
+
+bool RpcServer::handleRequest(Session* session, const RpcFrame& request)
+{
+    WMS_TRACE_SCOPE_CAT("RpcServer::handleRequest", "rpc");
+
+    static MetricCounter* const requests = MetricsRegistry::instance().counter(
+        "wms_rpc_requests_total", "Requests handled by the database server");
+
+    if (!session->authenticated && request.type != RpcType::Hello) {
+        replyError(session, request.id, "Expected a handshake");
+        closeSession(session);
+        return true;
+    }
+
+    bool inTransaction = m_transactionOwner == session->id;
+    switch (request.type) {
+    case RpcType::Hello: {
+        const char* data = request.payload.constData();
+        qsizetype pos = 0;
+        quint64 version = 0;
+        QString token;
+        if (!readVarint(data, request.payload.size(), pos, version)
+            || !decodeRpcString(request.payload.mid(pos), token)) {
+            replyError(session, request.id, "Invalid handshake");
+            closeSession(session);
+        } else if (version != kRpcProtocolVersion) {
+            replyError(session, request.id, QString("Protocol version %1 is not supported").arg(version));
+            closeSession(session);
+        } else if (!m_token.isEmpty() && token != m_token) {
+            replyError(session, request.id, "Wrong token");
+            closeSession(session);
+        } else {
+            session->authenticated = true;
+            reply(session, request.id, RpcType::Ok, encodeRpcString(DatabaseManager::instance().currentSite()));
+        }
+        return true;
+    }
+
+    case RpcType::Begin: {
+        // After the session's own writes, and once no other transaction runs
+        if (session->pendingWrites > 0 || (m_transactionOwner != 0 && !inTransaction)) {
+            return false;
+        }
+        QString error;
+        if (inTransaction || session->failedBegin) {
+            error = "A transaction is already active";
+        } else if (!beginTransaction(session, &error)) {
+            session->failedBegin = true;
+        }
+        error.isEmpty() ? reply(session, request.id, RpcType::Ok) : replyError(session, request.id, error);
+        requests->inc();
+        return true;
+    }
+
+    case RpcType::Commit:
+    case RpcType::Rollback: {
+        if (session->pendingWrites > 0) {
+            return false;
+        }
+        bool commit = request.type == RpcType::Commit;
+        QString error;
+        if (inTransaction) {
+            endTransaction(commit, &error);
+        } else if (session->failedBegin) {
+            session->failedBegin = false;
+            if (commit) {
+                error = "The transaction failed to begin";
+            }
+        } else {
+            error = "No transaction is active";
+        }
+        error.isEmpty() ? reply(session, request.id, RpcType::Ok) : replyError(session, request.id, error);
+        requests->inc();
+        return true;
+    }
+
+    case RpcType::Exec:
+    case RpcType::Batch:
+        if (!handleStatement(session, request)) {
+            return false;
+        }
+        requests->inc();
+        return true;
+
+    default:
+        if (session->pendingWrites > 0) {
+            return false;
+        }
+        replyError(session, request.id, QString("Unknown request type %1").arg(int(request.type)));
+        return true;
+    }
+}
+
+bool RpcServer::handleStatement(Session* session, const RpcFrame& request)
+{
+    bool inTransaction = m_transactionOwner == session->id;
+    QString sql;
+    std::vector<QVariantList> rows;
+    QString error;
+    sqlite3_stmt* statement = nullptr;
+    if (!decodeRpcStatement(request.payload, sql, rows) || (request.type == RpcType::Exec && rows.size() != 1)) {
+        error = "Invalid request";
+    } else if (session->failedBegin) {
+        error = "The transaction failed to begin";
+    } else if (QString keyword = refusedKeyword(sql); !keyword.isEmpty()) {
+        error = QString("%1 is not available through wmsd").arg(keyword);
+    } else if (rows.empty()) {
+        // A batch without rows has nothing to do
+    } else {
+        // Prepared on the writer even for reads, to learn whether the statement writes
+        statement = m_statements->prepare(sql, &error);
+    }
+
+    bool readOnly = statement && request.type == RpcType::Exec && sqlite3_stmt_readonly(statement);
+    if (statement && !inTransaction && !readOnly) {
+        // Joins the next group of writes
+        if (m_transactionOwner != 0) {
+            return false;
+        }
+        m_writes.push_back({session->id, request.id, sql, std::move(rows)});
+        ++session->pendingWrites;
+        if (!m_writeTimer.isActive()) {
+            m_writeTimer.start(0);
+        }
+        return true;
+    }
+
+    // Anything else is answered after the session's pending writes
+    if (session->pendingWrites > 0) {
+        return false;
+    }
+    if (!statement) {
+        error.isEmpty() ? reply(session, request.id, RpcType::Result, RpcResult().encode())
+                        : replyError(session, request.id, error);
+        return true;
+    }
+    if (inTransaction) {
+        // A batch is applied completely or not at all, also inside a transaction
+        sqlite3* db = m_statements->database();
+        RpcResult result;
+        bool ok = execSql(db, "SAVEPOINT rpc_write", &error)
+                  && runStatement(*m_statements, sql, rows, result, &error);
+        if (!ok) {
+            execSql(db, "ROLLBACK TO rpc_write");
+        }
+        execSql(db, "RELEASE rpc_write");
+        ok ? reply(session, request.id, RpcType::Result, result.encode()) : replyError(session, request.id, error);
+        return true;
+    }
+
+    session->reading = true;
+    RpcReader* reader = m_readers[m_nextReader++ % m_readers.size()];
+    quint64 sessionId = session->id;
+    quint64 requestId = request.id;
+    std::vector<RpcDatabaseFile> files = m_files;
+    QMetaObject::invokeMethod(reader, [this, reader, files, sessionId, requestId, sql, rows]() {
+        RpcResult result;
+        QString error;
+        bool ok = reader->run(files, sql, rows, result, &error);
+        QByteArray payload = ok ? result.encode() : encodeRpcString(error);
+        QMetaObject::invokeMethod(this, [this, sessionId, requestId, ok, payload]() {
+            readFinished(sessionId, requestId, ok, payload);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+    return true;
+}
+
+void RpcServer::readFinished(quint64 sessionId, quint64 requestId, bool ok, const QByteArray& payload)
+{
+    Session* session = m_sessions.value(sessionId);
+    if (!session) {
+        // The client went away before its answer was ready
+        return;
+    }
+    session->reading = false;
+    reply(session, requestId, ok ? RpcType::Result : RpcType::Error, payload);
+    processSession(session);
+}
+
+void RpcServer::reply(Session* session, quint64 requestId, RpcType type, const QByteArray& payload)
+{
+    session->socket->write(encodeRpcFrame(requestId, type, payload));
+}
+
+void RpcServer::replyError(Session* session, quint64 requestId, const QString& message)
+{
+    reply(session, requestId, RpcType::Error, encodeRpcString(message));
+}
+
+bool RpcServer::beginTransaction(Session* session, QString* errorMessage)
+{
+    // Writes other sessions queued so far go first
+    applyWrites();
+    if (!execSql(m_statements->database(), "BEGIN IMMEDIATE", errorMessage)) {
+        return false;
+    }
+    m_transactionOwner = session->id;
+    m_transactionStarted.start();
+    return true;
+}
+
+bool RpcServer::endTransaction(bool commit, QString* errorMessage)
+{
+    sqlite3* db = m_statements->database();
+    bool ok = execSql(db, commit ? "COMMIT" : "ROLLBACK", errorMessage);
+    // A failed COMMIT leaves the transaction open
+    if (!sqlite3_get_autocommit(db)) {
+        execSql(db, "ROLLBACK");
+    }
+    m_transactionOwner = 0;
+    scheduleResume();
+    return ok;
+}
+
+void RpcServer::checkTransactionTimeout()
+{
+    if (m_transactionOwner == 0 || !m_transactionStarted.hasExpired(m_transactionTimeoutMs)) {
+        return;
+    }
+    qDebug() << "Database client kept a transaction open for more than" << m_transactionTimeoutMs
+             << "ms; rolling it back and closing the connection";
+    Session* session = m_sessions.value(m_transactionOwner);
+    endTransaction(false);
+    if (session) {
+        closeSession(session);
+    }
+}
+
+void RpcServer::applyWrites()
+{
+    WMS_TRACE_SCOPE_CAT("RpcServer::applyWrites", "rpc");
+
+    static MetricCounter* const transactions = MetricsRegistry::instance().counter(
+        "wms_rpc_write_transactions_total", "Transactions that applied writes of database clients");
+    static MetricCounter* const statements = MetricsRegistry::instance().counter(
+        "wms_rpc_write_requests_total", "Write requests of database clients applied in group transactions");
+
+    if (m_writes.empty()) {
+        return;
+    }
+    std::vector<PendingWrite> writes;
+    writes.swap(m_writes);
+
+    struct Outcome
+    {
+        bool ok = false;
+        QByteArray payload;
+    };
+    std::vector<Outcome> outcomes(writes.size());
+    sqlite3* db = m_statements->database();
+    QString error;
+    bool committed = db && execSql(db, "BEGIN IMMEDIATE", &error);
+    if (committed) {
+        for (size_t i = 0; i < writes.size(); ++i) {
+            // A failing request only undoes its own changes
+            RpcResult result;
+            QString statementError;
+            bool ok = execSql(db, "SAVEPOINT rpc_write", &statementError)
+                      && runStatement(*m_statements, writes[i].sql, writes[i].rows, result, &statementError);
+            if (!ok) {
+                execSql(db, "ROLLBACK TO rpc_write");
+            }
+            execSql(db, "RELEASE rpc_write");
+            // Some errors (disk full, I/O) end the whole transaction
+            if (sqlite3_get_autocommit(db)) {
+                committed = false;
+                error = statementError;
+                break;
+            }
+            outcomes[i] = ok ? Outcome{true, result.encode()} : Outcome{false, encodeRpcString(statementError)};
+        }
+        if (committed) {
+            committed = execSql(db, "COMMIT", &error);
+        }
+        if (!sqlite3_get_autocommit(db)) {
+            execSql(db, "ROLLBACK");
+        }
+        transactions->inc();
+    } else if (!db) {
+        error = "The database is not open";
+    }
+    if (committed) {
+        statements->inc(writes.size());
+    }
+
+    for (size_t i = 0; i < writes.size(); ++i) {
+        Session* session = m_sessions.value(writes[i].session);
+        if (!session) {
+            continue;
+        }
+        --session->pendingWrites;
+        if (committed) {
+            reply(session, writes[i].requestId, outcomes[i].ok ? RpcType::Result : RpcType::Error, outcomes[i].payload);
+        } else {
+            replyError(session, writes[i].requestId, error);
+        }
+    }
+    scheduleResume();
+}
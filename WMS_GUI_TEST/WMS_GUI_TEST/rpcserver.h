@@ -0,0 +1,111 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLocalServer>
+#include <QObject>
+#include <QTcpServer>
+#include <QTimer>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "rpcprotocol.h"
+
+class QIODevice;
+class QThread;
+class RpcReader;
+class RpcStatementCache;
+struct RpcDatabaseFile;
+
+// Database server of wmsd (wmsd_main.cpp): owns the connection that
+// DatabaseManager opened on the current site and answers RemoteSqlDriver
+// clients (rpcprotocol.h) on the local socket "rpc/localName" (default
+// "wmsd") and on TCP "rpc/address" (default localhost) port "rpc/port"
+// (default 7878; 0 switches TCP off). With "rpc/token" set, clients must
+// send it as their password; without one the server only listens on a
+// loopback address.
+//
+// Each connection's requests are handled in order. Read-only statements
+// outside a transaction run on "rpc/readers" threads (default
+// QThread::idealThreadCount()), each with its own read-only connection.
+// Writes outside a transaction are collected from all connections and
+// applied together: one BEGIN IMMEDIATE, a savepoint per request, so a
+// failing request only undoes itself, and one COMMIT. Replies go out once
+// the group is committed, so many clients share one sync of the database
+// file. A connection's read waits for its own pending writes.
+//
+// An explicit transaction (QSqlDatabase::transaction()) holds the writer
+// for that connection alone; writes and transactions of other connections
+// wait until it ends. It is rolled back if the client disconnects or keeps
+// it open longer than "rpc/transactionTimeoutMs" (default 30 s).
+//
+// A request carries exactly one statement. ATTACH, DETACH, transaction and
+// savepoint statements, TEMP tables, views, indexes and triggers, and
+// pragmas given a value are refused by an authorizer while it is prepared,
+// wherever they appear in it, since the connection is shared. Pragmas that
+// take a table or index name (table_info, index_list, ...) are allowed.
+// Statements are prepared once and kept per connection, up to
+// kStatementCacheSize of them.
+class RpcServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int kStatementCacheSize = 128;
+
+    explicit RpcServer(QObject* parent = nullptr);
+    ~RpcServer();
+
+    bool start(QString* errorMessage = nullptr);
+    void stop();
+    bool isListening() const { return m_localServer.isListening() || m_tcpServer.isListening(); }
+
+private:
+    struct Session;
+    struct PendingWrite
+    {
+        quint64 session;
+        quint64 requestId;
+        QString sql;
+        std::vector<QVariantList> rows;
+    };
+
+    void addSession(QIODevice* socket);
+    void removeSession(quint64 sessionId);
+    // Answers nothing more and closes once the replies written so far are out
+    void closeSession(Session* session);
+    void readRequests(quint64 sessionId);
+    void processSession(Session* session);
+    void scheduleResume();
+    void resumeSessions();
+    // False if the request has to wait and stays queued
+    bool handleRequest(Session* session, const RpcFrame& request);
+    bool handleStatement(Session* session, const RpcFrame& request);
+    void readFinished(quint64 sessionId, quint64 requestId, bool ok, const QByteArray& payload);
+    void reply(Session* session, quint64 requestId, RpcType type, const QByteArray& payload = QByteArray());
+    void replyError(Session* session, quint64 requestId, const QString& message);
+    bool beginTransaction(Session* session, QString* errorMessage);
+    bool endTransaction(bool commit, QString* errorMessage = nullptr);
+    void checkTransactionTimeout();
+    void applyWrites();
+
+    QLocalServer m_localServer;
+    QTcpServer m_tcpServer;
+    QHash<quint64, Session*> m_sessions;
+    quint64 m_nextSessionId;
+    // Statements prepared on DatabaseManager's connection, the writer
+    std::unique_ptr<RpcStatementCache> m_statements;
+    std::vector<RpcDatabaseFile> m_files;
+    std::vector<QThread*> m_threads;
+    std::vector<RpcReader*> m_readers;
+    size_t m_nextReader;
+    std::vector<PendingWrite> m_writes;
+    QTimer m_writeTimer;
+    QTimer m_transactionTimer;
+    // Session holding the writer in an explicit transaction, or 0
+    quint64 m_transactionOwner;
+    QElapsedTimer m_transactionStarted;
+    QString m_token;
+    int m_transactionTimeoutMs;
+    bool m_resumeScheduled;
+};
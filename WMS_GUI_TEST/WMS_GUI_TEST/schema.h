@@ -0,0 +1,294 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+// Compile-time description of the wms.db tables. Each table lists its
+// columns once; CREATE TABLE, INSERT, UPDATE, SELECT and DELETE statements
+// are generated from that list at compile time, and the Column enums give
+// the positional indices used by models, mappers and row decoders.
+//
+// Conventions: the first column is the integer primary key and is never
+// written by INSERT/UPDATE; all other columns are written in declaration
+// order, which is also the order of the positional placeholders.
+
+struct SqlColumn
+{
+    std::string_view name;
+    std::string_view definition;
+};
+
+struct UsersTable
+{
+    static constexpr std::string_view name = "users";
+    enum Column { Id, Login, Password };
+    static constexpr std::array columns = {
+        SqlColumn{"id", "INTEGER PRIMARY KEY AUTOINCREMENT"},
+        SqlColumn{"login", "TEXT UNIQUE NOT NULL"},
+        SqlColumn{"password", "TEXT NOT NULL"},
+    };
+    static constexpr std::array<std::string_view, 0> constraints = {};
+};
+
+// price is in minor currency units (see Money)
+struct ItemsTable
+{
+    static constexpr std::string_view name = "items";
+    enum Column { Id, Code, Description, Quantity, Price };
+    static constexpr std::array columns = {
+        SqlColumn{"id", "INTEGER PRIMARY KEY AUTOINCREMENT"},
+        SqlColumn{"item_code", "TEXT UNIQUE NOT NULL"},
+        SqlColumn{"item_description", "TEXT"},
+        SqlColumn{"quantity", "INTEGER DEFAULT 0"},
+        SqlColumn{"price", "INTEGER NOT NULL DEFAULT 0"},
+    };
+    static constexpr std::array<std::string_view, 0> constraints = {};
+};
+
+// date is a Julian day number, type an OrderType value, status an OrderStatus value
+struct OrdersTable
+{
+    static constexpr std::string_view name = "orders";
+    enum Column { Id, Number, Date, Type, Status };
+    static constexpr std::array columns = {
+        SqlColumn{"id", "INTEGER PRIMARY KEY AUTOINCREMENT"},
+        SqlColumn{"order_number", "TEXT UNIQUE NOT NULL"},
+        SqlColumn{"date", "INTEGER NOT NULL"},
+        SqlColumn{"type", "INTEGER NOT NULL CHECK (type IN (0, 1))"},
+        SqlColumn{"status", "INTEGER NOT NULL DEFAULT 0 CHECK (status IN (0, 1))"},
+    };
+    static constexpr std::array<std::string_view, 0> constraints = {};
+};
+
+struct OrderLinesTable
+{
+    static constexpr std::string_view name = "order_lines";
+    enum Column { Id, OrderId, OrderNumber, ItemId, Quantity };
+    static constexpr std::array columns = {
+        SqlColumn{"id", "INTEGER PRIMARY KEY AUTOINCREMENT"},
+        SqlColumn{"order_id", "INTEGER NOT NULL"},
+        SqlColumn{"order_number", "TEXT NOT NULL"},
+        SqlColumn{"item_id", "INTEGER NOT NULL"},
+        SqlColumn{"quantity", "INTEGER NOT NULL"},
+    };
+    static constexpr std::array constraints = {
+        std::string_view("FOREIGN KEY (order_id) REFERENCES orders(id) ON DELETE CASCADE"),
+        std::string_view("FOREIGN KEY (order_number) REFERENCES orders(order_number) ON DELETE CASCADE"),
+        std::string_view("FOREIGN KEY (item_id) REFERENCES items(id) ON DELETE RESTRICT"),
+    };
+};
+
+// Per-order aggregates of order_lines, maintained by triggers so they can be
+// shown and sorted on without scanning order_lines. total_value is in minor
+// currency units at current item prices.
+struct OrderSummaryTable
+{
+    static constexpr std::string_view name = "order_summary";
+    enum Column { OrderId, LineCount, TotalUnits, TotalValue };
+    static constexpr std::array columns = {
+        SqlColumn{"order_id", "INTEGER PRIMARY KEY"},
+        SqlColumn{"line_count", "INTEGER NOT NULL DEFAULT 0"},
+        SqlColumn{"total_units", "INTEGER NOT NULL DEFAULT 0"},
+        SqlColumn{"total_value", "INTEGER NOT NULL DEFAULT 0"},
+    };
+    static constexpr std::array constraints = {
+        std::string_view("FOREIGN KEY (order_id) REFERENCES orders(id) ON DELETE CASCADE"),
+    };
+};
+
+// Append-only ledger of items.quantity changes, written by triggers on items.
+// moved_at is in seconds since the epoch (UTC).
+struct StockMovementsTable
+{
+    static constexpr std::string_view name = "stock_movements";
+    enum Column { Id, ItemId, MovedAt, Delta };
+    static constexpr std::array columns = {
+        SqlColumn{"id", "INTEGER PRIMARY KEY AUTOINCREMENT"},
+        SqlColumn{"item_id", "INTEGER NOT NULL"},
+        SqlColumn{"moved_at", "INTEGER NOT NULL"},
+        SqlColumn{"delta", "INTEGER NOT NULL"},
+    };
+    static constexpr std::array<std::string_view, 0> constraints = {};
+};
+
+// Checkpoint of an item's balance: quantity is the sum of all its movements
+// with id <= movement_id
+struct StockSnapshotsTable
+{
+    static constexpr std::string_view name = "stock_snapshots";
+    enum Column { Id, ItemId, MovementId, TakenAt, Quantity };
+    static constexpr std::array columns = {
+        SqlColumn{"id", "INTEGER PRIMARY KEY AUTOINCREMENT"},
+        SqlColumn{"item_id", "INTEGER NOT NULL"},
+        SqlColumn{"movement_id", "INTEGER NOT NULL"},
+        SqlColumn{"taken_at", "INTEGER NOT NULL"},
+        SqlColumn{"quantity", "INTEGER NOT NULL"},
+    };
+    static constexpr std::array<std::string_view, 0> constraints = {};
+};
+
+// Statement generation
+
+// String literal usable as a template argument (WHERE/ORDER BY suffixes)
+template <std::size_t N>
+struct SqlLiteral
+{
+    char chars[N] = {};
+
+    constexpr SqlLiteral(const char (&text)[N])
+    {
+        for (std::size_t i = 0; i < N; ++i) {
+            chars[i] = text[i];
+        }
+    }
+
+    constexpr std::string_view view() const { return std::string_view(chars, N - 1); }
+};
+
+template <std::size_t N>
+struct SqlText
+{
+    std::array<char, N + 1> chars = {};
+
+    constexpr std::string_view view() const { return std::string_view(chars.data(), N); }
+};
+
+// Counts characters when out is null, writes them otherwise
+struct SqlWriter
+{
+    char* out = nullptr;
+    std::size_t size = 0;
+
+    constexpr void put(std::string_view text)
+    {
+        for (char c : text) {
+            if (out) {
+                out[size] = c;
+            }
+            ++size;
+        }
+    }
+};
+
+template <typename Table>
+constexpr std::size_t writableColumnCount()
+{
+    return Table::columns.size() - 1;
+}
+
+template <typename Table>
+constexpr void writeColumnList(SqlWriter& w, std::size_t first)
+{
+    for (std::size_t i = first; i < Table::columns.size(); ++i) {
+        w.put(i == first ? "" : ", ");
+        w.put(Table::columns[i].name);
+    }
+}
+
+template <typename Table>
+constexpr void writeCreate(SqlWriter& w)
+{
+    w.put("CREATE TABLE IF NOT EXISTS ");
+    w.put(Table::name);
+    w.put(" (");
+    for (std::size_t i = 0; i < Table::columns.size(); ++i) {
+        w.put(i == 0 ? "" : ", ");
+        w.put(Table::columns[i].name);
+        w.put(" ");
+        w.put(Table::columns[i].definition);
+    }
+    for (std::string_view constraint : Table::constraints) {
+        w.put(", ");
+        w.put(constraint);
+    }
+    w.put(")");
+}
+
+template <typename Table>
+constexpr void writeInsert(SqlWriter& w)
+{
+    w.put("INSERT INTO ");
+    w.put(Table::name);
+    w.put(" (");
+    writeColumnList<Table>(w, 1);
+    w.put(") VALUES (");
+    for (std::size_t i = 1; i < Table::columns.size(); ++i) {
+        w.put(i == 1 ? "?" : ", ?");
+    }
+    w.put(")");
+}
+
+template <typename Table>
+constexpr void writeUpdate(SqlWriter& w)
+{
+    w.put("UPDATE ");
+    w.put(Table::name);
+    w.put(" SET ");
+    for (std::size_t i = 1; i < Table::columns.size(); ++i) {
+        w.put(i == 1 ? "" : ", ");
+        w.put(Table::columns[i].name);
+        w.put(" = ?");
+    }
+    w.put(" WHERE ");
+    w.put(Table::columns[0].name);
+    w.put(" = ?");
+}
+
+template <typename Table, SqlLiteral Suffix>
+constexpr void writeSelect(SqlWriter& w)
+{
+    w.put("SELECT ");
+    writeColumnList<Table>(w, 0);
+    w.put(" FROM ");
+    w.put(Table::name);
+    if (!Suffix.view().empty()) {
+        w.put(" ");
+        w.put(Suffix.view());
+    }
+}
+
+template <typename Table>
+constexpr void writeDelete(SqlWriter& w)
+{
+    w.put("DELETE FROM ");
+    w.put(Table::name);
+    w.put(" WHERE ");
+    w.put(Table::columns[0].name);
+    w.put(" = ?");
+}
+
+template <void (*Write)(SqlWriter&)>
+constexpr auto buildSql()
+{
+    constexpr std::size_t length = [] {
+        SqlWriter counter;
+        Write(counter);
+        return counter.size;
+    }();
+
+    SqlText<length> text;
+    SqlWriter writer{text.chars.data()};
+    Write(writer);
+    return text;
+}
+
+// Statement texts, materialised once as constants
+template <void (*Write)(SqlWriter&)>
+inline constexpr auto kSqlText = buildSql<Write>();
+
+template <typename Table>
+constexpr std::string_view createTableSql() { return kSqlText<&writeCreate<Table>>.view(); }
+
+template <typename Table>
+constexpr std::string_view insertSql() { return kSqlText<&writeInsert<Table>>.view(); }
+
+template <typename Table>
+constexpr std::string_view updateSql() { return kSqlText<&writeUpdate<Table>>.view(); }
+
+// selectSql<ItemsTable, "WHERE id = ?">() selects every column, in Column order
+template <typename Table, SqlLiteral Suffix = "">
+constexpr std::string_view selectSql() { return kSqlText<&writeSelect<Table, Suffix>>.view(); }
+
+template <typename Table>
+constexpr std::string_view deleteSql() { return kSqlText<&writeDelete<Table>>.view(); }
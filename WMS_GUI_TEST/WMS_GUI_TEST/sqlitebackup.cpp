@@ -0,0 +1,150 @@
+#include "sqlitebackup.h"
+#include "tracing.h"
+
+#include <QDebug>
+#include <sqlite3.h>
+
+SqliteBackupJob::SqliteBackupJob(sqlite3* source, sqlite3* destination, QObject* parent)
+    : QObject(parent),
+      m_source(source),
+      m_destination(destination),
+      m_ownsDestination(false),
+      m_backup(nullptr),
+      m_pagesPerStep(kDefaultPagesPerStep),
+      m_totalPages(0),
+      m_remainingPages(0)
+{
+    m_timer.setInterval(kDefaultStepIntervalMs);
+    connect(&m_timer, &QTimer::timeout, this, &SqliteBackupJob::step);
+}
+
+SqliteBackupJob::SqliteBackupJob(sqlite3* source, const QString& destinationPath, QObject* parent)
+    : SqliteBackupJob(source, static_cast<sqlite3*>(nullptr), parent)
+{
+    m_destinationPath = destinationPath;
+    m_ownsDestination = true;
+}
+
+SqliteBackupJob::~SqliteBackupJob()
+{
+    m_timer.stop();
+    if (m_backup) {
+        sqlite3_backup_finish(m_backup);
+    }
+    if (m_ownsDestination && m_destination) {
+        sqlite3_close_v2(m_destination);
+    }
+}
+
+sqlite3* SqliteBackupJob::openFile(const QString& filePath, bool readOnly, QString* errorMessage)
+{
+    sqlite3* db = nullptr;
+    int flags = readOnly ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+    int rc = sqlite3_open_v2(filePath.toUtf8().constData(), &db, flags, nullptr);
+    if (rc != SQLITE_OK) {
+        if (errorMessage) {
+            *errorMessage = db ? QString::fromUtf8(sqlite3_errmsg(db)) : QString::fromUtf8(sqlite3_errstr(rc));
+        }
+        sqlite3_close_v2(db);
+        return nullptr;
+    }
+    sqlite3_busy_timeout(db, 5000);
+    return db;
+}
+
+bool SqliteBackupJob::start(QString* errorMessage)
+{
+    auto fail = [errorMessage](const QString& message) {
+        qDebug() << "Failed to start backup:" << message;
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    if (m_backup) {
+        return fail("A backup is already running");
+    }
+    if (!m_source) {
+        return fail("No source database");
+    }
+
+    if (m_ownsDestination && !m_destination) {
+        QString error;
+        m_destination = openFile(m_destinationPath, false, &error);
+        if (!m_destination) {
+            return fail(error);
+        }
+    }
+    if (!m_destination) {
+        return fail("No destination database");
+    }
+
+    m_backup = sqlite3_backup_init(m_destination, "main", m_source, "main");
+    if (!m_backup) {
+        return fail(QString::fromUtf8(sqlite3_errmsg(m_destination)));
+    }
+
+    m_totalPages = 0;
+    m_remainingPages = 0;
+    m_timer.start();
+    return true;
+}
+
+void SqliteBackupJob::cancel()
+{
+    if (m_backup) {
+        finish(false, "Cancelled");
+    }
+}
+
+void SqliteBackupJob::step()
+{
+    WMS_TRACE_SCOPE_CAT("SqliteBackupJob::step", "sql");
+
+    if (!m_backup) {
+        m_timer.stop();
+        return;
+    }
+
+    int rc = sqlite3_backup_step(m_backup, qMax(1, m_pagesPerStep));
+    m_totalPages = sqlite3_backup_pagecount(m_backup);
+    m_remainingPages = sqlite3_backup_remaining(m_backup);
+
+    switch (rc) {
+    case SQLITE_DONE:
+        emit progress(0, m_totalPages);
+        finish(true, QString());
+        break;
+    case SQLITE_OK:
+        emit progress(m_remainingPages, m_totalPages);
+        break;
+    case SQLITE_BUSY:
+    case SQLITE_LOCKED:
+        // Someone holds a lock; try again on the next tick
+        break;
+    default:
+        finish(false, QString::fromUtf8(sqlite3_errstr(rc)));
+        break;
+    }
+}
+
+void SqliteBackupJob::finish(bool ok, const QString& errorMessage)
+{
+    m_timer.stop();
+
+    int rc = sqlite3_backup_finish(m_backup);
+    m_backup = nullptr;
+    QString error = errorMessage;
+    if (ok && rc != SQLITE_OK) {
+        ok = false;
+        error = QString::fromUtf8(sqlite3_errmsg(m_destination));
+    }
+
+    if (m_ownsDestination) {
+        sqlite3_close_v2(m_destination);
+        m_destination = nullptr;
+    }
+
+    emit finished(ok, error);
+}
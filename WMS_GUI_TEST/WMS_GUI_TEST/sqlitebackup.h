@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+struct sqlite3;
+struct sqlite3_backup;
+
+// Incremental copy of one SQLite database into another with the online
+// backup API. Each timer tick copies at most pagesPerStep pages, so the
+// source is only locked for short moments and the event loop keeps running
+// between steps. Changes made through the source connection while the copy
+// runs are carried over by SQLite itself; if another connection writes to
+// the source, the copy restarts automatically. A busy or locked destination
+// is retried on the next tick.
+//
+// The source handle must stay open, and be used from the job's thread only,
+// until finished() has been emitted.
+class SqliteBackupJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int kDefaultPagesPerStep = 256;
+    static constexpr int kDefaultStepIntervalMs = 10;
+
+    // Copies into an existing connection, which the job does not own
+    SqliteBackupJob(sqlite3* source, sqlite3* destination, QObject* parent = nullptr);
+    // Copies into a file, created or overwritten, which the job opens and closes
+    SqliteBackupJob(sqlite3* source, const QString& destinationPath, QObject* parent = nullptr);
+    ~SqliteBackupJob();
+
+    void setPagesPerStep(int pages) { m_pagesPerStep = pages; }
+    void setStepInterval(int ms) { m_timer.setInterval(ms); }
+
+    bool start(QString* errorMessage = nullptr);
+    void cancel();
+    bool isRunning() const { return m_backup != nullptr; }
+
+    int totalPages() const { return m_totalPages; }
+    int remainingPages() const { return m_remainingPages; }
+
+    // Opens a database file with the native API; nullptr on failure
+    static sqlite3* openFile(const QString& filePath, bool readOnly, QString* errorMessage = nullptr);
+
+signals:
+    void progress(int remainingPages, int totalPages);
+    void finished(bool ok, const QString& errorMessage);
+
+private slots:
+    void step();
+
+private:
+    void finish(bool ok, const QString& errorMessage);
+
+    sqlite3* m_source;
+    sqlite3* m_destination;
+    QString m_destinationPath;
+    bool m_ownsDestination;
+    sqlite3_backup* m_backup;
+    QTimer m_timer;
+    int m_pagesPerStep;
+    int m_totalPages;
+    int m_remainingPages;
+};
@@ -0,0 +1,155 @@
+#include "sqlitestatement.h"
+
+#include <QSqlDriver>
+#include <QVariant>
+#include <atomic>
+#include <sqlite3.h>
+
+static std::atomic<bool> nativeBackendEnabled{true};
+
+sqlite3* sqliteHandle(const QSqlDatabase& db)
+{
+    if (!db.isOpen() || !db.driver()) {
+        return nullptr;
+    }
+
+    QVariant handle = db.driver()->handle();
+    if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0) {
+        return *static_cast<sqlite3* const*>(handle.constData());
+    }
+    return nullptr;
+}
+
+void setNativeBackendEnabled(bool enabled)
+{
+    nativeBackendEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool isNativeBackendEnabled()
+{
+    return nativeBackendEnabled.load(std::memory_order_relaxed);
+}
+
+sqlite3* nativeBackendHandle(const QSqlDatabase& db)
+{
+    return isNativeBackendEnabled() ? sqliteHandle(db) : nullptr;
+}
+
+SqliteStatement::SqliteStatement(sqlite3* db, std::string_view sql) : m_db(db), m_stmt(nullptr)
+{
+    if (!m_db) {
+        m_error = "No database connection";
+        return;
+    }
+
+    if (sqlite3_prepare_v3(m_db, sql.data(), int(sql.size()), 0, &m_stmt, nullptr) != SQLITE_OK) {
+        setError();
+        m_stmt = nullptr;
+    }
+}
+
+SqliteStatement::~SqliteStatement()
+{
+    sqlite3_finalize(m_stmt);
+}
+
+void SqliteStatement::setError()
+{
+    m_error = QString::fromUtf8(sqlite3_errmsg(m_db));
+}
+
+void SqliteStatement::bind(int index, qint64 value)
+{
+    if (m_stmt && sqlite3_bind_int64(m_stmt, index + 1, value) != SQLITE_OK) {
+        setError();
+    }
+}
+
+void SqliteStatement::bind(int index, std::string_view utf8)
+{
+    if (m_stmt && sqlite3_bind_text(m_stmt, index + 1, utf8.data(), int(utf8.size()), SQLITE_TRANSIENT) != SQLITE_OK) {
+        setError();
+    }
+}
+
+void SqliteStatement::bind(int index, const QString& text)
+{
+    QByteArray utf8 = text.toUtf8();
+    bind(index, std::string_view(utf8.constData(), size_t(utf8.size())));
+}
+
+void SqliteStatement::bindNull(int index)
+{
+    if (m_stmt && sqlite3_bind_null(m_stmt, index + 1) != SQLITE_OK) {
+        setError();
+    }
+}
+
+bool SqliteStatement::step()
+{
+    if (!m_stmt) {
+        return false;
+    }
+
+    int rc = sqlite3_step(m_stmt);
+    if (rc == SQLITE_ROW) {
+        return true;
+    }
+    if (rc != SQLITE_DONE) {
+        setError();
+    }
+    return false;
+}
+
+bool SqliteStatement::exec()
+{
+    if (!m_stmt) {
+        return false;
+    }
+
+    while (step()) {
+    }
+    return !hasError();
+}
+
+void SqliteStatement::reset()
+{
+    // A statement that failed to prepare stays failed
+    if (m_stmt) {
+        sqlite3_reset(m_stmt);
+        sqlite3_clear_bindings(m_stmt);
+        m_error.clear();
+    }
+}
+
+qint64 SqliteStatement::columnInt64(int column) const
+{
+    return sqlite3_column_int64(m_stmt, column);
+}
+
+std::string_view SqliteStatement::columnText(int column) const
+{
+    // sqlite3_column_bytes() must follow sqlite3_column_text() so the length
+    // refers to the UTF-8 form
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(m_stmt, column));
+    if (!text) {
+        return std::string_view();
+    }
+    return std::string_view(text, size_t(sqlite3_column_bytes(m_stmt, column)));
+}
+
+QString SqliteStatement::columnString(int column) const
+{
+    std::string_view text = columnText(column);
+    return QString::fromUtf8(text.data(), qsizetype(text.size()));
+}
+
+bool SqliteStatement::columnIsNull(int column) const
+{
+    return sqlite3_column_type(m_stmt, column) == SQLITE_NULL;
+}
+
+qint64 SqliteStatement::lastInsertId() const
+{
+    return sqlite3_last_insert_rowid(m_db);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QSqlDatabase>
+#include <QString>
+#include <string_view>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Underlying SQLite connection of a QSQLITE database, or nullptr if the
+// connection is closed or uses another driver
+sqlite3* sqliteHandle(const QSqlDatabase& db);
+
+// Bulk paths (imports, exports, reports) go through SqliteStatement when
+// enabled and the connection exposes its handle; otherwise they fall back to
+// QSqlQuery. Controlled by the "database/nativeBackend" setting.
+void setNativeBackendEnabled(bool enabled);
+bool isNativeBackendEnabled();
+
+// Handle to use for a bulk path, or nullptr if the QtSql path should be taken
+sqlite3* nativeBackendHandle(const QSqlDatabase& db);
+
+// Prepared statement on a raw sqlite3 connection, bypassing the QtSql driver.
+// Parameters are bound and columns read as native integers and UTF-8 views,
+// so no QVariant or QSqlRecord is built per row. Text views returned by
+// columnText() are valid until the next step(), reset() or destruction.
+//
+// Parameter and column indices are zero-based like QSqlQuery's, and text is
+// decoded the same way the QSQLITE driver does (UTF-8), so both paths return
+// identical values.
+class SqliteStatement
+{
+public:
+    SqliteStatement(sqlite3* db, std::string_view sql);
+    ~SqliteStatement();
+    SqliteStatement(const SqliteStatement&) = delete;
+    SqliteStatement& operator=(const SqliteStatement&) = delete;
+
+    bool isValid() const { return m_stmt != nullptr; }
+
+    void bind(int index, qint64 value);
+    void bind(int index, int value) { bind(index, qint64(value)); }
+    void bind(int index, std::string_view utf8);
+    void bind(int index, const QString& text);
+    void bindNull(int index);
+
+    // Advances to the next row; false when done or on error (see hasError())
+    bool step();
+    // Runs a statement that returns no rows; true on success
+    bool exec();
+    // Makes the statement reusable with new bindings; keeps the error of a
+    // statement that could not be prepared
+    void reset();
+
+    qint64 columnInt64(int column) const;
+    int columnInt(int column) const { return int(columnInt64(column)); }
+    std::string_view columnText(int column) const;
+    QString columnString(int column) const;
+    bool columnIsNull(int column) const;
+
+    qint64 lastInsertId() const;
+    bool hasError() const { return !m_error.isEmpty(); }
+    QString lastError() const { return m_error; }
+
+private:
+    void setError();
+
+    sqlite3* m_db;
+    sqlite3_stmt* m_stmt;
+    QString m_error;
+};
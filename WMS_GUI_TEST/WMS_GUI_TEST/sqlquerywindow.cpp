@@ -6,6 +6,8 @@
 #include <QElapsedTimer>
 #include <QScreen>
 #include <QGuiApplication>
+#include "tracing.h"
+#include "databasemanager.h"
 
 SQLQueryWindow::SQLQueryWindow(QWidget *parent) :
     QWidget(parent),
@@ -29,7 +31,14 @@ SQLQueryWindow::SQLQueryWindow(QWidget *parent) :
                                     "-- SELECT * FROM users;\n"
                                     "-- SELECT * FROM items;\n"
                                     "-- SELECT * FROM orders;\n"
-                                    "-- SELECT * FROM order_lines;\n\n");
+                                    "-- SELECT * FROM v_orders;  (orders with readable date and type)\n"
+                                    "-- SELECT * FROM order_lines;\n"
+                                    "-- SELECT * FROM archive.orders;  (archived orders)\n\n");
+
+    // Queries run against the read replica unless the live database is requested
+    connect(&DatabaseManager::instance(), &DatabaseManager::replicaRefreshed, this, &SQLQueryWindow::updateFreshness);
+    connect(ui->liveDatabaseCheckBox, &QCheckBox::toggled, this, &SQLQueryWindow::updateFreshness);
+    updateFreshness();
 }
 
 SQLQueryWindow::~SQLQueryWindow()
@@ -39,6 +48,8 @@ SQLQueryWindow::~SQLQueryWindow()
 
 void SQLQueryWindow::on_executeButton_clicked()
 {
+    WMS_TRACE_SCOPE("SQLQueryWindow::on_executeButton_clicked");
+
     QString queryStr = ui->queryTextEdit->toPlainText().trimmed();
 
     if (queryStr.isEmpty() || queryStr.startsWith("--")) {
@@ -58,7 +69,9 @@ void SQLQueryWindow::on_executeButton_clicked()
     model->clear();
 
     // Execute query
-    QSqlQuery query;
+    DatabaseManager& dbManager = DatabaseManager::instance();
+    bool useReplica = !ui->liveDatabaseCheckBox->isChecked() && dbManager.hasReplica();
+    QSqlQuery query(useReplica ? dbManager.replicaDatabase() : QSqlDatabase::database());
     QElapsedTimer timer;
     timer.start();
 
@@ -80,6 +93,18 @@ void SQLQueryWindow::on_executeButton_clicked()
     }
 }
 
+void SQLQueryWindow::updateFreshness()
+{
+    DatabaseManager& dbManager = DatabaseManager::instance();
+    if (ui->liveDatabaseCheckBox->isChecked()) {
+        ui->freshnessLabel->setText(tr("Live database"));
+    } else if (dbManager.hasReplica()) {
+        ui->freshnessLabel->setText(tr("Replica as of %1").arg(dbManager.replicaRefreshedAt().toString("yyyy-MM-dd HH:mm:ss")));
+    } else {
+        ui->freshnessLabel->setText(tr("Live database (no replica yet)"));
+    }
+}
+
 void SQLQueryWindow::on_clearButton_clicked()
 {
     ui->queryTextEdit->clear();
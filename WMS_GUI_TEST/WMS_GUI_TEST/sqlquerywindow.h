@@ -18,6 +18,7 @@ public:
 private slots:
     void on_executeButton_clicked();
     void on_clearButton_clicked();
+    void updateFreshness();
 
 private:
     Ui::SQLQueryWindow *ui;
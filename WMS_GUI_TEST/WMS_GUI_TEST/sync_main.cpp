@@ -0,0 +1,149 @@
+#include "changesets.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QTextStream>
+#include <sqlite3.h>
+
+static sqlite3* openDatabase(const QString& filePath, bool readOnly, QTextStream& err)
+{
+    if (!QFileInfo::exists(filePath)) {
+        err << filePath << " does not exist\n";
+        return nullptr;
+    }
+    sqlite3* db = nullptr;
+    int flags = readOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+    if (sqlite3_open_v2(filePath.toUtf8().constData(), &db, flags, nullptr) != SQLITE_OK) {
+        err << "Could not open " << filePath << ": " << sqlite3_errmsg(db) << "\n";
+        sqlite3_close_v2(db);
+        return nullptr;
+    }
+    sqlite3_busy_timeout(db, 5000);
+    sqlite3_exec(db, "PRAGMA foreign_keys = ON", nullptr, nullptr, nullptr);
+    return db;
+}
+
+// Writes the changeset that turns target into source
+static int diffCommand(const QString& sourcePath, const QString& targetPath, const QString& outPath,
+                       const QString& nodeId, QTextStream& out, QTextStream& err)
+{
+    sqlite3* db = openDatabase(sourcePath, true, err);
+    if (!db) {
+        return 1;
+    }
+
+    int result = 1;
+    sqlite3_stmt* attach = nullptr;
+    sqlite3_prepare_v2(db, "ATTACH DATABASE ? AS target", -1, &attach, nullptr);
+    QByteArray target = targetPath.toUtf8();
+    sqlite3_bind_text(attach, 1, target.constData(), int(target.size()), SQLITE_TRANSIENT);
+    if (sqlite3_step(attach) != SQLITE_DONE) {
+        err << "Could not attach " << targetPath << ": " << sqlite3_errmsg(db) << "\n";
+    } else {
+        ChangesetFile file;
+        file.nodeId = nodeId;
+        file.sequence = 0;  // standalone, not part of the node's series
+        file.createdAt = QDateTime::currentDateTimeUtc();
+        QString error;
+        if (!ChangesetRecorder::diff(db, "target", file.changeset, &error) || !file.write(outPath, &error)) {
+            err << error << "\n";
+        } else {
+            out << ChangesetFile::describe(file.changeset) << "\n"
+                << file.changeset.size() << " bytes, " << QFileInfo(outPath).size() << " bytes compressed in "
+                << outPath << "\n";
+            result = 0;
+        }
+    }
+    sqlite3_finalize(attach);
+    sqlite3_close_v2(db);
+    return result;
+}
+
+static int applyCommand(const QString& dbPath, const QStringList& files, QTextStream& out, QTextStream& err)
+{
+    sqlite3* db = openDatabase(dbPath, false, err);
+    if (!db) {
+        return 1;
+    }
+
+    int result = 0;
+    for (const QString& path : files) {
+        ChangesetFile file;
+        ChangesetApplyReport report;
+        QString error;
+        if (!file.read(path, &error) || !applyChangeset(db, file, report, &error)) {
+            err << path << ": " << error << "\n";
+            for (const QString& message : report.messages) {
+                err << "  " << message << "\n";
+            }
+            result = 1;
+            break;
+        }
+        if (report.alreadyApplied) {
+            out << path << ": already applied\n";
+            continue;
+        }
+        out << path << ": " << report.replaced << " replaced, " << report.merged << " merged, " << report.omitted
+            << " skipped\n";
+        for (const QString& message : report.messages) {
+            out << "  " << message << "\n";
+        }
+    }
+    sqlite3_close_v2(db);
+    return result;
+}
+
+static int showCommand(const QStringList& files, QTextStream& out, QTextStream& err)
+{
+    for (const QString& path : files) {
+        ChangesetFile file;
+        QString error;
+        if (!file.read(path, &error)) {
+            err << error << "\n";
+            return 1;
+        }
+        out << path << ": node " << file.nodeId << ", sequence " << file.sequence << ", created "
+            << file.createdAt.toString(Qt::ISODate) << ", " << file.changeset.size() << " bytes\n"
+            << ChangesetFile::describe(file.changeset) << "\n";
+    }
+    return 0;
+}
+
+// wms_sync: works with the changeset files exchanged between WMS nodes
+// (sync/* settings). Two local database files can be synchronized by
+// diffing one against the other and applying the result.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("wms_sync");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Create, inspect and apply WMS changeset files.\n\n"
+        "  diff <source.db> <target.db> --out <file>   changes that turn target into source\n"
+        "  apply <db> <file>...                        apply changesets in the given order\n"
+        "  show <file>...                              print the contents of changesets");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "diff, apply or show.");
+    QCommandLineOption outOption({"o", "out"}, "Changeset file to write (diff).", "file");
+    QCommandLineOption nodeOption("node", "Node id recorded in the changeset (diff).", "id", "wms_sync");
+    parser.addOptions({outOption, nodeOption});
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QStringList args = parser.positionalArguments();
+    QString command = args.value(0);
+    if (command == "diff" && args.size() == 3 && parser.isSet(outOption)) {
+        return diffCommand(args[1], args[2], parser.value(outOption), parser.value(nodeOption), out, err);
+    }
+    if (command == "apply" && args.size() >= 3) {
+        return applyCommand(args[1], args.mid(2), out, err);
+    }
+    if (command == "show" && args.size() >= 2) {
+        return showCommand(args.mid(1), out, err);
+    }
+    parser.showHelp(1);
+}
@@ -0,0 +1,206 @@
+#include "cdclog.h"
+#include "changecapture.h"
+#include "crc32.h"
+#include "schema.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QSettings>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QtEndian>
+
+// The change log format, recovery from a record torn by a crash, and what
+// ChangeCapture writes for users
+class CdcLogTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void roundTrip();
+    void cutsOffTornRecord();
+    void withholdsPasswords();
+
+private:
+    static CdcRecord itemInsert(quint64 lsn, const QString& code);
+};
+
+void CdcLogTest::initTestCase()
+{
+    // ChangeCapture reads its settings; keep them away from a real installation
+    QStandardPaths::setTestModeEnabled(true);
+    QCoreApplication::setOrganizationName("WMS Tests");
+    QSettings settings;
+    settings.clear();
+}
+
+CdcRecord CdcLogTest::itemInsert(quint64 lsn, const QString& code)
+{
+    CdcRecord record;
+    record.lsn = lsn;
+    record.changedAt = QDateTime::fromMSecsSinceEpoch(1700000000000 + qint64(lsn));
+    record.table = "items";
+    record.operation = CdcOperation::Insert;
+    record.after = {qint64(lsn), code, QString("description %1").arg(code), qint64(10), qint64(250)};
+    return record;
+}
+
+void CdcLogTest::roundTrip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    CdcRecord update;
+    update.lsn = 3;
+    update.changedAt = QDateTime::fromMSecsSinceEpoch(1700000000003);
+    update.table = "orders";
+    update.operation = CdcOperation::Update;
+    update.before = {qint64(7), QString("O-7"), qint64(2460000), qint64(0), qint64(0)};
+    update.after = {qint64(7), QString("O-7"), qint64(2460000), qint64(0), qint64(1)};
+
+    CdcLogWriter writer;
+    QString error;
+    QVERIFY2(writer.open(dir.path(), CdcLogWriter::kDefaultSegmentBytes, &error), qPrintable(error));
+    QVERIFY(writer.append(itemInsert(1, "A")));
+    QVERIFY(writer.append(update));
+    // At or below lastLsn(): skipped
+    QVERIFY(writer.append(itemInsert(2, "B")));
+    QVERIFY2(writer.flush(true, &error), qPrintable(error));
+    QCOMPARE(writer.lastLsn(), quint64(3));
+
+    CdcLogReader reader;
+    QVERIFY2(reader.open(dir.path(), 0, &error), qPrintable(error));
+    CdcRecord record;
+    QVERIFY(reader.next(record));
+    QCOMPARE(record.lsn, quint64(1));
+    QCOMPARE(record.table, QString("items"));
+    QVERIFY(record.operation == CdcOperation::Insert);
+    QCOMPARE(record.after, itemInsert(1, "A").after);
+    QVERIFY(reader.next(record));
+    QCOMPARE(record.lsn, quint64(3));
+    QCOMPARE(record.changedAt, update.changedAt);
+    QVERIFY(record.operation == CdcOperation::Update);
+    QCOMPARE(record.before, update.before);
+    QCOMPARE(record.after, update.after);
+    QVERIFY(!reader.next(record));
+    QVERIFY(!reader.hasError());
+    QCOMPARE(reader.nextLsn(), quint64(4));
+}
+
+void CdcLogTest::cutsOffTornRecord()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString error;
+
+    QString segmentPath;
+    qint64 goodSize = 0;
+    {
+        CdcLogWriter writer;
+        QVERIFY2(writer.open(dir.path(), CdcLogWriter::kDefaultSegmentBytes, &error), qPrintable(error));
+        QVERIFY(writer.append(itemInsert(1, "A")));
+        QVERIFY(writer.append(itemInsert(2, "B")));
+        QVERIFY(writer.flush(true));
+    }
+    std::vector<CdcSegment> segments = cdcSegments(dir.path());
+    QCOMPARE(int(segments.size()), 1);
+    segmentPath = segments.front().filePath;
+
+    // A crash in the middle of writing record 3: the header is complete,
+    // half of the body made it to disk
+    QByteArray body = itemInsert(3, "C").encode();
+    quint32 header[2] = {qToLittleEndian(quint32(body.size())), qToLittleEndian(crc32(body.constData(), body.size()))};
+    QFile file(segmentPath);
+    QVERIFY(file.open(QIODevice::Append));
+    goodSize = file.size();
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(body.left(body.size() / 2));
+    file.close();
+
+    // Readers stop before the torn record without calling it damaged
+    CdcLogReader reader;
+    QVERIFY2(reader.open(dir.path(), 0, &error), qPrintable(error));
+    CdcRecord record;
+    QVERIFY(reader.next(record));
+    QCOMPARE(record.lsn, quint64(1));
+    QVERIFY(reader.next(record));
+    QCOMPARE(record.lsn, quint64(2));
+    QVERIFY(!reader.next(record));
+    QVERIFY2(!reader.hasError(), qPrintable(reader.lastError()));
+
+    // Opening the writer again cuts it off and carries on after LSN 2
+    CdcLogWriter writer;
+    QVERIFY2(writer.open(dir.path(), CdcLogWriter::kDefaultSegmentBytes, &error), qPrintable(error));
+    QCOMPARE(writer.lastLsn(), quint64(2));
+    QCOMPARE(QFile(segmentPath).size(), goodSize);
+    QVERIFY(writer.append(itemInsert(3, "C")));
+    QVERIFY(writer.flush(true));
+
+    // and the same reader picks the rewritten record up
+    QVERIFY(reader.next(record));
+    QCOMPARE(record.lsn, quint64(3));
+    QCOMPARE(record.after, itemInsert(3, "C").after);
+    QVERIFY(!reader.next(record));
+    QVERIFY(!reader.hasError());
+}
+
+void CdcLogTest::withholdsPasswords()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "cdc_test");
+        db.setDatabaseName(dir.filePath("capture.db"));
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        const std::string_view tables[] = {createTableSql<UsersTable>(), createTableSql<ItemsTable>(),
+                                           createTableSql<OrdersTable>(), createTableSql<OrderLinesTable>()};
+        for (std::string_view sql : tables) {
+            QVERIFY(query.exec(QString::fromUtf8(sql.data(), int(sql.size()))));
+        }
+
+        ChangeCapture capture(db);
+        QString error;
+        QVERIFY2(capture.start(dir.filePath("cdc"), &error), qPrintable(error));
+        QVERIFY(query.exec("INSERT INTO users (login, password) VALUES ('clerk', 'hash1')"));
+        // Only the password: not a change
+        QVERIFY(query.exec("UPDATE users SET password = 'hash2' WHERE login = 'clerk'"));
+        QVERIFY(query.exec("UPDATE users SET login = 'clerk2', password = 'hash3' WHERE login = 'clerk'"));
+        QVERIFY2(capture.drain(&error) >= 0, qPrintable(error));
+        capture.stop();
+
+        QSqlQuery outbox(db);
+        QVERIFY(outbox.exec("SELECT COUNT(*) FROM cdc_outbox"));
+        QVERIFY(outbox.next());
+        QCOMPARE(outbox.value(0).toInt(), 0);
+    }
+    QSqlDatabase::removeDatabase("cdc_test");
+
+    CdcLogReader reader;
+    QString error;
+    QVERIFY2(reader.open(dir.filePath("cdc"), 0, &error), qPrintable(error));
+    std::vector<CdcRecord> records;
+    CdcRecord record;
+    while (reader.next(record)) {
+        records.push_back(record);
+    }
+    QVERIFY(!reader.hasError());
+    QCOMPARE(int(records.size()), 2);
+
+    QVERIFY(records[0].operation == CdcOperation::Insert);
+    QCOMPARE(records[0].table, QString("users"));
+    QCOMPARE(records[0].after.value(UsersTable::Login).toString(), QString("clerk"));
+    QVERIFY(records[0].after.value(UsersTable::Password).isNull());
+
+    QVERIFY(records[1].operation == CdcOperation::Update);
+    QCOMPARE(records[1].after.value(UsersTable::Login).toString(), QString("clerk2"));
+    QVERIFY(records[1].before.value(UsersTable::Password).isNull());
+    QVERIFY(records[1].after.value(UsersTable::Password).isNull());
+}
+
+QTEST_GUILESS_MAIN(CdcLogTest)
+#include "tst_cdclog.moc"
@@ -0,0 +1,273 @@
+#include "changesets.h"
+#include "crc32.h"
+#include "databasemanager.h"
+#include "schema.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QSqlQuery>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTest>
+#include <sqlite3.h>
+#include <string>
+
+// Changesets from another node applied through DatabaseManager: sequence
+// checks, posted orders and aborting on order line conflicts and on ids
+// taken by other rows. The other node is a plain SQLite file in a
+// temporary directory.
+class ChangesetsTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void checksum();
+    void rejectsDamagedFile();
+    void appliesOnce();
+    void refusesGap();
+    void appliesLinesOfPostedOrder();
+    void abortsOnOrderLineConflict();
+    void abortsOnIdTakenByAnotherOrder();
+
+private:
+    // Runs sql on the sending node and writes the changes it made to a
+    // changeset file with the given sequence
+    QString send(const char* sql, quint64 sequence);
+    static int valueOf(const QString& sql);
+
+    QTemporaryDir m_dir;
+    sqlite3* m_sender = nullptr;
+    ChangesetRecorder m_recorder;
+};
+
+void ChangesetsTest::initTestCase()
+{
+    // A fresh database and settings of their own, away from a real installation
+    QStandardPaths::setTestModeEnabled(true);
+    QCoreApplication::setOrganizationName("WMS Tests");
+    QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).removeRecursively();
+    QSettings settings;
+    settings.clear();
+    settings.setValue("replica/enabled", false);
+    settings.setValue("maintenance/enabled", false);
+
+    DatabaseManager::useLocalDatabase();
+    QVERIFY(DatabaseManager::instance().initializeDatabase());
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+    QVERIFY(m_dir.isValid());
+    QCOMPARE(sqlite3_open(QFile::encodeName(m_dir.filePath("sender.db")).constData(), &m_sender), SQLITE_OK);
+    // order_lines without NOT NULL, as if the sender ran an older schema, so
+    // it can send a line the receiver's constraints reject
+    const std::string tables[] = {
+        std::string(createTableSql<ItemsTable>()), std::string(createTableSql<OrdersTable>()),
+        "CREATE TABLE order_lines (id INTEGER PRIMARY KEY AUTOINCREMENT, order_id INTEGER, "
+        "order_number TEXT, item_id INTEGER, quantity INTEGER)"};
+    for (const std::string& sql : tables) {
+        QCOMPARE(sqlite3_exec(m_sender, sql.c_str(), nullptr, nullptr, nullptr), SQLITE_OK);
+    }
+    QString error;
+    QVERIFY2(m_recorder.start(m_sender, &error), qPrintable(error));
+#endif
+}
+
+void ChangesetsTest::cleanupTestCase()
+{
+    m_recorder.stop();
+    sqlite3_close(m_sender);
+}
+
+QString ChangesetsTest::send(const char* sql, quint64 sequence)
+{
+    if (sqlite3_exec(m_sender, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        qWarning() << "Sender:" << sqlite3_errmsg(m_sender);
+        return QString();
+    }
+    ChangesetFile file;
+    file.nodeId = "remote";
+    file.sequence = sequence;
+    file.createdAt = QDateTime::currentDateTimeUtc();
+    QString path = m_dir.filePath(QString("remote-%1-%2.wchg").arg(sequence).arg(QDateTime::currentMSecsSinceEpoch()));
+    if (!m_recorder.take(file.changeset) || file.changeset.isEmpty() || !file.write(path)) {
+        return QString();
+    }
+    return path;
+}
+
+int ChangesetsTest::valueOf(const QString& sql)
+{
+    QSqlQuery query;
+    return query.exec(sql) && query.next() ? query.value(0).toInt() : -1;
+}
+
+void ChangesetsTest::checksum()
+{
+    const char check[] = "123456789";
+    QCOMPARE(crc32(check, 9), 0xcbf43926u);
+    QCOMPARE(crc32(check, 0), 0u);
+    // In pieces, passing the previous result on
+    QCOMPARE(crc32(check + 4, 5, crc32(check, 4)), 0xcbf43926u);
+}
+
+void ChangesetsTest::rejectsDamagedFile()
+{
+    ChangesetFile file;
+    file.nodeId = "remote";
+    file.sequence = 7;
+    file.createdAt = QDateTime::fromMSecsSinceEpoch(1700000000000);
+    file.changeset = QByteArray(200, 'x');
+    QString path = m_dir.filePath("damaged.wchg");
+    QVERIFY(file.write(path));
+
+    ChangesetFile read;
+    QVERIFY(read.read(path));
+    QCOMPARE(read.nodeId, QString("remote"));
+    QCOMPARE(read.sequence, quint64(7));
+    QCOMPARE(read.createdAt, file.createdAt);
+    QVERIFY(read.changeset == file.changeset);
+
+    // Flip a bit in the last payload byte
+    QFile raw(path);
+    QVERIFY(raw.open(QIODevice::ReadWrite));
+    QByteArray data = raw.readAll();
+    data[data.size() - 1] = char(data[data.size() - 1] ^ 0x01);
+    QVERIFY(raw.seek(0));
+    QCOMPARE(raw.write(data), qint64(data.size()));
+    raw.close();
+
+    QString error;
+    QVERIFY(!read.read(path, &error));
+    QVERIFY2(error.contains("checksum"), qPrintable(error));
+}
+
+void ChangesetsTest::appliesOnce()
+{
+    if (!m_sender) {
+        QSKIP("SQLite was built without the session extension");
+    }
+    DatabaseManager& db = DatabaseManager::instance();
+    QString error;
+
+    QString first = send("INSERT INTO items (id, item_code, item_description, quantity, price) "
+                         "VALUES (1000, 'REMOTE1', 'remote item', 5, 100)", 1);
+    QVERIFY(!first.isEmpty());
+    ChangesetApplyReport report;
+    QVERIFY2(db.applyChangesetFile(first, &report, &error), qPrintable(error));
+    QVERIFY(!report.alreadyApplied);
+    QCOMPARE(valueOf("SELECT quantity FROM items WHERE id = 1000"), 5);
+
+    // A quantity change is merged as a delta, so applying it twice would
+    // count it twice
+    QString second = send("UPDATE items SET quantity = quantity + 3 WHERE id = 1000", 2);
+    QVERIFY(!second.isEmpty());
+    QVERIFY2(db.applyChangesetFile(second, &report, &error), qPrintable(error));
+    QCOMPARE(valueOf("SELECT quantity FROM items WHERE id = 1000"), 8);
+
+    ChangesetApplyReport again;
+    QVERIFY2(db.applyChangesetFile(second, &again, &error), qPrintable(error));
+    QVERIFY(again.alreadyApplied);
+    QCOMPARE(valueOf("SELECT quantity FROM items WHERE id = 1000"), 8);
+    QCOMPARE(valueOf("SELECT sequence FROM changeset_applied WHERE node_id = 'remote'"), 2);
+}
+
+void ChangesetsTest::refusesGap()
+{
+    if (!m_sender) {
+        QSKIP("SQLite was built without the session extension");
+    }
+    QString path = send("UPDATE items SET item_description = 'skipped' WHERE id = 1000", 4);
+    QVERIFY(!path.isEmpty());
+
+    QString error;
+    QVERIFY(!DatabaseManager::instance().applyChangesetFile(path, nullptr, &error));
+    QVERIFY2(error.contains("missing"), qPrintable(error));
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM items WHERE id = 1000 AND item_description = 'skipped'"), 0);
+    QCOMPARE(valueOf("SELECT sequence FROM changeset_applied WHERE node_id = 'remote'"), 2);
+}
+
+void ChangesetsTest::appliesLinesOfPostedOrder()
+{
+    if (!m_sender) {
+        QSKIP("SQLite was built without the session extension");
+    }
+    DatabaseManager& db = DatabaseManager::instance();
+
+    // The order arrives already posted, together with its lines
+    QString path = send("INSERT INTO orders (id, order_number, date, type, status) VALUES (2000, 'R1', 2460000, 0, 1);"
+                        "INSERT INTO order_lines (id, order_id, order_number, item_id, quantity) VALUES "
+                        "(3000, 2000, 'R1', 1000, 2), (3001, 2000, 'R1', 1000, 4)", 3);
+    QVERIFY(!path.isEmpty());
+    QString error;
+    QVERIFY2(db.applyChangesetFile(path, nullptr, &error), qPrintable(error));
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM order_lines WHERE order_id = 2000"), 2);
+    QCOMPARE(valueOf("SELECT status FROM orders WHERE id = 2000"), 1);
+    QCOMPARE(valueOf("SELECT sequence FROM changeset_applied WHERE node_id = 'remote'"), 3);
+
+    // Local edits of the posted order are refused again afterwards
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM changeset_applying"), 0);
+    QVERIFY(!db.addOrderLine(2000, "R1", 1000, 1));
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM order_lines WHERE order_id = 2000"), 2);
+}
+
+void ChangesetsTest::abortsOnOrderLineConflict()
+{
+    if (!m_sender) {
+        QSKIP("SQLite was built without the session extension");
+    }
+    DatabaseManager& db = DatabaseManager::instance();
+
+    // The receiver requires a quantity; skipping just the line would leave
+    // the order different on the two nodes
+    QString path = send("INSERT INTO orders (id, order_number, date, type, status) VALUES (2001, 'R2', 2460001, 0, 0);"
+                        "INSERT INTO order_lines (id, order_id, order_number, item_id, quantity) VALUES "
+                        "(3002, 2001, 'R2', 1000, 1), (3003, 2001, 'R2', 1000, NULL)", 4);
+    QVERIFY(!path.isEmpty());
+    QString error;
+    QVERIFY(!db.applyChangesetFile(path, nullptr, &error));
+    QVERIFY2(error.contains("order_lines"), qPrintable(error));
+
+    // Nothing of it stays and its sequence is still the next one expected
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM orders WHERE id = 2001"), 0);
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM order_lines WHERE order_id = 2001"), 0);
+    QCOMPARE(valueOf("SELECT sequence FROM changeset_applied WHERE node_id = 'remote'"), 3);
+
+    QString next = send("UPDATE items SET item_description = 'renamed' WHERE id = 1000", 4);
+    QVERIFY(!next.isEmpty());
+    QVERIFY2(db.applyChangesetFile(next, nullptr, &error), qPrintable(error));
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM items WHERE id = 1000 AND item_description = 'renamed'"), 1);
+    QCOMPARE(valueOf("SELECT sequence FROM changeset_applied WHERE node_id = 'remote'"), 4);
+}
+
+void ChangesetsTest::abortsOnIdTakenByAnotherOrder()
+{
+    if (!m_sender) {
+        QSKIP("SQLite was built without the session extension");
+    }
+    DatabaseManager& db = DatabaseManager::instance();
+
+    // Both nodes create an order before exchanging and happen to pick the
+    // same id; skipping the incoming one would lose it
+    QSqlQuery local;
+    QVERIFY(local.exec("INSERT INTO orders (id, order_number, date, type, status) VALUES (2100, 'L1', 2460002, 0, 0)"));
+    QString path = send("INSERT INTO orders (id, order_number, date, type, status) VALUES (2100, 'R3', 2460002, 1, 0);"
+                        "INSERT INTO order_lines (id, order_id, order_number, item_id, quantity) VALUES "
+                        "(3100, 2100, 'R3', 1000, 1)", 5);
+    QVERIFY(!path.isEmpty());
+    QString error;
+    QVERIFY(!db.applyChangesetFile(path, nullptr, &error));
+    QVERIFY2(error.contains("orders 2100"), qPrintable(error));
+
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM orders WHERE id = 2100 AND order_number = 'L1'"), 1);
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM orders WHERE order_number = 'R3'"), 0);
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM order_lines WHERE order_id = 2100"), 0);
+    QCOMPARE(valueOf("SELECT COUNT(*) FROM changeset_applying"), 0);
+    QCOMPARE(valueOf("SELECT sequence FROM changeset_applied WHERE node_id = 'remote'"), 4);
+}
+
+QTEST_GUILESS_MAIN(ChangesetsTest)
+#include "tst_changesets.moc"
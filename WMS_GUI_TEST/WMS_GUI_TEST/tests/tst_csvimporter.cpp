@@ -0,0 +1,189 @@
+#include "csvimporter.h"
+#include "repositories.h"
+#include "schema.h"
+
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QTest>
+
+// Item files through CsvImporter: field splitting and quoting, number and
+// price parsing, line numbers across parser threads
+class CsvImporterTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void importsItems();
+    void rejectsBadLines_data();
+    void rejectsBadLines();
+    void rejectsDuplicateCodes();
+    void numbersLinesAcrossChunks();
+
+private:
+    QString writeFile(const QByteArray& contents);
+
+    QTemporaryDir m_dir;
+    QSqlDatabase m_db;
+    int m_files = 0;
+};
+
+void CsvImporterTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_db = QSqlDatabase::addDatabase("QSQLITE");
+    m_db.setDatabaseName(m_dir.filePath("wms.db"));
+    QVERIFY2(m_db.open(), qPrintable(m_db.lastError().text()));
+
+    QSqlQuery query(m_db);
+    for (std::string_view sql : {createTableSql<ItemsTable>(), createTableSql<OrdersTable>(),
+                                 createTableSql<OrderLinesTable>()}) {
+        QVERIFY2(query.exec(sqlString(sql)), qPrintable(query.lastError().text()));
+    }
+}
+
+void CsvImporterTest::cleanupTestCase()
+{
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void CsvImporterTest::init()
+{
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("DELETE FROM items"));
+}
+
+QString CsvImporterTest::writeFile(const QByteArray& contents)
+{
+    QString path = m_dir.filePath(QString("import%1.csv").arg(m_files++));
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size()) {
+        return QString();
+    }
+    return path;
+}
+
+void CsvImporterTest::importsItems()
+{
+    QString path = writeFile("code,description,quantity,price\n"
+                             "A1, Widget ,5,1.5\n"
+                             "\"B,2\",\"Say \"\"hi\"\"\",0,+2\r\n");
+    QVERIFY(!path.isEmpty());
+
+    CsvImportReport report = CsvImporter(m_db).importItems(path);
+    QVERIFY2(report.succeeded(), qPrintable(report.fatalError));
+    QCOMPARE(report.linesRead, qint64(3));
+    QCOMPARE(report.rowsImported, qint64(2));
+    QCOMPARE(report.errorCount, qint64(0));
+
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("SELECT item_code, item_description, quantity, price FROM items ORDER BY item_code"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("A1"));
+    QCOMPARE(query.value(1).toString(), QString("Widget"));
+    QCOMPARE(query.value(2).toInt(), 5);
+    QCOMPARE(query.value(3).toLongLong(), qint64(150));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("B,2"));
+    QCOMPARE(query.value(1).toString(), QString("Say \"hi\""));
+    QCOMPARE(query.value(2).toInt(), 0);
+    QCOMPARE(query.value(3).toLongLong(), qint64(200));
+    QVERIFY(!query.next());
+}
+
+void CsvImporterTest::rejectsBadLines_data()
+{
+    QTest::addColumn<QByteArray>("line");
+    QTest::addColumn<QString>("error");
+
+    QTest::newRow("too few fields") << QByteArray("A1,x,5") << QString("Expected 4 fields");
+    QTest::newRow("empty code") << QByteArray(" ,x,5,1") << QString("Item code is empty");
+    QTest::newRow("negative quantity") << QByteArray("A1,x,-1,1") << QString("Invalid quantity");
+    QTest::newRow("plus minus quantity") << QByteArray("A1,x,+-5,1") << QString("Invalid quantity");
+    QTest::newRow("quantity beyond int") << QByteArray("A1,x,2147483648,1") << QString("Invalid quantity");
+    QTest::newRow("fraction of a cent") << QByteArray("A1,x,1,1.005") << QString("Invalid price");
+    QTest::newRow("negative price") << QByteArray("A1,x,1,-1") << QString("Invalid price");
+    QTest::newRow("price overflow") << QByteArray("A1,x,1,92233720368547759") << QString("Invalid price");
+    QTest::newRow("unterminated quote") << QByteArray("\"A1,x,1,1") << QString("Unterminated quoted field");
+    QTest::newRow("text after quote") << QByteArray("\"A1\"x,x,1,1") << QString("Malformed record");
+}
+
+void CsvImporterTest::rejectsBadLines()
+{
+    QFETCH(QByteArray, line);
+    QFETCH(QString, error);
+
+    // A bad line only costs itself
+    QString path = writeFile(line + "\nOK1,fine,1,1\n");
+    QVERIFY(!path.isEmpty());
+
+    CsvImportReport report = CsvImporter(m_db).importItems(path);
+    QVERIFY2(report.succeeded(), qPrintable(report.fatalError));
+    QCOMPARE(report.rowsImported, qint64(1));
+    QCOMPARE(report.errorCount, qint64(1));
+    QCOMPARE(int(report.errors.size()), 1);
+    QCOMPARE(report.errors.front().line, qint64(1));
+    QVERIFY2(report.errors.front().message.contains(error), qPrintable(report.errors.front().message));
+}
+
+void CsvImporterTest::rejectsDuplicateCodes()
+{
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("INSERT INTO items (item_code, item_description, quantity, price) VALUES ('A1', 'old', 1, 100)"));
+
+    QString path = writeFile("A1,again,1,1\nB1,first,1,1\nB1,second,1,1\n");
+    QVERIFY(!path.isEmpty());
+
+    CsvImportReport report = CsvImporter(m_db).importItems(path);
+    QVERIFY2(report.succeeded(), qPrintable(report.fatalError));
+    QCOMPARE(report.rowsImported, qint64(1));
+    QCOMPARE(report.errorCount, qint64(2));
+    QCOMPARE(report.errors[0].line, qint64(1));
+    QVERIFY(report.errors[0].message.contains("already exists"));
+    QCOMPARE(report.errors[1].line, qint64(3));
+    QVERIFY(report.errors[1].message.contains("Duplicate item code B1"));
+
+    QVERIFY(query.exec("SELECT item_description FROM items WHERE item_code = 'B1'"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("first"));
+}
+
+void CsvImporterTest::numbersLinesAcrossChunks()
+{
+    // Big enough for two parser chunks (one per MiB) and several batches
+    const int rows = 60000;
+    const int badRow = 50000;
+    QByteArray contents = "code,description,quantity,price\n";
+    for (int i = 1; i <= rows; ++i) {
+        contents += i == badRow ? QByteArray("BAD,broken,many,1\n")
+                                : QString("C%1,description of item %1,%1,1.25\n").arg(i).toUtf8();
+    }
+    QVERIFY(contents.size() > 1024 * 1024);
+    QString path = writeFile(contents);
+    QVERIFY(!path.isEmpty());
+
+    CsvImporter importer(m_db);
+    importer.setThreadCount(4);
+    CsvImportReport report = importer.importItems(path);
+    QVERIFY2(report.succeeded(), qPrintable(report.fatalError));
+    QCOMPARE(report.linesRead, qint64(rows + 1));
+    QCOMPARE(report.rowsImported, qint64(rows - 1));
+    QCOMPARE(report.errorCount, qint64(1));
+    QCOMPARE(report.errors.front().line, qint64(badRow + 1));
+
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("SELECT COUNT(*), SUM(price) FROM items"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), rows - 1);
+    QCOMPARE(query.value(1).toLongLong(), qint64(rows - 1) * 125);
+}
+
+QTEST_GUILESS_MAIN(CsvImporterTest)
+#include "tst_csvimporter.moc"
@@ -0,0 +1,245 @@
+#include "orderarchive.h"
+#include "repositories.h"
+#include "schema.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QTest>
+
+// Writing and reading the columnar order archive
+class OrderArchiveTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void roundTrip();
+    void readsSelectedColumns();
+    void skipsGroupsByZoneMap();
+    void exportsFromDatabase();
+    void rejectsDamagedFiles();
+
+private:
+    struct Row
+    {
+        qint64 values[ArchiveColumnCount];
+        QByteArray orderNumber;
+    };
+
+    // Two row groups, in date order like exported lines
+    static constexpr int kRows = OrderArchiveWriter::kRowsPerGroup + 1000;
+    static Row row(int i);
+
+    QTemporaryDir m_dir;
+    QString m_path;
+};
+
+OrderArchiveTest::Row OrderArchiveTest::row(int i)
+{
+    Row r;
+    r.values[ArchiveLineId] = i + 1;
+    r.values[ArchiveOrderId] = i / 3 + 1;
+    r.values[ArchiveOrderNumber] = 0;
+    r.values[ArchiveDate] = 2460000 + i / 1000;
+    r.values[ArchiveType] = i % 2;
+    r.values[ArchiveStatus] = 1;
+    r.values[ArchiveItemId] = (i * 7) % 50 + 1;
+    r.values[ArchiveQuantity] = i % 5 - 2;
+    r.orderNumber = "ORD" + QByteArray::number(i / 3 + 1);
+    return r;
+}
+
+void OrderArchiveTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_path = m_dir.filePath("orders.warc");
+
+    OrderArchiveWriter writer;
+    QString error;
+    QVERIFY2(writer.open(m_path, &error), qPrintable(error));
+    for (int i = 0; i < kRows; ++i) {
+        Row r = row(i);
+        writer.append(r.values[ArchiveLineId], r.values[ArchiveOrderId], r.orderNumber, r.values[ArchiveDate],
+                      int(r.values[ArchiveType]), int(r.values[ArchiveStatus]), r.values[ArchiveItemId],
+                      r.values[ArchiveQuantity]);
+    }
+    QVERIFY2(writer.finish(&error), qPrintable(error));
+    QCOMPARE(writer.rowCount(), qint64(kRows));
+}
+
+void OrderArchiveTest::roundTrip()
+{
+    OrderArchiveReader reader;
+    QString error;
+    QVERIFY2(reader.open(m_path, &error), qPrintable(error));
+    QCOMPARE(reader.rowCount(), qint64(kRows));
+    QCOMPARE(reader.groupCount(), 2);
+
+    ArchiveScan scan;
+    int next = 0;
+    bool same = true;
+    QVERIFY2(reader.scan(scan, [&](const ArchiveBatch& batch) {
+        for (qint64 i = 0; i < batch.rowCount && same; ++i, ++next) {
+            Row expected = row(next);
+            for (int c = 0; c < ArchiveColumnCount; ++c) {
+                if (c != ArchiveOrderNumber && batch.column(ArchiveColumn(c))[size_t(i)] != expected.values[c]) {
+                    same = false;
+                }
+            }
+            if (batch.orderNumbers[size_t(i)] != expected.orderNumber) {
+                same = false;
+            }
+        }
+    }, &error), qPrintable(error));
+    QVERIFY2(same, qPrintable(QString("Row %1 differs").arg(next)));
+    QCOMPARE(next, kRows);
+    QCOMPARE(scan.groupsRead, 2);
+    QCOMPARE(scan.groupsSkipped, 0);
+}
+
+void OrderArchiveTest::readsSelectedColumns()
+{
+    OrderArchiveReader reader;
+    QVERIFY(reader.open(m_path));
+
+    ArchiveScan scan;
+    scan.columns = archiveColumnBit(ArchiveQuantity);
+    qint64 rows = 0;
+    qint64 sum = 0;
+    bool onlyQuantity = true;
+    QVERIFY(reader.scan(scan, [&](const ArchiveBatch& batch) {
+        rows += batch.rowCount;
+        for (qint64 quantity : batch.column(ArchiveQuantity)) {
+            sum += quantity;
+        }
+        onlyQuantity = onlyQuantity && batch.column(ArchiveLineId).empty() && batch.column(ArchiveDate).empty()
+                       && batch.orderNumbers.empty();
+    }));
+    QVERIFY(onlyQuantity);
+    QCOMPARE(rows, qint64(kRows));
+
+    qint64 expected = 0;
+    for (int i = 0; i < kRows; ++i) {
+        expected += row(i).values[ArchiveQuantity];
+    }
+    QCOMPARE(sum, expected);
+}
+
+void OrderArchiveTest::skipsGroupsByZoneMap()
+{
+    OrderArchiveReader reader;
+    QVERIFY(reader.open(m_path));
+
+    // Only the second group holds the last day
+    qint64 lastDay = row(kRows - 1).values[ArchiveDate];
+    ArchiveScan scan;
+    scan.columns = archiveColumnBit(ArchiveLineId);
+    scan.filterColumn = ArchiveDate;
+    scan.min = lastDay;
+    scan.max = lastDay;
+    qint64 rows = 0;
+    bool inRange = true;
+    QVERIFY(reader.scan(scan, [&](const ArchiveBatch& batch) {
+        rows += batch.rowCount;
+        for (qint64 lineId : batch.column(ArchiveLineId)) {
+            inRange = inRange && row(int(lineId - 1)).values[ArchiveDate] == lastDay;
+        }
+        // The filter column was not asked for
+        inRange = inRange && batch.column(ArchiveDate).empty();
+    }));
+    QVERIFY(inRange);
+    QCOMPARE(scan.groupsSkipped, 1);
+    QCOMPARE(scan.groupsRead, 1);
+
+    qint64 expected = 0;
+    for (int i = 0; i < kRows; ++i) {
+        expected += row(i).values[ArchiveDate] == lastDay ? 1 : 0;
+    }
+    QCOMPARE(rows, expected);
+}
+
+void OrderArchiveTest::exportsFromDatabase()
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "export");
+    db.setDatabaseName(m_dir.filePath("wms.db"));
+    QVERIFY2(db.open(), qPrintable(db.lastError().text()));
+    {
+        QSqlQuery query(db);
+        for (std::string_view sql : {createTableSql<OrdersTable>(), createTableSql<OrderLinesTable>()}) {
+            QVERIFY2(query.exec(sqlString(sql)), qPrintable(query.lastError().text()));
+        }
+        qint64 march = QDate(2024, 3, 1).toJulianDay();
+        QVERIFY(query.exec(QString("INSERT INTO orders (id, order_number, date, type, status) VALUES "
+                                   "(1, 'LATE', %1, 0, 1), (2, 'EARLY', %2, 1, 1), (3, 'NEW', %3, 0, 0)")
+                               .arg(march + 1).arg(march).arg(march + 40)));
+        QVERIFY(query.exec("INSERT INTO order_lines (id, order_id, order_number, item_id, quantity) VALUES "
+                           "(10, 1, 'LATE', 5, 2), (11, 2, 'EARLY', 6, 3), (12, 3, 'NEW', 7, 4), "
+                           "(13, 2, 'EARLY', 8, 1)"));
+
+        QString path = m_dir.filePath("export.warc");
+        qint64 rowCount = 0;
+        QString error;
+        QVERIFY2(OrderArchiveWriter::exportOrderLines(db, path, QDate(2024, 4, 1), &rowCount, &error),
+                 qPrintable(error));
+        QCOMPARE(rowCount, qint64(3));
+
+        OrderArchiveReader reader;
+        QVERIFY(reader.open(path));
+        ArchiveScan scan;
+        std::vector<qint64> lineIds;
+        std::vector<QByteArray> numbers;
+        QVERIFY(reader.scan(scan, [&](const ArchiveBatch& batch) {
+            lineIds.insert(lineIds.end(), batch.column(ArchiveLineId).begin(), batch.column(ArchiveLineId).end());
+            numbers.insert(numbers.end(), batch.orderNumbers.begin(), batch.orderNumbers.end());
+        }));
+        // Oldest order first
+        QVERIFY(lineIds == (std::vector<qint64>{11, 13, 10}));
+        QVERIFY(numbers == (std::vector<QByteArray>{"EARLY", "EARLY", "LATE"}));
+    }
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase("export");
+}
+
+void OrderArchiveTest::rejectsDamagedFiles()
+{
+    QFile original(m_path);
+    QVERIFY(original.open(QIODevice::ReadOnly));
+    QByteArray data = original.readAll();
+
+    auto write = [&](const QString& name, const QByteArray& contents) {
+        QString path = m_dir.filePath(name);
+        QFile file(path);
+        return file.open(QIODevice::WriteOnly) && file.write(contents) == contents.size() ? path : QString();
+    };
+
+    OrderArchiveReader reader;
+    QString path = write("truncated.warc", data.left(data.size() / 2));
+    QVERIFY(!path.isEmpty());
+    QVERIFY(!reader.open(path));
+
+    QByteArray badMagic = data;
+    badMagic[badMagic.size() - 1] = 'X';
+    path = write("magic.warc", badMagic);
+    QVERIFY(!path.isEmpty());
+    QVERIFY(!reader.open(path));
+
+    // A damaged page fails the scan instead of producing rows; the first
+    // page starts after the magic and qCompress's 4-byte length
+    QByteArray badPage = data;
+    for (int i = 16; i < 48; ++i) {
+        badPage[i] = char(badPage[i] ^ 0x5a);
+    }
+    path = write("page.warc", badPage);
+    QVERIFY(!path.isEmpty());
+    QVERIFY(reader.open(path));
+    ArchiveScan scan;
+    QString error;
+    QVERIFY(!reader.scan(scan, [](const ArchiveBatch&) {}, &error));
+    QVERIFY(!error.isEmpty());
+}
+
+QTEST_GUILESS_MAIN(OrderArchiveTest)
+#include "tst_orderarchive.moc"
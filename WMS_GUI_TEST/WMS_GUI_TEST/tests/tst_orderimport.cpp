@@ -0,0 +1,182 @@
+#include "csvimporter.h"
+#include "entities.h"
+#include "repositories.h"
+#include "schema.h"
+
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QTest>
+
+// Inbound order files: validated by OrderValidator up front and written
+// all-or-nothing in one transaction
+class OrderImportTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void importsOrders();
+    void rejectsWholeFile_data();
+    void rejectsWholeFile();
+    void rollsBackEarlierBatches();
+
+private:
+    QString writeFile(const QByteArray& contents);
+    int count(const QString& table);
+
+    QTemporaryDir m_dir;
+    QSqlDatabase m_db;
+    int m_files = 0;
+};
+
+void OrderImportTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_db = QSqlDatabase::addDatabase("QSQLITE");
+    m_db.setDatabaseName(m_dir.filePath("wms.db"));
+    QVERIFY2(m_db.open(), qPrintable(m_db.lastError().text()));
+
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("PRAGMA foreign_keys = ON"));
+    for (std::string_view sql : {createTableSql<ItemsTable>(), createTableSql<OrdersTable>(),
+                                 createTableSql<OrderLinesTable>()}) {
+        QVERIFY2(query.exec(sqlString(sql)), qPrintable(query.lastError().text()));
+    }
+    QVERIFY(query.exec("INSERT INTO items (item_code, item_description, quantity, price) VALUES ('I1', 'one', 10, 100)"));
+}
+
+void OrderImportTest::cleanupTestCase()
+{
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void OrderImportTest::init()
+{
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("DROP TRIGGER IF EXISTS temp.fail_line"));
+    QVERIFY(query.exec("DELETE FROM order_lines"));
+    QVERIFY(query.exec("DELETE FROM orders"));
+    // An order number that files may not reuse
+    QVERIFY(query.exec(QString("INSERT INTO orders (order_number, date, type) VALUES ('EXIST', %1, %2)")
+                           .arg(QDate(2024, 1, 1).toJulianDay())
+                           .arg(int(OrderTypeTo))));
+}
+
+QString OrderImportTest::writeFile(const QByteArray& contents)
+{
+    QString path = m_dir.filePath(QString("orders%1.csv").arg(m_files++));
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size()) {
+        return QString();
+    }
+    return path;
+}
+
+int OrderImportTest::count(const QString& table)
+{
+    QSqlQuery query(m_db);
+    return query.exec("SELECT COUNT(*) FROM " + table) && query.next() ? query.value(0).toInt() : -1;
+}
+
+void OrderImportTest::importsOrders()
+{
+    QString path = writeFile("order_number,date,type,item_code,quantity\n"
+                             "O1,2024-03-01,to,I1,5\n"
+                             "O2,2024-03-02,from,I1,1\n"
+                             "O1,2024-03-01,to,I1,2\n");
+    QVERIFY(!path.isEmpty());
+
+    CsvImportReport report = CsvImporter(m_db).importOrderLines(path);
+    QVERIFY2(report.succeeded(), qPrintable(report.fatalError));
+    QVERIFY(!report.rejectedWholeFile);
+    QCOMPARE(report.rowsImported, qint64(3));
+    QCOMPARE(report.errorCount, qint64(0));
+
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("SELECT date, type, status FROM orders WHERE order_number = 'O2'"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toLongLong(), QDate(2024, 3, 2).toJulianDay());
+    QCOMPARE(query.value(1).toInt(), int(OrderTypeFrom));
+    QCOMPARE(query.value(2).toInt(), int(OrderStatusOpen));
+
+    // Lines point at the order created for their number
+    QVERIFY(query.exec("SELECT COUNT(*), SUM(l.quantity) FROM order_lines l "
+                       "JOIN orders o ON o.id = l.order_id AND o.order_number = l.order_number "
+                       "WHERE o.order_number = 'O1'"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), 2);
+    QCOMPARE(query.value(1).toInt(), 7);
+}
+
+void OrderImportTest::rejectsWholeFile_data()
+{
+    QTest::addColumn<QByteArray>("badLine");
+    QTest::addColumn<QString>("error");
+
+    QTest::newRow("unknown item") << QByteArray("O2,2024-03-01,to,NOPE,1") << QString("Unknown item code");
+    QTest::newRow("zero quantity") << QByteArray("O2,2024-03-01,to,I1,0") << QString("Quantity must be positive");
+    QTest::newRow("existing order") << QByteArray("EXIST,2024-01-01,to,I1,1") << QString("already exists");
+    QTest::newRow("other date") << QByteArray("O1,2024-03-02,to,I1,1") << QString("Date or type differs");
+    QTest::newRow("other type") << QByteArray("O1,2024-03-01,from,I1,1") << QString("Date or type differs");
+    QTest::newRow("invalid date") << QByteArray("O2,2024-02-30,to,I1,1") << QString("Invalid date");
+    QTest::newRow("invalid type") << QByteArray("O2,2024-03-01,in,I1,1") << QString("Invalid order type");
+}
+
+void OrderImportTest::rejectsWholeFile()
+{
+    QFETCH(QByteArray, badLine);
+    QFETCH(QString, error);
+
+    QString path = writeFile("O1,2024-03-01,to,I1,5\n" + badLine + "\nO3,2024-03-03,to,I1,1\n");
+    QVERIFY(!path.isEmpty());
+
+    CsvImportReport report = CsvImporter(m_db).importOrderLines(path);
+    QVERIFY2(report.succeeded(), qPrintable(report.fatalError));
+    QVERIFY(report.rejectedWholeFile);
+    QCOMPARE(report.rowsImported, qint64(0));
+    QCOMPARE(report.errorCount, qint64(1));
+    QCOMPARE(report.errors.front().line, qint64(2));
+    QVERIFY2(report.errors.front().message.contains(error), qPrintable(report.errors.front().message));
+    QVERIFY(report.summary().startsWith("Rejected 1 of 3 lines"));
+
+    QCOMPARE(count("orders"), 1);
+    QCOMPARE(count("order_lines"), 0);
+}
+
+void OrderImportTest::rollsBackEarlierBatches()
+{
+    // The database refuses the very last line, in the second batch
+    QSqlQuery query(m_db);
+    QVERIFY(query.exec("CREATE TEMP TRIGGER fail_line BEFORE INSERT ON order_lines WHEN NEW.quantity = 13 "
+                       "BEGIN SELECT RAISE(ABORT, 'unlucky'); END"));
+
+    const int lines = CsvImporter::kBatchSize + 1;
+    QByteArray contents;
+    for (int i = 1; i <= lines; ++i) {
+        contents += QString("B%1,2024-03-01,to,I1,%2\n").arg(i / 100).arg(i == lines ? 13 : 1).toUtf8();
+    }
+    QString path = writeFile(contents);
+    QVERIFY(!path.isEmpty());
+
+    CsvImportReport report = CsvImporter(m_db).importOrderLines(path);
+    QVERIFY(report.rejectedWholeFile);
+    QCOMPARE(report.rowsImported, qint64(0));
+    QVERIFY(report.errorCount > 0);
+    QVERIFY2(report.errors.front().message.contains("unlucky"), qPrintable(report.errors.front().message));
+
+    // Nothing of the first batch is left either
+    QCOMPARE(count("orders"), 1);
+    QCOMPARE(count("order_lines"), 0);
+    QVERIFY(m_db.transaction());
+    QVERIFY(m_db.rollback());
+}
+
+QTEST_GUILESS_MAIN(OrderImportTest)
+#include "tst_orderimport.moc"
@@ -0,0 +1,131 @@
+#include "databasemanager.h"
+#include "money.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QSettings>
+#include <QSqlQuery>
+#include <QStandardPaths>
+#include <QTest>
+
+// Posting through DatabaseManager, and the triggers that freeze posted
+// orders against every other way of changing them
+class PostingTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void postsStock();
+    void freezesPostedOrder();
+    void freezesPostedOrderForRawSql();
+    void deletesPostedOrderWithItsLines();
+
+private:
+    static int idOf(const QString& sql);
+    static int quantityOf(int itemId);
+
+    int m_itemId = 0;
+    int m_orderId = 0;
+    int m_lineId = 0;
+};
+
+void PostingTest::initTestCase()
+{
+    // A fresh database and settings of their own, away from a real installation
+    QStandardPaths::setTestModeEnabled(true);
+    QCoreApplication::setOrganizationName("WMS Tests");
+    QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).removeRecursively();
+    QSettings settings;
+    settings.clear();
+    settings.setValue("replica/enabled", false);
+    settings.setValue("maintenance/enabled", false);
+
+    DatabaseManager::useLocalDatabase();
+    QVERIFY(DatabaseManager::instance().initializeDatabase());
+}
+
+int PostingTest::idOf(const QString& sql)
+{
+    QSqlQuery query;
+    return query.exec(sql) && query.next() ? query.value(0).toInt() : 0;
+}
+
+int PostingTest::quantityOf(int itemId)
+{
+    return idOf(QString("SELECT quantity FROM items WHERE id = %1").arg(itemId));
+}
+
+void PostingTest::postsStock()
+{
+    DatabaseManager& db = DatabaseManager::instance();
+    QVERIFY(db.addItem("POST1", "posted item", 10, Money::fromMinorUnits(100)));
+    m_itemId = idOf("SELECT id FROM items WHERE item_code = 'POST1'");
+    QVERIFY(m_itemId > 0);
+
+    QVERIFY(db.addOrder("P1", QDate(2024, 3, 1), "to"));
+    m_orderId = idOf("SELECT id FROM orders WHERE order_number = 'P1'");
+    QVERIFY(m_orderId > 0);
+    QVERIFY(db.addOrderLine(m_orderId, "P1", m_itemId, 5));
+    m_lineId = idOf(QString("SELECT id FROM order_lines WHERE order_id = %1").arg(m_orderId));
+    QVERIFY(m_lineId > 0);
+
+    // Open orders can still be edited
+    QVERIFY(db.updateOrderLine(m_lineId, m_orderId, "P1", m_itemId, 4));
+
+    QString error;
+    QVERIFY2(db.postOrder(m_orderId, &error), qPrintable(error));
+    QCOMPARE(quantityOf(m_itemId), 14);
+
+    // Posting again does nothing
+    QVERIFY2(db.postOrder(m_orderId, &error), qPrintable(error));
+    QCOMPARE(quantityOf(m_itemId), 14);
+}
+
+void PostingTest::freezesPostedOrder()
+{
+    DatabaseManager& db = DatabaseManager::instance();
+    QVERIFY(!db.addOrderLine(m_orderId, "P1", m_itemId, 1));
+    QVERIFY(!db.updateOrderLine(m_lineId, m_orderId, "P1", m_itemId, 100));
+    QVERIFY(!db.deleteOrderLine(m_lineId));
+    QVERIFY(!db.updateOrder(m_orderId, "P1-changed", QDate(2024, 3, 1), "to"));
+    QVERIFY(!db.updateOrder(m_orderId, "P1", QDate(2024, 3, 2), "to"));
+
+    QCOMPARE(idOf(QString("SELECT COUNT(*) FROM order_lines WHERE order_id = %1").arg(m_orderId)), 1);
+    QCOMPARE(idOf(QString("SELECT quantity FROM order_lines WHERE id = %1").arg(m_lineId)), 4);
+    QCOMPARE(quantityOf(m_itemId), 14);
+}
+
+void PostingTest::freezesPostedOrderForRawSql()
+{
+    // The SQL console goes past DatabaseManager; the triggers still apply
+    QSqlQuery query;
+    QVERIFY(!query.exec(QString("UPDATE orders SET status = 0 WHERE id = %1").arg(m_orderId)));
+    QVERIFY(query.lastError().text().contains("posted orders cannot be changed"));
+    QVERIFY(!query.exec(QString("DELETE FROM order_lines WHERE id = %1").arg(m_lineId)));
+    QVERIFY(!query.exec(QString("UPDATE order_lines SET quantity = 1 WHERE id = %1").arg(m_lineId)));
+    QVERIFY(!query.exec(QString("INSERT INTO order_lines (order_id, order_number, item_id, quantity) "
+                                "VALUES (%1, 'P1', %2, 1)").arg(m_orderId).arg(m_itemId)));
+
+    // Moving a line of an open order onto the posted one is a change too
+    QVERIFY(DatabaseManager::instance().addOrder("P2", QDate(2024, 3, 1), "to"));
+    int openOrderId = idOf("SELECT id FROM orders WHERE order_number = 'P2'");
+    QVERIFY(DatabaseManager::instance().addOrderLine(openOrderId, "P2", m_itemId, 1));
+    QVERIFY(!query.exec(QString("UPDATE order_lines SET order_id = %1, order_number = 'P1' WHERE order_id = %2")
+                            .arg(m_orderId).arg(openOrderId)));
+
+    QCOMPARE(idOf(QString("SELECT status FROM orders WHERE id = %1").arg(m_orderId)), int(OrderStatusPosted));
+}
+
+void PostingTest::deletesPostedOrderWithItsLines()
+{
+    // Archiving deletes posted orders; their lines go with them
+    QSqlQuery query;
+    QVERIFY2(query.exec(QString("DELETE FROM orders WHERE id = %1").arg(m_orderId)),
+             qPrintable(query.lastError().text()));
+    QCOMPARE(idOf(QString("SELECT COUNT(*) FROM order_lines WHERE order_id = %1").arg(m_orderId)), 0);
+    QCOMPARE(quantityOf(m_itemId), 14);
+}
+
+QTEST_GUILESS_MAIN(PostingTest)
+#include "tst_posting.moc"
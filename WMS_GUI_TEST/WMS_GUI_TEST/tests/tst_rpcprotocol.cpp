@@ -0,0 +1,185 @@
+#include "rpcprotocol.h"
+#include "valuecodec.h"
+
+#include <QTest>
+#include <limits>
+
+// Value encoding (valuecodec.h) and the wmsd frames built on it; whatever a
+// peer sends, decoding must fail cleanly rather than read past the data
+class RpcProtocolTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void valueRoundTrip_data();
+    void valueRoundTrip();
+    void rowRoundTrip();
+    void rejectsTruncatedValue();
+    void rejectsUnknownTag();
+    void rejectsOversizedRowCount();
+    void framesArriveInPieces();
+    void rejectsOversizedFrame();
+    void statementRoundTrip();
+    void resultRoundTrip();
+};
+
+void RpcProtocolTest::valueRoundTrip_data()
+{
+    QTest::addColumn<QVariant>("value");
+    QTest::addColumn<QVariant>("expected");
+    QTest::newRow("null") << QVariant() << QVariant();
+    QTest::newRow("int") << QVariant(42) << QVariant(qint64(42));
+    QTest::newRow("negative") << QVariant(qint64(-1234567890123)) << QVariant(qint64(-1234567890123));
+    QTest::newRow("64-bit min") << QVariant(std::numeric_limits<qint64>::min())
+                                << QVariant(std::numeric_limits<qint64>::min());
+    QTest::newRow("bool") << QVariant(true) << QVariant(qint64(1));
+    QTest::newRow("real") << QVariant(-2.5) << QVariant(-2.5);
+    QTest::newRow("empty text") << QVariant(QString("")) << QVariant(QString(""));
+    QTest::newRow("unicode text") << QVariant(QString::fromUtf8("Z\xc3\xa4hlung \xe2\x9c\x93"))
+                                  << QVariant(QString::fromUtf8("Z\xc3\xa4hlung \xe2\x9c\x93"));
+    QTest::newRow("blob") << QVariant(QByteArray("\0\x01\xff", 3)) << QVariant(QByteArray("\0\x01\xff", 3));
+}
+
+void RpcProtocolTest::valueRoundTrip()
+{
+    QFETCH(QVariant, value);
+    QFETCH(QVariant, expected);
+
+    QByteArray out;
+    appendValue(out, value);
+    qsizetype pos = 0;
+    QVariant decoded;
+    QVERIFY(readValue(out.constData(), out.size(), pos, decoded));
+    QCOMPARE(pos, out.size());
+    QCOMPARE(decoded.userType(), expected.userType());
+    QCOMPARE(decoded, expected);
+}
+
+void RpcProtocolTest::rowRoundTrip()
+{
+    const QVariantList row = {qint64(7), QString("ITEM-7"), QVariant(), 19.99, QByteArray("raw")};
+    QByteArray out;
+    appendRow(out, row);
+    appendRow(out, QVariantList());
+
+    qsizetype pos = 0;
+    QVariantList decoded;
+    QVERIFY(readRow(out.constData(), out.size(), pos, decoded));
+    QCOMPARE(decoded, row);
+    QVERIFY(readRow(out.constData(), out.size(), pos, decoded));
+    QVERIFY(decoded.isEmpty());
+    QCOMPARE(pos, out.size());
+}
+
+void RpcProtocolTest::rejectsTruncatedValue()
+{
+    const QVariantList values = {qint64(1) << 40, 3.25, QString("truncated text"), QByteArray(20, 'b')};
+    for (const QVariant& value : values) {
+        QByteArray out;
+        appendValue(out, value);
+        for (qsizetype size = 0; size < out.size(); ++size) {
+            qsizetype pos = 0;
+            QVariant decoded;
+            QVERIFY2(!readValue(out.constData(), size, pos, decoded), qPrintable(QString("%1 bytes").arg(size)));
+        }
+    }
+}
+
+void RpcProtocolTest::rejectsUnknownTag()
+{
+    const char data[] = {char(TagBlob + 1), 0};
+    qsizetype pos = 0;
+    QVariant decoded;
+    QVERIFY(!readValue(data, sizeof(data), pos, decoded));
+}
+
+void RpcProtocolTest::rejectsOversizedRowCount()
+{
+    // Claims a million values in a few bytes; must not reserve or read that many
+    QByteArray data;
+    appendVarint(data, 1000000);
+    data.append(char(TagNull));
+    data.append(char(TagNull));
+    qsizetype pos = 0;
+    QVariantList row;
+    QVERIFY(!readRow(data.constData(), data.size(), pos, row));
+}
+
+void RpcProtocolTest::framesArriveInPieces()
+{
+    QByteArray stream = encodeRpcFrame(1, RpcType::Exec, encodeRpcString("SELECT 1"))
+                        + encodeRpcFrame(300, RpcType::Commit);
+    QByteArray buffer;
+    RpcFrame frame;
+    bool corrupt = false;
+
+    // One byte at a time: nothing until the first frame is complete
+    qsizetype firstSize = stream.size() - encodeRpcFrame(300, RpcType::Commit).size();
+    for (qsizetype i = 0; i < firstSize - 1; ++i) {
+        buffer.append(stream.at(i));
+        QVERIFY(!takeRpcFrame(buffer, frame, &corrupt));
+        QVERIFY(!corrupt);
+    }
+    buffer.append(stream.mid(firstSize - 1));
+
+    QVERIFY(takeRpcFrame(buffer, frame, &corrupt));
+    QCOMPARE(frame.id, quint64(1));
+    QVERIFY(frame.type == RpcType::Exec);
+    QString sql;
+    QVERIFY(decodeRpcString(frame.payload, sql));
+    QCOMPARE(sql, QString("SELECT 1"));
+
+    QVERIFY(takeRpcFrame(buffer, frame, &corrupt));
+    QCOMPARE(frame.id, quint64(300));
+    QVERIFY(frame.type == RpcType::Commit);
+    QVERIFY(frame.payload.isEmpty());
+    QVERIFY(buffer.isEmpty());
+    QVERIFY(!takeRpcFrame(buffer, frame, &corrupt));
+    QVERIFY(!corrupt);
+}
+
+void RpcProtocolTest::rejectsOversizedFrame()
+{
+    QByteArray buffer(4, '\0');
+    qToLittleEndian(quint32(kRpcMaxFrameBytes + 1), buffer.data());
+    RpcFrame frame;
+    bool corrupt = false;
+    QVERIFY(!takeRpcFrame(buffer, frame, &corrupt));
+    QVERIFY(corrupt);
+}
+
+void RpcProtocolTest::statementRoundTrip()
+{
+    const std::vector<QVariantList> rows = {{qint64(1), QString("a")}, {QVariant(), QString("b")}};
+    QByteArray payload = encodeRpcStatement("INSERT INTO t VALUES (?, ?)", rows);
+
+    QString sql;
+    std::vector<QVariantList> decoded;
+    QVERIFY(decodeRpcStatement(payload, sql, decoded));
+    QCOMPARE(sql, QString("INSERT INTO t VALUES (?, ?)"));
+    QVERIFY(decoded == rows);
+
+    // Every proper prefix is rejected
+    for (qsizetype size = 0; size < payload.size(); ++size) {
+        QVERIFY(!decodeRpcStatement(payload.left(size), sql, decoded));
+    }
+}
+
+void RpcProtocolTest::resultRoundTrip()
+{
+    RpcResult result;
+    result.columns = QStringList{"id", "item_code"};
+    result.rows = {{qint64(1), QString("A")}, {qint64(2), QVariant()}};
+    result.rowsAffected = 2;
+    result.lastInsertId = -1;
+
+    RpcResult decoded;
+    QVERIFY(decoded.decode(result.encode()));
+    QCOMPARE(decoded.columns, result.columns);
+    QVERIFY(decoded.rows == result.rows);
+    QCOMPARE(decoded.rowsAffected, qint64(2));
+    QCOMPARE(decoded.lastInsertId, qint64(-1));
+}
+
+QTEST_GUILESS_MAIN(RpcProtocolTest)
+#include "tst_rpcprotocol.moc"
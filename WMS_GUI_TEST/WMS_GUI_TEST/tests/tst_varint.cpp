@@ -0,0 +1,111 @@
+#include "varint.h"
+
+#include <QTest>
+#include <limits>
+
+class VarintTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void roundTrip_data();
+    void roundTrip();
+    void signedRoundTrip_data();
+    void signedRoundTrip();
+    void encodedSize();
+    void rejectsTruncated();
+    void rejectsOverlong();
+};
+
+void VarintTest::roundTrip_data()
+{
+    QTest::addColumn<quint64>("value");
+    QTest::newRow("zero") << quint64(0);
+    QTest::newRow("one byte max") << quint64(127);
+    QTest::newRow("two bytes min") << quint64(128);
+    QTest::newRow("two bytes max") << quint64(16383);
+    QTest::newRow("three bytes min") << quint64(16384);
+    QTest::newRow("32-bit max") << quint64(std::numeric_limits<quint32>::max());
+    QTest::newRow("64-bit max") << std::numeric_limits<quint64>::max();
+}
+
+void VarintTest::roundTrip()
+{
+    QFETCH(quint64, value);
+
+    QByteArray out;
+    appendVarint(out, value);
+    qsizetype pos = 0;
+    quint64 decoded = 0;
+    QVERIFY(readVarint(out.constData(), out.size(), pos, decoded));
+    QCOMPARE(decoded, value);
+    QCOMPARE(int(pos), int(out.size()));
+}
+
+void VarintTest::signedRoundTrip_data()
+{
+    QTest::addColumn<qint64>("value");
+    QTest::newRow("zero") << qint64(0);
+    QTest::newRow("minus one") << qint64(-1);
+    QTest::newRow("one") << qint64(1);
+    QTest::newRow("minus 64") << qint64(-64);
+    QTest::newRow("min") << std::numeric_limits<qint64>::min();
+    QTest::newRow("max") << std::numeric_limits<qint64>::max();
+}
+
+void VarintTest::signedRoundTrip()
+{
+    QFETCH(qint64, value);
+
+    QByteArray out;
+    appendSignedVarint(out, value);
+    qsizetype pos = 0;
+    qint64 decoded = 0;
+    QVERIFY(readSignedVarint(out.constData(), out.size(), pos, decoded));
+    QCOMPARE(decoded, value);
+    QCOMPARE(int(pos), int(out.size()));
+}
+
+void VarintTest::encodedSize()
+{
+    QByteArray out;
+    appendVarint(out, 300);
+    QCOMPARE(out, QByteArray("\xac\x02", 2));
+
+    // Zigzag keeps small negative numbers small
+    out.clear();
+    appendSignedVarint(out, -1);
+    QCOMPARE(out, QByteArray("\x01", 1));
+    out.clear();
+    appendSignedVarint(out, -64);
+    QCOMPARE(int(out.size()), 1);
+
+    out.clear();
+    appendVarint(out, std::numeric_limits<quint64>::max());
+    QCOMPARE(int(out.size()), 10);
+}
+
+void VarintTest::rejectsTruncated()
+{
+    QByteArray out;
+    appendVarint(out, 300);
+    qsizetype pos = 0;
+    quint64 value = 0;
+    QVERIFY(!readVarint(out.constData(), out.size() - 1, pos, value));
+
+    pos = 0;
+    QVERIFY(!readVarint(out.constData(), 0, pos, value));
+}
+
+void VarintTest::rejectsOverlong()
+{
+    // Ten bytes that all announce another one
+    QByteArray out(10, char(0x80));
+    out.append(char(0x01));
+    qsizetype pos = 0;
+    quint64 value = 0;
+    QVERIFY(!readVarint(out.constData(), out.size(), pos, value));
+}
+
+QTEST_GUILESS_MAIN(VarintTest)
+#include "tst_varint.moc"
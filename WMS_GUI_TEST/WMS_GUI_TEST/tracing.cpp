@@ -0,0 +1,188 @@
+#include "tracing.h"
+
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+#include <QCoreApplication>
+#include <QDebug>
+#include <algorithm>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_LINUX)
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(Q_OS_MACOS)
+#include <pthread.h>
+#endif
+
+std::atomic<bool> Tracer::s_enabled{false};
+
+Tracer::Tracer()
+{
+    m_clock.start();
+}
+
+Tracer& Tracer::instance()
+{
+    static Tracer instance;
+    return instance;
+}
+
+void Tracer::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+    qDebug() << "Tracing" << (enabled ? "enabled" : "disabled");
+}
+
+// Id the OS and profilers know the thread by
+static quint64 osThreadId()
+{
+#if defined(Q_OS_WIN)
+    return GetCurrentThreadId();
+#elif defined(Q_OS_LINUX)
+    return quint64(syscall(SYS_gettid));
+#elif defined(Q_OS_MACOS)
+    uint64_t id = 0;
+    pthread_threadid_np(nullptr, &id);
+    return id;
+#else
+    return quint64(quintptr(QThread::currentThreadId()));
+#endif
+}
+
+Tracer::ThreadBuffer* Tracer::currentBuffer()
+{
+    // Gives the buffer back when the thread exits
+    struct Lease {
+        ThreadBuffer* buffer = nullptr;
+        ~Lease()
+        {
+            if (buffer) {
+                Tracer::instance().releaseBuffer(buffer);
+            }
+        }
+    };
+    thread_local Lease lease;
+    if (lease.buffer) {
+        return lease.buffer;
+    }
+
+    // First event on this thread: take a released buffer or register a new
+    // one (the only locked path)
+    QString threadName;
+    QThread* thread = QThread::currentThread();
+    if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) {
+        threadName = "main";
+    } else {
+        threadName = thread->objectName();
+    }
+    quint64 tid = osThreadId();
+    if (threadName.isEmpty()) {
+        threadName = QString("worker-%1").arg(tid);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    auto released = std::find_if(m_buffers.begin(), m_buffers.end(),
+                                 [](const std::unique_ptr<ThreadBuffer>& b) { return !b->inUse; });
+    ThreadBuffer* buffer;
+    if (released != m_buffers.end()) {
+        buffer = released->get();
+        // The previous thread's events would otherwise show up under this one
+        buffer->clearedAt = buffer->head.load(std::memory_order_acquire);
+    } else {
+        m_buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = m_buffers.back().get();
+        buffer->events.resize(ThreadBuffer::kCapacity);
+    }
+    buffer->tid = tid;
+    buffer->threadName = threadName;
+    buffer->inUse = true;
+    lease.buffer = buffer;
+    return buffer;
+}
+
+void Tracer::releaseBuffer(ThreadBuffer* buffer)
+{
+    QMutexLocker locker(&m_mutex);
+    buffer->inUse = false;
+}
+
+void Tracer::record(const char* name, const char* category, qint64 startNs, qint64 durationNs)
+{
+    ThreadBuffer* buffer = currentBuffer();
+    quint64 head = buffer->head.load(std::memory_order_relaxed);
+    buffer->events[head % ThreadBuffer::kCapacity] = Event{name, category, startNs, durationNs};
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::clear()
+{
+    // head belongs to the recording thread; resetting it here would race
+    // with record(), so only the start of the readable range moves
+    QMutexLocker locker(&m_mutex);
+    for (const auto& buffer : m_buffers) {
+        buffer->clearedAt = buffer->head.load(std::memory_order_acquire);
+    }
+}
+
+static QByteArray jsonEscaped(const char* text)
+{
+    QByteArray out;
+    for (const char* c = text; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out += '\\';
+            out += *c;
+        } else if (quint8(*c) < 0x20) {
+            out += QByteArray("\\u00") + QByteArray::number(quint8(*c), 16).rightJustified(2, '0');
+        } else {
+            out += *c;
+        }
+    }
+    return out;
+}
+
+bool Tracer::writeTrace(const QString& filePath)
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to write trace:" << file.errorString();
+        return false;
+    }
+
+    qint64 pid = QCoreApplication::applicationPid();
+    QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+
+    QMutexLocker locker(&m_mutex);
+    for (const auto& buffer : m_buffers) {
+        if (!first) {
+            out += ",\n";
+        }
+        first = false;
+        // Thread names come from QObject::objectName() and may hold anything
+        out += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + QByteArray::number(pid)
+               + ",\"tid\":" + QByteArray::number(buffer->tid)
+               + ",\"args\":{\"name\":\"" + jsonEscaped(buffer->threadName.toUtf8().constData()) + "\"}}";
+
+        // Events still being written by their thread while we copy may be
+        // torn; the ring is large enough that this only affects the oldest slots
+        quint64 head = buffer->head.load(std::memory_order_acquire);
+        quint64 begin = head > ThreadBuffer::kCapacity ? head - ThreadBuffer::kCapacity : 0;
+        begin = qMax(begin, qMin(buffer->clearedAt, head));
+        for (quint64 i = begin; i < head; ++i) {
+            const Event& e = buffer->events[i % ThreadBuffer::kCapacity];
+            out += ",\n{\"ph\":\"X\",\"name\":\"" + jsonEscaped(e.name)
+                   + "\",\"cat\":\"" + jsonEscaped(e.category)
+                   + "\",\"pid\":" + QByteArray::number(pid)
+                   + ",\"tid\":" + QByteArray::number(buffer->tid)
+                   + ",\"ts\":" + QByteArray::number(double(e.startNs) / 1000.0, 'f', 3)
+                   + ",\"dur\":" + QByteArray::number(double(e.durationNs) / 1000.0, 'f', 3) + "}";
+        }
+    }
+    locker.unlock();
+
+    out += "\n]}\n";
+    file.write(out);
+    return file.commit();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <QString>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Chrome/Perfetto trace-event recorder. Each thread records complete ("X")
+// events into its own fixed-size ring buffer, so the hot path never takes a
+// lock; writeTrace() merges all buffers into a JSON file that can be opened in
+// chrome://tracing or ui.perfetto.dev. Events carry the OS thread id. When a
+// thread exits its buffer is kept for the next new thread, so pool and API
+// worker threads coming and going do not add buffers; the exited thread's
+// events stay in the trace until then.
+//
+// Names and categories must be string literals (or otherwise live for the
+// whole process, like QMetaObject::className()) because only the pointer is stored.
+class Tracer
+{
+public:
+    static Tracer& instance();
+
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled);
+
+    // Discards everything recorded so far; safe while other threads record
+    void clear();
+    bool writeTrace(const QString& filePath);
+
+    qint64 nowNs() const { return m_clock.nsecsElapsed(); }
+    void record(const char* name, const char* category, qint64 startNs, qint64 durationNs);
+
+private:
+    Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    struct Event {
+        const char* name;
+        const char* category;
+        qint64 startNs;
+        qint64 durationNs;
+    };
+
+    struct ThreadBuffer {
+        static constexpr quint64 kCapacity = 1 << 16;
+        // Owner, name and inUse are guarded by m_mutex
+        quint64 tid = 0;
+        QString threadName;
+        bool inUse = true;
+        std::vector<Event> events;
+        // Written only by the buffer's own thread
+        std::atomic<quint64> head{0};
+        // Events before this position were discarded by clear(); guarded by m_mutex
+        quint64 clearedAt = 0;
+    };
+
+    ThreadBuffer* currentBuffer();
+    // Called on a thread's exit; the buffer is handed to the next new thread
+    void releaseBuffer(ThreadBuffer* buffer);
+
+    static std::atomic<bool> s_enabled;
+
+    QElapsedTimer m_clock;
+    QMutex m_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+};
+
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const char* category)
+        : m_name(name), m_category(category), m_startNs(Tracer::isEnabled() ? Tracer::instance().nowNs() : -1) {}
+    ~TraceScope()
+    {
+        if (m_startNs >= 0) {
+            Tracer& tracer = Tracer::instance();
+            tracer.record(m_name, m_category, m_startNs, tracer.nowNs() - m_startNs);
+        }
+    }
+
+private:
+    const char* m_name;
+    const char* m_category;
+    qint64 m_startNs;
+};
+
+#define WMS_TRACE_CONCAT_INNER(a, b) a##b
+#define WMS_TRACE_CONCAT(a, b) WMS_TRACE_CONCAT_INNER(a, b)
+
+// Records the enclosing scope as a span, e.g. WMS_TRACE_SCOPE("OrderLinesWindow::loadOrder")
+#define WMS_TRACE_SCOPE(name) TraceScope WMS_TRACE_CONCAT(traceScope_, __LINE__)(name, "wms")
+#define WMS_TRACE_SCOPE_CAT(name, category) TraceScope WMS_TRACE_CONCAT(traceScope_, __LINE__)(name, category)
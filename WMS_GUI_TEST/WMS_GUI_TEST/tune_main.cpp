@@ -0,0 +1,203 @@
+#include "tuningprofile.h"
+#include "workloadlog.h"
+#include "workloadreplayer.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTextStream>
+#include <algorithm>
+
+struct ProfileResult
+{
+    const TuningProfile* profile = nullptr;
+    qint64 medianWallMs = 0;
+    double throughput = 0;
+    quint64 p99Micros = 0;
+    quint64 errors = 0;
+};
+
+// Makes a consistent copy of the database (including WAL content) with the
+// profile's page size, ready to be replayed against
+static bool prepareCopy(const QString& sourcePath, const QString& copyPath, const TuningProfile& profile,
+                        QString* errorMessage)
+{
+    QFile::remove(copyPath);
+    bool ok = true;
+    {
+        QSqlDatabase source = QSqlDatabase::addDatabase("QSQLITE", "tune-source");
+        source.setDatabaseName(sourcePath);
+        source.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+        ok = source.open();
+        QSqlQuery query(source);
+        ok = ok && query.prepare("VACUUM INTO ?");
+        if (ok) {
+            query.addBindValue(copyPath);
+            ok = query.exec();
+        }
+        if (!ok && errorMessage) {
+            *errorMessage = source.isOpen() ? query.lastError().text() : source.lastError().text();
+        }
+    }
+    QSqlDatabase::removeDatabase("tune-source");
+    if (!ok) {
+        return false;
+    }
+
+    {
+        // page_size can only change through a VACUUM in rollback journal mode
+        QSqlDatabase copy = QSqlDatabase::addDatabase("QSQLITE", "tune-copy");
+        copy.setDatabaseName(copyPath);
+        ok = copy.open();
+        QSqlQuery query(copy);
+        ok = ok && query.exec("PRAGMA journal_mode = DELETE")
+             && query.exec(QString("PRAGMA page_size = %1").arg(profile.pageSize))
+             && query.exec("VACUUM")
+             && query.exec("PRAGMA journal_mode = WAL");
+        if (!ok && errorMessage) {
+            *errorMessage = copy.isOpen() ? query.lastError().text() : copy.lastError().text();
+        }
+    }
+    QSqlDatabase::removeDatabase("tune-copy");
+    return ok;
+}
+
+// wms_tune: replays a recorded workload (see wms_replay) against copies of
+// wms.db under every tuning profile and recommends the fastest one that is
+// crash-safe. With --write the recommendation becomes the application's
+// "database/tuningProfile" setting.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Same settings scope as the application, so --write reaches its config
+    QCoreApplication::setApplicationName("Warehouse Management System");
+    QCoreApplication::setOrganizationName("WMS Corp");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmark the WMS tuning profiles with a recorded workload.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("log", "Workload log (.wlog) to replay.");
+    QCommandLineOption dbOption("db", "Database file to benchmark (copied, never modified).", "file");
+    QCommandLineOption profilesOption("profiles", "Comma-separated profiles to try (default: all).", "names");
+    QCommandLineOption runsOption("runs", "Replays per profile; the median is compared.", "n", "3");
+    QCommandLineOption sessionsOption("sessions", "Number of parallel copies of the recorded sessions.", "n", "1");
+    QCommandLineOption readOnlyOption("read-only", "Only replay statements that do not modify data.");
+    QCommandLineOption unsafeOption("allow-unsafe", "Also recommend profiles that are not crash-safe.");
+    QCommandLineOption writeOption("write", "Store the recommended profile in the application settings.");
+    parser.addOptions({dbOption, profilesOption, runsOption, sessionsOption, readOnlyOption, unsafeOption, writeOption});
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    if (parser.positionalArguments().size() != 1 || !parser.isSet(dbOption)) {
+        parser.showHelp(1);
+    }
+
+    std::vector<const TuningProfile*> profiles;
+    QStringList names = parser.isSet(profilesOption) ? parser.value(profilesOption).split(',', Qt::SkipEmptyParts)
+                                                     : TuningProfile::presetNames();
+    for (const QString& name : names) {
+        const TuningProfile* profile = TuningProfile::find(name.trimmed());
+        if (!profile) {
+            err << "Unknown profile " << name << " (available: " << TuningProfile::presetNames().join(", ") << ")\n";
+            return 1;
+        }
+        profiles.push_back(profile);
+    }
+
+    std::vector<WorkloadEvent> events;
+    QString errorMessage;
+    if (!WorkloadLogReader::readAll(parser.positionalArguments().first(), events, &errorMessage)) {
+        err << "Failed to read workload log: " << errorMessage << "\n";
+        return 1;
+    }
+
+    int runs = qMax(1, parser.value(runsOption).toInt());
+    WorkloadReplayer replayer(std::move(events));
+    QString copyPath = QDir::temp().filePath("wms_tune_copy.db");
+    std::vector<ProfileResult> results;
+
+    for (const TuningProfile* profile : profiles) {
+        ProfileResult result;
+        result.profile = profile;
+        std::vector<qint64> wallTimes;
+
+        for (int run = 0; run < runs; ++run) {
+            out << "Profile " << profile->name << ", run " << run + 1 << "/" << runs << "...\n";
+            out.flush();
+
+            // A fresh copy per run, so every run starts from the same data
+            if (!prepareCopy(parser.value(dbOption), copyPath, *profile, &errorMessage)) {
+                err << "Failed to copy the database: " << errorMessage << "\n";
+                return 1;
+            }
+
+            ReplayOptions options;
+            options.databasePath = copyPath;
+            options.sessions = parser.value(sessionsOption).toInt();
+            options.speed = 0.0;
+            options.readOnly = parser.isSet(readOnlyOption);
+            options.setupStatements = profile->statements();
+
+            ReplayReport report;
+            if (!replayer.run(options, report, &errorMessage)) {
+                err << errorMessage << "\n";
+                return 1;
+            }
+            wallTimes.push_back(report.wallTimeMs);
+            result.p99Micros = qMax(result.p99Micros, report.total.quantile(0.99));
+            result.errors += report.errors.load();
+            result.throughput = qMax(result.throughput, double(report.total.count()) / (qMax<qint64>(report.wallTimeMs, 1) / 1000.0));
+        }
+
+        std::sort(wallTimes.begin(), wallTimes.end());
+        result.medianWallMs = wallTimes[wallTimes.size() / 2];
+        results.push_back(result);
+    }
+    QFile::remove(copyPath);
+    QFile::remove(copyPath + "-wal");
+    QFile::remove(copyPath + "-shm");
+
+    out << "\n"
+        << QString("%1 %2 %3 %4 %5 %6\n")
+               .arg(QString("profile"), -10).arg(QString("page"), 6).arg(QString("median ms"), 10)
+               .arg(QString("stmts/s"), 10).arg(QString("p99 ms"), 10).arg(QString("errors"), 8);
+    const ProfileResult* best = nullptr;
+    for (const ProfileResult& result : results) {
+        out << QString("%1 %2 %3 %4 %5 %6%7\n")
+                   .arg(result.profile->name, -10)
+                   .arg(result.profile->pageSize, 6)
+                   .arg(result.medianWallMs, 10)
+                   .arg(QString::number(result.throughput, 'f', 1), 10)
+                   .arg(QString::number(double(result.p99Micros) / 1000.0, 'f', 3), 10)
+                   .arg(result.errors, 8)
+                   .arg(result.profile->isCrashSafe() ? "" : "  (not crash-safe)");
+
+        // A profile that fails statements is fast for the wrong reason
+        bool eligible = (result.profile->isCrashSafe() || parser.isSet(unsafeOption)) && result.errors == 0;
+        if (eligible && (!best || result.medianWallMs < best->medianWallMs)) {
+            best = &result;
+        }
+    }
+
+    if (!best) {
+        out << "\nNo eligible profile: profiles with errors are never recommended, and unsafe ones only with"
+               " --allow-unsafe.\n";
+        return 1;
+    }
+
+    out << "\nRecommended profile: " << best->profile->name << "\n";
+    if (parser.isSet(writeOption)) {
+        QSettings settings;
+        settings.setValue("database/tuningProfile", best->profile->name);
+        settings.sync();
+        out << "Written to " << settings.fileName() << " (takes effect at the next start; page size applies to new databases)\n";
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "tuningprofile.h"
+
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+QStringList TuningProfile::statements() const
+{
+    // A negative cache_size is in KiB rather than pages, independent of page_size
+    return {QString("PRAGMA cache_size = -%1").arg(cacheSizeKiB),
+            QString("PRAGMA mmap_size = %1").arg(mmapSize),
+            QString("PRAGMA synchronous = %1").arg(synchronous),
+            QString("PRAGMA temp_store = %1").arg(tempStore)};
+}
+
+bool TuningProfile::apply(const QSqlDatabase& db, QString* errorMessage) const
+{
+    QSqlQuery query(db);
+    for (const QString& statement : statements()) {
+        if (!query.exec(statement)) {
+            qDebug() << "Failed to apply tuning profile" << name << ":" << query.lastError().text();
+            if (errorMessage) {
+                *errorMessage = query.lastError().text();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+const std::vector<TuningProfile>& TuningProfile::presets()
+{
+    static const std::vector<TuningProfile> profiles = [] {
+        TuningProfile durable;
+        durable.name = "durable";
+
+        TuningProfile balanced;
+        balanced.name = "balanced";
+        balanced.cacheSizeKiB = 65536;
+        balanced.mmapSize = qint64(256) << 20;
+        balanced.synchronous = "NORMAL";
+        balanced.tempStore = "MEMORY";
+
+        TuningProfile bulkLoad;
+        bulkLoad.name = "bulk-load";
+        bulkLoad.pageSize = 8192;
+        bulkLoad.cacheSizeKiB = 262144;
+        bulkLoad.mmapSize = qint64(1) << 30;
+        bulkLoad.synchronous = "OFF";
+        bulkLoad.tempStore = "MEMORY";
+
+        return std::vector<TuningProfile>{durable, balanced, bulkLoad};
+    }();
+    return profiles;
+}
+
+QStringList TuningProfile::presetNames()
+{
+    QStringList names;
+    for (const TuningProfile& profile : presets()) {
+        names.append(profile.name);
+    }
+    return names;
+}
+
+const TuningProfile* TuningProfile::find(const QString& name)
+{
+    for (const TuningProfile& profile : presets()) {
+        if (profile.name.compare(name, Qt::CaseInsensitive) == 0) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
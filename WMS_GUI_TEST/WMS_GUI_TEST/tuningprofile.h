@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+// Named set of SQLite storage settings.
+//
+//   durable    synchronous = FULL, modest cache, no memory mapping; every
+//              commit is on disk before it returns
+//   balanced   synchronous = NORMAL (safe in WAL mode, a power loss may only
+//              lose the last commits), larger cache, temp tables in memory
+//              and a memory-mapped read path (the default)
+//   bulk-load  synchronous = OFF, large cache and mapping, for imports and
+//              replays; a power loss can corrupt the file
+//
+// cache_size, mmap_size, synchronous and temp_store are per connection and
+// can be changed at any time. page_size only takes effect on a database
+// without tables, or after a VACUUM in rollback journal mode, so it is used
+// when a database is created (and by wms_tune on its copies).
+struct TuningProfile
+{
+    QString name;
+    int pageSize = 4096;
+    int cacheSizeKiB = 2000;
+    qint64 mmapSize = 0;
+    QString synchronous = "FULL";
+    QString tempStore = "DEFAULT";
+
+    // False if a power loss can corrupt the database
+    bool isCrashSafe() const { return synchronous.compare("OFF", Qt::CaseInsensitive) != 0; }
+
+    // PRAGMA statements for an open connection; page_size is left out
+    QStringList statements() const;
+    bool apply(const QSqlDatabase& db, QString* errorMessage = nullptr) const;
+
+    static const std::vector<TuningProfile>& presets();
+    static QStringList presetNames();
+    // Preset with the given name, or nullptr
+    static const TuningProfile* find(const QString& name);
+};
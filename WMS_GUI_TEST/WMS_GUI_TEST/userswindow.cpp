@@ -1,10 +1,12 @@
 #include "userswindow.h"
 #include "ui_userswindow.h"
 #include "databasemanager.h"
+#include "schema.h"
 #include <QMessageBox>
 #include <QSqlError>
 #include <QScreen>
 #include <QGuiApplication>
+#include "tracing.h"
 
 UsersWindow::UsersWindow(QWidget *parent) :
     QWidget(parent),
@@ -47,12 +49,14 @@ UsersWindow::~UsersWindow()
 
 void UsersWindow::setupModel()
 {
+    WMS_TRACE_SCOPE("UsersWindow::setupModel");
+
     model = new QSqlTableModel(this);
     model->setTable("users");
 
     // Set headers
-    model->setHeaderData(0, Qt::Horizontal, tr("ID"));
-    model->setHeaderData(1, Qt::Horizontal, tr("Login"));
+    model->setHeaderData(UsersTable::Id, Qt::Horizontal, tr("ID"));
+    model->setHeaderData(UsersTable::Login, Qt::Horizontal, tr("Login"));
 
     // Hide password column from view
     ui->tableView->setColumnHidden(2, true);
@@ -64,18 +68,20 @@ void UsersWindow::setupModel()
     ui->tableView->setModel(model);
 
     // Hide ID column
-    ui->tableView->hideColumn(0);
+    ui->tableView->hideColumn(UsersTable::Id);
 }
 
 void UsersWindow::setupMapper()
 {
+    WMS_TRACE_SCOPE("UsersWindow::setupMapper");
+
     mapper = new QDataWidgetMapper(this);
     mapper->setModel(model);
     mapper->setSubmitPolicy(QDataWidgetMapper::ManualSubmit);
 
     // Map fields to form controls
-    mapper->addMapping(ui->idLineEdit, 0);
-    mapper->addMapping(ui->loginLineEdit, 1);
+    mapper->addMapping(ui->idLineEdit, UsersTable::Id);
+    mapper->addMapping(ui->loginLineEdit, UsersTable::Login);
     // We don't map password field as it's hashed in the database
 
     if (model->rowCount() > 0) {
@@ -162,7 +168,7 @@ void UsersWindow::on_deleteButton_clicked()
     int row = ui->tableView->currentIndex().row();
 
     // Check if this is the admin user (ID 1)
-    if (model->data(model->index(row, 0)).toInt() == 1) {
+    if (model->data(model->index(row, UsersTable::Id)).toInt() == 1) {
         QMessageBox::warning(this, tr("Delete User"), tr("Cannot delete the admin user."));
         return;
     }
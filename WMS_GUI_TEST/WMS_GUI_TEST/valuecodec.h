@@ -0,0 +1,142 @@
+#pragma once
+
+#include "varint.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+#include <QVariantList>
+#include <QtEndian>
+#include <cstring>
+
+// Encoding of SQL values in the binary formats (change log, wmsd protocol).
+// Every value is a tag byte followed by its data: 0 NULL, 1 integer (zigzag
+// varint), 2 real (8-byte little-endian double), 3 text and 4 blob (both
+// varint-length-prefixed). A row is a varint value count and the values.
+
+enum ValueTag : quint8 { TagNull, TagInteger, TagReal, TagText, TagBlob };
+
+inline void appendBytes(QByteArray& out, const QByteArray& bytes)
+{
+    appendVarint(out, quint64(bytes.size()));
+    out.append(bytes);
+}
+
+inline void appendValue(QByteArray& out, const QVariant& value)
+{
+    if (value.isNull()) {
+        out.append(char(TagNull));
+        return;
+    }
+    switch (value.userType()) {
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Bool:
+        out.append(char(TagInteger));
+        appendSignedVarint(out, value.toLongLong());
+        break;
+    case QMetaType::Double:
+    case QMetaType::Float: {
+        out.append(char(TagReal));
+        quint64 bits;
+        double real = value.toDouble();
+        std::memcpy(&bits, &real, sizeof(bits));
+        bits = qToLittleEndian(bits);
+        out.append(reinterpret_cast<const char*>(&bits), sizeof(bits));
+        break;
+    }
+    case QMetaType::QByteArray:
+        out.append(char(TagBlob));
+        appendBytes(out, value.toByteArray());
+        break;
+    default:
+        out.append(char(TagText));
+        appendBytes(out, value.toString().toUtf8());
+        break;
+    }
+}
+
+inline void appendRow(QByteArray& out, const QVariantList& row)
+{
+    appendVarint(out, quint64(row.size()));
+    for (const QVariant& value : row) {
+        appendValue(out, value);
+    }
+}
+
+inline bool readBytes(const char* data, qsizetype size, qsizetype& pos, QByteArray& bytes)
+{
+    quint64 length;
+    if (!readVarint(data, size, pos, length) || length > quint64(size - pos)) {
+        return false;
+    }
+    bytes = QByteArray(data + pos, qsizetype(length));
+    pos += qsizetype(length);
+    return true;
+}
+
+inline bool readValue(const char* data, qsizetype size, qsizetype& pos, QVariant& value)
+{
+    if (pos >= size) {
+        return false;
+    }
+    QByteArray bytes;
+    switch (quint8(data[pos++])) {
+    case TagNull:
+        value = QVariant();
+        return true;
+    case TagInteger: {
+        qint64 integer;
+        if (!readSignedVarint(data, size, pos, integer)) {
+            return false;
+        }
+        value = integer;
+        return true;
+    }
+    case TagReal: {
+        if (size - pos < 8) {
+            return false;
+        }
+        quint64 bits = qFromLittleEndian<quint64>(data + pos);
+        double real;
+        std::memcpy(&real, &bits, sizeof(real));
+        pos += 8;
+        value = real;
+        return true;
+    }
+    case TagText:
+        if (!readBytes(data, size, pos, bytes)) {
+            return false;
+        }
+        value = QString::fromUtf8(bytes);
+        return true;
+    case TagBlob:
+        if (!readBytes(data, size, pos, bytes)) {
+            return false;
+        }
+        value = bytes;
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool readRow(const char* data, qsizetype size, qsizetype& pos, QVariantList& row)
+{
+    quint64 count;
+    if (!readVarint(data, size, pos, count) || count > quint64(size - pos)) {
+        return false;
+    }
+    row.clear();
+    row.reserve(qsizetype(count));
+    for (quint64 i = 0; i < count; ++i) {
+        QVariant value;
+        if (!readValue(data, size, pos, value)) {
+            return false;
+        }
+        row.append(value);
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+// LEB128 variable-length integers used by the binary file formats
+// (workload logs, ...). Signed values are zigzag-encoded first.
+
+inline void appendVarint(QByteArray& out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+inline void appendSignedVarint(QByteArray& out, qint64 value)
+{
+    appendVarint(out, (quint64(value) << 1) ^ quint64(value >> 63));
+}
+
+// Returns false on truncated or over-long input; pos is advanced past the value
+inline bool readVarint(const char* data, qsizetype size, qsizetype& pos, quint64& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= size) {
+            return false;
+        }
+        quint8 byte = quint8(data[pos++]);
+        value |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool readSignedVarint(const char* data, qsizetype size, qsizetype& pos, qint64& value)
+{
+    quint64 raw;
+    if (!readVarint(data, size, pos, raw)) {
+        return false;
+    }
+    value = qint64(raw >> 1) ^ -qint64(raw & 1);
+    return true;
+}
@@ -0,0 +1,35 @@
+#include "wmsapplication.h"
+#include "tracing.h"
+
+#include <QEvent>
+
+WmsApplication::WmsApplication(int &argc, char **argv) : QApplication(argc, argv)
+{
+}
+
+bool WmsApplication::notify(QObject *receiver, QEvent *event)
+{
+    if (!Tracer::isEnabled()) {
+        return QApplication::notify(receiver, event);
+    }
+
+    const char *category = nullptr;
+    switch (event->type()) {
+    case QEvent::Paint:
+        category = "paint";
+        break;
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::KeyPress:
+    case QEvent::KeyRelease:
+        category = "input";
+        break;
+    default:
+        return QApplication::notify(receiver, event);
+    }
+
+    // className() points into the static meta-object, so it outlives the trace
+    TraceScope scope(receiver->metaObject()->className(), category);
+    return QApplication::notify(receiver, event);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <QApplication>
+
+// QApplication that records input and paint event delivery as trace spans,
+// so a trace shows the whole click -> slot -> SQL -> model -> repaint chain.
+class WmsApplication : public QApplication
+{
+    Q_OBJECT
+
+public:
+    WmsApplication(int &argc, char **argv);
+
+    bool notify(QObject *receiver, QEvent *event) override;
+};
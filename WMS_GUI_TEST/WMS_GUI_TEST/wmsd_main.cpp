@@ -0,0 +1,56 @@
+#include "databasemanager.h"
+#include "backupmanager.h"
+#include "metrics.h"
+#include "rpcserver.h"
+#include "tracing.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QTextStream>
+
+// wmsd: owns the database of the current site and serves it to
+// WMS_GUI_TEST instances whose "database/server" setting points here
+// (see rpcserver.h and remotesqldriver.h). Maintenance, change capture,
+// replication and backups run here as they would in a local GUI instance.
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Same names as the GUI, so both find the same settings and data directory
+    QCoreApplication::setApplicationName("Warehouse Management System");
+    QCoreApplication::setOrganizationName("WMS Corp");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("WMS database server; configured through the rpc/* settings");
+    parser.addHelpOption();
+    parser.process(app);
+
+    QTextStream err(stderr);
+    QSettings settings;
+    if (settings.value("metrics/enabled", false).toBool()) {
+        MetricsRegistry& metrics = MetricsRegistry::instance();
+        metrics.startExporter(quint16(settings.value("metrics/port", 9464).toUInt()));
+
+        QString defaultDump = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/metrics.prom";
+        metrics.startDumping(settings.value("metrics/dumpFile", defaultDump).toString(),
+                             settings.value("metrics/dumpIntervalMs", 60000).toInt());
+    }
+    Tracer::instance().setEnabled(settings.value("tracing/enabled", false).toBool());
+
+    // The daemon is the one instance that opens the file itself
+    DatabaseManager::useLocalDatabase();
+    if (!DatabaseManager::instance().initializeDatabase()) {
+        err << "Failed to open the database\n";
+        return 1;
+    }
+    BackupManager::instance().startSchedule();
+
+    RpcServer server;
+    QString error;
+    if (!server.start(&error)) {
+        err << "Failed to start the database server: " << error << "\n";
+        return 1;
+    }
+    return app.exec();
+}
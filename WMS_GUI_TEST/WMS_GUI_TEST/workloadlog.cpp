@@ -0,0 +1,151 @@
+#include "workloadlog.h"
+#include "varint.h"
+
+#include <QMutexLocker>
+
+static const char kMagic[] = "WMSWLOG1";
+static const qsizetype kMagicSize = 8;
+static const qsizetype kFlushThreshold = 64 * 1024;
+
+WorkloadLogWriter::~WorkloadLogWriter()
+{
+    close();
+}
+
+bool WorkloadLogWriter::open(const QString& filePath)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+
+    m_buffer.clear();
+    m_statementIds.clear();
+    m_lastTimestampUs = 0;
+    m_file.write(kMagic, kMagicSize);
+    return true;
+}
+
+void WorkloadLogWriter::close()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_file.isOpen()) {
+        flushLocked();
+        m_file.close();
+    }
+}
+
+void WorkloadLogWriter::append(quint32 session, qint64 timestampUs, qint64 durationUs,
+                               const QByteArray& statement, const QByteArray& expandedSql)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_file.isOpen()) {
+        return;
+    }
+
+    quint64 statementId = m_statementIds.value(statement, 0);
+    if (statementId == 0) {
+        statementId = quint64(m_statementIds.size()) + 1;
+        m_statementIds.insert(statement, statementId);
+
+        m_buffer.append('S');
+        appendVarint(m_buffer, statementId);
+        appendVarint(m_buffer, quint64(statement.size()));
+        m_buffer.append(statement);
+    }
+
+    m_buffer.append('E');
+    appendVarint(m_buffer, session);
+    appendSignedVarint(m_buffer, timestampUs - m_lastTimestampUs);
+    appendVarint(m_buffer, quint64(qMax<qint64>(durationUs, 0)));
+    appendVarint(m_buffer, statementId);
+    appendVarint(m_buffer, quint64(expandedSql.size()));
+    m_buffer.append(expandedSql);
+    m_lastTimestampUs = timestampUs;
+
+    if (m_buffer.size() >= kFlushThreshold) {
+        flushLocked();
+    }
+}
+
+void WorkloadLogWriter::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    flushLocked();
+}
+
+void WorkloadLogWriter::flushLocked()
+{
+    if (m_file.isOpen() && !m_buffer.isEmpty()) {
+        m_file.write(m_buffer);
+        m_file.flush();
+    }
+    m_buffer.clear();
+}
+
+bool WorkloadLogReader::readAll(const QString& filePath, std::vector<WorkloadEvent>& events, QString* errorMessage)
+{
+    auto fail = [errorMessage](const QString& message) {
+        if (errorMessage) {
+            *errorMessage = message;
+        }
+        return false;
+    };
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return fail(file.errorString());
+    }
+
+    QByteArray content = file.readAll();
+    if (content.size() < kMagicSize || !content.startsWith(QByteArray(kMagic, kMagicSize))) {
+        return fail("Not a workload log file");
+    }
+
+    const char* data = content.constData();
+    qsizetype size = content.size();
+    qsizetype pos = kMagicSize;
+    QHash<quint64, QByteArray> statements;
+    qint64 timestampUs = 0;
+
+    while (pos < size) {
+        char tag = data[pos++];
+        quint64 id = 0;
+        quint64 length = 0;
+
+        if (tag == 'S') {
+            if (!readVarint(data, size, pos, id) || !readVarint(data, size, pos, length)
+                || quint64(size - pos) < length) {
+                break;
+            }
+            statements.insert(id, QByteArray(data + pos, qsizetype(length)));
+            pos += qsizetype(length);
+        } else if (tag == 'E') {
+            quint64 session = 0;
+            qint64 delta = 0;
+            quint64 duration = 0;
+            if (!readVarint(data, size, pos, session) || !readSignedVarint(data, size, pos, delta)
+                || !readVarint(data, size, pos, duration) || !readVarint(data, size, pos, id)
+                || !readVarint(data, size, pos, length) || quint64(size - pos) < length) {
+                break;
+            }
+
+            WorkloadEvent event;
+            timestampUs += delta;
+            event.session = quint32(session);
+            event.timestampUs = timestampUs;
+            event.durationUs = qint64(duration);
+            event.statement = statements.value(id);
+            event.sql = length > 0 ? QByteArray(data + pos, qsizetype(length)) : event.statement;
+            pos += qsizetype(length);
+            events.push_back(std::move(event));
+        } else {
+            return fail(QString("Corrupt record at offset %1").arg(pos - 1));
+        }
+    }
+
+    // A truncated tail (application killed while recording) is not an error
+    return true;
+}
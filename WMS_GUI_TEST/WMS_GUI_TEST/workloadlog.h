@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <vector>
+
+// One statement executed during a recorded session
+struct WorkloadEvent
+{
+    quint32 session = 0;
+    qint64 timestampUs = 0;  // start time, relative to the beginning of the recording
+    qint64 durationUs = 0;   // execution time observed while recording
+    QByteArray statement;    // SQL as prepared, with placeholders
+    QByteArray sql;          // SQL with the bound parameters inlined (what gets replayed)
+};
+
+// Compact binary workload log.
+//
+// File layout: the 8-byte magic "WMSWLOG1" followed by records. Each record
+// starts with a tag byte:
+//   'S' statement definition: varint id, varint length, UTF-8 text
+//   'E' execution: varint session, zigzag varint timestamp delta (us),
+//       varint duration (us), varint statement id, varint length + UTF-8 text
+//       of the expanded SQL (length 0 when the statement has no parameters
+//       or may bind a password hash; see QueryRecorder)
+// Statement texts are written once and referenced by id afterwards.
+class WorkloadLogWriter
+{
+public:
+    WorkloadLogWriter() = default;
+    ~WorkloadLogWriter();
+
+    bool open(const QString& filePath);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    // Thread-safe; statements from several connections can share one log
+    void append(quint32 session, qint64 timestampUs, qint64 durationUs,
+                const QByteArray& statement, const QByteArray& expandedSql);
+    void flush();
+
+private:
+    void flushLocked();
+
+    QMutex m_mutex;
+    QFile m_file;
+    QByteArray m_buffer;
+    QHash<QByteArray, quint64> m_statementIds;
+    qint64 m_lastTimestampUs = 0;
+};
+
+class WorkloadLogReader
+{
+public:
+    static bool readAll(const QString& filePath, std::vector<WorkloadEvent>& events, QString* errorMessage = nullptr);
+};
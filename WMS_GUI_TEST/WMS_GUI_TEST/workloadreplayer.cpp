@@ -0,0 +1,194 @@
+#include "workloadreplayer.h"
+#include "sqlitestatement.h"
+
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QThread>
+#include <QDebug>
+#include <map>
+#include <sqlite3.h>
+
+ReplayReport::Kind ReplayReport::classify(const QByteArray& statement)
+{
+    QByteArray head = statement.trimmed().left(8).toUpper();
+    // PRAGMA stays in Other: many of them write (journal_mode, user_version)
+    if (head.startsWith("SELECT") || head.startsWith("WITH")) {
+        return Select;
+    }
+    if (head.startsWith("INSERT") || head.startsWith("REPLACE")) {
+        return Insert;
+    }
+    if (head.startsWith("UPDATE")) {
+        return Update;
+    }
+    if (head.startsWith("DELETE")) {
+        return Delete;
+    }
+    return Other;
+}
+
+const char* ReplayReport::kindName(int kind)
+{
+    static const char* names[] = {"SELECT", "INSERT", "UPDATE", "DELETE", "OTHER"};
+    return names[kind];
+}
+
+static void printRow(QTextStream& out, const char* name, const MetricHistogram& h)
+{
+    auto ms = [](quint64 micros) { return QString::number(double(micros) / 1000.0, 'f', 3); };
+    out << QString("%1 %2 %3 %4 %5 %6 %7\n")
+               .arg(QString(name), -8)
+               .arg(h.count(), 10)
+               .arg(ms(h.count() ? h.sum() / h.count() : 0), 10)
+               .arg(ms(h.quantile(0.50)), 10)
+               .arg(ms(h.quantile(0.90)), 10)
+               .arg(ms(h.quantile(0.99)), 10)
+               .arg(ms(h.max()), 10);
+}
+
+void ReplayReport::print(QTextStream& out) const
+{
+    out << QString("%1 %2 %3 %4 %5 %6 %7\n")
+               .arg(QString("kind"), -8).arg(QString("count"), 10).arg(QString("mean ms"), 10)
+               .arg(QString("p50 ms"), 10).arg(QString("p90 ms"), 10).arg(QString("p99 ms"), 10)
+               .arg(QString("max ms"), 10);
+    for (int kind = 0; kind < KindCount; ++kind) {
+        if (latency[kind].count() > 0) {
+            printRow(out, kindName(kind), latency[kind]);
+        }
+    }
+    printRow(out, "TOTAL", total);
+
+    double seconds = qMax<qint64>(wallTimeMs, 1) / 1000.0;
+    out << "\nWall time: " << wallTimeMs << " ms, throughput: "
+        << QString::number(double(total.count()) / seconds, 'f', 1) << " statements/s\n"
+        << "Errors: " << errors.load() << ", skipped: " << skipped.load() << "\n";
+}
+
+// Asks SQLite whether the statement leaves the database untouched; WITH ...
+// DELETE or a writing PRAGMA cannot be told apart by the first keyword
+static bool isReadOnly(sqlite3* db, const QByteArray& sql)
+{
+    sqlite3_stmt* stmt = nullptr;
+    if (!db || sqlite3_prepare_v2(db, sql.constData(), int(sql.size()), &stmt, nullptr) != SQLITE_OK || !stmt) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    bool readOnly = sqlite3_stmt_readonly(stmt) != 0;
+    sqlite3_finalize(stmt);
+    return readOnly;
+}
+
+WorkloadReplayer::WorkloadReplayer(std::vector<WorkloadEvent> events)
+{
+    if (!events.empty()) {
+        m_firstTimestampUs = events.front().timestampUs;
+    }
+    std::map<quint32, std::vector<WorkloadEvent>> bySession;
+    for (WorkloadEvent& event : events) {
+        bySession[event.session].push_back(std::move(event));
+    }
+    for (auto& session : bySession) {
+        m_sessions.push_back(std::move(session.second));
+    }
+}
+
+bool WorkloadReplayer::run(const ReplayOptions& options, ReplayReport& report, QString* errorMessage)
+{
+    int copies = qMax(1, options.sessions);
+    size_t threadCount = size_t(copies) * m_sessions.size();
+    std::vector<QThread*> threads;
+    std::vector<char> opened(threadCount, 0);
+
+    QElapsedTimer wallClock;
+    wallClock.start();
+
+    for (size_t i = 0; i < threadCount; ++i) {
+        const std::vector<WorkloadEvent>& events = m_sessions[i % m_sessions.size()];
+        threads.push_back(QThread::create([this, i, &events, &options, &report, &opened]() {
+            bool ok = false;
+            replaySession(int(i), events, options, report, ok);
+            opened[i] = ok;
+        }));
+        threads.back()->start();
+    }
+
+    for (QThread* thread : threads) {
+        thread->wait();
+        delete thread;
+    }
+    report.wallTimeMs = wallClock.elapsed();
+
+    for (char ok : opened) {
+        if (!ok) {
+            if (errorMessage) {
+                *errorMessage = QString("Could not open %1").arg(options.databasePath);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void WorkloadReplayer::replaySession(int thread, const std::vector<WorkloadEvent>& events,
+                                     const ReplayOptions& options, ReplayReport& report, bool& opened)
+{
+    QString connectionName = QString("replay-%1").arg(thread);
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(options.databasePath);
+        db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+        opened = db.open();
+
+        if (opened) {
+            QSqlQuery pragma(db);
+            pragma.exec("PRAGMA foreign_keys = ON");
+            for (const QString& statement : options.setupStatements) {
+                if (!pragma.exec(statement)) {
+                    qDebug() << "Replay setup statement failed:" << statement << pragma.lastError().text();
+                }
+            }
+
+            // Sessions share one clock so their statements interleave as recorded
+            QElapsedTimer clock;
+            clock.start();
+            qint64 firstTimestampUs = m_firstTimestampUs;
+            sqlite3* handle = sqliteHandle(db);
+
+            for (const WorkloadEvent& event : events) {
+                ReplayReport::Kind kind = ReplayReport::classify(event.statement);
+                if (options.readOnly && !isReadOnly(handle, event.sql)) {
+                    report.skipped.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                // Keep the recorded pacing (scaled by the speed factor)
+                if (options.speed > 0) {
+                    qint64 dueUs = qint64(double(event.timestampUs - firstTimestampUs) / options.speed);
+                    qint64 waitUs = dueUs - clock.nsecsElapsed() / 1000;
+                    if (waitUs > 0) {
+                        QThread::usleep(quint64(waitUs));
+                    }
+                }
+
+                QElapsedTimer timer;
+                timer.start();
+                QSqlQuery query(db);
+                query.setForwardOnly(true);
+                bool ok = query.exec(QString::fromUtf8(event.sql));
+                while (ok && query.next()) {
+                }
+                quint64 micros = quint64(timer.nsecsElapsed() / 1000);
+
+                report.latency[kind].record(micros);
+                report.total.record(micros);
+                if (!ok) {
+                    report.errors.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "workloadlog.h"
+#include "metrics.h"
+
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <array>
+#include <atomic>
+#include <vector>
+
+struct ReplayOptions
+{
+    QString databasePath;
+    int sessions = 1;        // parallel copies of the recorded workload
+    double speed = 1.0;      // 1.0 = original pacing, 2.0 = twice as fast, 0 = as fast as possible
+    bool readOnly = false;   // skip statements that modify the database
+    QStringList setupStatements;  // run on every session's connection after opening
+};
+
+// Latency distributions collected during a replay, per statement kind
+struct ReplayReport
+{
+    enum Kind { Select, Insert, Update, Delete, Other, KindCount };
+
+    std::array<MetricHistogram, KindCount> latency;
+    MetricHistogram total;
+    std::atomic<quint64> errors{0};
+    std::atomic<quint64> skipped{0};
+    qint64 wallTimeMs = 0;
+
+    static Kind classify(const QByteArray& statement);
+    static const char* kindName(int kind);
+    void print(QTextStream& out) const;
+};
+
+// Replays a recorded workload against a SQLite database file. Every session
+// of the recording runs on its own thread with its own connection and
+// replays only its own statements, so the statements of one connection keep
+// their order and transactions are not interleaved on one connection.
+class WorkloadReplayer
+{
+public:
+    explicit WorkloadReplayer(std::vector<WorkloadEvent> events);
+
+    int recordedSessions() const { return int(m_sessions.size()); }
+    bool run(const ReplayOptions& options, ReplayReport& report, QString* errorMessage = nullptr);
+
+private:
+    void replaySession(int thread, const std::vector<WorkloadEvent>& events, const ReplayOptions& options,
+                       ReplayReport& report, bool& opened);
+
+    // Events of each recorded session, in recording order
+    std::vector<std::vector<WorkloadEvent>> m_sessions;
+    qint64 m_firstTimestampUs = 0;
+};